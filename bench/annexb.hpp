@@ -0,0 +1,30 @@
+#pragma once
+
+#ifndef __H26XCODEC_BENCH_ANNEXB__
+#define __H26XCODEC_BENCH_ANNEXB__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// true if the Annex B buffer holds an IDR slice (H.264 type 5, HEVC IDR_W_RADL/IDR_N_LP)
+inline bool contains_idr(std::vector<char> const& buffer, bool hevc)
+{
+    uint8_t const* data = reinterpret_cast<uint8_t const*>(buffer.data());
+    for (size_t i = 0; i + 3 < buffer.size(); i++)
+    {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+        {
+            continue;
+        }
+        uint8_t header = data[i + 3];
+        int     type   = hevc ? (header >> 1) & 0x3f : header & 0x1f;
+        if ((!hevc && type == 5) || (hevc && (type == 19 || type == 20)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
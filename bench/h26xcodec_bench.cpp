@@ -0,0 +1,366 @@
+/*
+  Regression benchmarks for the whole library: NAL parsing, decode_frame,
+  ConverterRGB24::convert, to_jpeg, from_jpeg and H26xEncoder::Encode per
+  preset, at several resolutions. The H.264/H.265 streams are encoded from
+  synthetic frames when the program starts, no input files are needed.
+
+  h26xcodec_bench --json results.json
+  h26xcodec_bench --filter 'decode/h264' --min_time 2
+*/
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/avutil.h>
+#include <libavutil/frame.h>
+}
+
+#include <cxxopts.hpp>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <h26xcodec/converter.hpp>
+#include <h26xcodec/frame_ptr.hpp>
+#include <h26xcodec/h26xdecoder.hpp>
+#include <h26xcodec/h26xencoder.hpp>
+#include "microbench.hpp"
+#include "synthetic.hpp"
+
+namespace fs = std::filesystem;
+
+struct Resolution
+{
+    std::string name;
+    int         width;
+    int         height;
+};
+
+static std::vector<std::string> split(std::string const& list)
+{
+    std::vector<std::string> items;
+    std::stringstream        ss(list);
+    std::string              item;
+    while (std::getline(ss, item, ','))
+    {
+        items.push_back(item);
+    }
+    return items;
+}
+
+static Resolution parse_resolution(std::string const& name)
+{
+    if (name == "360p")
+    {
+        return {name, 640, 360};
+    }
+    if (name == "720p")
+    {
+        return {name, 1280, 720};
+    }
+    if (name == "1080p")
+    {
+        return {name, 1920, 1080};
+    }
+    if (name == "2160p")
+    {
+        return {name, 3840, 2160};
+    }
+    int width = 0, height = 0;
+    if (std::sscanf(name.c_str(), "%dx%d", &width, &height) != 2)
+    {
+        throw cxxopts::exceptions::specification("illegal resolution " + name);
+    }
+    return {name, width, height};
+}
+
+/// A synthetic Annex B stream and its frame count.
+struct Stream
+{
+    std::vector<char> data;
+    int               frames = 0;
+};
+
+static Stream make_stream(std::string const& codec, Resolution const& resolution, int frames)
+{
+    H26xEncoder encoder(codec);
+    encoder.SetWidth(resolution.width);
+    encoder.SetHeight(resolution.height);
+    encoder.SetInputPixelFormat(AV_PIX_FMT_RGB24);
+    encoder.SetFps(30);
+    encoder.SetGopSize(30);
+    encoder.SetOption("preset", "veryfast");
+    encoder.SetOption("tune", "zerolatency");
+    encoder.Enable();
+
+    Stream            stream;
+    std::string       image;
+    std::vector<char> output;
+    for (int i = 0; i < frames; i++)
+    {
+        synthetic_rgb24(resolution.width, resolution.height, i, image);
+        encoder.Encode(reinterpret_cast<uint8_t const*>(image.data()), output);
+        stream.data.insert(stream.data.end(), output.begin(), output.end());
+    }
+    encoder.Flush(output);
+    stream.data.insert(stream.data.end(), output.begin(), output.end());
+    stream.frames = frames;
+    return stream;
+}
+
+/// Decode a whole stream through parse/decode_frame, on_frame may be empty. Returns the frame count.
+static int decode_stream(H26xDecoder& decoder, Stream const& stream, std::function<void(AVFrame const&)> const& on_frame)
+{
+    auto const* data    = reinterpret_cast<unsigned char const*>(stream.data.data());
+    ptrdiff_t   left    = stream.data.size();
+    int         decoded = 0;
+    bool        flushed = false;
+    while (!flushed)
+    {
+        ptrdiff_t consumed = decoder.parse(left > 0 ? data : nullptr, left);
+        data += consumed;
+        left -= consumed;
+        flushed = left <= 0 && consumed == 0;
+        if (decoder.is_frame_available())
+        {
+            try
+            {
+                AVFrame const& frame = decoder.decode_frame();
+                if (on_frame)
+                {
+                    on_frame(frame);
+                }
+                decoded++;
+            }
+            catch (H26xDecodeFailure const& e)
+            {
+                if (!std::strstr(e.what(), "EAGAIN"))
+                {
+                    throw;
+                }
+            }
+        }
+    }
+    return decoded;
+}
+
+static std::string decoder_id(std::string const& codec)
+{
+    return codec == "h264" ? "h264" : "h265";
+}
+
+int main(int argc, char const* argv[])
+{
+    cxxopts::Options options("h26xcodec_bench", "h26xcodec performance suite");
+    options.add_options()
+        ("h,help", "print usage")
+        ("filter", "regex, only benchmarks whose name matches run", cxxopts::value<std::string>()->default_value("."))
+        ("list", "list the benchmarks and exit", cxxopts::value<bool>()->default_value("false"))
+        ("min_time", "minimum measured seconds per benchmark", cxxopts::value<double>()->default_value("0.5"))
+        ("json", "write the results as JSON (Google Benchmark format) to this file", cxxopts::value<std::string>()->default_value(""))
+        ("codecs", "comma separated codecs", cxxopts::value<std::string>()->default_value("h264,h265"))
+        ("resolutions", "comma separated 360p/720p/1080p/2160p or WxH", cxxopts::value<std::string>()->default_value("360p,720p,1080p"))
+        ("presets", "comma separated encoder presets", cxxopts::value<std::string>()->default_value("ultrafast,veryfast,medium"))
+        ("frames", "frames of every synthetic stream", cxxopts::value<int>()->default_value("60"))
+        ;
+    auto result = options.parse(argc, argv);
+    if (result.count("help"))
+    {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    std::vector<std::string> codecs  = split(result["codecs"].as<std::string>());
+    std::vector<std::string> presets = split(result["presets"].as<std::string>());
+    std::vector<Resolution>  resolutions;
+    for (auto& name : split(result["resolutions"].as<std::string>()))
+    {
+        resolutions.push_back(parse_resolution(name));
+    }
+    int         frames = result["frames"].as<int>();
+    std::string filter = result["filter"].as<std::string>();
+
+    // inputs are made on first use, so a filtered run only encodes what it needs
+    std::map<std::string, Stream> streams;
+    auto get_stream = [&](std::string const& codec, Resolution const& resolution) -> Stream const& {
+        std::string key = codec + "/" + resolution.name;
+        if (streams.find(key) == streams.end())
+        {
+            streams[key] = make_stream(codec, resolution, frames);
+        }
+        return streams[key];
+    };
+    std::map<std::string, FramePtr> yuv_frames;
+    auto get_frame = [&](Resolution const& resolution) -> AVFrame const& {
+        FramePtr& frame = yuv_frames[resolution.name];
+        if (!frame)
+        {
+            H26xDecoder decoder("h264");
+            decode_stream(decoder, get_stream("h264", resolution), [&](AVFrame const& decoded) {
+                if (!frame)
+                {
+                    frame.reset(av_frame_clone(&decoded));
+                }
+            });
+        }
+        return *frame;
+    };
+    fs::path jpeg_dir = fs::temp_directory_path() / ("h26xcodec_bench_" + std::to_string(getpid()));
+    auto get_jpeg = [&](Resolution const& resolution) -> std::string {
+        fs::path path = jpeg_dir / (resolution.name + ".jpg");
+        if (!fs::exists(path))
+        {
+            fs::create_directories(jpeg_dir);
+            AVFrame const& frame = get_frame(resolution);
+            ConverterRGB24 converter;
+            std::string    rgb(converter.predict_size(frame.width, frame.height), '\0');
+            converter.convert(frame, reinterpret_cast<unsigned char*>(&rgb[0]));
+            auto          jpeg = converter.to_jpeg();
+            std::ofstream file(path, std::ios::binary);
+            file.write(jpeg->data(), jpeg->size());
+        }
+        return path.string();
+    };
+
+    BenchmarkRunner runner;
+    for (auto& resolution : resolutions)
+    {
+        for (auto& codec : codecs)
+        {
+            // parser only: split the stream into access units
+            runner.Register("parse/" + codec + "/" + resolution.name, [&, codec, resolution](BenchmarkState& state) {
+                Stream const& stream  = get_stream(codec, resolution);
+                int64_t       packets = 0;
+                while (state.KeepRunning())
+                {
+                    state.PauseTiming();
+                    H26xDecoder decoder(decoder_id(codec));
+                    state.ResumeTiming();
+                    auto const* data = reinterpret_cast<unsigned char const*>(stream.data.data());
+                    ptrdiff_t   left = stream.data.size();
+                    while (true)
+                    {
+                        ptrdiff_t consumed = decoder.parse(left > 0 ? data : nullptr, left);
+                        data += consumed;
+                        left -= consumed;
+                        packets += decoder.is_frame_available();
+                        if (left <= 0 && consumed == 0)
+                        {
+                            break;
+                        }
+                    }
+                }
+                state.SetItemsProcessed(packets);
+                state.SetBytesProcessed(state.GetIterations() * int64_t(stream.data.size()));
+            });
+
+            // parse + decode_frame of the whole stream
+            runner.Register("decode/" + codec + "/" + resolution.name, [&, codec, resolution](BenchmarkState& state) {
+                Stream const& stream  = get_stream(codec, resolution);
+                int64_t       decoded = 0;
+                while (state.KeepRunning())
+                {
+                    state.PauseTiming();
+                    H26xDecoder decoder(decoder_id(codec));
+                    state.ResumeTiming();
+                    decoded += decode_stream(decoder, stream, nullptr);
+                }
+                state.SetItemsProcessed(decoded);
+                state.SetBytesProcessed(state.GetIterations() * int64_t(stream.data.size()));
+            });
+
+            for (auto& preset : presets)
+            {
+                // steady state Encode() of one frame, lookahead delay is amortised over the run
+                runner.Register("encode/" + codec + "/" + resolution.name + "/" + preset,
+                                [&, codec, resolution, preset](BenchmarkState& state) {
+                                    H26xEncoder encoder(codec);
+                                    encoder.SetWidth(resolution.width);
+                                    encoder.SetHeight(resolution.height);
+                                    encoder.SetInputPixelFormat(AV_PIX_FMT_RGB24);
+                                    encoder.SetFps(30);
+                                    encoder.SetGopSize(60);
+                                    encoder.SetOption("preset", preset);
+                                    encoder.Enable();
+                                    std::vector<std::string> images(30);
+                                    for (size_t i = 0; i < images.size(); i++)
+                                    {
+                                        synthetic_rgb24(resolution.width, resolution.height, i, images[i]);
+                                    }
+                                    std::vector<char> output;
+                                    int64_t           bytes = 0;
+                                    while (state.KeepRunning())
+                                    {
+                                        auto& image = images[state.GetIterations() % images.size()];
+                                        encoder.Encode(reinterpret_cast<uint8_t const*>(image.data()), output);
+                                        bytes += output.size();
+                                    }
+                                    state.SetItemsProcessed(state.GetIterations());
+                                    state.SetBytesProcessed(bytes);
+                                });
+            }
+        }
+
+        runner.Register("convert_rgb24/" + resolution.name, [&, resolution](BenchmarkState& state) {
+            AVFrame const& frame = get_frame(resolution);
+            ConverterRGB24 converter;
+            std::string    rgb(converter.predict_size(frame.width, frame.height), '\0');
+            while (state.KeepRunning())
+            {
+                converter.convert(frame, reinterpret_cast<unsigned char*>(&rgb[0]));
+            }
+            state.SetItemsProcessed(state.GetIterations());
+            state.SetBytesProcessed(state.GetIterations() * int64_t(rgb.size()));
+        });
+
+        runner.Register("to_jpeg/" + resolution.name, [&, resolution](BenchmarkState& state) {
+            AVFrame const& frame = get_frame(resolution);
+            ConverterRGB24 converter;
+            std::string    rgb(converter.predict_size(frame.width, frame.height), '\0');
+            converter.convert(frame, reinterpret_cast<unsigned char*>(&rgb[0]));
+            int64_t bytes = 0;
+            while (state.KeepRunning())
+            {
+                bytes += converter.to_jpeg()->size();
+            }
+            state.SetItemsProcessed(state.GetIterations());
+            state.SetBytesProcessed(bytes);
+        });
+
+        runner.Register("from_jpeg/" + resolution.name, [&, resolution](BenchmarkState& state) {
+            std::string    path = get_jpeg(resolution);
+            ConverterRGB24 converter;
+            int64_t        bytes = 0;
+            while (state.KeepRunning())
+            {
+                bytes += converter.from_jpeg(path)->size();
+            }
+            state.SetItemsProcessed(state.GetIterations());
+            state.SetBytesProcessed(bytes);
+        });
+    }
+
+    if (result["list"].as<bool>())
+    {
+        runner.List(filter);
+        return 0;
+    }
+
+    nlohmann::json context;
+    context["executable"]      = argv[0];
+    context["ffmpeg_version"]  = av_version_info();
+    context["synthetic_frames"] = frames;
+    nlohmann::json report      = runner.Run(filter, result["min_time"].as<double>(), context);
+    fs::remove_all(jpeg_dir);
+
+    std::string json_path = result["json"].as<std::string>();
+    if (!json_path.empty())
+    {
+        std::ofstream json_file(json_path);
+        json_file << report.dump(2) << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+  Loopback latency: synthetic frame -> H26xEncoder -> H26xDecoder, for
+  every combination of preset, tune and codec threads.
+
+  The capture time of every frame travels inside the bitstream as a user
+  data unregistered SEI, so the decoder side measures frame-in to
+  frame-out without any bookkeeping that could hide codec delay. Frames
+  are paced at --fps like a camera unless --unpaced is given. No input
+  files, no display.
+
+  h26xcodec_loopback_bench --codec h264 --presets ultrafast,veryfast,medium --tunes zerolatency,none --threads 1,4
+*/
+#include <cxxopts.hpp>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <h26xcodec/encoder_stats.hpp>
+#include <h26xcodec/h26xdecoder.hpp>
+#include <h26xcodec/h26xencoder.hpp>
+#include "synthetic.hpp"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+using Clock = std::chrono::steady_clock;
+
+static uint8_t const kTimestampUuid[16] = {0x68, 0x32, 0x36, 0x78, 0x63, 0x6f, 0x64, 0x65,
+                                           0x63, 0x2d, 0x6c, 0x61, 0x74, 0x65, 0x6e, 0x63};
+
+static std::vector<std::string> split(std::string const& list)
+{
+    std::vector<std::string> items;
+    std::stringstream        ss(list);
+    std::string              item;
+    while (std::getline(ss, item, ','))
+    {
+        items.push_back(item);
+    }
+    return items;
+}
+
+static std::vector<uint8_t> timestamp_sei(int64_t ns)
+{
+    std::vector<uint8_t> sei(kTimestampUuid, kTimestampUuid + 16);
+    for (int i = 0; i < 8; i++)
+    {
+        sei.push_back(uint8_t(uint64_t(ns) >> (i * 8)));
+    }
+    return sei;
+}
+
+/// capture time carried by a decoded frame, -1 if it has none
+static int64_t frame_timestamp(AVFrame const& frame)
+{
+    for (int i = 0; i < frame.nb_side_data; i++)
+    {
+        AVFrameSideData const* side = frame.side_data[i];
+        if (side->type != AV_FRAME_DATA_SEI_UNREGISTERED || side->size < 24 ||
+            std::memcmp(side->data, kTimestampUuid, 16) != 0)
+        {
+            continue;
+        }
+        uint64_t ns = 0;
+        for (int b = 0; b < 8; b++)
+        {
+            ns |= uint64_t(side->data[16 + b]) << (b * 8);
+        }
+        return int64_t(ns);
+    }
+    return -1;
+}
+
+static int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct LoopbackResult
+{
+    LatencyHistogram latency;
+    LatencyHistogram encode;
+    size_t           decoded = 0;
+    size_t           missing = 0;
+    size_t           bytes   = 0;
+    double           seconds = 0;
+};
+
+int main(int argc, char const* argv[])
+{
+    cxxopts::Options options("h26xcodec_loopback_bench", "encode -> decode latency with timestamps in SEI");
+    options.add_options()
+        ("h,help", "print usage")
+        ("codec", "h264/h265", cxxopts::value<std::string>()->default_value("h264"))
+        ("width", "frame width", cxxopts::value<int>()->default_value("1280"))
+        ("height", "frame height", cxxopts::value<int>()->default_value("720"))
+        ("fps", "frame rate of the synthetic camera", cxxopts::value<int>()->default_value("30"))
+        ("frames", "frames per combination", cxxopts::value<int>()->default_value("150"))
+        ("presets", "comma separated presets", cxxopts::value<std::string>()->default_value("ultrafast,veryfast,medium"))
+        ("tunes", "comma separated tunes, none for no tune", cxxopts::value<std::string>()->default_value("zerolatency,none"))
+        ("threads", "comma separated codec thread counts", cxxopts::value<std::string>()->default_value("1,4"))
+        ("unpaced", "feed frames as fast as possible instead of at --fps", cxxopts::value<bool>()->default_value("false"))
+        ;
+    auto result = options.parse(argc, argv);
+    if (result.count("help"))
+    {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    std::string codec   = result["codec"].as<std::string>();
+    int         width   = result["width"].as<int>();
+    int         height  = result["height"].as<int>();
+    int         fps     = result["fps"].as<int>();
+    int         frames  = result["frames"].as<int>();
+    bool        unpaced = result["unpaced"].as<bool>();
+    std::string decoder_id = codec == "h264" ? "h264" : "h265";
+
+    std::vector<std::string> images(fps);
+    for (int i = 0; i < fps; i++)
+    {
+        synthetic_rgb24(width, height, i, images[i]);
+    }
+
+    std::stringstream table;
+    table << std::left << std::setw(12) << "preset" << std::setw(13) << "tune" << std::right << std::setw(8)
+          << "threads" << std::setw(9) << "fps" << std::setw(11) << "enc p50" << std::setw(11) << "p50"
+          << std::setw(11) << "p99" << std::setw(11) << "max" << std::setw(10) << "kbit/s" << "  (ms)" << std::endl;
+
+    for (auto& preset : split(result["presets"].as<std::string>()))
+    {
+        for (auto& tune : split(result["tunes"].as<std::string>()))
+        {
+            for (auto& threads : split(result["threads"].as<std::string>()))
+            {
+                H26xEncoder encoder(codec);
+                encoder.SetWidth(width);
+                encoder.SetHeight(height);
+                encoder.SetInputPixelFormat(AV_PIX_FMT_RGB24);
+                encoder.SetFps(fps);
+                encoder.SetGopSize(fps * 2);
+                encoder.SetThreadNum(std::stoi(threads));
+                encoder.SetOption("preset", preset);
+                if (tune != "none")
+                {
+                    encoder.SetOption("tune", tune);
+                }
+                encoder.Enable();
+                H26xDecoder decoder(decoder_id);
+
+                LoopbackResult loop;
+                auto           on_frame = [&](AVFrame const& frame) {
+                    int64_t sent = frame_timestamp(frame);
+                    if (sent < 0)
+                    {
+                        loop.missing++;
+                        return;
+                    }
+                    loop.latency.Record((now_ns() - sent) / 1000.0);
+                    loop.decoded++;
+                };
+
+                auto              interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+                auto              start    = Clock::now();
+                auto              next     = start;
+                std::vector<char> output;
+                for (int i = 0; i < frames; i++)
+                {
+                    int64_t captured = now_ns();
+                    encoder.AddUserDataSei(timestamp_sei(captured));
+                    encoder.Encode(reinterpret_cast<uint8_t const*>(images[i % fps].data()), output);
+                    if (!output.empty())
+                    {
+                        loop.encode.Record((now_ns() - captured) / 1000.0);
+                        loop.bytes += output.size();
+                        try
+                        {
+                            on_frame(decoder.decode_packet(reinterpret_cast<unsigned char const*>(output.data()),
+                                                           output.size()));
+                        }
+                        catch (H26xDecodeFailure const& e)
+                        {
+                            if (!std::strstr(e.what(), "EAGAIN"))
+                            {
+                                throw;
+                            }
+                        }
+                        output.clear();
+                    }
+                    if (!unpaced)
+                    {
+                        next += interval;
+                        std::this_thread::sleep_until(next);
+                    }
+                }
+
+                // delayed frames come out concatenated, split them again with the parser
+                encoder.Flush(output);
+                loop.bytes += output.size();
+                auto const* data = reinterpret_cast<unsigned char const*>(output.data());
+                ptrdiff_t   left = output.size();
+                while (true)
+                {
+                    ptrdiff_t consumed = decoder.parse(data, left);
+                    data += consumed;
+                    left -= consumed;
+                    while (decoder.is_frame_available())
+                    {
+                        try
+                        {
+                            on_frame(decoder.decode_frame());
+                        }
+                        catch (H26xDecodeFailure const& e)
+                        {
+                            if (!std::strstr(e.what(), "EAGAIN"))
+                            {
+                                throw;
+                            }
+                            break;
+                        }
+                    }
+                    if (left <= 0)
+                    {
+                        if (consumed == 0)
+                        {
+                            break;
+                        }
+                        data = nullptr;
+                        left = 0;
+                    }
+                }
+                loop.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+                table << std::fixed << std::setprecision(2) << std::left << std::setw(12) << preset << std::setw(13)
+                      << tune << std::right << std::setw(8) << threads << std::setw(9)
+                      << loop.decoded / loop.seconds << std::setw(11) << loop.encode.Percentile(50) / 1000
+                      << std::setw(11) << loop.latency.Percentile(50) / 1000 << std::setw(11)
+                      << loop.latency.Percentile(99) / 1000 << std::setw(11) << loop.latency.GetMaxUs() / 1000
+                      << std::setw(10) << loop.bytes * 8 / loop.seconds / 1000;
+                if (loop.missing > 0 || loop.decoded != size_t(frames))
+                {
+                    table << "  decoded " << loop.decoded << "/" << frames << ", " << loop.missing << " without SEI";
+                }
+                table << std::endl;
+            }
+        }
+    }
+
+    std::cout << table.str();
+    return 0;
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#ifndef __H26XCODEC_BENCH_MICROBENCH__
+#define __H26XCODEC_BENCH_MICROBENCH__
+
+#include <nlohmann/json.hpp>
+#include <time.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+  A tiny benchmark runner in the style of Google Benchmark, without the
+  dependency. A benchmark loops on KeepRunning() until --min_time of timed
+  work is reached; setup before the loop and inside PauseTiming/ResumeTiming
+  is not measured. Results are printed as a table and optionally written as
+  JSON in Google Benchmark's format, so its tools/compare.py can diff two
+  runs from different commits.
+*/
+class BenchmarkState
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit BenchmarkState(double min_time)
+      : min_time_{min_time}
+      , iterations_{0}
+      , items_{0}
+      , bytes_{0}
+      , running_{false}
+      , real_ns_{0}
+      , cpu_ns_{0}
+    {
+    }
+
+    bool KeepRunning()
+    {
+        if (!running_)
+        {
+            if (iterations_ == 0)
+            {
+                ResumeTiming();
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (iterations_ > 0 && elapsedNs() >= min_time_ * 1e9)
+        {
+            PauseTiming();
+            return false;
+        }
+        iterations_++;
+        return true;
+    }
+
+    void PauseTiming()
+    {
+        if (running_)
+        {
+            real_ns_ += std::chrono::duration<double, std::nano>(Clock::now() - real_start_).count();
+            cpu_ns_ += cpuNs() - cpu_start_;
+            running_ = false;
+        }
+    }
+
+    void ResumeTiming()
+    {
+        if (!running_)
+        {
+            real_start_ = Clock::now();
+            cpu_start_  = cpuNs();
+            running_    = true;
+        }
+    }
+
+    /// Totals over all iterations, reported per second.
+    void SetItemsProcessed(int64_t value)
+    {
+        items_ = value;
+    }
+
+    void SetBytesProcessed(int64_t value)
+    {
+        bytes_ = value;
+    }
+
+    int64_t GetIterations() const
+    {
+        return iterations_;
+    }
+
+    int64_t GetItems() const
+    {
+        return items_;
+    }
+
+    int64_t GetBytes() const
+    {
+        return bytes_;
+    }
+
+    double GetRealNs() const
+    {
+        return real_ns_;
+    }
+
+    double GetCpuNs() const
+    {
+        return cpu_ns_;
+    }
+
+private:
+    double elapsedNs() const
+    {
+        return real_ns_ + std::chrono::duration<double, std::nano>(Clock::now() - real_start_).count();
+    }
+
+    /// process CPU time, the codecs run their own threads
+    static double cpuNs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+    }
+
+    double            min_time_;
+    int64_t           iterations_;
+    int64_t           items_;
+    int64_t           bytes_;
+    bool              running_;
+    Clock::time_point real_start_;
+    double            cpu_start_;
+    double            real_ns_;
+    double            cpu_ns_;
+};
+
+class BenchmarkRunner
+{
+public:
+    using Function = std::function<void(BenchmarkState&)>;
+
+    void Register(std::string const& name, Function function)
+    {
+        benchmarks_.push_back({name, std::move(function)});
+    }
+
+    void List(std::string const& filter)
+    {
+        std::regex pattern(filter);
+        for (auto& benchmark : benchmarks_)
+        {
+            if (std::regex_search(benchmark.name, pattern))
+            {
+                std::cout << benchmark.name << std::endl;
+            }
+        }
+    }
+
+    /// Runs every benchmark whose name matches filter, returns the JSON report.
+    nlohmann::json Run(std::string const& filter, double min_time, nlohmann::json context)
+    {
+        std::regex     pattern(filter);
+        nlohmann::json results = nlohmann::json::array();
+        std::cout << std::left << std::setw(36) << "benchmark" << std::right << std::setw(14) << "time/iter"
+                  << std::setw(14) << "cpu/iter" << std::setw(12) << "iterations" << std::setw(14) << "items/s"
+                  << std::setw(12) << "MB/s" << std::endl;
+        for (auto& benchmark : benchmarks_)
+        {
+            if (!std::regex_search(benchmark.name, pattern))
+            {
+                continue;
+            }
+            BenchmarkState state(min_time);
+            benchmark.function(state);
+            state.PauseTiming();
+            if (state.GetIterations() == 0)
+            {
+                continue;
+            }
+
+            double iterations = double(state.GetIterations());
+            double seconds    = state.GetRealNs() / 1e9;
+            double real_ms    = state.GetRealNs() / iterations / 1e6;
+            double cpu_ms     = state.GetCpuNs() / iterations / 1e6;
+
+            nlohmann::json entry;
+            entry["name"]        = benchmark.name;
+            entry["run_name"]    = benchmark.name;
+            entry["run_type"]    = "iteration";
+            entry["iterations"]  = state.GetIterations();
+            entry["real_time"]   = real_ms;
+            entry["cpu_time"]    = cpu_ms;
+            entry["time_unit"]   = "ms";
+            double items_per_sec = seconds > 0 ? state.GetItems() / seconds : 0;
+            double bytes_per_sec = seconds > 0 ? state.GetBytes() / seconds : 0;
+            if (state.GetItems() > 0)
+            {
+                entry["items_per_second"] = items_per_sec;
+            }
+            if (state.GetBytes() > 0)
+            {
+                entry["bytes_per_second"] = bytes_per_sec;
+            }
+            results.push_back(entry);
+
+            std::cout << std::left << std::setw(36) << benchmark.name << std::right << std::fixed
+                      << std::setprecision(3) << std::setw(11) << real_ms << " ms" << std::setw(11) << cpu_ms
+                      << " ms" << std::setw(12) << state.GetIterations() << std::setprecision(1) << std::setw(14)
+                      << items_per_sec << std::setw(12) << bytes_per_sec / 1e6 << std::endl;
+        }
+
+        char host[256] = {};
+        gethostname(host, sizeof(host) - 1);
+        char        date[64];
+        std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+        context["date"]      = date;
+        context["host_name"] = host;
+        context["num_cpus"]  = std::thread::hardware_concurrency();
+#ifdef NDEBUG
+        context["library_build_type"] = "release";
+#else
+        context["library_build_type"] = "debug";
+#endif
+
+        nlohmann::json report;
+        report["context"]    = context;
+        report["benchmarks"] = results;
+        return report;
+    }
+
+private:
+    struct Benchmark
+    {
+        std::string name;
+        Function    function;
+    };
+
+    std::vector<Benchmark> benchmarks_;
+};
+
+#endif
@@ -0,0 +1,158 @@
+/*
+  Check the VBV buffer model of a rate control mode under scene cuts.
+
+  Synthetic frames switch to a completely different picture every
+  --scene_every frames. Every packet's size and QP come from the
+  encoder's frame stats hook and are replayed through a leaky bucket
+  decoder buffer filled at maxrate: a conformant stream never underflows
+  it, and the largest frame tells how big a network buffer has to be.
+
+  h26xcodec_ratecontrol_bench --rc cbr --bitrate 2000000 --bufsize 400000
+*/
+#include <cxxopts.hpp>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <h26xcodec/h26xencoder.hpp>
+#include "synthetic.hpp"
+
+// the moving gradient of synthetic_rgb24 with a texture that changes completely every scene
+static void scene_rgb24(int width, int height, size_t index, size_t scene, std::string& buffer)
+{
+    synthetic_rgb24(width, height, index, buffer);
+    uint32_t seed = uint32_t(scene) * 2654435761u;
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t* row = reinterpret_cast<uint8_t*>(&buffer[size_t(y) * width * 3]);
+        for (int x = 0; x < width; x++)
+        {
+            uint32_t noise = (uint32_t(x) * 73856093u) ^ (uint32_t(y) * 19349663u) ^ seed;
+            row[x * 3 + 0] ^= uint8_t(noise >> 3);
+            row[x * 3 + 1] ^= uint8_t(noise >> 11);
+        }
+    }
+}
+
+int main(int argc, char const* argv[])
+{
+    cxxopts::Options options("h26xcodec_ratecontrol_bench", "frame sizes and VBV fullness of a rate control mode");
+    options.add_options()
+        ("h,help", "print usage")
+        ("codec", "h264/h265", cxxopts::value<std::string>()->default_value("h264"))
+        ("width", "frame width", cxxopts::value<int>()->default_value("1280"))
+        ("height", "frame height", cxxopts::value<int>()->default_value("720"))
+        ("frames", "number of frames", cxxopts::value<int>()->default_value("300"))
+        ("fps", "fps", cxxopts::value<int>()->default_value("25"))
+        ("gop_size", "gop size", cxxopts::value<int>()->default_value("50"))
+        ("scene_every", "frames per scene", cxxopts::value<int>()->default_value("40"))
+        ("rc", "options/cbr/vbr", cxxopts::value<std::string>()->default_value("cbr"))
+        ("bitrate", "target bitrate in bit/s", cxxopts::value<int64_t>()->default_value("2000000"))
+        ("maxrate", "max rate in bit/s", cxxopts::value<int64_t>()->default_value("0"))
+        ("bufsize", "VBV buffer in bits", cxxopts::value<int>()->default_value("0"))
+        ("crf", "crf for --rc options", cxxopts::value<std::string>()->default_value("23"))
+        ("intra_refresh", "periodic intra refresh", cxxopts::value<bool>()->default_value("false"))
+        ;
+    auto result = options.parse(argc, argv);
+    if (result.count("help"))
+    {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    int     width       = result["width"].as<int>();
+    int     height      = result["height"].as<int>();
+    int     frames      = result["frames"].as<int>();
+    int     fps         = result["fps"].as<int>();
+    int     scene_every = result["scene_every"].as<int>();
+    int64_t bitrate     = result["bitrate"].as<int64_t>();
+
+    H26xEncoder encoder(result["codec"].as<std::string>());
+    encoder.SetWidth(width);
+    encoder.SetHeight(height);
+    encoder.SetInputPixelFormat(AV_PIX_FMT_RGB24);
+    encoder.SetFps(fps);
+    encoder.SetGopSize(result["gop_size"].as<int>());
+    encoder.SetOption("preset", "veryfast");
+    encoder.SetOption("tune", "zerolatency");
+    encoder.SetOption("crf", result["crf"].as<std::string>());
+    encoder.SetRateControl(result["rc"].as<std::string>());
+    encoder.SetBitrate(bitrate);
+    encoder.SetMaxRate(result["maxrate"].as<int64_t>());
+    encoder.SetBufferSize(result["bufsize"].as<int>());
+    encoder.SetIntraRefresh(result["intra_refresh"].as<bool>());
+
+    std::vector<H26xFrameStats> stats;
+    encoder.SetFrameStatsCallback([&](H26xFrameStats const& frame) { stats.push_back(frame); });
+    encoder.Enable();
+
+    std::string       buffer;
+    std::vector<char> output;
+    for (int i = 0; i < frames; i++)
+    {
+        scene_rgb24(width, height, i, i / scene_every, buffer);
+        encoder.Encode(reinterpret_cast<uint8_t const*>(buffer.data()), output);
+    }
+    encoder.Flush(output);
+
+    if (stats.empty())
+    {
+        std::cout << "no packets" << std::endl;
+        return 1;
+    }
+
+    // decoder side leaky bucket: maxrate/fps bits arrive per frame interval, the frame leaves at once
+    int64_t max_rate    = encoder.GetRateControl() == RateControlMode::CBR ? bitrate : encoder.GetMaxRate();
+    int64_t buffer_size = encoder.GetBufferSize() > 0 ? encoder.GetBufferSize() : max_rate;
+    double  fullness    = max_rate > 0 ? buffer_size * 0.9 : 0;
+    double  min_full    = fullness;
+    int     underflows  = 0;
+    int64_t total_bits  = 0;
+    int     max_size    = 0;
+    double  min_qp = 1e9, max_qp = -1, sum_qp = 0;
+    int     qp_frames = 0;
+    std::vector<int> sizes;
+    for (auto& frame : stats)
+    {
+        int64_t bits = int64_t(frame.size) * 8;
+        total_bits += bits;
+        max_size = std::max(max_size, frame.size);
+        sizes.push_back(frame.size);
+        if (frame.qp >= 0)
+        {
+            min_qp = std::min(min_qp, frame.qp);
+            max_qp = std::max(max_qp, frame.qp);
+            sum_qp += frame.qp;
+            qp_frames++;
+        }
+        if (max_rate > 0)
+        {
+            fullness = std::min<double>(fullness + double(max_rate) / fps, double(buffer_size));
+            fullness -= bits;
+            if (fullness < 0)
+            {
+                underflows++;
+                fullness = 0;
+            }
+            min_full = std::min(min_full, fullness);
+        }
+    }
+    std::sort(sizes.begin(), sizes.end());
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "rate control: " << encoder.GetRateControlString() << ", packets " << stats.size() << std::endl;
+    std::cout << "average bitrate: " << total_bits * fps / double(stats.size()) / 1000 << " kbit/s" << std::endl;
+    std::cout << "frame size p50 " << sizes[sizes.size() / 2] << " B, p99 " << sizes[sizes.size() * 99 / 100]
+              << " B, max " << max_size << " B" << std::endl;
+    if (qp_frames > 0)
+    {
+        std::cout << "qp min " << min_qp << ", avg " << sum_qp / qp_frames << ", max " << max_qp << std::endl;
+    }
+    if (max_rate > 0)
+    {
+        std::cout << "vbv " << buffer_size << " bits, lowest fullness " << min_full << " bits, underflows "
+                  << underflows << std::endl;
+    }
+    return underflows > 0 ? 1 : 0;
+}
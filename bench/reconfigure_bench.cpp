@@ -0,0 +1,128 @@
+/*
+  Measure what runtime rate control changes and key frame requests cost a
+  live encode: per frame Encode() latency of plain frames, frames carrying
+  a bitrate change and frames carrying an IDR request, and whether the
+  requested frame really came out as IDR.
+
+  h26xcodec_reconfigure_bench --codec h264 --width 1280 --height 720 --frames 500
+*/
+#include <cxxopts.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <h26xcodec/h26xencoder.hpp>
+#include "annexb.hpp"
+#include "synthetic.hpp"
+
+static void print_latency(std::string const& name, std::vector<double> samples)
+{
+    if (samples.empty())
+    {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    std::cout << std::left << std::setw(12) << name << std::right << " frames " << std::setw(5) << samples.size()
+              << std::fixed << std::setprecision(3) << "  p50 " << samples[samples.size() / 2] << " ms  p99 "
+              << samples[samples.size() * 99 / 100] << " ms  max " << samples.back() << " ms" << std::endl;
+}
+
+int main(int argc, char const* argv[])
+{
+    cxxopts::Options options("h26xcodec_reconfigure_bench", "latency of runtime reconfiguration and IDR requests");
+    options.add_options()
+        ("h,help", "print usage")
+        ("codec", "h264/h265", cxxopts::value<std::string>()->default_value("h264"))
+        ("width", "frame width", cxxopts::value<int>()->default_value("1280"))
+        ("height", "frame height", cxxopts::value<int>()->default_value("720"))
+        ("frames", "number of frames", cxxopts::value<int>()->default_value("500"))
+        ("fps", "fps", cxxopts::value<int>()->default_value("25"))
+        ("reconfigure_every", "change the bitrate every n frames", cxxopts::value<int>()->default_value("50"))
+        ("idr_every", "request an IDR every n frames", cxxopts::value<int>()->default_value("37"))
+        ;
+    auto result = options.parse(argc, argv);
+    if (result.count("help"))
+    {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    std::string codec             = result["codec"].as<std::string>();
+    int         width             = result["width"].as<int>();
+    int         height            = result["height"].as<int>();
+    int         frames            = result["frames"].as<int>();
+    int         fps               = result["fps"].as<int>();
+    int         reconfigure_every = result["reconfigure_every"].as<int>();
+    int         idr_every         = result["idr_every"].as<int>();
+    bool        hevc              = codec == "h265" || codec == "hevc";
+
+    H26xEncoder encoder(codec);
+    encoder.SetWidth(width);
+    encoder.SetHeight(height);
+    encoder.SetInputPixelFormat(AV_PIX_FMT_RGB24);
+    encoder.SetFps(fps);
+    encoder.SetGopSize(fps * 10);
+    encoder.SetBitrate(2000000);
+    encoder.SetMaxRate(2000000);
+    encoder.SetBufferSize(1000000);
+    encoder.SetOption("preset", "veryfast");
+    encoder.SetOption("tune", "zerolatency");
+    encoder.Enable();
+    std::cout << "in place reconfiguration: " << (encoder.SupportsReconfigure() ? "yes" : "no, reopen") << std::endl;
+
+    std::vector<std::string> images(fps);
+    for (int i = 0; i < fps; i++)
+    {
+        synthetic_rgb24(width, height, i, images[i]);
+    }
+
+    std::vector<double> plain, reconfigured, keyframe;
+    std::vector<char>   output;
+    int                 idr_requested = 0, idr_delivered = 0;
+    for (int i = 1; i <= frames; i++)
+    {
+        bool reconfigure = i % reconfigure_every == 0;
+        bool idr         = i % idr_every == 0;
+        if (reconfigure)
+        {
+            int64_t bit_rate = (i / reconfigure_every) % 2 ? 1000000 : 3000000;
+            encoder.UpdateRateControl(bit_rate, bit_rate, int(bit_rate / 2));
+        }
+        if (idr)
+        {
+            encoder.RequestKeyFrame();
+            idr_requested++;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        output.clear();
+        encoder.Encode(reinterpret_cast<uint8_t const*>(images[i % fps].data()), output);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (idr)
+        {
+            keyframe.push_back(ms);
+            // zerolatency has no frame delay, the packet belongs to the frame just sent
+            idr_delivered += contains_idr(output, hevc);
+        }
+        else if (reconfigure)
+        {
+            reconfigured.push_back(ms);
+        }
+        else
+        {
+            plain.push_back(ms);
+        }
+    }
+
+    print_latency("plain", plain);
+    print_latency("reconfigure", reconfigured);
+    print_latency("idr", keyframe);
+    std::cout << "reconfigurations: " << encoder.GetReconfigureCount() << ", last took "
+              << encoder.GetLastReconfigureMs() << " ms" << std::endl;
+    std::cout << "idr requested: " << idr_requested << ", idr delivered on the requested frame: " << idr_delivered
+              << std::endl;
+    return 0;
+}
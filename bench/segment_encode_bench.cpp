@@ -0,0 +1,108 @@
+/*
+  Compare wall time and bitrate of the single encoder path with the
+  parallel segment encoder on a synthetic RGB24 sequence.
+
+  h26xcodec_segment_bench --codec h265 --width 1280 --height 720 --frames 600 --gop_size 60 --segments 8
+*/
+#include <cxxopts.hpp>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <h26xcodec/h26xencoder.hpp>
+#include <h26xcodec/segment_encoder.hpp>
+#include "synthetic.hpp"
+
+int main(int argc, char const* argv[])
+{
+    cxxopts::Options options("h26xcodec_segment_bench", "single encoder vs parallel segment encoder");
+    options.add_options()
+        ("h,help", "print usage")
+        ("codec", "h264/h265", cxxopts::value<std::string>()->default_value("h265"))
+        ("width", "frame width", cxxopts::value<int>()->default_value("1280"))
+        ("height", "frame height", cxxopts::value<int>()->default_value("720"))
+        ("frames", "number of frames", cxxopts::value<int>()->default_value("600"))
+        ("fps", "fps", cxxopts::value<int>()->default_value("25"))
+        ("gop_size", "gop size", cxxopts::value<int>()->default_value("50"))
+        ("segments", "number of parallel encoders", cxxopts::value<int>()->default_value("8"))
+        ("thread_num", "codec threads per encoder", cxxopts::value<int>()->default_value("4"))
+        ("preset", "encoder preset", cxxopts::value<std::string>()->default_value("veryfast"))
+        ;
+    auto result = options.parse(argc, argv);
+    if (result.count("help"))
+    {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    std::string codec      = result["codec"].as<std::string>();
+    int         width      = result["width"].as<int>();
+    int         height     = result["height"].as<int>();
+    size_t      frames     = result["frames"].as<int>();
+    int         fps        = result["fps"].as<int>();
+    int         gop_size   = result["gop_size"].as<int>();
+    int         segments   = result["segments"].as<int>();
+    int         thread_num = result["thread_num"].as<int>();
+    std::string preset     = result["preset"].as<std::string>();
+
+    auto create_encoder = [&]() {
+        auto encoder = std::make_unique<H26xEncoder>(codec);
+        encoder->SetWidth(width);
+        encoder->SetHeight(height);
+        encoder->SetInputPixelFormat(AV_PIX_FMT_RGB24);
+        encoder->SetFps(fps);
+        encoder->SetGopSize(gop_size);
+        encoder->SetThreadNum(thread_num);
+        encoder->SetOption("preset", preset);
+        encoder->SetOption("crf", "23");
+        encoder->SetOption("tune", "zerolatency");
+        return encoder;
+    };
+    auto load_frame = [&](size_t index, std::string& buffer) { synthetic_rgb24(width, height, index, buffer); };
+
+    auto report = [&](std::string const& name, std::chrono::steady_clock::duration elapsed, size_t bytes) {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        double kbps    = bytes * 8.0 * fps / frames / 1000.0;
+        std::cout << std::left << std::setw(12) << name << " wall " << std::fixed << std::setprecision(3) << seconds
+                  << " s, " << std::setprecision(1) << frames / seconds << " fps, " << bytes << " bytes, " << kbps
+                  << " kbit/s" << std::endl;
+    };
+
+    // single encoder path, frame by frame like encode_image_to_frame
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        std::unique_ptr<H26xEncoder> encoder = create_encoder();
+        encoder->Enable();
+        std::string       buffer;
+        std::vector<char> output;
+        size_t            bytes = 0;
+        for (size_t i = 0; i < frames; i++)
+        {
+            load_frame(i, buffer);
+            output.clear();
+            encoder->Encode(reinterpret_cast<uint8_t const*>(buffer.data()), output);
+            bytes += output.size();
+        }
+        encoder->Flush(output);
+        bytes += output.size();
+
+        report("single", std::chrono::steady_clock::now() - start, bytes);
+    }
+
+    // parallel segment path
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        SegmentEncoder segment_encoder(create_encoder, segments, gop_size);
+        size_t         bytes = 0;
+        segment_encoder.Encode(frames, load_frame,
+                               [&](size_t, std::vector<char> const& packet) { bytes += packet.size(); });
+
+        report("segments:" + std::to_string(segments), std::chrono::steady_clock::now() - start, bytes);
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+  Simulate many live camera encodes sharing one host through
+  EncoderSessionManager and print per-session fps and queue latency.
+
+  h26xcodec_session_bench --sessions 24 --cpu_budget 16 --width 640 --height 360 --fps 25 --seconds 10
+*/
+#include <cxxopts.hpp>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <h26xcodec/encoder_session_manager.hpp>
+#include "synthetic.hpp"
+
+int main(int argc, char const* argv[])
+{
+    cxxopts::Options options("h26xcodec_session_bench", "many encoder sessions with a shared cpu budget");
+    options.add_options()
+        ("h,help", "print usage")
+        ("codec", "h264/h265", cxxopts::value<std::string>()->default_value("h264"))
+        ("sessions", "number of camera sessions", cxxopts::value<int>()->default_value("16"))
+        ("cpu_budget", "codec threads shared by all sessions, 0 for all cores", cxxopts::value<int>()->default_value("0"))
+        ("width", "frame width", cxxopts::value<int>()->default_value("640"))
+        ("height", "frame height", cxxopts::value<int>()->default_value("360"))
+        ("fps", "fps of every camera", cxxopts::value<int>()->default_value("25"))
+        ("seconds", "duration of the simulation", cxxopts::value<int>()->default_value("10"))
+        ("preset", "encoder preset", cxxopts::value<std::string>()->default_value("veryfast"))
+        ;
+    auto result = options.parse(argc, argv);
+    if (result.count("help"))
+    {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    std::string codec    = result["codec"].as<std::string>();
+    int         sessions = result["sessions"].as<int>();
+    int         width    = result["width"].as<int>();
+    int         height   = result["height"].as<int>();
+    int         fps      = result["fps"].as<int>();
+    int         seconds  = result["seconds"].as<int>();
+
+    EncoderSessionManager manager(result["cpu_budget"].as<int>());
+    std::vector<size_t>   bytes(sessions, 0);
+    for (int i = 0; i < sessions; i++)
+    {
+        auto encoder = std::make_unique<H26xEncoder>(codec);
+        encoder->SetWidth(width);
+        encoder->SetHeight(height);
+        encoder->SetInputPixelFormat(AV_PIX_FMT_RGB24);
+        encoder->SetFps(fps);
+        encoder->SetGopSize(fps * 2);
+        encoder->SetOption("preset", result["preset"].as<std::string>());
+        encoder->SetOption("tune", "zerolatency");
+        manager.AddSession("camera" + std::to_string(i), std::move(encoder),
+                           [&bytes, i](std::vector<char> const& packet) { bytes[i] += packet.size(); });
+    }
+    manager.Start();
+
+    // every camera delivers one frame per interval, frames that don't fit the queue are dropped like a live source
+    std::vector<std::string> frames(fps);
+    for (int i = 0; i < fps; i++)
+    {
+        synthetic_rgb24(width, height, i, frames[i]);
+    }
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+    auto next     = std::chrono::steady_clock::now();
+    for (int n = 0; n < fps * seconds; n++)
+    {
+        std::string const& frame = frames[n % fps];
+        for (int i = 0; i < sessions; i++)
+        {
+            manager.Submit(i, reinterpret_cast<uint8_t const*>(frame.data()), frame.size());
+        }
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+    manager.Stop();
+
+    std::cout << manager.Report();
+    return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#ifndef __H26XCODEC_BENCH_SYNTHETIC__
+#define __H26XCODEC_BENCH_SYNTHETIC__
+
+#include <cstdint>
+#include <string>
+
+// a moving diagonal gradient with a bouncing square, cheap to generate and not trivially compressible
+inline void synthetic_rgb24(int width, int height, size_t index, std::string& buffer)
+{
+    buffer.resize(size_t(width) * height * 3);
+    int box_x = int(index * 7) % (width > 64 ? width - 64 : 1);
+    int box_y = int(index * 3) % (height > 64 ? height - 64 : 1);
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t* row = reinterpret_cast<uint8_t*>(&buffer[size_t(y) * width * 3]);
+        for (int x = 0; x < width; x++)
+        {
+            bool in_box = x >= box_x && x < box_x + 64 && y >= box_y && y < box_y + 64;
+            row[x * 3 + 0] = in_box ? 255 : uint8_t(x + index);
+            row[x * 3 + 1] = in_box ? 255 : uint8_t(y + index * 2);
+            row[x * 3 + 2] = uint8_t((x ^ y) + index);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,115 @@
+/*
+  Reads the frames `h26xcodec -d --shm <name>` publishes, in place: the
+  payload is used straight from the shared mapping and checked with
+  ShmRingConsumer::Valid afterwards, a frame the producer overwrote
+  meanwhile is thrown away. Needs only libh26xcodec_shm, no FFmpeg.
+
+  h26xcodec_shm_consumer frames [first.ppm]
+  h26xcodec -d -p video.mp4 --tf rgb --shm frames
+*/
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <h26xcodec/shm_ring.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+static char const* format_name(ShmFrameFormat format)
+{
+    switch (format)
+    {
+    case ShmFrameFormat::RGB24:
+        return "rgb24";
+    case ShmFrameFormat::YUV420P:
+        return "yuv420p";
+    case ShmFrameFormat::JPEG:
+        return "jpeg";
+    case ShmFrameFormat::PNG:
+        return "png";
+    }
+    return "unknown";
+}
+
+/// stands in for real work on the pixels, reads every byte of the frame
+static uint64_t checksum(uint8_t const* data, size_t size)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        sum = sum * 31 + data[i];
+    }
+    return sum;
+}
+
+int main(int argc, char const* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " <ring name> [first frame.ppm]" << std::endl;
+        return 1;
+    }
+    std::string name     = argv[1];
+    std::string ppm_path = argc > 2 ? argv[2] : "";
+
+    // the producer makes the ring once its first frame is decoded, wait for it
+    std::unique_ptr<ShmRingConsumer> ring;
+    auto                             give_up = Clock::now() + std::chrono::seconds(30);
+    while (!ring)
+    {
+        try
+        {
+            ring = std::make_unique<ShmRingConsumer>(name);
+        }
+        catch (std::system_error const& e)
+        {
+            if (Clock::now() > give_up)
+            {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    uint64_t frames    = 0;
+    uint64_t discarded = 0;
+    uint64_t bytes     = 0;
+    auto     start     = Clock::now();
+    ShmFrame frame;
+    while (ring->Next(frame, 5000))
+    {
+        uint64_t sum = checksum(frame.data, frame.info.size);
+        bool     ppm = !ppm_path.empty() && frame.info.format == ShmFrameFormat::RGB24;
+        if (ppm)
+        {
+            std::ofstream out(ppm_path, std::ios::binary);
+            out << "P6\n" << frame.info.width << " " << frame.info.height << "\n255\n";
+            out.write(reinterpret_cast<char const*>(frame.data), frame.info.size);
+        }
+        if (!ring->Valid(frame))
+        {
+            // overwritten while we were reading it, the checksum (and the ppm) may mix two frames
+            discarded++;
+            continue;
+        }
+        if (ppm)
+        {
+            ppm_path.clear();
+        }
+        std::cout << "frame " << frame.info.sequence << " pts " << frame.info.pts << " " << frame.info.width << "x"
+                  << frame.info.height << " " << format_name(frame.info.format) << " " << frame.info.size
+                  << " bytes checksum " << std::hex << sum << std::dec << std::endl;
+        frames++;
+        bytes += frame.info.size;
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << frames << " frames, " << bytes / (1024.0 * 1024.0) << " MiB in " << seconds << " s, "
+              << ring->GetDropped() << " dropped, " << discarded << " overwritten while read" << std::endl;
+    return 0;
+}
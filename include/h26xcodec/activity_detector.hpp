@@ -0,0 +1,123 @@
+#pragma once
+
+#ifndef __H26XCODEC_ACTIVITY_DETECTOR__
+#define __H26XCODEC_ACTIVITY_DETECTOR__
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "bitstream_parser.hpp"
+
+/*
+  Where something happens in a video, told from the compressed stream
+  alone: the pictures H26xStreamParser hands out (type, size, slice QP),
+  no decoding.
+
+  An encoder spends bits on what changes. A static camera view codes to
+  tiny P/B pictures, motion makes them grow, a cut makes one of them (or
+  an unscheduled key frame) jump. The activity of a picture is its size,
+  scaled to QP 26 when the QP is known (twice the bits per 6 QP steps),
+  over the 25th percentile of the last `window` pictures of the same
+  type: ~1 for the quiet background, 2+ for motion. Key frames and I
+  pictures take the activity of the picture before them, their size says
+  nothing about motion.
+
+  A scene change is
+    - a key frame earlier than the regular key frame interval (the most
+      common one so far), which is what scene cut detection in the encoder
+      produces,
+    - likewise an I picture that is no key frame earlier than the regular
+      interval between those (scene cut with open GOPs),
+    - a P/B picture of scene_threshold times the usual size (encoders with
+      scene cut detection off), or
+    - a QP jump of qp_jump against the last picture of the same type.
+  Active pictures (activity of activity_threshold or more, and scene
+  changes) merge into segments when they are at most max_gap_seconds
+  apart, each segment padded by padding_seconds on both sides.
+*/
+
+struct ActivityOptions
+{
+    double activity_threshold  = 2.0;
+    double scene_threshold     = 4.0;
+    double qp_jump             = 10;   ///< 0 turns it off
+    size_t window              = 250;  ///< pictures per type for the baseline
+    double max_gap_seconds     = 1.0;
+    double padding_seconds     = 1.0;
+    double min_segment_seconds = 0;
+};
+
+struct FrameActivity
+{
+    uint64_t    index    = 0;  ///< decode order
+    double      time     = 0;  ///< seconds, from the pts or index / fps
+    char        type     = 'I';
+    bool        key      = false;
+    uint64_t    bytes    = 0;
+    double      qp       = -1;
+    double      activity = 0;
+    std::string scene_change;  ///< forced_key, intra, size or qp, empty if none
+};
+
+struct ActivitySegment
+{
+    uint64_t first_frame = 0;  ///< decode order, padding included
+    uint64_t last_frame  = 0;
+    double   start       = 0;  ///< seconds
+    double   end         = 0;
+    double   peak        = 0;  ///< highest activity
+};
+
+struct ActivityReport
+{
+    double                       fps      = 0;
+    double                       duration = 0;  ///< seconds
+    std::vector<FrameActivity>   frames;
+    std::vector<uint64_t>        scene_changes;  ///< frame indices
+    std::vector<ActivitySegment> segments;
+
+    /// Seconds of the video inside a segment.
+    double GetActiveSeconds() const;
+    std::string Str() const;
+    /// With every frame when with_frames is set, otherwise the scene changes and segments only.
+    std::string Json(bool with_frames) const;
+};
+
+class ActivityDetector
+{
+public:
+    explicit ActivityDetector(ActivityOptions const& options = ActivityOptions());
+
+    /// Pictures in decode order, time in seconds or NaN when the picture has no timestamp.
+    void Add(H26xPictureInfo const& picture, double time);
+
+    /// fps places the pictures without a timestamp and turns seconds into pictures, 0 takes 25.
+    ActivityReport Finish(double fps);
+
+private:
+    /// Where the key frames (or the I pictures that are none) fall.
+    struct IntraCadence
+    {
+        std::map<uint64_t, uint32_t> intervals;  ///< pictures in between, how often
+        uint64_t                     last = 0;
+        bool                         seen = false;
+    };
+
+    /// Records a picture at index, true if it comes before the regular interval of cadence.
+    static bool early(IntraCadence& cadence, uint64_t index);
+    double      normalizedSize(H26xPictureInfo const& picture) const;
+    double      baseline(char type) const;
+
+    ActivityOptions                    options_;
+    std::vector<FrameActivity>         frames_;
+    std::map<char, std::deque<double>> history_;  ///< normalized sizes per picture type
+    std::map<char, double>             last_qp_;
+    IntraCadence                       key_cadence_;
+    IntraCadence                       intra_cadence_;  ///< non-key I pictures
+    double                             last_activity_;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+
+#ifndef __H26XCODEC_ASYNC_WRITER__
+#define __H26XCODEC_ASYNC_WRITER__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "memory_budget.hpp"
+
+/*
+  Writes whole files in the background so the decode or encode thread
+  never waits for storage.
+
+  Write takes a path and a finished buffer and returns at once; it only
+  blocks while more than max_bytes_in_flight are queued, which keeps memory
+  bounded when the disk is slower than the codec. Given a MemoryBudget the
+  queued bytes count against it as well, shared with the other stages.
+  Files are created, written and closed in batches through io_uring when
+  the library was built with liburing and the kernel allows it, otherwise
+  by a small pool of writer threads. Finish waits for everything and rethrows the first error.
+*/
+
+struct AsyncWriterStats
+{
+    std::string backend;
+    uint64_t    files            = 0;
+    uint64_t    bytes            = 0;
+    uint64_t    batches          = 0;
+    uint64_t    peak_bytes       = 0;  ///< most bytes queued or being written at once
+    double      write_seconds    = 0;  ///< from the first Write until the last file was closed
+    double      blocked_seconds  = 0;  ///< producers waiting for the byte budget
+
+    double GetMiBPerSecond() const
+    {
+        return write_seconds > 0 ? bytes / write_seconds / (1024.0 * 1024.0) : 0;
+    }
+
+    std::string Str() const;
+};
+
+class AsyncFileWriter
+{
+public:
+    enum class Backend
+    {
+        Auto,     ///< io_uring if available, threads otherwise
+        IoUring,  ///< falls back to threads if io_uring can't be set up
+        Threads,
+        Sync  ///< write on the calling thread, for comparison
+    };
+
+    static Backend ParseBackend(std::string const& name);
+
+    explicit AsyncFileWriter(Backend backend = Backend::Auto, size_t max_bytes_in_flight = 64 << 20,
+                             int threads = 4, MemoryBudget* budget = nullptr);
+    /// Waits for the queued files, errors are lost then: call Finish to see them.
+    ~AsyncFileWriter();
+
+    AsyncFileWriter(AsyncFileWriter const&) = delete;
+    AsyncFileWriter& operator=(AsyncFileWriter const&) = delete;
+
+    /// Create or truncate path and write data into it. Throws the first error of an earlier write.
+    void Write(std::string path, std::string data);
+    void Write(std::string path, std::vector<char> const& data);
+
+    /// Wait until every file is written and closed, rethrows the first error.
+    void Finish();
+
+    AsyncWriterStats GetStats();
+
+    /// "io_uring", "threads" or "sync", what actually runs.
+    std::string GetBackendName() const;
+
+private:
+    struct Job
+    {
+        std::string path;
+        std::string data;
+    };
+    struct Ring;
+
+    void threadLoop();
+    void ringLoop();
+    /// Take up to max jobs, false once stopping and nothing is left.
+    bool takeJobs(std::vector<Job>& jobs, size_t max);
+    void completed(std::vector<Job> const& jobs, std::exception_ptr error);
+    void writeJob(Job const& job);
+    void stop();
+
+    using Clock = std::chrono::steady_clock;
+
+    Backend                  backend_;
+    size_t                   max_bytes_in_flight_;
+    MemoryBudget*            budget_;
+    MemoryBudget::Account    budget_account_;
+    std::unique_ptr<Ring>    ring_;
+    std::vector<std::thread> workers_;
+
+    std::mutex              mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable space_available_;
+    std::condition_variable idle_;
+    std::deque<Job>         queue_;
+    size_t                  bytes_in_flight_;
+    size_t                  jobs_in_flight_;
+    bool                    stopping_;
+    std::exception_ptr      error_;
+    AsyncWriterStats        stats_;
+    bool                    started_;
+    Clock::time_point       first_write_;
+    Clock::time_point       last_done_;
+};
+
+#endif
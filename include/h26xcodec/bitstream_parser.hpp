@@ -0,0 +1,169 @@
+#pragma once
+
+#ifndef __H26XCODEC_BITSTREAM_PARSER__
+#define __H26XCODEC_BITSTREAM_PARSER__
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+  What a H.264/H.265 stream is, read from its parameter sets and slice
+  headers alone: no FFmpeg, no decoding, one pass over the bytes.
+
+  H26xStreamParser splits Annex B input into NAL units, parses the H.264
+  SPS/PPS and the H.265 VPS/SPS/PPS (Exp-Golomb fields of the RBSP, with
+  the emulation prevention bytes removed) and reads just the first fields
+  of every slice header: enough for resolution, profile, level, chroma
+  format and bit depth, frame rate when the stream carries timing info,
+  and the type of every picture, from which the GOP structure follows.
+  Only the first few dozen bytes of a slice are looked at, so inspecting a
+  stream costs about as much as reading it.
+
+  A picture starts with the slice whose first_mb_in_slice is 0 (H.264) or
+  whose first_slice_segment_in_pic_flag is set (H.265), H.264 fields count
+  as pictures of their own. Key frames are IDR pictures for H.264 and IRAP
+  pictures (IDR, CRA, BLA) for H.265, a GOP runs from one to the next in
+  decode order.
+
+  Every picture can also be handed to a callback as it ends, with its
+  size and, for H.264, the average slice QP: what ActivityDetector needs
+  to tell motion and scene changes from the compressed stream alone.
+  H.265 slice headers are not read as far as slice_qp_delta (the
+  reference picture sets come first), their QP is -1.
+*/
+
+/// MSB first reader over an RBSP. Reading past the end yields zero bits and sets IsOverrun.
+class BitReader
+{
+public:
+    BitReader(uint8_t const* data, size_t size);
+
+    /// n up to 32
+    uint32_t ReadBits(int n);
+    bool     ReadFlag();
+    /// ue(v), Exp-Golomb
+    uint32_t ReadUE();
+    /// se(v)
+    int32_t  ReadSE();
+    void     SkipBits(size_t n);
+
+    size_t GetBitsLeft() const
+    {
+        return pos_ < size_ * 8 ? size_ * 8 - pos_ : 0;
+    }
+
+    bool IsOverrun() const
+    {
+        return overrun_;
+    }
+
+private:
+    uint8_t const* data_;
+    size_t         size_;
+    size_t         pos_;
+    bool           overrun_;
+};
+
+/// The payload of a NAL unit (header included) with every emulation prevention byte of 00 00 03 removed,
+/// at most max_bytes of it.
+std::vector<uint8_t> NalToRbsp(uint8_t const* nal, size_t size, size_t max_bytes = SIZE_MAX);
+
+struct H26xStreamInfo
+{
+    std::string codec;  ///< h264 or h265
+    std::string profile;
+    int         profile_idc = 0;
+    std::string tier;       ///< Main or High, H.265 only
+    std::string level;      ///< e.g. "4.1"
+    int         width        = 0;  ///< after the cropping/conformance window
+    int         height       = 0;
+    int         coded_width  = 0;
+    int         coded_height = 0;
+    std::string chroma_format;  ///< 4:0:0, 4:2:0, 4:2:2 or 4:4:4
+    int         bit_depth_luma   = 0;
+    int         bit_depth_chroma = 0;
+    bool        interlaced       = false;  ///< H.264 field or MBAFF coding allowed
+    std::string entropy_coding;            ///< CAVLC or CABAC
+    int         max_ref_frames = 0;        ///< H.264 only
+    double      fps            = 0;        ///< from VUI/VPS timing info, 0 if the stream has none
+
+    uint64_t nal_units  = 0;
+    uint64_t bytes      = 0;  ///< of all NAL units, without start codes
+    uint64_t pictures   = 0;
+    uint64_t i_pictures = 0;
+    uint64_t p_pictures = 0;
+    uint64_t b_pictures = 0;
+    uint64_t key_frames = 0;
+    uint64_t idr_frames = 0;
+
+    uint64_t    gops              = 0;
+    uint32_t    gop_min           = 0;
+    uint32_t    gop_max           = 0;
+    double      gop_average       = 0;
+    bool        closed_gop        = true;  ///< every key frame is an IDR
+    uint32_t    max_consecutive_b = 0;
+    std::string gop_pattern;  ///< picture types of the first GOP in decode order, e.g. "IPBBPBB"
+
+    std::string Json() const;
+};
+
+/// One picture in decode order, see H26xStreamParser::SetPictureCallback.
+struct H26xPictureInfo
+{
+    uint64_t index = 0;  ///< decode order, from 0
+    char     type  = 'I';  ///< I, P or B, the highest of its slices
+    bool     key   = false;
+    bool     idr   = false;
+    uint64_t bytes = 0;          ///< of its slice NAL units
+    double   qp    = -1;         ///< average slice QP, -1 if unknown
+    int64_t  pts   = INT64_MIN;  ///< as passed to FeedAccessUnit, INT64_MIN if none
+};
+
+class H26xStreamParser
+{
+public:
+    /// "h264", "h265" or "hevc", throws std::invalid_argument otherwise.
+    explicit H26xStreamParser(std::string const& codec);
+    ~H26xStreamParser();
+
+    H26xStreamParser(H26xStreamParser const&) = delete;
+    H26xStreamParser& operator=(H26xStreamParser const&) = delete;
+
+    /// "h264" or "h265" from the NAL unit headers at the start of an Annex B buffer, empty if neither fits.
+    static std::string DetectCodec(uint8_t const* data, size_t size);
+
+    /// Annex B bytes in chunks of any size.
+    void Feed(uint8_t const* data, size_t size);
+    /// One NAL unit without its start code.
+    void FeedNal(uint8_t const* nal, size_t size);
+    /// A complete access unit in Annex B, e.g. a demuxed packet: its NAL units are parsed right away, its
+    /// picture gets the pts.
+    void FeedAccessUnit(uint8_t const* data, size_t size, int64_t pts);
+
+    /// Called with every picture once its last slice is in, in decode order.
+    void SetPictureCallback(std::function<void(H26xPictureInfo const&)> on_picture);
+
+    /// Ends the stream, the parser can't be fed afterwards.
+    H26xStreamInfo Finish();
+
+private:
+    struct State;
+
+    void flushPending();
+    void endPicture();
+    void startPicture(char type, bool key, bool idr);
+    void h264Nal(uint8_t const* nal, size_t size);
+    void hevcNal(uint8_t const* nal, size_t size);
+
+    std::unique_ptr<State>                      state_;
+    std::function<void(H26xPictureInfo const&)> on_picture_;
+    std::vector<uint8_t>                        pending_;
+    size_t                                      scan_;
+    size_t                                      nal_start_;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#pragma once
+
+#ifndef __H26XCODEC_BOUNDED_QUEUE__
+#define __H26XCODEC_BOUNDED_QUEUE__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include "memory_budget.hpp"
+
+/*
+  A blocking FIFO between pipeline stages. Push blocks while the queue is
+  full so a fast producer can't run ahead of its consumer, Pop blocks
+  until an item arrives or the queue is closed and drained.
+
+  With a MemoryBudget, Push also takes the item's bytes from it (waiting
+  if the budget is used up) and Pop gives them back, so several queues
+  together stay under one limit.
+*/
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity, MemoryBudget* budget = nullptr)
+      : capacity_{capacity > 0 ? capacity : 1}
+      , budget_{budget}
+      , closed_{false}
+    {
+    }
+
+    ~BoundedQueue()
+    {
+        if (budget_)
+        {
+            for (auto const& entry : items_)
+            {
+                budget_->Release(account_, entry.second);
+            }
+        }
+    }
+
+    /// Returns false if the queue was closed, the item is dropped then.
+    bool Push(T item, size_t bytes = 0)
+    {
+        if (budget_ && !budget_->Acquire(account_, bytes, &closed_))
+        {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+        if (closed_)
+        {
+            lock.unlock();
+            if (budget_)
+            {
+                budget_->Release(account_, bytes);
+            }
+            return false;
+        }
+        items_.emplace_back(std::move(item), bytes);
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /// Returns false once the queue is closed and empty.
+    bool Pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+        if (items_.empty())
+        {
+            return false;
+        }
+        item         = std::move(items_.front().first);
+        size_t bytes = items_.front().second;
+        items_.pop_front();
+        lock.unlock();
+        not_full_.notify_one();
+        if (budget_)
+        {
+            budget_->Release(account_, bytes);
+        }
+        return true;
+    }
+
+    /// Wake up everybody, Pop still returns the items queued so far.
+    void Close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+        if (budget_)
+        {
+            budget_->WakeAll();
+        }
+    }
+
+    size_t Size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return items_.size();
+    }
+
+private:
+    size_t                           capacity_;
+    MemoryBudget*                    budget_;
+    MemoryBudget::Account            account_;
+    std::atomic<bool>                closed_;
+    std::deque<std::pair<T, size_t>> items_;
+    std::mutex                       mutex_;
+    std::condition_variable          not_full_;
+    std::condition_variable          not_empty_;
+};
+
+#endif
@@ -4,6 +4,11 @@
 #define __H26XCODEC_CONVERTOR__
 
 #include <memory>
+#include <string>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
 
 struct SwsContext;
 struct AVFrame;
@@ -36,7 +41,14 @@ public:
   int predict_size(int w, int h) override;
   void convert(const AVFrame &frame, unsigned char* out_image) override;
   std::unique_ptr<std::string> to_jpeg();
+  /* PNG of the last converted frame, lossless and straight from RGB24. 
+  */
+  std::unique_ptr<std::string> to_png();
   std::unique_ptr<std::string> from_jpeg(std::string jpeg_path);
+  /* Same as from_jpeg for a JPEG or PNG image already in memory, 
+no file and no demuxer involved. Returns nullptr if it can't be decoded. 
+  */
+  std::unique_ptr<std::string> from_jpeg_buffer(const std::string& image);
 
 private:
   SwsContext *context;
@@ -44,6 +56,7 @@ private:
   AVFrame *frameRGB;
   const AVCodec* jpegCodec;
   AVCodecContext* jpegContext;
+  AVCodecContext* pngContext;
   AVPacket packet;
 };
 
@@ -0,0 +1,138 @@
+#pragma once
+
+#ifndef __H26XCODEC_ENCODER_SESSION_MANAGER__
+#define __H26XCODEC_ENCODER_SESSION_MANAGER__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "h26xencoder.hpp"
+
+struct EncoderSessionStats
+{
+    std::string name;
+    int         thread_num           = 0;
+    uint64_t    frames_submitted     = 0;
+    uint64_t    frames_rejected      = 0;
+    uint64_t    frames_encoded       = 0;
+    uint64_t    deadline_misses      = 0;
+    uint64_t    encode_errors        = 0;  ///< frames the encoder or on_packet threw on, they are dropped
+    size_t      queue_depth          = 0;
+    double      fps                  = 0;
+    double      avg_queue_latency_ms = 0;
+    double      max_queue_latency_ms = 0;
+    double      avg_encode_ms        = 0;
+};
+
+/*
+  Hosts many H26xEncoder sessions in one process.
+
+  Codec threads are handed out from a global CPU budget in proportion to
+  the pixel rate (width * height * fps) of every session, instead of every
+  encoder running its own fixed thread_num_. Frames are queued per session
+  and a worker pool picks the queued frame with the earliest deadline
+  (enqueue time + one frame interval) whose session is idle and whose
+  threads still fit in the budget, so no core is left idle while a frame
+  waits and no session monopolises the machine.
+
+  Frame threaded codecs keep working on a frame after Encode returns, so
+  the threads of a session count against the budget for as long as it is
+  enabled, not only while a worker is inside Encode. The shares are
+  therefore set once in Start and add up to the budget at most (with at
+  least one thread per session, more sessions than the budget overshoot
+  it, then only the encode calls are kept within it). The sessions are
+  fixed from Start to Stop.
+*/
+class EncoderSessionManager
+{
+public:
+    using Clock          = std::chrono::steady_clock;
+    using PacketCallback = std::function<void(std::vector<char> const& packet)>;
+
+    /// cpu_budget <= 0 uses std::thread::hardware_concurrency().
+    explicit EncoderSessionManager(int cpu_budget = 0);
+    ~EncoderSessionManager();
+
+    EncoderSessionManager(EncoderSessionManager const&)            = delete;
+    EncoderSessionManager& operator=(EncoderSessionManager const&) = delete;
+
+    /// The encoder must be configured but not enabled, its thread_num is overwritten from the budget.
+    /// on_packet is called from a worker thread, never concurrently for the same session.
+    /// Throws H26xInitFailure while the manager is started, the shares of the running sessions are fixed.
+    int AddSession(std::string const& name, std::unique_ptr<H26xEncoder> encoder, PacketCallback on_packet,
+                   size_t queue_size = 8);
+
+    /// Hands out the thread shares and enables (after a Stop restarts) every encoder.
+    void Start();
+    /// Encode the remaining queued frames, flush every encoder and join the workers.
+    /// Sessions can be added after it and Start called again, the encoders start over with an IDR frame.
+    void Stop();
+
+    /// Copies the image into the session queue, returns false (counted as rejected) if the queue is full or
+    /// size is less than a picture of the encoder's input format.
+    bool Submit(int session, uint8_t const* image, size_t size);
+
+    std::vector<EncoderSessionStats> Stats();
+    std::string                      Report();
+
+    int GetCpuBudget()
+    {
+        return cpu_budget_;
+    }
+
+private:
+    struct QueuedFrame
+    {
+        std::string       image;
+        Clock::time_point enqueued;
+        Clock::time_point deadline;
+    };
+
+    struct Session
+    {
+        std::string                  name;
+        std::unique_ptr<H26xEncoder> encoder;
+        PacketCallback               on_packet;
+        size_t                       queue_size;
+        size_t                       frame_size;  ///< bytes of one input picture
+        std::deque<QueuedFrame>      queue;
+        Clock::duration              frame_interval;
+        double                       weight;
+        bool                         enabled;  ///< the encoder has been opened once
+        bool                         flushed;  ///< by Stop, Restart before the next frame
+        bool                         busy;
+
+        uint64_t          frames_submitted;
+        uint64_t          frames_rejected;
+        uint64_t          frames_encoded;
+        uint64_t          deadline_misses;
+        uint64_t          encode_errors;
+        Clock::duration   total_queue_latency;
+        Clock::duration   max_queue_latency;
+        Clock::duration   total_encode_time;
+        Clock::time_point first_encoded;
+        Clock::time_point last_encoded;
+    };
+
+    void     assignThreads();
+    Session* pickSession();
+    void     workerLoop();
+
+    int                                   cpu_budget_;
+    int                                   busy_threads_;
+    bool                                  started_;
+    bool                                  stopping_;
+    std::vector<std::unique_ptr<Session>> sessions_;
+    std::vector<std::thread>              workers_;
+    std::mutex                            mutex_;
+    std::condition_variable               work_available_;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#pragma once
+
+#ifndef __H26XCODEC_ENCODER_STATS__
+#define __H26XCODEC_ENCODER_STATS__
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+/*
+  Latency histogram with logarithmic buckets (8 per power of two, about 9%
+  resolution) from 1us to over an hour. Recording is a log2 and an
+  increment, no allocation, so it can stay on in production.
+*/
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()
+      : buckets_{}
+      , count_{0}
+      , sum_us_{0}
+      , max_us_{0}
+    {
+    }
+
+    void Record(double us)
+    {
+        buckets_[bucketIndex(us)]++;
+        count_++;
+        sum_us_ += us;
+        max_us_ = std::max(max_us_, us);
+    }
+
+    void Merge(LatencyHistogram const& other)
+    {
+        for (size_t i = 0; i < buckets_.size(); i++)
+        {
+            buckets_[i] += other.buckets_[i];
+        }
+        count_ += other.count_;
+        sum_us_ += other.sum_us_;
+        max_us_ = std::max(max_us_, other.max_us_);
+    }
+
+    /// Upper bound of the bucket holding the p-th percentile (0..100), in microseconds.
+    double Percentile(double p) const;
+
+    uint64_t GetCount() const
+    {
+        return count_;
+    }
+
+    double GetMeanUs() const
+    {
+        return count_ ? sum_us_ / count_ : 0;
+    }
+
+    double GetMaxUs() const
+    {
+        return max_us_;
+    }
+
+private:
+    static constexpr int kSubBuckets = 8;
+    static constexpr int kBuckets    = 32 * kSubBuckets;
+
+    static int bucketIndex(double us)
+    {
+        if (us < 1)
+        {
+            return 0;
+        }
+        return std::min(int(std::log2(us) * kSubBuckets) + 1, kBuckets - 1);
+    }
+
+    static double bucketUpperUs(int index)
+    {
+        return std::exp2(double(index) / kSubBuckets);
+    }
+
+    std::array<uint64_t, kBuckets> buckets_;
+    uint64_t                       count_;
+    double                         sum_us_;
+    double                         max_us_;
+};
+
+/// Per-frame timing of an H26xEncoder, see H26xEncoder::EnableStats().
+struct EncoderStats
+{
+    /// input image/frame into the encoder frame (pixel format conversion, scaling or copy)
+    LatencyHistogram convert;
+    /// avcodec_send_frame, the codec's own work on the calling thread
+    LatencyHistogram send;
+    /// send returned -> its packet came out: lookahead, frame threads and B-frame reordering
+    LatencyHistogram queue;
+    /// Encode/EncodeFrame entered -> its packet came out
+    LatencyHistogram total;
+
+    uint64_t frames_in     = 0;
+    uint64_t packets_out   = 0;
+    uint64_t bytes_out     = 0;
+    uint64_t key_frames    = 0;
+    uint64_t send_errors   = 0;
+    /// packets whose input frame could not be matched by pts
+    uint64_t untagged      = 0;
+    /// first frame in -> last packet out
+    double   wall_ms       = 0;
+
+    double GetFps() const
+    {
+        return wall_ms > 0 ? packets_out * 1000.0 / wall_ms : 0;
+    }
+
+    void Merge(EncoderStats const& other);
+
+    /// Multi line summary, latencies in milliseconds.
+    std::string Str() const;
+};
+
+#endif
@@ -6,19 +6,77 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include "input_source.hpp"
+#include "packet_ptr.hpp"
 #include "video_reader.hpp"
 
 struct AVFrame;
+struct AVBSFContext;
+
+/*
+  逐个拉取容器里 H.264/H.265 视频流的 packet，不复制数据。
+
+  next 返回的 AVPacket 是引用计数的：数据仍在 libavformat/BSF 分配的
+  缓冲区里，pts/dts（流的时间基）和 AV_PKT_FLAG_KEY 原样保留，可以
+  直接交给 avcodec_send_packet，或者放进队列交给别的线程。annexb 为
+  true 时经过 h264_mp4toannexb/hevc_mp4toannexb，MP4 的 AVCC packet
+  变成带起始码的 Annex B，关键帧前带 SPS/PPS(/VPS)；TS 等本来就是
+  Annex B 的容器 BSF 原样透传。
+
+  打开失败或没有 H.26x 视频流时构造函数抛 H26xInitFailure。
+*/
+class PacketReader {
+public:
+    explicit PacketReader(const InputSource& source, bool annexb = true);
+    /** 接管 VideoReader::Open 已经打开并探测过的上下文，文件只打开、探测一次 */
+    explicit PacketReader(VideoReader& probed, bool annexb = true);
+    ~PacketReader();
+
+    PacketReader(const PacketReader&) = delete;
+    PacketReader& operator=(const PacketReader&) = delete;
+
+    /** 下一个视频 packet 放进 packet（为空时分配），流结束返回 false */
+    bool next(PacketPtr& packet);
+
+    /** "h264" 或 "h265"，即 H26xDecoder 的 decoder_id */
+    std::string get_codec_name() const;
+    const AVCodecParameters* get_codec_parameters() const;
+    AVRational get_time_base() const { return time_base; }
+    AVRational get_frame_rate() const { return frame_rate; }
+
+private:
+    void init(bool annexb, const std::string& name);
+
+    AVFormatContext* fmt_ctx = nullptr;
+    AVBSFContext* bsf_ctx = nullptr;
+    AVPacket* input = nullptr;
+    int video_stream_index = -1;
+    bool draining = false;
+    AVRational time_base{0, 1};
+    AVRational frame_rate{0, 1};
+};
 
 class Extractor {
 public:
     Extractor(std::string source_file_path);
+    /** 从内存或管道读取容器，见 InputSource */
+    Extractor(InputSource source);
+    /** 每个 Annex B packet 复制成一个 string，需要整段保存时用；逐个处理用 extract_packets */
     void extract(std::vector<std::string>& output_frames);
-    /** 直接从 MP4 解码并回调每一帧，绕过 parser，适用于容器格式 */
+    /** 逐个回调 Annex B packet，packet 只在回调期间有效，要保留用 av_packet_clone(只加引用) */
+    void extract_packets(std::function<void(const AVPacket&)> on_packet);
+    /** 直接从 MP4 解码并回调每一帧，绕过 parser，适用于容器格式。
+        打不开、没有 H.26x 视频流或解码器打不开时抛 H26xInitFailure，读或解码出错抛 H26xDecodeFailure */
     void extract_decoded(std::function<void(const AVFrame&)> on_frame);
 
+    /** 视频流的时间基和帧率，在第一帧回调之前设置 */
+    AVRational get_time_base() const { return time_base; }
+    AVRational get_frame_rate() const { return frame_rate; }
+
 private:
-    std::string source_file_path;
+    InputSource source;
+    AVRational time_base{0, 1};
+    AVRational frame_rate{0, 1};
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,104 @@
+#pragma once
+
+#ifndef __H26XCODEC_FRAME_ARCHIVE__
+#define __H26XCODEC_FRAME_ARCHIVE__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+  All frames of a run in one file instead of one file per frame, made to
+  be mmapped and read at random.
+
+      header   64 bytes   "H26XARCH", version, payload format ("jpeg", "png", "rgb", "yuv420p")
+      frames   payloads back to back, each starting at a multiple of 64
+      index    one 48 byte FrameArchiveEntry per frame
+      footer   32 bytes   index offset, frame count, entry size, version, "H26XINDX"
+
+  Every integer is little endian. The writer buffers and appends only, the
+  index is written by Finish, so an archive without its footer (a crashed
+  run) is rejected by the reader.
+*/
+
+struct FrameArchiveEntry
+{
+    static constexpr uint32_t kKeyFrame = 1;
+
+    uint64_t offset       = 0;
+    uint64_t size         = 0;
+    int64_t  frame_number = 0;
+    int64_t  pts          = INT64_MIN;  ///< stream time base, INT64_MIN when unknown
+    uint32_t width        = 0;
+    uint32_t height       = 0;
+    uint32_t flags        = 0;
+};
+
+class FrameArchiveWriter
+{
+public:
+    /// Creates or truncates path. format names the payloads, at most 31 characters.
+    FrameArchiveWriter(std::string const& path, std::string const& format);
+    /// Finishes the archive if Finish wasn't called, errors are lost then.
+    ~FrameArchiveWriter();
+
+    FrameArchiveWriter(FrameArchiveWriter const&) = delete;
+    FrameArchiveWriter& operator=(FrameArchiveWriter const&) = delete;
+
+    /// Appends one payload, entry.offset and entry.size are filled in. Returns the frame's index.
+    size_t Append(void const* data, size_t size, FrameArchiveEntry entry);
+
+    /// Writes the index and footer and closes the file.
+    void Finish();
+
+    size_t GetFrameCount() const
+    {
+        return entries_.size();
+    }
+
+private:
+    void write(void const* data, size_t size);
+    void flushBuffer();
+
+    int                            fd_;
+    std::string                    path_;
+    uint64_t                       offset_;
+    std::vector<char>              buffer_;
+    std::vector<FrameArchiveEntry> entries_;
+};
+
+class FrameArchiveReader
+{
+public:
+    /// Maps the whole file read only, throws H26xDecodeFailure if it isn't a complete archive.
+    explicit FrameArchiveReader(std::string const& path);
+    ~FrameArchiveReader();
+
+    FrameArchiveReader(FrameArchiveReader const&) = delete;
+    FrameArchiveReader& operator=(FrameArchiveReader const&) = delete;
+
+    std::string const& GetFormat() const
+    {
+        return format_;
+    }
+
+    size_t GetFrameCount() const
+    {
+        return count_;
+    }
+
+    FrameArchiveEntry GetEntry(size_t index) const;
+
+    /// Points into the mapping, valid as long as the reader lives. No copy, no syscall.
+    uint8_t const* GetFrame(size_t index, size_t* size = nullptr) const;
+
+private:
+    uint8_t const* map_;
+    size_t         map_size_;
+    uint8_t const* index_;
+    size_t         count_;
+    std::string    format_;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#ifndef __H26XCODEC_FRAME_PTR__
+#define __H26XCODEC_FRAME_PTR__
+
+#include <cstddef>
+#include <memory>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+/* Owning pointer for reference counted frames handed between pipeline stages. */
+struct FrameDeleter
+{
+    void operator()(AVFrame* frame) const
+    {
+        av_frame_free(&frame);
+    }
+};
+
+using FramePtr = std::unique_ptr<AVFrame, FrameDeleter>;
+
+/// Bytes held by the frame's buffers, what queueing it costs a MemoryBudget.
+inline size_t FrameBytes(AVFrame const* frame)
+{
+    size_t bytes = 0;
+    for (AVBufferRef* buf : frame->buf)
+    {
+        if (buf)
+        {
+            bytes += buf->size;
+        }
+    }
+    return bytes;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#ifndef __H26XCODEC__
+#define __H26XCODEC__
+
+/*
+  Everything libh26xcodec offers, for programs linking h26xcodec::h26xcodec.
+*/
+#include "h26xexceptions.hpp"
+#include "h26xencoder.hpp"
+#include "h26xdecoder.hpp"
+#include "converter.hpp"
+#include "input_source.hpp"
+#include "bitstream_parser.hpp"
+#include "activity_detector.hpp"
+#include "extractor.hpp"
+#include "video_reader.hpp"
+#include "frame_ptr.hpp"
+#include "packet_ptr.hpp"
+#include "frame_archive.hpp"
+#include "motion_vectors.hpp"
+#include "memory_budget.hpp"
+#include "async_writer.hpp"
+#include "shm_ring.hpp"
+#include "encoder_stats.hpp"
+#include "trace.hpp"
+#include "run_stats.hpp"
+#include "segment_encoder.hpp"
+#include "encoder_session_manager.hpp"
+#include "transcoder.hpp"
+#include "rendition_ladder.hpp"
+#include "pipeline.hpp"
+
+#endif
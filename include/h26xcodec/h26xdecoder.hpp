@@ -16,17 +16,20 @@ However, in contrast to roxlu's code the color space conversion is
 done by libav functions - so on the CPU, I suppose.
 
 Most functions/members throw exceptions. This way, error states are 
-conveniently forwarded to python via the exception translation 
-mechanisms of boost::python.  
+conveniently forwarded to python: the pybind11 module in python/ 
+raises them as h26xcodec.DecodeError/InitError.  
 */
 
 // for ssize_t (signed int type as large as pointer type)
 #include <cstdlib>
+#include <functional>
 #include <stdexcept>
+#include <string>
 #include <utility>
 #include <vector>
 #include <memory>
 #include "h26xexceptions.hpp"
+#include "input_source.hpp"
 
 struct AVCodecContext;
 struct AVFrame;
@@ -49,8 +52,18 @@ to the encoded data, which must be kept around  between calls to
 parse- and decode frame. In release 11 it is put on the stack, too. 
   */
   AVPacket              *pkt;
+  size_t send_and_receive(const std::function<void(const AVFrame&)>& on_frame);
+  size_t receive_frames(const std::function<void(const AVFrame&)>& on_frame);
 public:
-  H26xDecoder(std::string const& decoder_id);
+  typedef std::function<void(const AVFrame&)> FrameCallback;
+
+  /* With export_motion_vectors every decoded frame carries its motion 
+vectors (AV_FRAME_DATA_MOTION_VECTORS) and, with FFmpeg 4.4 or newer, 
+its macroblock QPs (AV_FRAME_DATA_VIDEO_ENC_PARAMS) as side data, see 
+motion_vectors.hpp. Only the H.264 decoder of FFmpeg exports them, 
+H.265 frames come without.
+  */
+  H26xDecoder(std::string const& decoder_id, bool export_motion_vectors = false);
   ~H26xDecoder();
   /* First, parse a continuous data stream, dividing it into 
 packets. When there is enough data to form a new frame, decode 
@@ -61,7 +74,30 @@ bytes at frame boundaries.
   ptrdiff_t parse(const unsigned char* in_data, ptrdiff_t in_size);
   bool is_frame_available() const;
   const AVFrame& decode_frame();
+  /* Decode one complete access unit (e.g. a packet straight from 
+H26xEncoder) without going through the parser, which would hold it 
+back until the start of the next one arrives.
+  */
+  const AVFrame& decode_packet(const unsigned char* in_data, ptrdiff_t in_size);
+  /* Streaming decode of in-memory Annex B data in chunks of any size: 
+every frame completed by the chunk is passed to on_frame (valid during 
+the call only), returns the number of frames. flush ends the stream, 
+hands out what parser and decoder still hold and leaves the decoder 
+ready for a new stream.
+  */
+  size_t feed(const unsigned char* in_data, ptrdiff_t in_size, const FrameCallback& on_frame);
+  size_t flush(const FrameCallback& on_frame);
+  /* Decode one demuxed packet (e.g. from PacketReader) straight 
+through avcodec_send_packet: no parser, and the decoder takes a 
+reference on the packet's buffer instead of copying it. pts/dts are 
+passed on to the frames. End the stream with flush.
+  */
+  size_t decode_packet(const AVPacket& packet, const FrameCallback& on_frame);
   void decode_video(const std::string& video_path, std::vector<std::shared_ptr<AVFrame>>& decoded_frames);
+  /* Same for a container in memory or coming through a pipe, see 
+InputSource.
+  */
+  void decode_video(const InputSource& source, std::vector<std::shared_ptr<AVFrame>>& decoded_frames);
 };
 
 void disable_logging();
@@ -3,10 +3,17 @@
 #ifndef __H26XCODEC_ENCODER__
 #define __H26XCODEC_ENCODER__
 
+#include <algorithm>
+#include <cctype>
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <functional>
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
+#include "encoder_stats.hpp"
 #include "h26xexceptions.hpp"
 
 extern "C" {
@@ -20,6 +27,30 @@ extern "C" {
 #include <libswscale/swscale.h>
 }
 
+/// How the encoder spends its bits.
+/// Options:   whatever options_ says (crf/qp), bitrate/maxrate/bufsize only if set.
+/// CBR:       bitrate == maxrate with a VBV buffer, frame sizes are bounded by the buffer instead of
+///            spiking on scene cuts. Needs a bitrate.
+/// CappedVBR: average bitrate (or the crf of options_ when no bitrate is set) capped by maxrate over
+///            the VBV buffer. Needs a maxrate.
+enum class RateControlMode
+{
+    Options,
+    CBR,
+    CappedVBR,
+};
+
+/// What the encoder reports for every packet it outputs.
+struct H26xFrameStats
+{
+    int64_t       pts;
+    int64_t       dts;
+    int           size;      /// bytes
+    double        qp;        /// average QP of the frame, -1 if the codec doesn't export it
+    AVPictureType pict_type; /// AV_PICTURE_TYPE_NONE if the codec doesn't export it
+    bool          key;
+};
+
 class H26xEncoder
 {
 public:
@@ -40,6 +71,29 @@ public:
       , input_pixel_format_{}
       , bits_per_pixel_{0}
       , swsContext_{nullptr}
+      , closed_gop_{false}
+      , fixed_gop_{false}
+      , time_base_{0, 1}
+      , scaleContext_{nullptr}
+      , input_frame_{nullptr}
+      , next_pts_{0}
+      , bit_rate_{0}
+      , max_rate_{0}
+      , buffer_size_{0}
+      , force_key_frame_{false}
+      , reconfigure_pending_{false}
+      , pending_rate_{}
+      , pending_output_{}
+      , reconfigure_count_{0}
+      , last_reconfigure_ms_{0}
+      , rate_control_{RateControlMode::Options}
+      , intra_refresh_{false}
+      , frame_stats_callback_{}
+      , stats_enabled_{false}
+      , stats_{}
+      , in_flight_{}
+      , first_frame_{}
+      , pending_user_data_{}
       , frame_index_{0}
     {
     }
@@ -61,6 +115,29 @@ public:
       , input_pixel_format_{}
       , bits_per_pixel_{0}
       , swsContext_{nullptr}
+      , closed_gop_{false}
+      , fixed_gop_{false}
+      , time_base_{0, 1}
+      , scaleContext_{nullptr}
+      , input_frame_{nullptr}
+      , next_pts_{0}
+      , bit_rate_{0}
+      , max_rate_{0}
+      , buffer_size_{0}
+      , force_key_frame_{false}
+      , reconfigure_pending_{false}
+      , pending_rate_{}
+      , pending_output_{}
+      , reconfigure_count_{0}
+      , last_reconfigure_ms_{0}
+      , rate_control_{RateControlMode::Options}
+      , intra_refresh_{false}
+      , frame_stats_callback_{}
+      , stats_enabled_{false}
+      , stats_{}
+      , in_flight_{}
+      , first_frame_{}
+      , pending_user_data_{}
       , frame_index_{0}
     {
         if (name == "h264" || name == "H264")
@@ -77,11 +154,20 @@ public:
     {
         avcodec_free_context(&context_);
         sws_freeContext(swsContext_);
+        sws_freeContext(scaleContext_);
         av_frame_free(&frame_);
+        av_frame_free(&input_frame_);
     }
 
     void Enable();
 
+    /// Open a new codec context after Flush so an enabled encoder takes frames again, with the current
+    /// settings. The next frame is an IDR frame.
+    void Restart()
+    {
+        reopen();
+    }
+
     void SetWidth(int value)
     {
         width_ = value;
@@ -127,16 +213,40 @@ public:
         input_pixel_format_ = value;
     }
 
+    /// Accepts RGB24, BGR24, BGRA, YUV420P, NV12 and YUYV422 (case insensitive, with a few common aliases).
     void SetInputPixelFormat(std::string const& value)
     {
-        if (value == "RGB24" || value == "RGB")
+        std::string name(value);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+        if (name == "RGB24" || name == "RGB")
         {
             input_pixel_format_ = AV_PIX_FMT_RGB24;
         }
-        else if (value == "YUV240P" || value == "NV12")
+        else if (name == "BGR24" || name == "BGR")
+        {
+            input_pixel_format_ = AV_PIX_FMT_BGR24;
+        }
+        else if (name == "BGRA" || name == "BGR32")
+        {
+            input_pixel_format_ = AV_PIX_FMT_BGRA;
+        }
+        else if (name == "YUV420P" || name == "YUV240P" || name == "I420")
         {
             input_pixel_format_ = AV_PIX_FMT_YUV420P;
         }
+        else if (name == "NV12")
+        {
+            input_pixel_format_ = AV_PIX_FMT_NV12;
+        }
+        else if (name == "YUYV" || name == "YUYV422" || name == "YUY2")
+        {
+            input_pixel_format_ = AV_PIX_FMT_YUYV422;
+        }
+        else
+        {
+            std::string msg = std::string("Unknown input pixel format ") + value;
+            throw H26xInitFailure(msg.c_str());
+        }
     }
 
     AVPixelFormat GetInputPixelFormat()
@@ -146,15 +256,23 @@ public:
 
     std::string GetInputPixelFormatString()
     {
-        if (input_pixel_format_ == AV_PIX_FMT_YUV420P)
-        {
-            return "YUV420P";
-        }
-        if (input_pixel_format_ == AV_PIX_FMT_RGB24)
+        switch (input_pixel_format_)
         {
-            return "RGB24";
+            case AV_PIX_FMT_YUV420P:
+                return "YUV420P";
+            case AV_PIX_FMT_RGB24:
+                return "RGB24";
+            case AV_PIX_FMT_BGR24:
+                return "BGR24";
+            case AV_PIX_FMT_BGRA:
+                return "BGRA";
+            case AV_PIX_FMT_NV12:
+                return "NV12";
+            case AV_PIX_FMT_YUYV422:
+                return "YUYV422";
+            default:
+                return "UNKNOWN";
         }
-        return "UNKNOWN";
     }
 
     void SetRefs(int value)
@@ -204,6 +322,199 @@ public:
         }
     }
 
+    /// Closed GOPs never reference frames of the previous GOP, so independently encoded
+    /// segments can be concatenated. Must be set before Enable().
+    void SetClosedGop(bool value)
+    {
+        closed_gop_ = value;
+    }
+
+    bool GetClosedGop()
+    {
+        return closed_gop_;
+    }
+
+    /// Key frames exactly every gop_size frames, no scene cut detection. Encoders fed with the same
+    /// frames then put their IDRs on the same frames. Must be set before Enable().
+    void SetFixedGop(bool value)
+    {
+        fixed_gop_ = value;
+    }
+
+    bool GetFixedGop()
+    {
+        return fixed_gop_;
+    }
+
+    /// Time base of the pts passed to EncodeFrame, defaults to 1/fps.
+    void SetTimeBase(AVRational value)
+    {
+        time_base_ = value;
+    }
+
+    AVRational GetTimeBase()
+    {
+        return time_base_;
+    }
+
+    /// Target bitrate in bit/s for average bitrate encoding, 0 leaves it to the codec.
+    void SetBitrate(int64_t value)
+    {
+        bit_rate_ = value;
+    }
+
+    int64_t GetBitrate()
+    {
+        return bit_rate_;
+    }
+
+    /// VBV maximum rate in bit/s, 0 disables VBV.
+    void SetMaxRate(int64_t value)
+    {
+        max_rate_ = value;
+    }
+
+    int64_t GetMaxRate()
+    {
+        return max_rate_;
+    }
+
+    /// VBV buffer size in bits.
+    void SetBufferSize(int value)
+    {
+        buffer_size_ = value;
+    }
+
+    int GetBufferSize()
+    {
+        return buffer_size_;
+    }
+
+    void SetRateControl(RateControlMode value)
+    {
+        rate_control_ = value;
+    }
+
+    /// Accepts options, cbr and vbr (capped VBR), case insensitive.
+    void SetRateControl(std::string const& value)
+    {
+        std::string name(value);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (name == "options" || name.empty())
+        {
+            rate_control_ = RateControlMode::Options;
+        }
+        else if (name == "cbr")
+        {
+            rate_control_ = RateControlMode::CBR;
+        }
+        else if (name == "vbr" || name == "capped_vbr" || name == "cvbr")
+        {
+            rate_control_ = RateControlMode::CappedVBR;
+        }
+        else
+        {
+            std::string msg = std::string("Unknown rate control ") + value;
+            throw H26xInitFailure(msg.c_str());
+        }
+    }
+
+    RateControlMode GetRateControl()
+    {
+        return rate_control_;
+    }
+
+    std::string GetRateControlString()
+    {
+        switch (rate_control_)
+        {
+            case RateControlMode::CBR:
+                return "CBR";
+            case RateControlMode::CappedVBR:
+                return "CappedVBR";
+            default:
+                return "Options";
+        }
+    }
+
+    /// Periodic intra refresh: a column of intra blocks sweeps over gop_size frames instead of
+    /// sending IDR frames, which removes the key frame size spikes. Must be set before Enable().
+    void SetIntraRefresh(bool value)
+    {
+        intra_refresh_ = value;
+    }
+
+    bool GetIntraRefresh()
+    {
+        return intra_refresh_;
+    }
+
+    /// Called for every packet the encoder outputs, on the thread that calls Encode/EncodeFrame/Flush.
+    void SetFrameStatsCallback(std::function<void(H26xFrameStats const&)> callback)
+    {
+        frame_stats_callback_ = std::move(callback);
+    }
+
+    /// Per-frame latency histograms and counters, off by default. Enabled it costs a few clock reads and
+    /// an uncontended lock per frame. Must be set before the first frame.
+    void EnableStats(bool value = true)
+    {
+        stats_enabled_ = value;
+    }
+
+    bool GetStatsEnabled()
+    {
+        return stats_enabled_;
+    }
+
+    /// Snapshot of the statistics so far, safe to call from any thread.
+    EncoderStats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        return stats_;
+    }
+
+    void ResetStats()
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_ = EncoderStats{};
+        in_flight_.clear();
+    }
+
+    /// Attach a user data unregistered SEI (16 byte UUID followed by the payload) to the next frame,
+    /// it is written into that frame's access unit. Call from the encoding thread.
+    void AddUserDataSei(std::vector<uint8_t> const& uuid_and_payload)
+    {
+        pending_user_data_.push_back(uuid_and_payload);
+    }
+
+    /// Make the next frame an IDR frame. Safe to call from any thread.
+    void RequestKeyFrame()
+    {
+        force_key_frame_ = true;
+    }
+
+    /// Change rate control while encoding, a negative value keeps the current setting. Safe to call from
+    /// any thread, the change is applied in front of the next frame: in place through x264's
+    /// reconfiguration, other codecs are drained and reopened (the next frame is an IDR frame then).
+    /// Only the parameters of the configured mode (bitrate for ABR, crf for CRF) and an already
+    /// enabled VBV can change in place. In CRF mode a bitrate, in CBR/capped VBR a crf, and in place a VBV that
+    /// is off, is ignored with a warning; an update left with nothing to change isn't counted.
+    void UpdateRateControl(int64_t bit_rate, int64_t max_rate = -1, int buffer_size = -1, double crf = -1);
+
+    bool SupportsReconfigure();
+
+    int GetReconfigureCount()
+    {
+        return reconfigure_count_;
+    }
+
+    /// Time the last rate control change took inside the encode call.
+    double GetLastReconfigureMs()
+    {
+        return last_reconfigure_ms_;
+    }
+
     std::map<std::string, std::string>& GetOptions()
     {
         return options_;
@@ -216,15 +527,35 @@ public:
 
     void createCodec();
     void createContext();
+    void rateControlValues(int64_t& bit_rate, int64_t& max_rate, int& buffer_size);
+    void appendPrivateParam(std::string const& param);
     void calculateBitsPerPixel();
     void createSwsContext();
     void createAVFrameAndAVPacket();
+    bool supportsPixelFormat(AVPixelFormat format);
 
+    /// Copy or convert one input image of input_pixel_format_ straight into the encoder frame.
+    void fillFrame(uint8_t const* input_image);
     void fillYuv420pFrame(uint8_t const* input_image);
     void fillRgb24Frame(uint8_t const* input_image);
+    void applyReconfigure();
+    void reopen();
+    void applyKeyFrameRequest(AVFrame* frame);
+    void applyUserData(AVFrame* frame);
+    void takePendingOutput(std::vector<char>& output);
     bool sendFrame();
+    using StatsClock = std::chrono::steady_clock;
+    StatsClock::time_point statsNow();
+    void recordFrame(int64_t pts, StatsClock::time_point start, StatsClock::time_point converted, bool sent);
+    void recordPacket(AVPacket const& packet);
+    void reportFrameStats(AVPacket const& packet);
     bool recvPacket(std::vector<char>& output);
+    bool drainPackets(std::vector<char>& output);
     bool Encode(uint8_t const* input, std::vector<char>& output);
+    /// Encode a decoded frame, keeping its pts (in the time base set by SetTimeBase). A frame with the
+    /// encoder's size and pixel format is passed on by reference, anything else is scaled into the
+    /// encoder frame. output receives every packet available afterwards.
+    bool EncodeFrame(AVFrame const& input, std::vector<char>& output);
     bool Flush(std::vector<char>& output);
 
     std::string Str();
@@ -246,6 +577,50 @@ protected:
     AVPixelFormat                      input_pixel_format_;
     int                                bits_per_pixel_;
     SwsContext*                        swsContext_;
+    bool                               closed_gop_;
+    bool                               fixed_gop_;
+    AVRational                         time_base_;
+    SwsContext*                        scaleContext_;
+    AVFrame*                           input_frame_;
+    int64_t                            next_pts_;
+    int64_t                            bit_rate_;
+    int64_t                            max_rate_;
+    int                                buffer_size_;
+
+    struct RateUpdate
+    {
+        int64_t bit_rate;
+        int64_t max_rate;
+        int     buffer_size;
+        double  crf;
+    };
+
+    std::atomic<bool>                  force_key_frame_;
+    std::atomic<bool>                  reconfigure_pending_;
+    std::mutex                         reconfigure_mutex_;
+    RateUpdate                         pending_rate_;
+    std::vector<char>                  pending_output_;
+    int                                reconfigure_count_;
+    double                             last_reconfigure_ms_;
+    RateControlMode                    rate_control_;
+    bool                               intra_refresh_;
+
+    std::function<void(H26xFrameStats const&)> frame_stats_callback_;
+
+    /// when a frame entered Encode/EncodeFrame and when the codec took it, by pts
+    struct FrameTiming
+    {
+        StatsClock::time_point start;
+        StatsClock::time_point sent;
+    };
+
+    bool                                stats_enabled_;
+    std::mutex                          stats_mutex_;
+    EncoderStats                        stats_;
+    std::map<int64_t, FrameTiming>      in_flight_;
+    StatsClock::time_point              first_frame_;
+
+    std::vector<std::vector<uint8_t>>   pending_user_data_;
 
     int frame_index_;
 };
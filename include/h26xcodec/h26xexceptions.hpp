@@ -2,6 +2,8 @@
 #ifndef __H26XCODEC_EXCEPTION__
 #define __H26XCODEC_EXCEPTION__
 
+#include <stdexcept>
+
 class H26xException : public std::runtime_error
 {
 public:
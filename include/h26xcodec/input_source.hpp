@@ -0,0 +1,106 @@
+#pragma once
+
+#ifndef __H26XCODEC_INPUT_SOURCE__
+#define __H26XCODEC_INPUT_SOURCE__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct AVFormatContext;
+
+/// How much of a source libavformat reads to find its streams, see InputSource::OpenProbed.
+struct ProbeOptions
+{
+    int64_t probesize           = 0;      ///< bytes, 0 keeps libavformat's default (5 MB)
+    int64_t analyze_duration_us = 0;      ///< 0 keeps libavformat's default (5 s)
+    bool    trust_headers       = false;  ///< MP4/MOV/MKV with complete headers skip avformat_find_stream_info
+    bool    cache               = true;   ///< reopening an unchanged file reuses its stream info
+};
+
+/*
+  Where a container (MP4/MKV/TS/raw Annex B...) is demuxed from.
+
+  A path goes to avformat_open_input as before. A memory span or a file
+  descriptor gets a custom AVIOContext whose read/seek callbacks read
+  straight from it: the span is never copied as a whole, libavformat only
+  pulls the bytes it needs into its 64 KiB I/O buffer, just like it does
+  for a file.
+
+  A descriptor (a pipe, a socket, stdin) is read sequentially and can't
+  seek, so an MP4 needs its moov atom first (faststart) or has to be
+  fragmented; MKV, TS and Annex B stream fine. It is consumed by the first
+  open. A memory span must stay valid until every context opened on it is
+  closed, it can be opened any number of times.
+
+  Probing (avformat_find_stream_info decodes the first frames of every
+  stream) is most of the time it takes to open a short clip. OpenProbed
+  does it the way the ProbeOptions say: with a smaller probesize and
+  analyzeduration, not at all when trust_headers is set and the MP4/MKV
+  header already has the size and parameter sets of the video, and only
+  once per file: the stream info of a path is cached, keyed by path, size
+  and modification time, and a later open of the same file takes it from
+  there.
+*/
+class InputSource
+{
+public:
+    static InputSource FromPath(std::string const& path);
+    static InputSource FromMemory(uint8_t const* data, size_t size);
+    static InputSource FromFd(int fd);
+    /// "-" reads stdin, anything else is a path.
+    static InputSource FromArgument(std::string const& argument);
+
+    /// A path, "memory" or "fd:<n>", for messages.
+    std::string const& GetName() const
+    {
+        return name_;
+    }
+
+    bool IsPath() const
+    {
+        return kind_ == Kind::Path;
+    }
+
+    InputSource& SetProbeOptions(ProbeOptions const& probe)
+    {
+        probe_ = probe;
+        return *this;
+    }
+
+    ProbeOptions const& GetProbeOptions() const
+    {
+        return probe_;
+    }
+
+    /// Taken by every source made afterwards, e.g. from the command line. Set it before any thread opens sources.
+    static void SetDefaultProbeOptions(ProbeOptions const& probe);
+
+    /// avformat_open_input on the source, returns its AVERROR code. The context must be closed with Close.
+    int Open(AVFormatContext** fmt_ctx) const;
+
+    /// Open plus the stream info (codec parameters, frame rate), probed or cached as the ProbeOptions say.
+    int OpenProbed(AVFormatContext** fmt_ctx) const;
+
+    /// avformat_close_input plus the custom I/O context and its state.
+    static void Close(AVFormatContext** fmt_ctx);
+
+private:
+    enum class Kind
+    {
+        Path,
+        Memory,
+        Fd
+    };
+
+    InputSource(Kind kind, std::string name);
+
+    Kind           kind_;
+    std::string    name_;
+    uint8_t const* data_;
+    size_t         size_;
+    int            fd_;
+    ProbeOptions   probe_;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#pragma once
+
+#ifndef __H26XCODEC_MEMORY_BUDGET__
+#define __H26XCODEC_MEMORY_BUDGET__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/*
+  One byte budget for everything a pipeline holds between its stages:
+  packets waiting for the decoder, frames waiting for conversion, images
+  waiting for the writer. BoundedQueue and AsyncFileWriter take from it
+  when something is queued and give back when it is taken out, a producer
+  blocks while the budget is used up, so memory stays flat however far a
+  fast stage could run ahead of a slow one.
+
+  Every queue or writer takes from the budget through its own Account. An
+  account that holds nothing may always take one item, even past the
+  limit: otherwise frames piling up in front of a slow stage could use the
+  whole budget and leave the stage below nothing to hand its results on
+  with, and the chain would stop. So the bound is the limit plus one item
+  per stage, and a small budget slows the pipeline down but never stops
+  it. A limit of 0 only counts, it never blocks.
+*/
+class MemoryBudget
+{
+public:
+    /// What one stage holds, only touched by the budget.
+    struct Account
+    {
+        size_t held = 0;
+    };
+
+    explicit MemoryBudget(size_t limit_bytes = 0);
+
+    /// "512M", "2G", "64k" or plain bytes, binary units. Throws std::invalid_argument.
+    static size_t ParseSize(std::string const& text);
+
+    /// Blocks until bytes fit. Returns false without taking anything if cancel became true meanwhile,
+    /// WakeAll makes waiters look at it again.
+    bool Acquire(Account& account, size_t bytes, std::atomic<bool> const* cancel = nullptr);
+    void Release(Account& account, size_t bytes);
+    void WakeAll();
+
+    size_t GetLimit() const
+    {
+        return limit_;
+    }
+
+    size_t GetUsed();
+    /// Most bytes held at once.
+    size_t GetPeak();
+    /// Producers waiting for the budget, summed over threads.
+    double GetBlockedSeconds();
+
+    /// "peak 310.2 MiB of 512.0 MiB, producers blocked 1.20 s"
+    std::string Str();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    size_t                  limit_;
+    size_t                  used_;
+    size_t                  peak_;
+    double                  blocked_seconds_;
+    std::mutex              mutex_;
+    std::condition_variable released_;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#pragma once
+
+#ifndef __H26XCODEC_MOTION_VECTORS__
+#define __H26XCODEC_MOTION_VECTORS__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct AVFrame;
+
+/*
+  The motion vectors and macroblock QPs the decoder already has, handed
+  on with every frame so tracking and analytics can use them instead of
+  computing dense optical flow on the pictures.
+
+  H26xDecoder(codec, true) makes FFmpeg attach them to the frames as side
+  data, FrameMotion::Extract reads them out. Only FFmpeg's H.264 decoder
+  exports them; H.265 frames, and I frames, have no vectors. QPs need
+  FFmpeg 4.4 or newer. Block kinds are not exported by FFmpeg, they are
+  derived from the vectors: a macroblock that no vector lands in is
+  intra (or has no data), the others are predicted from the past, the
+  future or both.
+
+  As a byte stream (every integer little endian):
+
+      file header   8 bytes    "H26M", version, reserved
+      per frame     40 bytes   FrameMotion header, see AppendBinary
+                    16 bytes   per MotionVectorRecord
+                    1 byte     per macroblock, QP (int8, -1 unknown)    if flags & kHasQp
+                    1 byte     per macroblock, BlockKind               if flags & kHasVectors
+
+  Macroblocks are 16x16, mb_cols * mb_rows of them in raster order. The
+  JSON form is one object per frame and line.
+*/
+
+/// One block's vector as AVMotionVector has it, packed into 16 bytes.
+struct MotionVectorRecord
+{
+    int16_t src_x        = 0;  ///< where the block is predicted from, the center of the block
+    int16_t src_y        = 0;
+    int16_t dst_x        = 0;  ///< the center of the block in this frame
+    int16_t dst_y        = 0;
+    int16_t motion_x     = 0;  ///< dst + motion / motion_scale = src
+    int16_t motion_y     = 0;
+    uint8_t w            = 0;
+    uint8_t h            = 0;
+    int8_t  source       = 0;  ///< -1 a past reference, 1 a future one
+    uint8_t motion_scale = 1;
+};
+
+struct FrameMotion
+{
+    enum BlockKind : uint8_t
+    {
+        Intra         = 0,
+        Forward       = 1,
+        Backward      = 2,
+        Bidirectional = 3
+    };
+
+    static constexpr uint32_t kFileMagic      = 0x4d363248;  // "H26M"
+    static constexpr uint32_t kFrameMagic     = 0x46564d4d;  // "MMVF"
+    static constexpr uint16_t kVersion        = 1;
+    static constexpr size_t   kFileHeaderSize = 8;
+    static constexpr size_t   kHeaderSize     = 40;
+    static constexpr size_t   kVectorSize     = 16;
+    static constexpr int      kBlockSize      = 16;
+    static constexpr uint8_t  kHasVectors     = 1;
+    static constexpr uint8_t  kHasQp          = 2;
+
+    uint64_t frame   = 0;          ///< presentation order, from 0
+    int64_t  pts     = INT64_MIN;  ///< stream time base, INT64_MIN when unknown
+    uint16_t width   = 0;
+    uint16_t height  = 0;
+    char     type    = '?';  ///< I, P, B, ...
+    uint8_t  flags   = 0;
+    uint16_t mb_cols = 0;
+    uint16_t mb_rows = 0;
+
+    std::vector<MotionVectorRecord> vectors;
+    std::vector<int8_t>             qp;      ///< per macroblock when flags & kHasQp
+    std::vector<uint8_t>            blocks;  ///< BlockKind per macroblock when flags & kHasVectors
+
+    /// Fills everything in from the side data of a decoded frame, index becomes frame.
+    void Extract(AVFrame const& decoded, uint64_t index);
+
+    static void AppendFileHeader(std::string& out);
+    void        AppendBinary(std::string& out) const;
+
+    /// One frame of a stream written by AppendBinary, returns the bytes it took or 0 if data holds less than
+    /// the whole frame. Throws std::runtime_error if data doesn't start with a frame.
+    size_t ParseBinary(uint8_t const* data, size_t size);
+
+    /// One line, without the newline.
+    std::string Json() const;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef __H26XCODEC_PACKET_PTR__
+#define __H26XCODEC_PACKET_PTR__
+
+#include <cstddef>
+#include <memory>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+/* Owning pointer for reference counted packets handed between pipeline stages. */
+struct PacketDeleter
+{
+    void operator()(AVPacket* packet) const
+    {
+        av_packet_free(&packet);
+    }
+};
+
+using PacketPtr = std::unique_ptr<AVPacket, PacketDeleter>;
+
+#endif
@@ -0,0 +1,152 @@
+#pragma once
+
+#ifndef __H26XCODEC_PIPELINE__
+#define __H26XCODEC_PIPELINE__
+
+/*
+  The jobs of the h26xcodec command line tool as library calls: decode a
+  video or frame files to images, encode images or raw frames, transcode
+  and encode a bitrate ladder. Paths in, files out, exceptions on errors
+  (H26xException, std::filesystem::filesystem_error). decode_to_stream and
+  transcode_h26x also take "-" for stdin/stdout to run inside a shell
+  pipeline.
+
+  For in-memory work use the classes directly: H26xDecoder::feed/flush
+  turn Annex B bytes into frames, ConverterRGB24 turns frames into RGB24
+  or JPEG and JPEG/PNG bytes into RGB24, H26xEncoder turns frames into
+  Annex B packets, Transcoder and RenditionLadder chain them.
+*/
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "activity_detector.hpp"
+#include "bitstream_parser.hpp"
+#include "h26xencoder.hpp"
+#include "video_reader.hpp"
+
+struct EncoderParameters{
+    uint32_t width=0;
+    uint32_t height=0;
+    std::string input_pixel_format;
+    int32_t gop_size=0;
+    uint32_t fps=25;
+    uint32_t refs=0;
+    uint32_t max_b_frames=0;
+    uint32_t thread_num=4;
+    // options (crf below), cbr or vbr (capped), bitrates in bit/s
+    std::string rate_control="options";
+    int64_t bitrate=0;
+    int64_t maxrate=0;
+    int32_t bufsize=0;
+    bool intra_refresh=false;
+    std::map<std::string, std::string> options{
+        {"preset","veryfast"},
+        {"crf","10"},
+        {"tune","zerolatency"}
+    };
+};
+
+/// In front of every picture written by decode_to_stream, 24 bytes, all fields little endian.
+struct RawFrameHeader{
+    static constexpr uint32_t kMagic = 0x46363248;   // "H26F"
+    static constexpr size_t kSize = 24;
+    enum Format : uint32_t { RGB24 = 0, YUV420P = 1 };
+
+    uint32_t magic = kMagic;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint32_t format = RGB24;
+    uint32_t size = 0;      // bytes of the tightly packed picture that follows
+    int64_t pts = INT64_MIN; // stream time base, INT64_MIN when the stream has none
+
+    void write(uint8_t* out) const;
+    /// false if the bytes don't start with kMagic
+    bool read(const uint8_t* in);
+};
+
+struct RenditionParameters{
+    std::string name;
+    std::string output;
+    EncoderParameters encoder;
+};
+
+// The image and frame files are written by an AsyncFileWriter, writer_backend is auto, uring, threads or
+// sync, see async_writer.hpp. Its throughput is printed at the end.
+//
+// max_memory (bytes, 0 for no limit) bounds what waits between the stages, decoded frames and images not
+// yet on disk, see memory_budget.hpp. Stages that get ahead block instead of buffering, the peak is printed
+// at the end.
+
+/// Decode a raw H.264/H.265 stream to one image per frame in output_dir_path. Decoding runs on its own
+/// thread, converting to the target format and writing overlap with it.
+bool decode_h26x_to_image(const std::string& source_file_path, const std::string& output_dir_path, const std::string& source_format, const std::string& target_format, const std::string& writer_backend = "auto", size_t max_memory = 0);
+
+/// Decode the video stream of an MP4 (or any container libavformat reads) to numbered images.
+bool decode_mp4_to_image(const std::string& source_file_path, const std::string& output_dir_path, const std::string& source_format, const std::string& target_format, const std::string& writer_backend = "auto", size_t max_memory = 0);
+
+/// Same on a file VideoReader::Open already probed: its demux context is taken over, the file is opened and
+/// probed once.
+bool decode_mp4_to_image(VideoReader& probed, const std::string& output_dir_path, const std::string& target_format, const std::string& writer_backend = "auto", size_t max_memory = 0);
+
+/// Decode a file or a directory of single frame files, every image keeps the name of its frame file.
+bool decode_frame_to_image(const std::string& source_file_path, const std::string& output_dir_path, const std::string& source_format, const std::string& target_format, const std::string& writer_backend = "auto", size_t max_memory = 0);
+
+/// Decode incrementally and write every frame as soon as it is decoded: a RawFrameHeader then the rgb24
+/// or yuv420p picture. source and output are paths or "-" for stdin/stdout. stdin with a source_format of
+/// h264/h265 is a raw Annex B stream fed to the decoder in 64 KiB reads, anything else is demuxed by
+/// libavformat. Returns the number of frames.
+size_t decode_to_stream(const std::string& source, const std::string& output, const std::string& source_format, const std::string& target_format);
+
+/// Decode with motion vector export and write every frame's vectors, macroblock QPs and block kinds to output
+/// ("-" for stdout) as format "bin" (the FrameMotion byte stream) or "json" (one object per line), see
+/// motion_vectors.hpp. source is read like decode_to_stream. No pictures are converted. Returns the number of
+/// frames.
+size_t export_motion_vectors(const std::string& source, const std::string& output, const std::string& source_format, const std::string& format);
+
+/// Decode like decode_to_stream into one FrameArchive file of jpeg, png, rgb or yuv420p frames with their
+/// frame numbers and timestamps, see frame_archive.hpp. Returns the number of frames.
+size_t decode_to_archive(const std::string& source, const std::string& archive_path, const std::string& source_format, const std::string& target_format);
+
+/// Decode like decode_to_stream into a ShmRingProducer named shm_name with `slots` slots sized by the first
+/// frame, see shm_ring.hpp. rgb and yuv420p frames are converted straight into the shared slots. The ring
+/// is removed when this returns, consumers keep their mapping. Returns the number of frames.
+size_t decode_to_shm(const std::string& source, const std::string& shm_name, const std::string& source_format, const std::string& target_format, uint32_t slots = 8);
+
+/// Profile, level, resolution, frame rate, frame types and GOP structure of the H.264/H.265 video of source
+/// ("-" for stdin) from its parameter sets and slice headers, nothing is decoded, see bitstream_parser.hpp.
+/// A raw Annex B file (or stdin with a source_format of h264/h265) is read in 1 MiB chunks, its codec taken
+/// from source_format or guessed from the NAL unit headers; a container is demuxed without probing.
+H26xStreamInfo inspect_stream(const std::string& source, const std::string& source_format = "");
+
+/// Activity timeline, scene changes and active segments of source from the compressed stream alone, read like
+/// inspect_stream, see activity_detector.hpp. Raw streams have no timestamps, their frames are placed by the
+/// frame rate of the SPS/VPS timing info (25 without).
+ActivityReport analyze_activity(const std::string& source, const std::string& source_format = "", const ActivityOptions& options = ActivityOptions());
+
+/// Decode only the segments of report to images named segment<n>_<frame>.<target_format> in output_dir_path,
+/// each from the key frame before it; the packets in between are demuxed and dropped, never decoded. source
+/// is the file analyze_activity read, stdin can't be read a second time. Returns the number of images.
+size_t decode_active_segments(const std::string& source, const ActivityReport& report, const std::string& output_dir_path, const std::string& target_format, const std::string& writer_backend = "auto", size_t max_memory = 0);
+
+// compressed images are decoded to RGB24 before encoding, anything else is a raw frame file
+bool is_image_format(const std::string& format);
+bool is_raw_frame_format(const std::string& format);
+
+std::unique_ptr<H26xEncoder> create_encoder(const std::string& target_format, const EncoderParameters& parameters);
+
+/// Read one encoder input: a jpg/png decoded to RGB24, or a raw frame file as it is.
+void load_image(const std::filesystem::path& image_path, const std::string& source_format, std::string& buffer);
+
+/// Encode every file of a directory in alphabetical order, to one file (single_file) or one file per frame.
+bool encode_image_to_frame(const std::string& source_file_path, const std::string& output_file_path, const std::string& source_format, const std::string& target_format, const EncoderParameters& parameters, bool single_file, int segments, bool print_stats, const std::string& writer_backend = "auto");
+
+/// source and output may be "-", packets are written as soon as the encoder hands them out.
+bool transcode_h26x(const std::string& source_file_path, const std::string& output_file_path, const std::string& target_format, const EncoderParameters& parameters, bool print_stats, size_t max_memory = 0);
+
+bool encode_ladder(const std::string& source_file_path, const std::string& output_dir_path, const std::string& target_format, const std::vector<RenditionParameters>& renditions, int gop_size, bool print_stats, size_t max_memory = 0);
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef __H26XCODEC_RENDITION_LADDER__
+#define __H26XCODEC_RENDITION_LADDER__
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "h26xencoder.hpp"
+#include "input_source.hpp"
+#include "memory_budget.hpp"
+
+/*
+  Adaptive bitrate ladder: decode a source once and encode it into several
+  renditions (e.g. 1080p/720p/480p/360p) in parallel.
+
+  Every rendition runs on its own thread with its own scaler and encoder.
+  Scaling is cascaded: a rendition is scaled from the smallest larger
+  rendition instead of the full size source, and the scaled frame is shared
+  by reference with the renditions below it. All encoders get the same
+  fixed, closed GOP so their key frames land on the same source frames.
+*/
+class RenditionLadder
+{
+public:
+    /// Called from the rendition's thread, never concurrently for the same rendition.
+    using PacketWriter = std::function<void(size_t rendition, std::vector<char> const& packet)>;
+
+    explicit RenditionLadder(int gop_size, size_t queue_size = 4);
+    ~RenditionLadder();
+
+    /// The encoder must be configured with its output size but not enabled. A fps of 0 takes the
+    /// source frame rate. Returns the rendition index passed to the PacketWriter.
+    size_t AddRendition(std::string const& name, std::unique_ptr<H26xEncoder> encoder);
+
+    /// Queued frames count against budget as well, blocking the decoder when it is used up. Not owned,
+    /// set it before AddRendition.
+    void SetMemoryBudget(MemoryBudget* budget)
+    {
+        budget_ = budget;
+    }
+
+    /// Returns the number of decoded source frames. A source that can't be opened, holds no H.26x stream or
+    /// fails to read throws, after the frames decoded up to then are encoded.
+    size_t Run(std::string const& source_path, PacketWriter const& on_packet);
+    size_t Run(InputSource const& source, PacketWriter const& on_packet);
+
+    std::string const& GetName(size_t rendition);
+
+    H26xEncoder& GetEncoder(size_t rendition);
+
+private:
+    struct Rendition;
+
+    void planCascade();
+
+    int                                     gop_size_;
+    size_t                                  queue_size_;
+    MemoryBudget*                           budget_;
+    std::vector<std::unique_ptr<Rendition>> renditions_;
+    std::vector<size_t>                     roots_;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#pragma once
+
+#ifndef __H26XCODEC_RUN_STATS__
+#define __H26XCODEC_RUN_STATS__
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "trace.hpp"
+
+/*
+  What a whole run cost, for --stats: frames, fps, bytes in and out, wall
+  and CPU time per stage, peak RSS and allocation counts, as a table or
+  as JSON for monitoring.
+
+  Stages are the categories of the H26X_TRACE_SCOPE scopes (demux, parse,
+  decode, convert, jpeg, encode, io, ...), their times exclusive of nested
+  scopes and summed over threads, so a stage can exceed the run's wall
+  time when it runs on several threads. Allocations are only counted when
+  the program routes operator new to RunStats::CountAllocation, as the
+  h26xcodec tool does; FFmpeg's own av_malloc isn't seen.
+*/
+
+struct RunStatsReport
+{
+    double   wall_seconds        = 0;
+    double   cpu_seconds         = 0;  ///< user plus system time of the process
+    uint64_t frames_decoded      = 0;
+    uint64_t frames_encoded      = 0;
+    uint64_t bytes_in            = 0;
+    uint64_t bytes_out           = 0;
+    uint64_t peak_rss_bytes      = 0;
+    bool     allocations_counted = false;
+    uint64_t allocations         = 0;
+    uint64_t allocated_bytes     = 0;
+
+    /// every scope, categories in the order they were first seen
+    std::vector<TraceStageStats> stages;
+
+    /// Frames through the busier side, decoded or encoded, per second.
+    double GetFps() const
+    {
+        uint64_t frames = frames_decoded > frames_encoded ? frames_decoded : frames_encoded;
+        return wall_seconds > 0 ? frames / wall_seconds : 0;
+    }
+
+    /// Summary lines and a table with one row per stage.
+    std::string Str() const;
+    std::string Json() const;
+};
+
+class RunStats
+{
+public:
+    RunStats();
+
+    /// Zeroes the counters and starts timing, stage totals are collected until Stop.
+    void Start();
+    RunStatsReport Stop();
+
+    static void CountAllocation(size_t size)
+    {
+        if (counting_.load(std::memory_order_relaxed))
+        {
+            allocations_.fetch_add(1, std::memory_order_relaxed);
+            allocated_bytes_.fetch_add(size, std::memory_order_relaxed);
+        }
+    }
+
+    /// Call once, before Start, from a program that replaced operator new.
+    static void EnableAllocationCounting()
+    {
+        hooked_ = true;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point start_;
+    double            cpu_start_;
+
+    static std::atomic<bool>     counting_;
+    static std::atomic<uint64_t> allocations_;
+    static std::atomic<uint64_t> allocated_bytes_;
+    static bool                  hooked_;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef __H26XCODEC_SEGMENT_ENCODER__
+#define __H26XCODEC_SEGMENT_ENCODER__
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "h26xencoder.hpp"
+
+/*
+  Encode a long image sequence with several H26xEncoder instances at once.
+
+  The sequence is split into segments made of whole GOPs, every segment is
+  encoded by its own encoder with closed GOPs and the same parameters, so
+  each segment starts with an IDR frame carrying identical parameter sets
+  and the Annex B outputs can simply be concatenated in frame order.
+*/
+class SegmentEncoder
+{
+public:
+    /// Creates a configured but not yet enabled encoder, called once per segment.
+    using EncoderFactory = std::function<std::unique_ptr<H26xEncoder>()>;
+    /// Fills buffer with the raw input image of frame index, called from worker threads.
+    using FrameLoader = std::function<void(size_t index, std::string& buffer)>;
+    /// Receives the encoded packets in output order, always called from the calling thread.
+    using PacketWriter = std::function<void(size_t index, std::vector<char> const& packet)>;
+
+    SegmentEncoder(EncoderFactory factory, int jobs, int gop_size);
+
+    /// Number of frames per segment, a multiple of the GOP size.
+    size_t SegmentSize(size_t frame_count) const;
+
+    void Encode(size_t frame_count, FrameLoader const& loader, PacketWriter const& writer);
+
+private:
+    void encodeSegment(size_t first, size_t last, FrameLoader const& loader, std::vector<std::vector<char>>& packets);
+
+    EncoderFactory factory_;
+    int            jobs_;
+    int            gop_size_;
+};
+
+#endif
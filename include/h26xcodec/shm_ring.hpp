@@ -0,0 +1,170 @@
+#pragma once
+
+#ifndef __H26XCODEC_SHM_RING__
+#define __H26XCODEC_SHM_RING__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+  Decoded frames handed to other processes through a POSIX shared memory
+  ring (shm_open), without files and without copies.
+
+  One producer, any number of consumers, no locks. The producer never
+  waits for anybody: it writes frame n into slot n % slot_count while the
+  slot's sequence word is odd (2n+1) and publishes it by storing 2n+2.
+  A consumer reads the sequence before and after using a slot, if it
+  changed the producer lapped it and the frame is counted as dropped.
+  Consumers sleep on a futex in the shared header, the producer wakes
+  them after every frame.
+
+  A producer that dies never closes its ring, and a new producer replaces
+  the ring under the same name without touching the old mapping. A
+  consumer has to call Next with a timeout to tell a dead producer from a
+  slow one, and open the ring again to follow a restarted producer.
+
+  This header and libh26xcodec_shm are all a consumer needs, no FFmpeg.
+*/
+
+enum class ShmFrameFormat : uint32_t
+{
+    RGB24   = 0,
+    YUV420P = 1,
+    JPEG    = 2,
+    PNG     = 3
+};
+
+struct ShmFrameInfo
+{
+    uint64_t       sequence = 0;          ///< frame number since the producer started
+    int64_t        pts      = INT64_MIN;  ///< stream time base, INT64_MIN when unknown
+    uint32_t       size     = 0;          ///< payload bytes
+    ShmFrameFormat format   = ShmFrameFormat::RGB24;
+    uint32_t       width    = 0;
+    uint32_t       height   = 0;
+};
+
+/// Shared memory layout, 64 byte header then slot_count slots of slot_stride bytes.
+struct ShmRingHeader
+{
+    static constexpr uint64_t kMagic   = 0x474e495258363248;  // "H26XRING"
+    static constexpr uint32_t kVersion = 1;
+
+    uint64_t              magic;
+    uint32_t              version;
+    uint32_t              slot_count;
+    uint64_t              slot_size;    ///< payload capacity of a slot
+    uint64_t              slot_stride;  ///< slot header plus payload, a multiple of 64
+    std::atomic<uint64_t> published;    ///< frames completed so far
+    std::atomic<uint32_t> closed;       ///< set once the producer is done
+    std::atomic<uint32_t> futex;        ///< bumped with every frame, consumers wait on it
+    uint8_t               reserved[16];
+};
+
+/// In front of every slot's payload, written by the producer while sequence is odd.
+struct ShmSlotHeader
+{
+    std::atomic<uint64_t> sequence;
+    int64_t               pts;
+    uint32_t              size;
+    uint32_t              format;
+    uint32_t              width;
+    uint32_t              height;
+    uint8_t               reserved[32];
+};
+
+static_assert(sizeof(ShmRingHeader) == 64, "shared layout");
+static_assert(sizeof(ShmSlotHeader) == 64, "shared layout");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs address free atomics");
+
+class ShmRingProducer
+{
+public:
+    /// Creates (or replaces) the shared memory object /name.
+    ShmRingProducer(std::string const& name, uint32_t slot_count, size_t slot_size);
+    /// Closes the ring and removes the name, consumers keep what they mapped.
+    ~ShmRingProducer();
+
+    ShmRingProducer(ShmRingProducer const&) = delete;
+    ShmRingProducer& operator=(ShmRingProducer const&) = delete;
+
+    /// The payload of the next slot, GetSlotSize() bytes to write the frame into. Readers skip the slot
+    /// from now on until Commit.
+    uint8_t* Begin();
+
+    /// Publish the slot returned by Begin, info.sequence is filled in.
+    void Commit(ShmFrameInfo info);
+
+    /// Tell the consumers that no frame follows.
+    void Close();
+
+    size_t GetSlotSize() const
+    {
+        return header_->slot_size;
+    }
+
+    uint64_t GetPublished() const
+    {
+        return next_;
+    }
+
+private:
+    ShmSlotHeader* slot(uint64_t sequence) const;
+
+    std::string    name_;
+    uint8_t*       map_;
+    size_t         map_size_;
+    ShmRingHeader* header_;
+    uint64_t       next_;
+    bool           writing_;
+};
+
+struct ShmFrame
+{
+    ShmFrameInfo   info;
+    uint8_t const* data = nullptr;  ///< inside the mapping, valid until the producer laps the slot
+};
+
+class ShmRingConsumer
+{
+public:
+    /// Maps /name read only, throws std::system_error if there is no such ring (yet).
+    explicit ShmRingConsumer(std::string const& name);
+    ~ShmRingConsumer();
+
+    ShmRingConsumer(ShmRingConsumer const&) = delete;
+    ShmRingConsumer& operator=(ShmRingConsumer const&) = delete;
+
+    /// Wait for the next frame, skipping the ones the producer already overwrote. Returns false once the
+    /// producer closed the ring and every frame was read, or after timeout_ms (-1 waits forever, also
+    /// for a producer that crashed).
+    bool Next(ShmFrame& frame, int timeout_ms = -1);
+
+    /// Whether frame.data still holds the frame: check after using it in place, false means it was
+    /// overwritten meanwhile and the result has to be thrown away.
+    bool Valid(ShmFrame const& frame) const;
+
+    /// Frames overwritten before this consumer got to them.
+    uint64_t GetDropped() const
+    {
+        return dropped_;
+    }
+
+    size_t GetSlotSize() const
+    {
+        return header_->slot_size;
+    }
+
+private:
+    ShmSlotHeader const* slot(uint64_t sequence) const;
+
+    uint8_t const*       map_;
+    size_t               map_size_;
+    ShmRingHeader const* header_;
+    uint64_t             next_;
+    uint64_t             dropped_;
+};
+
+#endif
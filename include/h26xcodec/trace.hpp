@@ -0,0 +1,234 @@
+#pragma once
+
+#ifndef __H26XCODEC_TRACE__
+#define __H26XCODEC_TRACE__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+  Timeline of the pipeline in Chrome's trace event format (open the file
+  in chrome://tracing or https://ui.perfetto.dev).
+
+  H26X_TRACE_SCOPE("decode", "send_packet") records the enclosing block as
+  a complete event. Every thread appends to its own chunked buffer with
+  no lock and no allocation except one chunk per 4096 events; the chunks
+  stay readable while other threads write. While tracing is off a scope
+  costs one relaxed atomic load. Category and name must be string literals,
+  only the pointers are stored. Building with H26XCODEC_DISABLE_TRACE
+  removes the scopes altogether.
+
+  The same scopes feed the per-stage totals of RunStats (--stats): with
+  StartStages every scope adds its wall and thread CPU time, minus the
+  scopes nested in it, to per-thread counters. H26X_TRACE_COUNT adds to
+  the run's frame and byte counters, it does nothing otherwise and stays
+  in builds without the scopes.
+*/
+
+struct TraceEvent
+{
+    char const* category;
+    char const* name;
+    int64_t     start_ns;
+    int64_t     duration_ns;
+};
+
+/// One kind of scope over a run. Exclusive: time in the scopes nested inside it is theirs.
+struct TraceStageStats
+{
+    std::string category;
+    std::string name;
+    uint64_t    calls   = 0;
+    int64_t     wall_ns = 0;  ///< summed over threads
+    int64_t     cpu_ns  = 0;
+};
+
+enum class TraceCounter
+{
+    FramesDecoded,
+    FramesEncoded,
+    BytesIn,
+    BytesOut,
+    Count
+};
+
+class TraceScope;
+
+class Tracer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint32_t kTimeline = 1;
+    static constexpr uint32_t kStages   = 2;
+
+    static Tracer& Instance();
+
+    /// kTimeline and/or kStages while something is recorded, 0 otherwise.
+    static uint32_t Mode()
+    {
+        return mode_.load(std::memory_order_relaxed);
+    }
+
+    /// Whether the timeline is recorded.
+    static bool Enabled()
+    {
+        return (Mode() & kTimeline) != 0;
+    }
+
+    static void Count(TraceCounter counter, uint64_t value)
+    {
+        if (Mode() & kStages)
+        {
+            counters_[int(counter)].fetch_add(value, std::memory_order_relaxed);
+        }
+    }
+
+    /// Drops what was recorded before and starts recording on every thread.
+    void Start();
+    void Stop();
+
+    /// Zeroes the stage totals and counters and starts adding to them.
+    void StartStages();
+    void StopStages();
+    /// Totals of every thread, in the order the scopes were first seen.
+    std::vector<TraceStageStats> GetStageStats();
+    uint64_t GetCounter(TraceCounter counter) const
+    {
+        return counters_[int(counter)].load(std::memory_order_relaxed);
+    }
+
+    /// Shown as the thread's name in the timeline, call from the thread itself.
+    void SetThreadName(std::string const& name);
+
+    void Record(char const* category, char const* name, Clock::time_point start, Clock::time_point end);
+
+    /// Write everything recorded so far as Chrome trace event JSON, returns the number of events.
+    size_t WriteChromeTrace(std::string const& path);
+
+private:
+    struct Chunk
+    {
+        static constexpr size_t kCapacity = 4096;
+
+        TraceEvent          events[kCapacity];
+        std::atomic<size_t> size{0};
+        std::atomic<Chunk*> next{nullptr};
+    };
+
+    /// Written by the owner thread only, read by GetStageStats.
+    struct StageSlot
+    {
+        char const*           category = nullptr;
+        char const*           name     = nullptr;
+        std::atomic<uint64_t> calls{0};
+        std::atomic<int64_t>  wall_ns{0};
+        std::atomic<int64_t>  cpu_ns{0};
+    };
+
+    static constexpr size_t kMaxStages = 64;
+
+    struct ThreadBuffer
+    {
+        int         tid;
+        std::string name;
+        Chunk*      head;
+        Chunk*      tail;
+        /// recording generation, a Start() makes the thread begin a fresh chunk list
+        uint64_t    generation;
+
+        StageSlot           stages[kMaxStages];
+        std::atomic<size_t> stage_count{0};
+    };
+
+    friend class TraceScope;
+
+    Tracer();
+    ~Tracer();
+
+    ThreadBuffer& threadBuffer();
+    static void freeChunks(Chunk* chunk);
+    void enter(TraceScope& scope);
+    void leave(TraceScope& scope, Clock::time_point end);
+    void addStage(ThreadBuffer& buffer, char const* category, char const* name, int64_t wall_ns, int64_t cpu_ns);
+
+    static std::atomic<uint32_t> mode_;
+    static std::atomic<uint64_t> counters_[int(TraceCounter::Count)];
+
+    std::mutex                                 mutex_;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+    std::atomic<uint64_t>                      generation_;
+    /// Start() time, event timestamps are relative to it
+    std::atomic<Clock::rep>                    epoch_;
+};
+
+class TraceScope
+{
+public:
+    TraceScope(char const* category, char const* name)
+      : category_{category}
+      , name_{name}
+      , mode_{Tracer::Mode()}
+    {
+        if (mode_)
+        {
+            if (mode_ & Tracer::kStages)
+            {
+                Tracer::Instance().enter(*this);
+            }
+            start_ = Tracer::Clock::now();
+        }
+    }
+
+    ~TraceScope()
+    {
+        if (mode_)
+        {
+            Tracer::Instance().leave(*this, Tracer::Clock::now());
+        }
+    }
+
+    TraceScope(TraceScope const&)            = delete;
+    TraceScope& operator=(TraceScope const&) = delete;
+
+private:
+    friend class Tracer;
+
+    char const*               category_;
+    char const*               name_;
+    uint32_t                  mode_;
+    Tracer::Clock::time_point start_;
+    // stage accounting only
+    TraceScope*               parent_;
+    int64_t                   cpu_start_ns_;
+    int64_t                   child_wall_ns_;
+    int64_t                   child_cpu_ns_;
+};
+
+#define H26X_TRACE_CONCAT_INNER(a, b) a##b
+#define H26X_TRACE_CONCAT(a, b) H26X_TRACE_CONCAT_INNER(a, b)
+
+#ifdef H26XCODEC_DISABLE_TRACE
+#define H26X_TRACE_SCOPE(category, name)
+#define H26X_TRACE_THREAD_NAME(name)
+#else
+#define H26X_TRACE_SCOPE(category, name) TraceScope H26X_TRACE_CONCAT(h26x_trace_scope_, __LINE__)(category, name)
+#define H26X_TRACE_THREAD_NAME(name)                   \
+    do                                                 \
+    {                                                  \
+        if (Tracer::Enabled())                         \
+        {                                              \
+            Tracer::Instance().SetThreadName(name);    \
+        }                                              \
+    } while (0)
+#endif
+
+// kept without the scopes, the --stats counters cost a relaxed load each
+#define H26X_TRACE_COUNT(counter, value) Tracer::Count(TraceCounter::counter, uint64_t(value))
+
+#endif
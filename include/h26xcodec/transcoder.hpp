@@ -0,0 +1,56 @@
+#pragma once
+
+#ifndef __H26XCODEC_TRANSCODER__
+#define __H26XCODEC_TRANSCODER__
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "h26xencoder.hpp"
+#include "input_source.hpp"
+#include "memory_budget.hpp"
+
+/*
+  Decode a H.264/H.265 stream (raw Annex B or any container libavformat
+  reads) and feed the decoded frames straight into an H26xEncoder, with no
+  image files in between.
+
+  Decoding runs on its own thread and hands reference counted frames over
+  a small bounded queue, so decode and encode overlap while memory stays
+  bounded. Frames keep the timestamps of the source stream; when the
+  encoder has the source size and pixel format (YUV420P) they reach it
+  without any conversion, otherwise they are scaled in one pass.
+*/
+class Transcoder
+{
+public:
+    using PacketWriter = std::function<void(std::vector<char> const& packet)>;
+
+    /// The encoder must be configured but not enabled. A width/height of 0 keeps the source size,
+    /// a fps of 0 takes the source frame rate.
+    explicit Transcoder(std::unique_ptr<H26xEncoder> encoder, size_t queue_size = 8);
+
+    /// Queued frames count against budget as well, blocking the decoder when it is used up. Not owned.
+    void SetMemoryBudget(MemoryBudget* budget)
+    {
+        budget_ = budget;
+    }
+
+    /// Returns the number of frames encoded. A source that can't be opened, holds no H.26x stream or fails
+    /// to read throws, after the frames decoded up to then are encoded.
+    size_t Run(std::string const& source_path, PacketWriter const& on_packet);
+    size_t Run(InputSource const& source, PacketWriter const& on_packet);
+
+    H26xEncoder& GetEncoder()
+    {
+        return *encoder_;
+    }
+
+private:
+    std::unique_ptr<H26xEncoder> encoder_;
+    size_t                       queue_size_;
+    MemoryBudget*                budget_;
+};
+
+#endif
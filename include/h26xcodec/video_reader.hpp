@@ -9,6 +9,7 @@ extern "C" {
 }
 
 #include <string>
+#include "input_source.hpp"
 
 enum class FrameFormat{
     UNKNOWN,
@@ -18,7 +19,8 @@ enum class FrameFormat{
 
 class VideoReader {
 public:
-    VideoReader(std::string source_file_path):source_file_path(source_file_path){};
+    VideoReader(std::string source_file_path):source(InputSource::FromPath(source_file_path)){};
+    VideoReader(InputSource source):source(std::move(source)){};
     ~VideoReader();
 
     void Open();
@@ -27,11 +29,15 @@ public:
 
     std::string get_file_format();
 
+    /// The context Open probed, to demux it without opening the file again (PacketReader). Close it with
+    /// InputSource::Close, or let the PacketReader do it.
+    AVFormatContext* Release();
+
 private:
-    std::string source_file_path;
+    InputSource source;
     std::string file_format;
-    FrameFormat frame_format;
-    AVFormatContext* fmt_ctx;
+    FrameFormat frame_format = FrameFormat::UNKNOWN;
+    AVFormatContext* fmt_ctx = nullptr;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,380 @@
+/*
+  Python module h26xcodec: the streaming decoder, the converter and the
+  encoder without going through the command line tool.
+
+  Decoded frames keep a reference to the decoder's buffer, their planes
+  are read only NumPy views of it. Converter.to_rgb converts straight
+  into a NumPy array (a new one or `out`), so pixels are never copied
+  after decoding. Decoding, converting and encoding release the GIL:
+  streams in different threads run in parallel, one object is used by
+  one thread at a time (calls on the same object are serialized).
+
+      import h26xcodec
+      decoder = h26xcodec.Decoder("h264")
+      converter = h26xcodec.Converter()
+      for chunk in chunks:
+          for frame in decoder.feed(chunk):
+              rgb = converter.to_rgb(frame)   # (height, width, 3) uint8
+*/
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include <h26xcodec/converter.hpp>
+#include <h26xcodec/extractor.hpp>
+#include <h26xcodec/frame_ptr.hpp>
+#include <h26xcodec/h26xdecoder.hpp>
+#include <h26xcodec/h26xencoder.hpp>
+#include <h26xcodec/h26xexceptions.hpp>
+#include <h26xcodec/input_source.hpp>
+#include <h26xcodec/pipeline.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace py = pybind11;
+
+namespace
+{
+/// A decoded frame, a new reference to the decoder's buffers and not a copy of them.
+struct Frame
+{
+    FramePtr frame;
+};
+
+struct Decoder
+{
+    explicit Decoder(std::string const& codec)
+      : decoder{codec}
+    {
+    }
+
+    H26xDecoder decoder;
+    std::mutex  mutex;
+};
+
+struct Converter
+{
+    ConverterRGB24 converter;
+    std::string    rgb;  ///< to_jpeg/to_png encode from here
+    std::mutex     mutex;
+};
+
+struct Encoder
+{
+    std::unique_ptr<H26xEncoder> encoder;
+    size_t                       input_size = 0;
+    std::mutex                   mutex;
+};
+
+using Frames = std::vector<FramePtr>;
+
+/// Collects the frames of a decoder call without the GIL, they become Python objects afterwards.
+H26xDecoder::FrameCallback collect(Frames& frames)
+{
+    return [&frames](AVFrame const& frame) {
+        AVFrame* reference = av_frame_clone(&frame);
+        if (!reference)
+        {
+            throw H26xDecodeFailure("cannot reference a decoded frame");
+        }
+        frames.emplace_back(reference);
+    };
+}
+
+py::list toPython(Frames& frames)
+{
+    py::list list;
+    for (auto& frame : frames)
+    {
+        list.append(Frame{std::move(frame)});
+    }
+    return list;
+}
+
+/// Bytes of a C contiguous buffer (bytes, bytearray, memoryview, NumPy array).
+py::buffer_info contiguousBuffer(py::buffer const& data)
+{
+    py::buffer_info info = data.request();
+    ssize_t         size = info.itemsize;
+    for (size_t i = info.ndim; i-- > 0;)
+    {
+        if (info.shape[i] > 1 && info.strides[i] != size)
+        {
+            throw py::value_error("the buffer must be C contiguous");
+        }
+        size *= info.shape[i];
+    }
+    return info;
+}
+
+size_t byteSize(py::buffer_info const& info)
+{
+    return size_t(info.size) * size_t(info.itemsize);
+}
+
+py::list planes(py::object const& self)
+{
+    AVFrame const*            frame  = self.cast<Frame const&>().frame.get();
+    AVPixelFormat             format = AVPixelFormat(frame->format);
+    AVPixFmtDescriptor const* desc   = av_pix_fmt_desc_get(format);
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+    {
+        throw py::value_error("the frame is not in system memory");
+    }
+
+    py::list list;
+    for (int i = 0; i < av_pix_fmt_count_planes(format); i++)
+    {
+        ssize_t rows = frame->height;
+        if (i == 1 || i == 2)
+        {
+            rows = -((-rows) >> desc->log2_chroma_h);
+        }
+        ssize_t row_bytes = av_image_get_linesize(format, frame->width, i);
+        // the views keep the Frame alive, and the Frame the buffer
+        py::array plane(py::dtype::of<uint8_t>(), {rows, row_bytes}, {ssize_t(frame->linesize[i]), ssize_t(1)},
+                        frame->data[i], self);
+        // the decoder may still predict from it
+        plane.attr("setflags")(py::arg("write") = false);
+        list.append(plane);
+    }
+    return list;
+}
+
+py::array_t<uint8_t> toRgb(Converter& self, Frame const& frame, py::object const& out)
+{
+    using Array = py::array_t<uint8_t, py::array::c_style>;
+    ssize_t w   = frame.frame->width;
+    ssize_t h   = frame.frame->height;
+    Array   array;
+    if (out.is_none())
+    {
+        array = Array({h, w, ssize_t(3)});
+    }
+    else
+    {
+        if (!py::isinstance<Array>(out))
+        {
+            throw py::type_error("out must be a C contiguous uint8 array");
+        }
+        array = py::reinterpret_borrow<Array>(out);
+        if (array.ndim() != 3 || array.shape(0) != h || array.shape(1) != w || array.shape(2) != 3 ||
+            !array.writeable())
+        {
+            throw py::value_error("out must be a writeable (height, width, 3) array");
+        }
+    }
+
+    uint8_t* data = array.mutable_data();
+    {
+        py::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(self.mutex);
+        self.converter.convert(*frame.frame, data);
+    }
+    return array;
+}
+
+py::bytes toImage(Converter& self, Frame const& frame, bool png)
+{
+    std::unique_ptr<std::string> image;
+    {
+        py::gil_scoped_release release;
+        std::lock_guard<std::mutex> lock(self.mutex);
+        self.rgb.resize(size_t(self.converter.predict_size(frame.frame->width, frame.frame->height)));
+        self.converter.convert(*frame.frame, reinterpret_cast<unsigned char*>(&self.rgb[0]));
+        image = png ? self.converter.to_png() : self.converter.to_jpeg();
+    }
+    if (!image)
+    {
+        throw H26xDecodeFailure(png ? "cannot encode png" : "cannot encode jpeg");
+    }
+    return py::bytes(*image);
+}
+
+py::bytes packets(std::vector<char> const& output)
+{
+    return py::bytes(output.data(), output.size());
+}
+
+std::unique_ptr<Encoder> createEncoder(std::string const& codec, uint32_t width, uint32_t height,
+                                       std::string const& pixel_format, uint32_t fps, int32_t gop_size,
+                                       uint32_t max_b_frames, uint32_t refs, uint32_t threads,
+                                       std::string const& rate_control, int64_t bitrate, int64_t maxrate,
+                                       int32_t bufsize, std::map<std::string, std::string> const& options)
+{
+    EncoderParameters parameters;
+    parameters.width              = width;
+    parameters.height             = height;
+    parameters.input_pixel_format = pixel_format;
+    parameters.fps                = fps;
+    parameters.gop_size           = gop_size;
+    parameters.max_b_frames       = max_b_frames;
+    parameters.refs               = refs;
+    parameters.thread_num         = threads;
+    parameters.rate_control       = rate_control;
+    parameters.bitrate            = bitrate;
+    parameters.maxrate            = maxrate;
+    parameters.bufsize            = bufsize;
+    for (auto const& option : options)
+    {
+        parameters.options[option.first] = option.second;
+    }
+
+    auto encoder     = std::make_unique<Encoder>();
+    encoder->encoder = create_encoder(codec, parameters);
+    encoder->encoder->Enable();
+    encoder->input_size =
+        size_t(av_image_get_buffer_size(encoder->encoder->GetInputPixelFormat(), int(width), int(height), 1));
+    return encoder;
+}
+}  // namespace
+
+PYBIND11_MODULE(h26xcodec, m)
+{
+    m.doc() = "H.264/H.265 decoding, encoding and RGB/JPEG/PNG conversion on top of FFmpeg";
+
+    // translators run newest first, the subclasses go after their base
+    auto& error = py::register_exception<H26xException>(m, "H26xError", PyExc_RuntimeError);
+    py::register_exception<H26xInitFailure>(m, "InitError", error.ptr());
+    py::register_exception<H26xDecodeFailure>(m, "DecodeError", error.ptr());
+
+    py::class_<Frame>(m, "Frame", "A decoded picture, its planes are read only views of the decoder's buffer")
+        .def_property_readonly("width", [](Frame const& f) { return f.frame->width; })
+        .def_property_readonly("height", [](Frame const& f) { return f.frame->height; })
+        .def_property_readonly("pts", [](Frame const& f) -> py::object {
+            return f.frame->pts == AV_NOPTS_VALUE ? py::object(py::none()) : py::int_(f.frame->pts);
+        })
+        .def_property_readonly("key_frame", [](Frame const& f) { return (f.frame->flags & AV_FRAME_FLAG_KEY) != 0; })
+        .def_property_readonly("pixel_format", [](Frame const& f) {
+            char const* name = av_get_pix_fmt_name(AVPixelFormat(f.frame->format));
+            return std::string(name ? name : "none");
+        })
+        .def_property_readonly("planes", &planes,
+                               "One (rows, bytes per row) uint8 array per plane, no copy: Y, U, V for yuv420p")
+        .def("__repr__", [](Frame const& f) {
+            char const* name = av_get_pix_fmt_name(AVPixelFormat(f.frame->format));
+            return "<h26xcodec.Frame " + std::to_string(f.frame->width) + "x" + std::to_string(f.frame->height) +
+                   " " + (name ? name : "none") + ">";
+        });
+
+    py::class_<Decoder>(m, "Decoder", "Streaming Annex B decoder, feed it chunks of any size")
+        .def(py::init<std::string const&>(), py::arg("codec") = "h264")
+        .def(
+            "feed",
+            [](Decoder& self, py::buffer const& data) {
+                py::buffer_info info = contiguousBuffer(data);
+                Frames          frames;
+                {
+                    py::gil_scoped_release      release;
+                    std::lock_guard<std::mutex> lock(self.mutex);
+                    self.decoder.feed(static_cast<unsigned char const*>(info.ptr), ptrdiff_t(byteSize(info)),
+                                      collect(frames));
+                }
+                return toPython(frames);
+            },
+            py::arg("data"), "Decode the frames this chunk completes")
+        .def(
+            "flush",
+            [](Decoder& self) {
+                Frames frames;
+                {
+                    py::gil_scoped_release      release;
+                    std::lock_guard<std::mutex> lock(self.mutex);
+                    self.decoder.flush(collect(frames));
+                }
+                return toPython(frames);
+            },
+            "End of the stream: the frames still held back, the decoder is ready for a new stream afterwards");
+
+    m.def(
+        "decode",
+        [](py::object const& source) {
+            Frames frames;
+            auto   run = [&frames](InputSource input) {
+                py::gil_scoped_release release;
+                Extractor              extractor(std::move(input));
+                extractor.extract_decoded(collect(frames));
+            };
+            if (py::isinstance<py::str>(source))
+            {
+                run(InputSource::FromPath(source.cast<std::string>()));
+            }
+            else
+            {
+                py::buffer_info info = contiguousBuffer(source.cast<py::buffer>());
+                run(InputSource::FromMemory(static_cast<uint8_t const*>(info.ptr), byteSize(info)));
+            }
+            return toPython(frames);
+        },
+        py::arg("source"), "Every frame of a video, source is a path or the bytes of a container or raw stream");
+
+    py::class_<Converter>(m, "Converter", "Frames to RGB24, JPEG or PNG")
+        .def(py::init<>())
+        .def("to_rgb", &toRgb, py::arg("frame"), py::arg("out") = py::none(),
+             "A (height, width, 3) uint8 array converted in place, out is reused if given")
+        .def(
+            "to_jpeg", [](Converter& self, Frame const& frame) { return toImage(self, frame, false); },
+            py::arg("frame"))
+        .def(
+            "to_png", [](Converter& self, Frame const& frame) { return toImage(self, frame, true); },
+            py::arg("frame"));
+
+    py::class_<Encoder>(m, "Encoder", "Raw pictures or decoded frames to Annex B")
+        .def(py::init(&createEncoder), py::arg("codec"), py::arg("width"), py::arg("height"),
+             py::arg("pixel_format") = "rgb24", py::arg("fps") = 25, py::arg("gop_size") = 0,
+             py::arg("max_b_frames") = 0, py::arg("refs") = 1, py::arg("threads") = 4,
+             py::arg("rate_control") = "options", py::arg("bitrate") = 0, py::arg("maxrate") = 0,
+             py::arg("bufsize") = 0, py::arg("options") = std::map<std::string, std::string>{})
+        .def(
+            "encode",
+            [](Encoder& self, py::buffer const& picture) {
+                py::buffer_info info = contiguousBuffer(picture);
+                if (byteSize(info) < self.input_size)
+                {
+                    throw py::value_error("the picture needs " + std::to_string(self.input_size) + " bytes");
+                }
+                std::vector<char> output;
+                {
+                    py::gil_scoped_release      release;
+                    std::lock_guard<std::mutex> lock(self.mutex);
+                    self.encoder->Encode(static_cast<uint8_t const*>(info.ptr), output);
+                }
+                return packets(output);
+            },
+            py::arg("picture"), "Encode a tightly packed picture in pixel_format, returns the packets ready so far")
+        .def(
+            "encode_frame",
+            [](Encoder& self, Frame const& frame) {
+                std::vector<char> output;
+                {
+                    py::gil_scoped_release      release;
+                    std::lock_guard<std::mutex> lock(self.mutex);
+                    self.encoder->EncodeFrame(*frame.frame, output);
+                }
+                return packets(output);
+            },
+            py::arg("frame"), "Encode a decoded frame, scaled if its size or pixel format differ")
+        .def("flush",
+             [](Encoder& self) {
+                 std::vector<char> output;
+                 {
+                     py::gil_scoped_release      release;
+                     std::lock_guard<std::mutex> lock(self.mutex);
+                     self.encoder->Flush(output);
+                 }
+                 return packets(output);
+             })
+        .def("request_key_frame", [](Encoder& self) {
+            std::lock_guard<std::mutex> lock(self.mutex);
+            self.encoder->RequestKeyFrame();
+        });
+}
@@ -0,0 +1,262 @@
+#include <h26xcodec/activity_detector.hpp>
+
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <utility>
+
+namespace
+{
+/// Baselines need a few pictures of their type before they mean anything.
+constexpr size_t kMinHistory = 8;
+}  // namespace
+
+double ActivityReport::GetActiveSeconds() const
+{
+    double seconds = 0;
+    for (ActivitySegment const& segment : segments)
+    {
+        seconds += segment.end - segment.start;
+    }
+    return seconds;
+}
+
+std::string ActivityReport::Str() const
+{
+    char line[160];
+    std::snprintf(line, sizeof(line), "activity: %zu frames, %.1f s, %zu scene changes, %zu segments, %.1f s active\n",
+                  frames.size(), duration, scene_changes.size(), segments.size(), GetActiveSeconds());
+    std::string text = line;
+    for (ActivitySegment const& segment : segments)
+    {
+        std::snprintf(line, sizeof(line), "  %10.3f - %10.3f s  frames %llu-%llu  peak %.1f\n", segment.start, segment.end,
+                      (unsigned long long)segment.first_frame, (unsigned long long)segment.last_frame, segment.peak);
+        text += line;
+    }
+    return text;
+}
+
+std::string ActivityReport::Json(bool with_frames) const
+{
+    nlohmann::json json;
+    json["fps"]            = fps;
+    json["duration"]       = duration;
+    json["frames"]         = frames.size();
+    json["active_seconds"] = GetActiveSeconds();
+
+    nlohmann::json scenes = nlohmann::json::array();
+    for (uint64_t index : scene_changes)
+    {
+        FrameActivity const& frame = frames[index];
+        scenes.push_back({{"frame", frame.index}, {"time", frame.time}, {"reason", frame.scene_change}});
+    }
+    json["scene_changes"] = scenes;
+
+    nlohmann::json segment_list = nlohmann::json::array();
+    for (ActivitySegment const& segment : segments)
+    {
+        segment_list.push_back({{"first_frame", segment.first_frame},
+                                {"last_frame", segment.last_frame},
+                                {"start", segment.start},
+                                {"end", segment.end},
+                                {"peak", segment.peak}});
+    }
+    json["segments"] = segment_list;
+
+    if (with_frames)
+    {
+        nlohmann::json timeline = nlohmann::json::array();
+        for (FrameActivity const& frame : frames)
+        {
+            timeline.push_back({{"frame", frame.index},
+                                {"time", frame.time},
+                                {"type", std::string(1, frame.type)},
+                                {"key", frame.key},
+                                {"bytes", frame.bytes},
+                                {"qp", frame.qp},
+                                {"activity", frame.activity}});
+        }
+        json["timeline"] = timeline;
+    }
+    return json.dump(2);
+}
+
+ActivityDetector::ActivityDetector(ActivityOptions const& options)
+  : options_{options}
+  , last_activity_{1}
+{
+    options_.window = std::max(options_.window, kMinHistory);
+}
+
+bool ActivityDetector::early(IntraCadence& cadence, uint64_t index)
+{
+    bool found_early = false;
+    if (cadence.seen)
+    {
+        uint64_t interval = index - cadence.last;
+        // the regular interval is the most common one so far, a picture before it was forced
+        auto regular = std::max_element(cadence.intervals.begin(), cadence.intervals.end(),
+                                        [](auto const& a, auto const& b) { return a.second < b.second; });
+        found_early = regular != cadence.intervals.end() && regular->second >= 2 && interval < regular->first;
+        cadence.intervals[interval]++;
+    }
+    cadence.seen = true;
+    cadence.last = index;
+    return found_early;
+}
+
+double ActivityDetector::normalizedSize(H26xPictureInfo const& picture) const
+{
+    // about twice the bits every 6 QP steps down
+    return picture.qp >= 0 ? picture.bytes * std::exp2((picture.qp - 26) / 6) : double(picture.bytes);
+}
+
+double ActivityDetector::baseline(char type) const
+{
+    auto found = history_.find(type);
+    if (found == history_.end() || found->second.size() < kMinHistory)
+    {
+        return 0;
+    }
+    std::vector<double> sizes(found->second.begin(), found->second.end());
+    auto                quartile = sizes.begin() + std::ptrdiff_t(sizes.size() / 4);
+    std::nth_element(sizes.begin(), quartile, sizes.end());
+    return *quartile;
+}
+
+void ActivityDetector::Add(H26xPictureInfo const& picture, double time)
+{
+    FrameActivity frame;
+    frame.index = frames_.size();
+    frame.time  = time;
+    frame.type  = picture.type;
+    frame.key   = picture.key;
+    frame.bytes = picture.bytes;
+    frame.qp    = picture.qp;
+
+    double size = normalizedSize(picture);
+    if (picture.key || picture.type == 'I')
+    {
+        // key frames and open GOP I pictures each have their own cadence, only an early one is a cut
+        if (early(picture.key ? key_cadence_ : intra_cadence_, frame.index))
+        {
+            frame.scene_change = picture.key ? "forced_key" : "intra";
+        }
+        frame.activity = last_activity_;
+    }
+    else
+    {
+        double usual   = baseline(picture.type);
+        frame.activity = usual > 0 ? size / usual : 1;
+        if (usual > 0 && frame.activity >= options_.scene_threshold)
+        {
+            frame.scene_change = "size";
+        }
+        last_activity_ = frame.activity;
+    }
+
+    if (picture.qp >= 0)
+    {
+        auto last = last_qp_.find(picture.type);
+        if (frame.scene_change.empty() && options_.qp_jump > 0 && last != last_qp_.end() &&
+            std::abs(picture.qp - last->second) >= options_.qp_jump)
+        {
+            frame.scene_change = "qp";
+        }
+        last_qp_[picture.type] = picture.qp;
+    }
+
+    std::deque<double>& history = history_[picture.type];
+    history.push_back(size);
+    if (history.size() > options_.window)
+    {
+        history.pop_front();
+    }
+    frames_.push_back(std::move(frame));
+}
+
+ActivityReport ActivityDetector::Finish(double fps)
+{
+    ActivityReport report;
+    report.fps = fps > 0 ? fps : 25;
+    for (FrameActivity& frame : frames_)
+    {
+        if (std::isnan(frame.time))
+        {
+            frame.time = frame.index / report.fps;
+        }
+        if (!frame.scene_change.empty())
+        {
+            report.scene_changes.push_back(frame.index);
+        }
+    }
+    if (!frames_.empty())
+    {
+        auto [first, last] = std::minmax_element(frames_.begin(), frames_.end(),
+                                                 [](auto const& a, auto const& b) { return a.time < b.time; });
+        report.duration    = last->time - first->time + 1 / report.fps;
+    }
+
+    // active pictures no more than max_gap apart make one segment
+    auto     to_frames = [&](double seconds) { return uint64_t(std::llround(std::max(seconds, 0.0) * report.fps)); };
+    uint64_t max_gap   = to_frames(options_.max_gap_seconds);
+    uint64_t padding   = to_frames(options_.padding_seconds);
+    std::vector<ActivitySegment> segments;
+    for (FrameActivity const& frame : frames_)
+    {
+        if (frame.activity < options_.activity_threshold && frame.scene_change.empty())
+        {
+            continue;
+        }
+        if (!segments.empty() && frame.index - segments.back().last_frame <= max_gap + 1)
+        {
+            segments.back().last_frame = frame.index;
+            segments.back().peak       = std::max(segments.back().peak, frame.activity);
+            continue;
+        }
+        ActivitySegment segment;
+        segment.first_frame = frame.index;
+        segment.last_frame  = frame.index;
+        segment.peak        = frame.activity;
+        segments.push_back(segment);
+    }
+
+    for (ActivitySegment segment : segments)
+    {
+        segment.first_frame = segment.first_frame > padding ? segment.first_frame - padding : 0;
+        segment.last_frame  = std::min<uint64_t>(segment.last_frame + padding, frames_.size() - 1);
+        if (!report.segments.empty() && segment.first_frame <= report.segments.back().last_frame + 1)
+        {
+            ActivitySegment& previous = report.segments.back();
+            previous.last_frame       = segment.last_frame;
+            previous.peak             = std::max(previous.peak, segment.peak);
+        }
+        else
+        {
+            report.segments.push_back(segment);
+        }
+    }
+
+    std::vector<ActivitySegment> kept;
+    for (ActivitySegment segment : report.segments)
+    {
+        // B pictures make decode order times go back and forth
+        segment.start = frames_[segment.first_frame].time;
+        segment.end   = frames_[segment.first_frame].time;
+        for (uint64_t i = segment.first_frame; i <= segment.last_frame; i++)
+        {
+            segment.start = std::min(segment.start, frames_[i].time);
+            segment.end   = std::max(segment.end, frames_[i].time);
+        }
+        segment.end += 1 / report.fps;
+        if (segment.end - segment.start >= options_.min_segment_seconds)
+        {
+            kept.push_back(segment);
+        }
+    }
+    report.segments = std::move(kept);
+    report.frames   = std::move(frames_);
+    frames_.clear();
+    return report;
+}
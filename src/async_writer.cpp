@@ -0,0 +1,541 @@
+#include <h26xcodec/async_writer.hpp>
+#include <h26xcodec/h26xexceptions.hpp>
+#include <h26xcodec/trace.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef H26XCODEC_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+/// Files per io_uring batch, every phase of a batch fits in the submission queue.
+constexpr unsigned kRingBatch = 64;
+
+[[noreturn]] void throwFileError(char const* what, std::string const& path, int error)
+{
+    throw fs::filesystem_error(what, path, std::error_code(error, std::generic_category()));
+}
+}  // namespace
+
+#ifdef H26XCODEC_HAVE_LIBURING
+struct AsyncFileWriter::Ring
+{
+    io_uring ring;
+    bool     ready = false;
+
+    /// false if the kernel refuses io_uring (old kernel, seccomp) or lacks open/write/close
+    bool Init()
+    {
+        if (io_uring_queue_init(kRingBatch, &ring, 0) < 0)
+        {
+            return false;
+        }
+        io_uring_probe* probe     = io_uring_get_probe_ring(&ring);
+        bool            supported = probe && io_uring_opcode_supported(probe, IORING_OP_OPENAT) &&
+                         io_uring_opcode_supported(probe, IORING_OP_WRITE) &&
+                         io_uring_opcode_supported(probe, IORING_OP_CLOSE);
+        if (probe)
+        {
+            io_uring_free_probe(probe);
+        }
+        if (!supported)
+        {
+            io_uring_queue_exit(&ring);
+        }
+        ready = supported;
+        return supported;
+    }
+
+    ~Ring()
+    {
+        if (ready)
+        {
+            io_uring_queue_exit(&ring);
+        }
+    }
+
+    /// Submit count prepared requests and hand every completion to on_complete(job index, result).
+    template <typename Callback>
+    void submitAndReap(unsigned count, Callback const& on_complete)
+    {
+        int ret = io_uring_submit_and_wait(&ring, count);
+        if (ret < 0)
+        {
+            throwFileError("io_uring_submit", "", -ret);
+        }
+        for (unsigned i = 0; i < count;)
+        {
+            io_uring_cqe* cqe;
+            ret = io_uring_wait_cqe(&ring, &cqe);
+            if (ret == -EINTR)
+            {
+                continue;
+            }
+            if (ret < 0)
+            {
+                throwFileError("io_uring_wait_cqe", "", -ret);
+            }
+            on_complete(size_t(io_uring_cqe_get_data64(cqe)), cqe->res);
+            io_uring_cqe_seen(&ring, cqe);
+            i++;
+        }
+    }
+
+    /// Three round trips for the whole batch: open all files, write all of them, close all of them.
+    template <typename Job>
+    void WriteBatch(std::vector<Job> const& jobs)
+    {
+        size_t              n = jobs.size();
+        std::vector<int>    fds(n, -1);
+        std::vector<size_t> done(n, 0);
+        std::vector<int>    errors(n, 0);
+
+        /// Closes the opened files if a round throws, the close round takes them over otherwise.
+        struct OpenFiles
+        {
+            std::vector<int>& fds;
+            bool              owned;
+
+            ~OpenFiles()
+            {
+                for (int fd : fds)
+                {
+                    if (owned && fd >= 0)
+                    {
+                        close(fd);
+                    }
+                }
+            }
+        } open_files{fds, true};
+
+        for (size_t i = 0; i < n; i++)
+        {
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_openat(sqe, AT_FDCWD, jobs[i].path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            io_uring_sqe_set_data64(sqe, i);
+        }
+        submitAndReap(unsigned(n), [&](size_t i, int res) {
+            if (res < 0)
+            {
+                errors[i] = -res;
+            }
+            else
+            {
+                fds[i] = res;
+            }
+        });
+
+        // short writes are continued in the next round
+        while (true)
+        {
+            unsigned count = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                if (fds[i] >= 0 && !errors[i] && done[i] < jobs[i].data.size())
+                {
+                    io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+                    io_uring_prep_write(sqe, fds[i], jobs[i].data.data() + done[i],
+                                        unsigned(jobs[i].data.size() - done[i]), done[i]);
+                    io_uring_sqe_set_data64(sqe, i);
+                    count++;
+                }
+            }
+            if (count == 0)
+            {
+                break;
+            }
+            submitAndReap(count, [&](size_t i, int res) {
+                if (res == -EINTR || res == -EAGAIN)
+                {
+                    return;
+                }
+                if (res <= 0)
+                {
+                    errors[i] = res < 0 ? -res : EIO;
+                }
+                else
+                {
+                    done[i] += size_t(res);
+                }
+            });
+        }
+
+        open_files.owned = false;
+        unsigned count   = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (fds[i] >= 0)
+            {
+                io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+                io_uring_prep_close(sqe, fds[i]);
+                io_uring_sqe_set_data64(sqe, i);
+                count++;
+            }
+        }
+        submitAndReap(count, [&](size_t i, int res) {
+            if (res < 0 && !errors[i])
+            {
+                errors[i] = -res;
+            }
+        });
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (errors[i])
+            {
+                throwFileError("cannot write", jobs[i].path, errors[i]);
+            }
+        }
+    }
+};
+#else
+struct AsyncFileWriter::Ring
+{
+    bool Init()
+    {
+        return false;
+    }
+
+    template <typename Job>
+    void WriteBatch(std::vector<Job> const&)
+    {
+    }
+};
+#endif
+
+std::string AsyncWriterStats::Str() const
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << "write: " << backend << ", " << files << " files, "
+        << bytes / (1024.0 * 1024.0) << " MiB in " << std::setprecision(3) << write_seconds << " s ("
+        << std::setprecision(1) << GetMiBPerSecond() << " MiB/s), " << batches << " batches, peak "
+        << peak_bytes / (1024.0 * 1024.0) << " MiB in flight, producers blocked " << blocked_seconds * 1000
+        << " ms" << std::endl;
+    return out.str();
+}
+
+AsyncFileWriter::Backend AsyncFileWriter::ParseBackend(std::string const& name)
+{
+    if (name == "auto")
+    {
+        return Backend::Auto;
+    }
+    if (name == "uring" || name == "io_uring")
+    {
+        return Backend::IoUring;
+    }
+    if (name == "threads")
+    {
+        return Backend::Threads;
+    }
+    if (name == "sync")
+    {
+        return Backend::Sync;
+    }
+    std::string msg = "unknown writer " + name + ", expected auto, uring, threads or sync";
+    throw H26xInitFailure(msg.c_str());
+}
+
+AsyncFileWriter::AsyncFileWriter(Backend backend, size_t max_bytes_in_flight, int threads, MemoryBudget* budget)
+  : backend_{backend}
+  , max_bytes_in_flight_{max_bytes_in_flight > 0 ? max_bytes_in_flight : 1}
+  , budget_{budget}
+  , bytes_in_flight_{0}
+  , jobs_in_flight_{0}
+  , stopping_{false}
+  , started_{false}
+{
+    if (backend_ == Backend::Auto || backend_ == Backend::IoUring)
+    {
+        ring_ = std::make_unique<Ring>();
+        if (ring_->Init())
+        {
+            backend_ = Backend::IoUring;
+            workers_.emplace_back(&AsyncFileWriter::ringLoop, this);
+        }
+        else
+        {
+            ring_.reset();
+            backend_ = Backend::Threads;
+        }
+    }
+    if (backend_ == Backend::Threads)
+    {
+        for (int i = 0; i < std::max(1, threads); i++)
+        {
+            workers_.emplace_back(&AsyncFileWriter::threadLoop, this);
+        }
+    }
+    stats_.backend = GetBackendName();
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    stop();
+}
+
+std::string AsyncFileWriter::GetBackendName() const
+{
+    switch (backend_)
+    {
+        case Backend::IoUring:
+            return "io_uring";
+        case Backend::Sync:
+            return "sync";
+        default:
+            return "threads";
+    }
+}
+
+void AsyncFileWriter::Write(std::string path, std::vector<char> const& data)
+{
+    Write(std::move(path), std::string(data.begin(), data.end()));
+}
+
+void AsyncFileWriter::Write(std::string path, std::string data)
+{
+    size_t size = data.size();
+    // before our own lock, completed() gives the bytes back under it
+    if (budget_)
+    {
+        budget_->Acquire(budget_account_, size);
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto fail = [&]() {
+        if (budget_)
+        {
+            budget_->Release(budget_account_, size);
+        }
+        std::rethrow_exception(error_);
+    };
+    if (error_)
+    {
+        fail();
+    }
+    if (!started_)
+    {
+        started_     = true;
+        first_write_ = Clock::now();
+    }
+
+    if (backend_ == Backend::Sync)
+    {
+        lock.unlock();
+        std::vector<Job> jobs{Job{std::move(path), std::move(data)}};
+        std::exception_ptr error;
+        try
+        {
+            writeJob(jobs[0]);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        lock.lock();
+        jobs_in_flight_++;
+        bytes_in_flight_ += size;
+        stats_.peak_bytes = std::max<uint64_t>(stats_.peak_bytes, bytes_in_flight_);
+        lock.unlock();
+        completed(jobs, error);
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        return;
+    }
+
+    // a single file larger than the budget still goes through, alone
+    auto has_space = [&]() { return error_ || bytes_in_flight_ == 0 || bytes_in_flight_ + size <= max_bytes_in_flight_; };
+    if (!has_space())
+    {
+        H26X_TRACE_SCOPE("io", "writer_blocked");
+        auto start = Clock::now();
+        space_available_.wait(lock, has_space);
+        stats_.blocked_seconds += std::chrono::duration<double>(Clock::now() - start).count();
+        if (error_)
+        {
+            fail();
+        }
+    }
+
+    bytes_in_flight_ += size;
+    jobs_in_flight_++;
+    stats_.peak_bytes = std::max<uint64_t>(stats_.peak_bytes, bytes_in_flight_);
+    queue_.push_back(Job{std::move(path), std::move(data)});
+    lock.unlock();
+    work_available_.notify_one();
+}
+
+bool AsyncFileWriter::takeJobs(std::vector<Job>& jobs, size_t max)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_available_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+    while (!queue_.empty() && jobs.size() < max)
+    {
+        jobs.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+    }
+    return !jobs.empty();
+}
+
+void AsyncFileWriter::completed(std::vector<Job> const& jobs, std::exception_ptr error)
+{
+    bool idle;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto const& job : jobs)
+        {
+            bytes_in_flight_ -= job.data.size();
+            jobs_in_flight_--;
+            if (budget_)
+            {
+                budget_->Release(budget_account_, job.data.size());
+            }
+        }
+        if (error)
+        {
+            if (!error_)
+            {
+                error_ = error;
+            }
+        }
+        else
+        {
+            stats_.files += jobs.size();
+            for (auto const& job : jobs)
+            {
+                stats_.bytes += job.data.size();
+                H26X_TRACE_COUNT(BytesOut, job.data.size());
+            }
+        }
+        stats_.batches++;
+        last_done_ = Clock::now();
+        idle       = jobs_in_flight_ == 0;
+    }
+    space_available_.notify_all();
+    if (idle)
+    {
+        idle_.notify_all();
+    }
+}
+
+void AsyncFileWriter::writeJob(Job const& job)
+{
+    H26X_TRACE_SCOPE("io", "write_file");
+    int fd = open(job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throwFileError("cannot create", job.path, errno);
+    }
+    char const* p    = job.data.data();
+    size_t      left = job.data.size();
+    while (left > 0)
+    {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            int error = errno;
+            close(fd);
+            throwFileError("cannot write", job.path, error);
+        }
+        p += n;
+        left -= size_t(n);
+    }
+    if (close(fd) < 0)
+    {
+        throwFileError("cannot close", job.path, errno);
+    }
+}
+
+void AsyncFileWriter::threadLoop()
+{
+    H26X_TRACE_THREAD_NAME("writer");
+    std::vector<Job> jobs;
+    while (takeJobs(jobs, 1))
+    {
+        std::exception_ptr error;
+        try
+        {
+            writeJob(jobs[0]);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        completed(jobs, error);
+        jobs.clear();
+    }
+}
+
+void AsyncFileWriter::ringLoop()
+{
+    H26X_TRACE_THREAD_NAME("io_uring writer");
+    std::vector<Job> jobs;
+    while (takeJobs(jobs, kRingBatch))
+    {
+        std::exception_ptr error;
+        try
+        {
+            H26X_TRACE_SCOPE("io", "uring_batch");
+            ring_->WriteBatch(jobs);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        completed(jobs, error);
+        jobs.clear();
+    }
+}
+
+void AsyncFileWriter::Finish()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return jobs_in_flight_ == 0; });
+    if (error_)
+    {
+        std::exception_ptr error = error_;
+        error_                   = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+AsyncWriterStats AsyncFileWriter::GetStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    AsyncWriterStats            stats = stats_;
+    if (started_ && stats.batches > 0)
+    {
+        stats.write_seconds = std::chrono::duration<double>(last_done_ - first_write_).count();
+    }
+    return stats;
+}
+
+void AsyncFileWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+    for (auto& worker : workers_)
+    {
+        worker.join();
+    }
+    workers_.clear();
+}
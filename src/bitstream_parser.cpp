@@ -0,0 +1,1210 @@
+#include <h26xcodec/bitstream_parser.hpp>
+#include <h26xcodec/trace.hpp>
+
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+/// Slice headers are parsed up to slice_qp_delta, behind the weight tables of up to 32 references at most.
+constexpr size_t kSliceHeaderBytes = 512;
+/// Pictures kept of the first GOP for gop_pattern.
+constexpr size_t kMaxPatternLength = 256;
+
+std::string chromaFormatName(uint32_t chroma_format_idc)
+{
+    switch (chroma_format_idc)
+    {
+        case 0:
+            return "4:0:0";
+        case 1:
+            return "4:2:0";
+        case 2:
+            return "4:2:2";
+        default:
+            return "4:4:4";
+    }
+}
+
+std::string h264ProfileName(int profile_idc, uint32_t constraints)
+{
+    switch (profile_idc)
+    {
+        case 66:
+            return (constraints & 0x40) ? "Constrained Baseline" : "Baseline";
+        case 77:
+            return "Main";
+        case 88:
+            return "Extended";
+        case 100:
+            return "High";
+        case 110:
+            return (constraints & 0x10) ? "High 10 Intra" : "High 10";
+        case 122:
+            return (constraints & 0x10) ? "High 4:2:2 Intra" : "High 4:2:2";
+        case 244:
+            return (constraints & 0x10) ? "High 4:4:4 Intra" : "High 4:4:4 Predictive";
+        case 44:
+            return "CAVLC 4:4:4 Intra";
+        default:
+            return "profile " + std::to_string(profile_idc);
+    }
+}
+
+std::string hevcProfileName(int profile_idc)
+{
+    switch (profile_idc)
+    {
+        case 1:
+            return "Main";
+        case 2:
+            return "Main 10";
+        case 3:
+            return "Main Still Picture";
+        case 4:
+            return "Range Extensions";
+        case 5:
+            return "High Throughput";
+        case 9:
+            return "Screen Content Coding";
+        default:
+            return "profile " + std::to_string(profile_idc);
+    }
+}
+
+std::string levelName(int level_idc, int divisor)
+{
+    char text[16];
+    if (level_idc % divisor == 0)
+    {
+        std::snprintf(text, sizeof(text), "%d", level_idc / divisor);
+    }
+    else
+    {
+        std::snprintf(text, sizeof(text), "%d.%d", level_idc / divisor, level_idc % divisor * 10 / divisor);
+    }
+    return text;
+}
+
+bool isH264ProfileWithChromaInfo(int profile_idc)
+{
+    switch (profile_idc)
+    {
+        case 100:
+        case 110:
+        case 122:
+        case 244:
+        case 44:
+        case 83:
+        case 86:
+        case 118:
+        case 128:
+        case 138:
+        case 139:
+        case 134:
+        case 135:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void skipH264ScalingList(BitReader& bits, int size)
+{
+    int last = 8;
+    int next = 8;
+    for (int j = 0; j < size; j++)
+    {
+        if (next != 0)
+        {
+            next = (last + bits.ReadSE() + 256) % 256;
+        }
+        last = next == 0 ? last : next;
+    }
+}
+
+struct ProfileTierLevel
+{
+    int  profile_idc = 0;
+    bool high_tier   = false;
+    int  level_idc   = 0;
+};
+
+ProfileTierLevel readProfileTierLevel(BitReader& bits, int max_sub_layers_minus1)
+{
+    ProfileTierLevel ptl;
+    bits.SkipBits(2);  // general_profile_space
+    ptl.high_tier   = bits.ReadFlag();
+    ptl.profile_idc = int(bits.ReadBits(5));
+    uint32_t compatibility = bits.ReadBits(32);
+    if (ptl.profile_idc == 0)
+    {
+        // only the compatibility flags say which profile it is
+        for (int j = 1; j < 32; j++)
+        {
+            if (compatibility & (1u << (31 - j)))
+            {
+                ptl.profile_idc = j;
+                break;
+            }
+        }
+    }
+    bits.SkipBits(4 + 43 + 1);  // source flags, constraint flags, inbld/reserved
+    ptl.level_idc = int(bits.ReadBits(8));
+
+    bool profile_present[8] = {};
+    bool level_present[8]   = {};
+    for (int i = 0; i < max_sub_layers_minus1; i++)
+    {
+        profile_present[i] = bits.ReadFlag();
+        level_present[i]   = bits.ReadFlag();
+    }
+    if (max_sub_layers_minus1 > 0)
+    {
+        bits.SkipBits(2 * (8 - max_sub_layers_minus1));
+    }
+    for (int i = 0; i < max_sub_layers_minus1; i++)
+    {
+        if (profile_present[i])
+        {
+            bits.SkipBits(88);
+        }
+        if (level_present[i])
+        {
+            bits.SkipBits(8);
+        }
+    }
+    return ptl;
+}
+
+struct H264Sps
+{
+    bool     valid                 = false;
+    int      profile_idc           = 0;
+    uint32_t constraints           = 0;
+    int      level_idc             = 0;
+    uint32_t chroma_format_idc     = 1;
+    bool     separate_colour_plane = false;
+    int      bit_depth_luma        = 8;
+    int      bit_depth_chroma      = 8;
+    int      max_ref_frames        = 0;
+    int      log2_max_frame_num    = 4;
+    uint32_t poc_type              = 0;
+    int      log2_max_poc_lsb      = 4;
+    bool     delta_pic_order_zero  = false;
+    bool     frame_mbs_only        = true;
+    int      width                 = 0;
+    int      height                = 0;
+    int      coded_width           = 0;
+    int      coded_height          = 0;
+    double   fps                   = 0;
+};
+
+struct H264Pps
+{
+    bool     valid                   = false;
+    uint32_t sps_id                  = 0;
+    bool     cabac                   = false;
+    bool     bottom_field_poc        = false;
+    bool     slice_groups            = false;
+    uint32_t num_ref_idx_default[2]  = {1, 1};
+    bool     weighted_pred           = false;
+    uint32_t weighted_bipred_idc     = 0;
+    int      pic_init_qp             = 26;
+    bool     redundant_pic_cnt       = false;
+};
+
+struct HevcSps
+{
+    bool             valid = false;
+    ProfileTierLevel ptl;
+    uint32_t         chroma_format_idc = 1;
+    int              bit_depth_luma    = 8;
+    int              bit_depth_chroma  = 8;
+    int              width             = 0;
+    int              height            = 0;
+    int              coded_width       = 0;
+    int              coded_height      = 0;
+};
+
+struct HevcPps
+{
+    bool     valid                       = false;
+    uint32_t sps_id                      = 0;
+    int      num_extra_slice_header_bits = 0;
+};
+
+H264Sps parseH264Sps(BitReader& bits)
+{
+    H264Sps sps;
+    sps.profile_idc = int(bits.ReadBits(8));
+    sps.constraints = bits.ReadBits(8);
+    sps.level_idc   = int(bits.ReadBits(8));
+    bits.ReadUE();  // seq_parameter_set_id, read by the caller
+
+    if (isH264ProfileWithChromaInfo(sps.profile_idc))
+    {
+        sps.chroma_format_idc = bits.ReadUE();
+        if (sps.chroma_format_idc == 3)
+        {
+            sps.separate_colour_plane = bits.ReadFlag();
+        }
+        sps.bit_depth_luma   = 8 + int(bits.ReadUE());
+        sps.bit_depth_chroma = 8 + int(bits.ReadUE());
+        bits.SkipBits(1);  // qpprime_y_zero_transform_bypass_flag
+        if (bits.ReadFlag())
+        {
+            int lists = sps.chroma_format_idc != 3 ? 8 : 12;
+            for (int i = 0; i < lists; i++)
+            {
+                if (bits.ReadFlag())
+                {
+                    skipH264ScalingList(bits, i < 6 ? 16 : 64);
+                }
+            }
+        }
+    }
+
+    sps.log2_max_frame_num = 4 + int(bits.ReadUE());
+    sps.poc_type           = bits.ReadUE();
+    if (sps.poc_type == 0)
+    {
+        sps.log2_max_poc_lsb = 4 + int(bits.ReadUE());
+    }
+    else if (sps.poc_type == 1)
+    {
+        sps.delta_pic_order_zero = bits.ReadFlag();
+        bits.ReadSE();
+        bits.ReadSE();
+        uint32_t cycle = bits.ReadUE();
+        for (uint32_t i = 0; i < cycle && !bits.IsOverrun(); i++)
+        {
+            bits.ReadSE();
+        }
+    }
+    sps.max_ref_frames = int(bits.ReadUE());
+    bits.SkipBits(1);  // gaps_in_frame_num_value_allowed_flag
+    uint32_t width_in_mbs      = bits.ReadUE() + 1;
+    uint32_t height_in_map_units = bits.ReadUE() + 1;
+    sps.frame_mbs_only         = bits.ReadFlag();
+    if (!sps.frame_mbs_only)
+    {
+        bits.SkipBits(1);  // mb_adaptive_frame_field_flag
+    }
+    bits.SkipBits(1);  // direct_8x8_inference_flag
+
+    sps.coded_width  = int(width_in_mbs * 16);
+    sps.coded_height = int(height_in_map_units * 16 * (sps.frame_mbs_only ? 1 : 2));
+    sps.width        = sps.coded_width;
+    sps.height       = sps.coded_height;
+    if (bits.ReadFlag())
+    {
+        uint32_t left   = bits.ReadUE();
+        uint32_t right  = bits.ReadUE();
+        uint32_t top    = bits.ReadUE();
+        uint32_t bottom = bits.ReadUE();
+        uint32_t chroma = sps.separate_colour_plane ? 0 : sps.chroma_format_idc;
+        int      unit_x = chroma == 1 || chroma == 2 ? 2 : 1;
+        int      unit_y = (chroma == 1 ? 2 : 1) * (sps.frame_mbs_only ? 1 : 2);
+        sps.width -= int(left + right) * unit_x;
+        sps.height -= int(top + bottom) * unit_y;
+    }
+
+    if (bits.ReadFlag())
+    {
+        // VUI, up to the timing info
+        if (bits.ReadFlag() && bits.ReadBits(8) == 255)
+        {
+            bits.SkipBits(32);  // sar_width, sar_height
+        }
+        if (bits.ReadFlag())
+        {
+            bits.SkipBits(1);  // overscan_appropriate_flag
+        }
+        if (bits.ReadFlag())
+        {
+            bits.SkipBits(4);  // video_format, video_full_range_flag
+            if (bits.ReadFlag())
+            {
+                bits.SkipBits(24);  // colour_primaries, transfer_characteristics, matrix_coefficients
+            }
+        }
+        if (bits.ReadFlag())
+        {
+            bits.ReadUE();
+            bits.ReadUE();
+        }
+        if (bits.ReadFlag())
+        {
+            uint32_t num_units_in_tick = bits.ReadBits(32);
+            uint32_t time_scale        = bits.ReadBits(32);
+            if (num_units_in_tick > 0 && !bits.IsOverrun())
+            {
+                // a tick is a field
+                sps.fps = time_scale / (2.0 * num_units_in_tick);
+            }
+        }
+    }
+    sps.valid = !bits.IsOverrun() || sps.coded_width > 0;
+    return sps;
+}
+
+H264Pps parseH264Pps(BitReader& bits)
+{
+    H264Pps pps;
+    pps.sps_id           = bits.ReadUE();
+    pps.cabac            = bits.ReadFlag();
+    pps.bottom_field_poc = bits.ReadFlag();
+    // slice groups (FMO, Baseline only) move the QP out of reach, their maps come first
+    pps.slice_groups           = bits.ReadUE() > 0;
+    pps.num_ref_idx_default[0] = bits.ReadUE() + 1;
+    pps.num_ref_idx_default[1] = bits.ReadUE() + 1;
+    pps.weighted_pred          = bits.ReadFlag();
+    pps.weighted_bipred_idc    = bits.ReadBits(2);
+    pps.pic_init_qp            = 26 + bits.ReadSE();
+    bits.ReadSE();     // pic_init_qs_minus26
+    bits.ReadSE();     // chroma_qp_index_offset
+    bits.SkipBits(2);  // deblocking_filter_control_present_flag, constrained_intra_pred_flag
+    pps.redundant_pic_cnt = bits.ReadFlag();
+    pps.valid             = !bits.IsOverrun();
+    return pps;
+}
+
+/// slice_qp_delta applied to the PPS QP, the bits stand behind slice_type and pic_parameter_set_id. -1 if the
+/// header is cut short or uses slice groups.
+int readH264SliceQp(BitReader& bits, uint8_t nal_header, uint32_t slice_type, H264Sps const& sps, H264Pps const& pps)
+{
+    if (pps.slice_groups)
+    {
+        return -1;
+    }
+    int  nal_type = nal_header & 0x1f;
+    bool is_b     = slice_type == 1;
+    bool is_intra = slice_type == 2 || slice_type == 4;
+    if (sps.separate_colour_plane)
+    {
+        bits.SkipBits(2);  // colour_plane_id
+    }
+    bits.SkipBits(size_t(sps.log2_max_frame_num));  // frame_num
+    bool field_pic = false;
+    if (!sps.frame_mbs_only)
+    {
+        field_pic = bits.ReadFlag();
+        if (field_pic)
+        {
+            bits.SkipBits(1);  // bottom_field_flag
+        }
+    }
+    if (nal_type == 5)
+    {
+        bits.ReadUE();  // idr_pic_id
+    }
+    if (sps.poc_type == 0)
+    {
+        bits.SkipBits(size_t(sps.log2_max_poc_lsb));
+        if (pps.bottom_field_poc && !field_pic)
+        {
+            bits.ReadSE();
+        }
+    }
+    else if (sps.poc_type == 1 && !sps.delta_pic_order_zero)
+    {
+        bits.ReadSE();
+        if (pps.bottom_field_poc && !field_pic)
+        {
+            bits.ReadSE();
+        }
+    }
+    if (pps.redundant_pic_cnt)
+    {
+        bits.ReadUE();
+    }
+    if (is_b)
+    {
+        bits.SkipBits(1);  // direct_spatial_mv_pred_flag
+    }
+
+    uint32_t refs[2] = {pps.num_ref_idx_default[0], pps.num_ref_idx_default[1]};
+    if (!is_intra)
+    {
+        if (bits.ReadFlag())  // num_ref_idx_active_override_flag
+        {
+            refs[0] = bits.ReadUE() + 1;
+            if (is_b)
+            {
+                refs[1] = bits.ReadUE() + 1;
+            }
+        }
+        if (refs[0] > 32 || refs[1] > 32)
+        {
+            return -1;
+        }
+        // ref_pic_list_modification
+        for (int list = 0; list < (is_b ? 2 : 1); list++)
+        {
+            if (!bits.ReadFlag())
+            {
+                continue;
+            }
+            uint32_t idc;
+            while ((idc = bits.ReadUE()) != 3 && !bits.IsOverrun())
+            {
+                bits.ReadUE();
+            }
+        }
+    }
+
+    if ((pps.weighted_pred && !is_intra && !is_b) || (pps.weighted_bipred_idc == 1 && is_b))
+    {
+        uint32_t chroma_array_type = sps.separate_colour_plane ? 0 : sps.chroma_format_idc;
+        bits.ReadUE();  // luma_log2_weight_denom
+        if (chroma_array_type != 0)
+        {
+            bits.ReadUE();  // chroma_log2_weight_denom
+        }
+        for (int list = 0; list < (is_b ? 2 : 1); list++)
+        {
+            for (uint32_t i = 0; i < refs[list] && !bits.IsOverrun(); i++)
+            {
+                if (bits.ReadFlag())
+                {
+                    bits.ReadSE();
+                    bits.ReadSE();
+                }
+                if (chroma_array_type != 0 && bits.ReadFlag())
+                {
+                    for (int j = 0; j < 4; j++)
+                    {
+                        bits.ReadSE();
+                    }
+                }
+            }
+        }
+    }
+
+    if (nal_header & 0x60)
+    {
+        // dec_ref_pic_marking
+        if (nal_type == 5)
+        {
+            bits.SkipBits(2);  // no_output_of_prior_pics_flag, long_term_reference_flag
+        }
+        else if (bits.ReadFlag())
+        {
+            uint32_t mmco;
+            while ((mmco = bits.ReadUE()) != 0 && !bits.IsOverrun())
+            {
+                if (mmco == 1 || mmco == 2 || mmco == 3 || mmco == 6)
+                {
+                    bits.ReadUE();
+                }
+                if (mmco == 3)
+                {
+                    bits.ReadUE();
+                }
+                if (mmco == 4)
+                {
+                    bits.ReadUE();
+                }
+            }
+        }
+    }
+    if (pps.cabac && !is_intra)
+    {
+        bits.ReadUE();  // cabac_init_idc
+    }
+    int qp = pps.pic_init_qp + bits.ReadSE();
+    return bits.IsOverrun() || qp < 0 || qp > 63 ? -1 : qp;
+}
+
+HevcSps parseHevcSps(BitReader& bits)
+{
+    HevcSps sps;
+    bits.SkipBits(4);  // sps_video_parameter_set_id
+    int max_sub_layers_minus1 = int(bits.ReadBits(3));
+    bits.SkipBits(1);  // sps_temporal_id_nesting_flag
+    sps.ptl = readProfileTierLevel(bits, max_sub_layers_minus1);
+    bits.ReadUE();  // sps_seq_parameter_set_id, read by the caller
+    sps.chroma_format_idc      = bits.ReadUE();
+    bool separate_colour_plane = false;
+    if (sps.chroma_format_idc == 3)
+    {
+        separate_colour_plane = bits.ReadFlag();
+    }
+    sps.coded_width  = int(bits.ReadUE());
+    sps.coded_height = int(bits.ReadUE());
+    sps.width        = sps.coded_width;
+    sps.height       = sps.coded_height;
+    if (bits.ReadFlag())
+    {
+        uint32_t left   = bits.ReadUE();
+        uint32_t right  = bits.ReadUE();
+        uint32_t top    = bits.ReadUE();
+        uint32_t bottom = bits.ReadUE();
+        uint32_t chroma = separate_colour_plane ? 0 : sps.chroma_format_idc;
+        int      unit_x = chroma == 1 || chroma == 2 ? 2 : 1;
+        int      unit_y = chroma == 1 ? 2 : 1;
+        sps.width -= int(left + right) * unit_x;
+        sps.height -= int(top + bottom) * unit_y;
+    }
+    sps.bit_depth_luma   = 8 + int(bits.ReadUE());
+    sps.bit_depth_chroma = 8 + int(bits.ReadUE());
+    sps.valid            = !bits.IsOverrun();
+    return sps;
+}
+
+/// Frame rate from vps_timing_info, 0 if the VPS has none.
+double parseHevcVpsFps(BitReader& bits)
+{
+    bits.SkipBits(4 + 1 + 1 + 6);  // vps_video_parameter_set_id, base layer flags, vps_max_layers_minus1
+    int max_sub_layers_minus1 = int(bits.ReadBits(3));
+    bits.SkipBits(1 + 16);  // vps_temporal_id_nesting_flag, vps_reserved_0xffff_16bits
+    readProfileTierLevel(bits, max_sub_layers_minus1);
+    bool ordering_info_present = bits.ReadFlag();
+    for (int i = ordering_info_present ? 0 : max_sub_layers_minus1; i <= max_sub_layers_minus1; i++)
+    {
+        bits.ReadUE();
+        bits.ReadUE();
+        bits.ReadUE();
+    }
+    uint32_t max_layer_id  = bits.ReadBits(6);
+    uint32_t layer_sets    = bits.ReadUE() + 1;
+    for (uint32_t i = 1; i < layer_sets && !bits.IsOverrun(); i++)
+    {
+        bits.SkipBits(max_layer_id + 1);
+    }
+    if (!bits.ReadFlag())
+    {
+        return 0;
+    }
+    uint32_t num_units_in_tick = bits.ReadBits(32);
+    uint32_t time_scale        = bits.ReadBits(32);
+    return num_units_in_tick > 0 && !bits.IsOverrun() ? double(time_scale) / num_units_in_tick : 0;
+}
+
+/// How likely the bytes after a start code are a NAL unit header of each codec.
+bool plausibleH264Header(uint8_t header)
+{
+    if (header & 0x80)
+    {
+        return false;
+    }
+    int  type = header & 0x1f;
+    bool ref  = (header & 0x60) != 0;
+    switch (type)
+    {
+        case 1:
+            return true;
+        case 5:
+        case 7:
+        case 8:
+            return ref;
+        case 6:
+        case 9:
+        case 10:
+        case 11:
+        case 12:
+            return !ref;
+        default:
+            return false;
+    }
+}
+
+bool plausibleHevcHeader(uint8_t header0, uint8_t header1)
+{
+    // forbidden bit and the high bit of nuh_layer_id clear, layer 0, temporal id present
+    if ((header0 & 0x81) != 0 || (header1 & 0xf8) != 0 || (header1 & 0x07) == 0)
+    {
+        return false;
+    }
+    int type = (header0 >> 1) & 0x3f;
+    return type <= 9 || (type >= 16 && type <= 21) || (type >= 32 && type <= 40);
+}
+}  // namespace
+
+BitReader::BitReader(uint8_t const* data, size_t size)
+  : data_{data}
+  , size_{size}
+  , pos_{0}
+  , overrun_{false}
+{
+}
+
+uint32_t BitReader::ReadBits(int n)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < n; i++)
+    {
+        value <<= 1;
+        if (pos_ < size_ * 8)
+        {
+            value |= (data_[pos_ >> 3] >> (7 - (pos_ & 7))) & 1;
+        }
+        else
+        {
+            overrun_ = true;
+        }
+        pos_++;
+    }
+    return value;
+}
+
+bool BitReader::ReadFlag()
+{
+    return ReadBits(1) != 0;
+}
+
+uint32_t BitReader::ReadUE()
+{
+    int zeros = 0;
+    while (!ReadFlag())
+    {
+        if (++zeros > 31 || overrun_)
+        {
+            overrun_ = true;
+            return 0;
+        }
+    }
+    if (zeros == 0)
+    {
+        return 0;
+    }
+    return uint32_t((uint64_t(1) << zeros) - 1 + ReadBits(zeros));
+}
+
+int32_t BitReader::ReadSE()
+{
+    uint32_t code = ReadUE();
+    return (code & 1) ? int32_t((code + 1) / 2) : -int32_t(code / 2);
+}
+
+void BitReader::SkipBits(size_t n)
+{
+    pos_ += n;
+    if (pos_ > size_ * 8)
+    {
+        overrun_ = true;
+    }
+}
+
+std::vector<uint8_t> NalToRbsp(uint8_t const* nal, size_t size, size_t max_bytes)
+{
+    std::vector<uint8_t> rbsp;
+    rbsp.reserve(std::min(size, max_bytes));
+    int zeros = 0;
+    for (size_t i = 0; i < size && rbsp.size() < max_bytes; i++)
+    {
+        if (zeros >= 2 && nal[i] == 3)
+        {
+            zeros = 0;
+            continue;
+        }
+        zeros = nal[i] == 0 ? zeros + 1 : 0;
+        rbsp.push_back(nal[i]);
+    }
+    return rbsp;
+}
+
+std::string H26xStreamInfo::Json() const
+{
+    nlohmann::json json;
+    json["codec"]       = codec;
+    json["profile"]     = profile;
+    json["profile_idc"] = profile_idc;
+    if (!tier.empty())
+    {
+        json["tier"] = tier;
+    }
+    json["level"]          = level;
+    json["width"]          = width;
+    json["height"]         = height;
+    json["coded_width"]    = coded_width;
+    json["coded_height"]   = coded_height;
+    json["chroma_format"]  = chroma_format;
+    json["bit_depth"]      = {{"luma", bit_depth_luma}, {"chroma", bit_depth_chroma}};
+    json["interlaced"]     = interlaced;
+    json["entropy_coding"] = entropy_coding;
+    if (codec == "h264")
+    {
+        json["max_ref_frames"] = max_ref_frames;
+    }
+    json["fps"]       = fps;
+    json["nal_units"] = nal_units;
+    json["bytes"]     = bytes;
+    json["frames"]    = {{"total", pictures}, {"I", i_pictures}, {"P", p_pictures},
+                         {"B", b_pictures},   {"key", key_frames}, {"idr", idr_frames}};
+    json["gop"]       = {{"count", gops},
+                         {"min", gop_min},
+                         {"max", gop_max},
+                         {"average", gop_average},
+                         {"closed", closed_gop},
+                         {"max_consecutive_b", max_consecutive_b},
+                         {"pattern", gop_pattern}};
+    return json.dump(2);
+}
+
+struct H26xStreamParser::State
+{
+    bool           hevc;
+    H26xStreamInfo info;
+
+    std::array<H264Sps, 32>  h264_sps;
+    std::array<H264Pps, 256> h264_pps;
+    std::array<HevcSps, 16>  hevc_sps;
+    std::array<HevcPps, 64>  hevc_pps;
+    double                   vps_fps = 0;
+    /// the parameter set of the first picture describes the stream
+    bool described = false;
+
+    bool     in_picture    = false;
+    char     type          = 'I';
+    bool     key           = false;
+    bool     idr           = false;
+    uint64_t picture_bytes = 0;
+    double   qp_sum        = 0;
+    uint32_t qp_slices     = 0;
+    int64_t  pts           = INT64_MIN;  ///< of the access unit being fed
+    int64_t  picture_pts   = INT64_MIN;
+    uint32_t gop_length = 0;
+    uint64_t gop_total  = 0;
+    uint32_t b_run      = 0;
+    bool     first_gop  = true;
+};
+
+H26xStreamParser::H26xStreamParser(std::string const& codec)
+  : state_{std::make_unique<State>()}
+  , scan_{0}
+  , nal_start_{SIZE_MAX}
+{
+    if (codec == "h264")
+    {
+        state_->hevc = false;
+    }
+    else if (codec == "h265" || codec == "hevc")
+    {
+        state_->hevc = true;
+    }
+    else
+    {
+        throw std::invalid_argument("unknown codec " + codec + ", expected h264 or h265");
+    }
+    state_->info.codec          = state_->hevc ? "h265" : "h264";
+    state_->info.entropy_coding = state_->hevc ? "CABAC" : "";
+}
+
+H26xStreamParser::~H26xStreamParser() = default;
+
+std::string H26xStreamParser::DetectCodec(uint8_t const* data, size_t size)
+{
+    int h264 = 0;
+    int hevc = 0;
+    int nals = 0;
+    for (size_t i = 0; i + 4 < size && nals < 32; i++)
+    {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+        {
+            continue;
+        }
+        h264 += plausibleH264Header(data[i + 3]);
+        hevc += plausibleHevcHeader(data[i + 3], data[i + 4]);
+        nals++;
+        i += 2;
+    }
+    if (nals == 0 || (h264 == 0 && hevc == 0))
+    {
+        return std::string();
+    }
+    return hevc > h264 ? "h265" : "h264";
+}
+
+void H26xStreamParser::Feed(uint8_t const* data, size_t size)
+{
+    H26X_TRACE_SCOPE("parse", "inspect");
+    pending_.insert(pending_.end(), data, data + size);
+    uint8_t const* p = pending_.data();
+    size_t         n = pending_.size();
+    size_t         i = scan_;
+    while (i + 2 < n)
+    {
+        // the third byte of a start code is 1, anything larger can't be part of one
+        if (p[i + 2] > 1)
+        {
+            i += 3;
+            continue;
+        }
+        if (p[i] != 0 || p[i + 1] != 0 || p[i + 2] != 1)
+        {
+            i++;
+            continue;
+        }
+        if (nal_start_ != SIZE_MAX)
+        {
+            // the zero of a four byte start code and trailing_zero_8bits belong to no NAL unit
+            size_t end = i;
+            while (end > nal_start_ && p[end - 1] == 0)
+            {
+                end--;
+            }
+            FeedNal(p + nal_start_, end - nal_start_);
+        }
+        nal_start_ = i + 3;
+        i += 3;
+    }
+
+    // keep the unfinished NAL unit, or just enough bytes to find a start code split by the chunk boundary
+    size_t keep = nal_start_ != SIZE_MAX ? nal_start_ : (n > 2 ? n - 2 : 0);
+    pending_.erase(pending_.begin(), pending_.begin() + std::ptrdiff_t(keep));
+    if (nal_start_ != SIZE_MAX)
+    {
+        nal_start_ = 0;
+    }
+    scan_ = i - keep;
+}
+
+void H26xStreamParser::FeedNal(uint8_t const* nal, size_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    state_->info.nal_units++;
+    state_->info.bytes += size;
+    if (state_->hevc)
+    {
+        hevcNal(nal, size);
+    }
+    else
+    {
+        h264Nal(nal, size);
+    }
+}
+
+void H26xStreamParser::h264Nal(uint8_t const* nal, size_t size)
+{
+    State& s    = *state_;
+    int    type = nal[0] & 0x1f;
+    if (type == 7 || type == 8)
+    {
+        std::vector<uint8_t> rbsp = NalToRbsp(nal, size);
+        BitReader            bits(rbsp.data() + 1, rbsp.size() - 1);
+        if (type == 7)
+        {
+            // the id sits behind profile, constraints and level
+            BitReader id_bits(rbsp.data() + 4, rbsp.size() > 4 ? rbsp.size() - 4 : 0);
+            uint32_t  id = id_bits.ReadUE();
+            if (id < s.h264_sps.size())
+            {
+                s.h264_sps[id] = parseH264Sps(bits);
+            }
+        }
+        else
+        {
+            uint32_t id  = bits.ReadUE();
+            H264Pps  pps = parseH264Pps(bits);
+            pps.valid    = pps.valid && pps.sps_id < s.h264_sps.size();
+            if (id < s.h264_pps.size())
+            {
+                s.h264_pps[id] = pps;
+            }
+        }
+        return;
+    }
+    if (type != 1 && type != 5)
+    {
+        return;
+    }
+
+    std::vector<uint8_t> rbsp = NalToRbsp(nal, size, kSliceHeaderBytes);
+    BitReader            bits(rbsp.data() + 1, rbsp.size() - 1);
+    uint32_t             first_mb   = bits.ReadUE();
+    uint32_t             slice_type = bits.ReadUE() % 5;
+    uint32_t             pps_id     = bits.ReadUE();
+    if (bits.IsOverrun())
+    {
+        return;
+    }
+    // P and SP are P, I and SI are I
+    char picture_type = slice_type == 1 ? 'B' : (slice_type == 2 || slice_type == 4 ? 'I' : 'P');
+    if (first_mb == 0)
+    {
+        startPicture(picture_type, type == 5, type == 5);
+        if (!s.described && pps_id < s.h264_pps.size() && s.h264_pps[pps_id].valid &&
+            s.h264_sps[s.h264_pps[pps_id].sps_id].valid)
+        {
+            H264Sps const&  sps  = s.h264_sps[s.h264_pps[pps_id].sps_id];
+            H26xStreamInfo& info = s.info;
+            info.profile_idc      = sps.profile_idc;
+            info.profile          = h264ProfileName(sps.profile_idc, sps.constraints);
+            info.level            = sps.level_idc == 11 && (sps.constraints & 0x10) && sps.profile_idc != 100
+                                        ? "1b"
+                                        : levelName(sps.level_idc, 10);
+            info.width            = sps.width;
+            info.height           = sps.height;
+            info.coded_width      = sps.coded_width;
+            info.coded_height     = sps.coded_height;
+            info.chroma_format    = chromaFormatName(sps.chroma_format_idc);
+            info.bit_depth_luma   = sps.bit_depth_luma;
+            info.bit_depth_chroma = sps.bit_depth_chroma;
+            info.interlaced       = !sps.frame_mbs_only;
+            info.entropy_coding   = s.h264_pps[pps_id].cabac ? "CABAC" : "CAVLC";
+            info.max_ref_frames   = sps.max_ref_frames;
+            info.fps              = sps.fps;
+            s.described           = true;
+        }
+    }
+    else if (s.in_picture && picture_type == 'B' && s.type != 'B')
+    {
+        s.type = 'B';
+    }
+    else if (s.in_picture && picture_type == 'P' && s.type == 'I')
+    {
+        s.type = 'P';
+    }
+    if (!s.in_picture)
+    {
+        // the first slice of the picture is lost
+        return;
+    }
+    s.picture_bytes += size;
+    if (on_picture_ && pps_id < s.h264_pps.size() && s.h264_pps[pps_id].valid &&
+        s.h264_sps[s.h264_pps[pps_id].sps_id].valid)
+    {
+        int qp = readH264SliceQp(bits, nal[0], slice_type, s.h264_sps[s.h264_pps[pps_id].sps_id], s.h264_pps[pps_id]);
+        if (qp >= 0)
+        {
+            s.qp_sum += qp;
+            s.qp_slices++;
+        }
+    }
+}
+
+void H26xStreamParser::hevcNal(uint8_t const* nal, size_t size)
+{
+    State& s = *state_;
+    if (size < 3)
+    {
+        return;
+    }
+    int type = (nal[0] >> 1) & 0x3f;
+    if (type >= 32 && type <= 34)
+    {
+        std::vector<uint8_t> rbsp = NalToRbsp(nal, size);
+        BitReader            bits(rbsp.data() + 2, rbsp.size() - 2);
+        if (type == 32)
+        {
+            double fps = parseHevcVpsFps(bits);
+            if (fps > 0)
+            {
+                s.vps_fps = fps;
+            }
+        }
+        else if (type == 33)
+        {
+            HevcSps  sps = parseHevcSps(bits);
+            // the id follows the profile_tier_level, parse again up to it
+            BitReader id_bits(rbsp.data() + 2, rbsp.size() - 2);
+            id_bits.SkipBits(4);
+            int max_sub_layers_minus1 = int(id_bits.ReadBits(3));
+            id_bits.SkipBits(1);
+            readProfileTierLevel(id_bits, max_sub_layers_minus1);
+            uint32_t id = id_bits.ReadUE();
+            if (id < s.hevc_sps.size())
+            {
+                s.hevc_sps[id] = sps;
+            }
+        }
+        else
+        {
+            uint32_t id = bits.ReadUE();
+            HevcPps  pps;
+            pps.sps_id = bits.ReadUE();
+            bits.SkipBits(2);  // dependent_slice_segments_enabled_flag, output_flag_present_flag
+            pps.num_extra_slice_header_bits = int(bits.ReadBits(3));
+            pps.valid                       = !bits.IsOverrun() && pps.sps_id < s.hevc_sps.size();
+            if (id < s.hevc_pps.size())
+            {
+                s.hevc_pps[id] = pps;
+            }
+        }
+        return;
+    }
+    // VCL: TRAIL, TSA, STSA, RADL, RASL, then BLA, IDR, CRA
+    if (!(type <= 9 || (type >= 16 && type <= 21)))
+    {
+        return;
+    }
+
+    std::vector<uint8_t> rbsp = NalToRbsp(nal, size, kSliceHeaderBytes);
+    BitReader            bits(rbsp.data() + 2, rbsp.size() - 2);
+    if (!bits.ReadFlag())
+    {
+        // not the first slice segment of its picture, the address in front of slice_type needs the
+        // SPS coding block sizes; the first segment decides the type
+        if (s.in_picture)
+        {
+            s.picture_bytes += size;
+        }
+        return;
+    }
+    bool irap = type >= 16;
+    if (irap)
+    {
+        bits.SkipBits(1);  // no_output_of_prior_pics_flag
+    }
+    uint32_t pps_id = bits.ReadUE();
+    int      extra  = pps_id < s.hevc_pps.size() && s.hevc_pps[pps_id].valid
+                          ? s.hevc_pps[pps_id].num_extra_slice_header_bits
+                          : 0;
+    bits.SkipBits(size_t(extra));
+    uint32_t slice_type = bits.ReadUE();
+    if (bits.IsOverrun())
+    {
+        return;
+    }
+    char picture_type = slice_type == 0 ? 'B' : (slice_type == 1 ? 'P' : 'I');
+    startPicture(picture_type, irap, type == 19 || type == 20);
+    s.picture_bytes += size;
+
+    if (!s.described && pps_id < s.hevc_pps.size() && s.hevc_pps[pps_id].valid &&
+        s.hevc_sps[s.hevc_pps[pps_id].sps_id].valid)
+    {
+        HevcSps const&  sps  = s.hevc_sps[s.hevc_pps[pps_id].sps_id];
+        H26xStreamInfo& info = s.info;
+        info.profile_idc      = sps.ptl.profile_idc;
+        info.profile          = hevcProfileName(sps.ptl.profile_idc);
+        info.tier             = sps.ptl.high_tier ? "High" : "Main";
+        info.level            = levelName(sps.ptl.level_idc, 30);
+        info.width            = sps.width;
+        info.height           = sps.height;
+        info.coded_width      = sps.coded_width;
+        info.coded_height     = sps.coded_height;
+        info.chroma_format    = chromaFormatName(sps.chroma_format_idc);
+        info.bit_depth_luma   = sps.bit_depth_luma;
+        info.bit_depth_chroma = sps.bit_depth_chroma;
+        info.fps              = s.vps_fps;
+        s.described           = true;
+    }
+}
+
+void H26xStreamParser::startPicture(char type, bool key, bool idr)
+{
+    endPicture();
+    State& s        = *state_;
+    s.in_picture    = true;
+    s.type          = type;
+    s.key           = key;
+    s.idr           = idr;
+    s.picture_bytes = 0;
+    s.qp_sum        = 0;
+    s.qp_slices     = 0;
+    s.picture_pts   = s.pts;
+}
+
+void H26xStreamParser::endPicture()
+{
+    State& s = *state_;
+    if (!s.in_picture)
+    {
+        return;
+    }
+    s.in_picture         = false;
+    H26xStreamInfo& info = s.info;
+    if (on_picture_)
+    {
+        H26xPictureInfo picture;
+        picture.index = info.pictures;
+        picture.type  = s.type;
+        picture.key   = s.key;
+        picture.idr   = s.idr;
+        picture.bytes = s.picture_bytes;
+        picture.qp    = s.qp_slices > 0 ? s.qp_sum / s.qp_slices : -1;
+        picture.pts   = s.picture_pts;
+        on_picture_(picture);
+    }
+    info.pictures++;
+    switch (s.type)
+    {
+        case 'I':
+            info.i_pictures++;
+            break;
+        case 'P':
+            info.p_pictures++;
+            break;
+        default:
+            info.b_pictures++;
+    }
+    s.b_run                = s.type == 'B' ? s.b_run + 1 : 0;
+    info.max_consecutive_b = std::max(info.max_consecutive_b, s.b_run);
+
+    if (s.key)
+    {
+        info.key_frames++;
+        info.idr_frames += s.idr;
+        info.closed_gop = info.closed_gop && s.idr;
+        if (s.gop_length > 0 && info.key_frames > 1)
+        {
+            info.gops++;
+            s.gop_total += s.gop_length;
+            info.gop_min = info.gops == 1 ? s.gop_length : std::min(info.gop_min, s.gop_length);
+            info.gop_max = std::max(info.gop_max, s.gop_length);
+            s.first_gop  = false;
+        }
+        s.gop_length = 0;
+    }
+    s.gop_length++;
+    if (s.first_gop && info.gop_pattern.size() < kMaxPatternLength)
+    {
+        info.gop_pattern.push_back(s.type);
+    }
+}
+
+void H26xStreamParser::FeedAccessUnit(uint8_t const* data, size_t size, int64_t pts)
+{
+    state_->pts = pts;
+    Feed(data, size);
+    flushPending();
+}
+
+void H26xStreamParser::SetPictureCallback(std::function<void(H26xPictureInfo const&)> on_picture)
+{
+    on_picture_ = std::move(on_picture);
+}
+
+void H26xStreamParser::flushPending()
+{
+    if (nal_start_ != SIZE_MAX && nal_start_ < pending_.size())
+    {
+        size_t end = pending_.size();
+        while (end > nal_start_ && pending_[end - 1] == 0)
+        {
+            end--;
+        }
+        FeedNal(pending_.data() + nal_start_, end - nal_start_);
+    }
+    pending_.clear();
+    nal_start_ = SIZE_MAX;
+    scan_      = 0;
+}
+
+H26xStreamInfo H26xStreamParser::Finish()
+{
+    flushPending();
+    endPicture();
+
+    State&          s    = *state_;
+    H26xStreamInfo& info = s.info;
+    // the last GOP only counts when it is the only one, it may be cut short
+    if (info.gops == 0 && s.gop_length > 0)
+    {
+        info.gops    = 1;
+        s.gop_total  = s.gop_length;
+        info.gop_min = s.gop_length;
+        info.gop_max = s.gop_length;
+    }
+    info.gop_average = info.gops > 0 ? double(s.gop_total) / info.gops : 0;
+    return info;
+}
@@ -8,11 +8,12 @@ extern "C" {
 }
 
 #include <h26xcodec/converter.hpp>
+#include <h26xcodec/trace.hpp>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
 
-ConverterRGB24::ConverterRGB24():context(nullptr),swsContext(nullptr),jpegCodec(avcodec_find_encoder(AV_CODEC_ID_MJPEG))
+ConverterRGB24::ConverterRGB24():context(nullptr),swsContext(nullptr),jpegCodec(avcodec_find_encoder(AV_CODEC_ID_MJPEG)),pngContext(nullptr)
 {
   frameRGB = av_frame_alloc();
   if (!frameRGB)
@@ -30,12 +31,15 @@ ConverterRGB24::~ConverterRGB24()
 {
   av_packet_unref(&packet);
   avcodec_free_context(&jpegContext);
+  avcodec_free_context(&pngContext);
   sws_freeContext(context);
+  sws_freeContext(swsContext);
   av_frame_free(&frameRGB);
 }
 
 void ConverterRGB24::convert(const AVFrame &frame, unsigned char* out_image)
 {
+  H26X_TRACE_SCOPE("convert", "rgb24");
   int w = frame.width;
   int h = frame.height;
   int pix_fmt = frame.format;
@@ -70,6 +74,7 @@ int ConverterRGB24::predict_size(int w, int h)
 }
 
 std::unique_ptr<std::string> ConverterRGB24::to_jpeg() {
+    H26X_TRACE_SCOPE("jpeg", "to_jpeg");
     jpegContext->height = frameRGB->height;
     jpegContext->width = frameRGB->width;
 
@@ -79,7 +84,8 @@ std::unique_ptr<std::string> ConverterRGB24::to_jpeg() {
     }
 
     // 转换 RGB24 -> YUVJ420P
-    swsContext = sws_getContext(
+    // 复用上一帧的转换上下文, 每帧新建会泄漏
+    swsContext = sws_getCachedContext(swsContext,
         frameRGB->width, frameRGB->height, AV_PIX_FMT_RGB24, // 输入格式
         jpegContext->width, jpegContext->height, AV_PIX_FMT_YUVJ420P, // 输出格式
         SWS_BICUBIC, NULL, NULL, NULL);
@@ -117,7 +123,41 @@ std::unique_ptr<std::string> ConverterRGB24::to_jpeg() {
     }
 }
 
+std::unique_ptr<std::string> ConverterRGB24::to_png() {
+    H26X_TRACE_SCOPE("jpeg", "to_png");
+    // PNG 直接编码 RGB24, 尺寸变化时才重新打开编码器
+    if (!pngContext || pngContext->width != frameRGB->width || pngContext->height != frameRGB->height) {
+        avcodec_free_context(&pngContext);
+        const AVCodec* pngCodec = avcodec_find_encoder(AV_CODEC_ID_PNG);
+        pngContext = pngCodec ? avcodec_alloc_context3(pngCodec) : nullptr;
+        if (!pngContext) {
+            throw std::runtime_error("Could not allocate PNG codec.");
+        }
+        pngContext->pix_fmt = AV_PIX_FMT_RGB24;
+        pngContext->time_base = {1, 25};
+        pngContext->width = frameRGB->width;
+        pngContext->height = frameRGB->height;
+        if (avcodec_open2(pngContext, pngCodec, NULL) < 0) {
+            avcodec_free_context(&pngContext);
+            throw std::runtime_error("Could not open PNG codec.");
+        }
+    }
+
+    // frameRGB 指向调用者的缓冲区, 编码器会自己复制一份
+    frameRGB->format = AV_PIX_FMT_RGB24;
+    if (avcodec_send_frame(pngContext, frameRGB) < 0) {
+        throw std::runtime_error("Error sending frame to PNG codec.");
+    }
+    if (avcodec_receive_packet(pngContext, &packet) < 0) {
+        throw std::runtime_error("Error receiving packet from PNG codec.");
+    }
+    auto png = std::make_unique<std::string>((char*)packet.data, packet.size);
+    av_packet_unref(&packet);
+    return png;
+}
+
 std::unique_ptr<std::string> ConverterRGB24::from_jpeg(std::string jpeg_path){
+    H26X_TRACE_SCOPE("jpeg", "from_jpeg");
     // 打开 JPEG 文件
     AVFormatContext* formatContext = nullptr;
     if (avformat_open_input(&formatContext, jpeg_path.c_str(), nullptr, nullptr) < 0) {
@@ -240,7 +280,73 @@ std::unique_ptr<std::string> ConverterRGB24::from_jpeg(std::string jpeg_path){
     av_frame_free(&frame);
     av_frame_free(&frameRGB);
     avcodec_free_context(&codecContext);
+    if (formatContext->pb) {
+      H26X_TRACE_COUNT(BytesIn, formatContext->pb->bytes_read);
+    }
     avformat_close_input(&formatContext);
 
     return std::make_unique<std::string>(rgbData);
-}
\ No newline at end of file
+}
+std::unique_ptr<std::string> ConverterRGB24::from_jpeg_buffer(const std::string& image){
+    H26X_TRACE_SCOPE("jpeg", "from_jpeg_buffer");
+    // PNG 以签名识别, 其余按 JPEG 解码
+    static const char pngSignature[] = "\x89PNG";
+    AVCodecID codecId = image.compare(0, 4, pngSignature) == 0 ? AV_CODEC_ID_PNG : AV_CODEC_ID_MJPEG;
+    const AVCodec* codec = avcodec_find_decoder(codecId);
+    if (!codec) {
+        std::cerr << "Could not find image decoder." << std::endl;
+        return nullptr;
+    }
+
+    AVCodecContext* codecContext = avcodec_alloc_context3(codec);
+    AVFrame* frame = av_frame_alloc();
+    AVPacket* imagePacket = av_packet_alloc();
+    if (!codecContext || !frame || !imagePacket || avcodec_open2(codecContext, codec, nullptr) < 0) {
+        std::cerr << "Could not open image decoder." << std::endl;
+        av_packet_free(&imagePacket);
+        av_frame_free(&frame);
+        avcodec_free_context(&codecContext);
+        return nullptr;
+    }
+
+    // 直接解码内存中的数据, 不复制
+    imagePacket->data = (uint8_t*)image.data();
+    imagePacket->size = (int)image.size();
+    int ret = avcodec_send_packet(codecContext, imagePacket);
+    if (ret >= 0) {
+        avcodec_send_packet(codecContext, nullptr);
+        ret = avcodec_receive_frame(codecContext, frame);
+    }
+
+    std::unique_ptr<std::string> rgbData;
+    if (ret >= 0) {
+        int width = frame->width;
+        int height = frame->height;
+        rgbData = std::make_unique<std::string>(av_image_get_buffer_size(AV_PIX_FMT_RGB24, width, height, 1), '\0');
+
+        // 转换为紧凑排列的 RGB24, 直接写入输出
+        uint8_t* rgbPlanes[4];
+        int rgbLinesize[4];
+        av_image_fill_arrays(rgbPlanes, rgbLinesize, (uint8_t*)&(*rgbData)[0], AV_PIX_FMT_RGB24, width, height, 1);
+        swsContext = sws_getCachedContext(swsContext,
+            width, height, (AVPixelFormat)frame->format,
+            width, height, AV_PIX_FMT_RGB24,
+            SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (swsContext) {
+            sws_scale(swsContext, frame->data, frame->linesize, 0, height, rgbPlanes, rgbLinesize);
+        } else {
+            std::cerr << "Could not initialize conversion context." << std::endl;
+            rgbData.reset();
+        }
+    } else {
+        std::cerr << "Could not decode image." << std::endl;
+    }
+
+    // 释放资源
+    imagePacket->data = nullptr;
+    imagePacket->size = 0;
+    av_packet_free(&imagePacket);
+    av_frame_free(&frame);
+    avcodec_free_context(&codecContext);
+    return rgbData;
+}
@@ -0,0 +1,337 @@
+#include <h26xcodec/encoder_session_manager.hpp>
+#include <h26xcodec/trace.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+EncoderSessionManager::EncoderSessionManager(int cpu_budget)
+  : cpu_budget_{cpu_budget > 0 ? cpu_budget : std::max(1, int(std::thread::hardware_concurrency()))}
+  , busy_threads_{0}
+  , started_{false}
+  , stopping_{false}
+{
+}
+
+EncoderSessionManager::~EncoderSessionManager()
+{
+    Stop();
+}
+
+int EncoderSessionManager::AddSession(std::string const& name, std::unique_ptr<H26xEncoder> encoder,
+                                      PacketCallback on_packet, size_t queue_size)
+{
+    auto session        = std::make_unique<Session>();
+    session->name       = name;
+    session->on_packet  = std::move(on_packet);
+    session->queue_size = std::max<size_t>(queue_size, 1);
+    int fps             = std::max(1, encoder->GetFps());
+    session->frame_interval =
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+    session->weight  = double(std::max(1, encoder->GetWidth())) * std::max(1, encoder->GetHeight()) * fps;
+    session->frame_size =
+        size_t(std::max(0, av_image_get_buffer_size(encoder->GetInputPixelFormat(), encoder->GetWidth(),
+                                                    encoder->GetHeight(), 1)));
+    session->encoder = std::move(encoder);
+    session->enabled = false;
+    session->flushed = false;
+    session->busy    = false;
+
+    session->frames_submitted    = 0;
+    session->frames_rejected     = 0;
+    session->frames_encoded      = 0;
+    session->deadline_misses     = 0;
+    session->encode_errors       = 0;
+    session->total_queue_latency = Clock::duration::zero();
+    session->max_queue_latency   = Clock::duration::zero();
+    session->total_encode_time   = Clock::duration::zero();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (started_)
+    {
+        throw H26xInitFailure("sessions can't be added while the manager is started");
+    }
+    sessions_.push_back(std::move(session));
+    return int(sessions_.size()) - 1;
+}
+
+/// Shares of the budget proportional to the pixel rate of the sessions, at least one thread each.
+/// Rounding every session up to one thread is taken back from the largest shares.
+void EncoderSessionManager::assignThreads()
+{
+    double total_weight = 0;
+    for (auto const& s : sessions_)
+    {
+        total_weight += s->weight;
+    }
+    std::vector<int> shares;
+    int              total = 0;
+    for (auto const& s : sessions_)
+    {
+        shares.push_back(std::max(1, int(cpu_budget_ * s->weight / total_weight)));
+        total += shares.back();
+    }
+    while (total > cpu_budget_)
+    {
+        auto largest = std::max_element(shares.begin(), shares.end());
+        if (*largest <= 1)
+        {
+            break;
+        }
+        (*largest)--;
+        total--;
+    }
+    for (size_t i = 0; i < sessions_.size(); i++)
+    {
+        sessions_[i]->encoder->SetThreadNum(shares[i]);
+    }
+}
+
+void EncoderSessionManager::Start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (started_)
+    {
+        return;
+    }
+    assignThreads();
+    for (auto& session : sessions_)
+    {
+        if (!session->enabled)
+        {
+            session->encoder->Enable();
+            session->enabled = true;
+        }
+        else if (session->flushed)
+        {
+            session->encoder->Restart();
+        }
+        session->flushed = false;
+    }
+    started_  = true;
+    stopping_ = false;
+
+    // a worker only runs while its session's threads fit in the budget, so the budget bounds the pool
+    for (int i = 0; i < cpu_budget_; i++)
+    {
+        workers_.emplace_back(&EncoderSessionManager::workerLoop, this);
+    }
+}
+
+void EncoderSessionManager::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!started_)
+        {
+            return;
+        }
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+    for (auto& worker : workers_)
+    {
+        worker.join();
+    }
+    workers_.clear();
+
+    std::vector<char> output;
+    for (auto& session : sessions_)
+    {
+        if (session->enabled && session->encoder->Flush(output))
+        {
+            session->on_packet(output);
+        }
+        session->flushed = session->enabled;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    started_  = false;
+    stopping_ = false;
+}
+
+bool EncoderSessionManager::Submit(int session_id, uint8_t const* image, size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (session_id < 0 || size_t(session_id) >= sessions_.size() || stopping_)
+        {
+            return false;
+        }
+
+        Session& session = *sessions_[session_id];
+        session.frames_submitted++;
+        // the encoder reads a whole picture from the buffer
+        if (size < session.frame_size || session.queue.size() >= session.queue_size)
+        {
+            session.frames_rejected++;
+            return false;
+        }
+
+        QueuedFrame frame;
+        frame.image.assign(reinterpret_cast<char const*>(image), size);
+        frame.enqueued = Clock::now();
+        frame.deadline = frame.enqueued + session.frame_interval;
+        session.queue.push_back(std::move(frame));
+    }
+    work_available_.notify_one();
+    return true;
+}
+
+/// Earliest deadline first among idle sessions whose threads fit into the remaining budget.
+/// Called with mutex_ held.
+EncoderSessionManager::Session* EncoderSessionManager::pickSession()
+{
+    Session* picked = nullptr;
+    for (auto& session : sessions_)
+    {
+        if (!session->enabled || session->busy || session->queue.empty())
+        {
+            continue;
+        }
+        // an oversized session may still run alone, otherwise it would starve forever
+        int threads = session->encoder->GetThreadNum();
+        if (busy_threads_ > 0 && busy_threads_ + threads > cpu_budget_)
+        {
+            continue;
+        }
+        if (!picked || session->queue.front().deadline < picked->queue.front().deadline)
+        {
+            picked = session.get();
+        }
+    }
+    return picked;
+}
+
+void EncoderSessionManager::workerLoop()
+{
+    H26X_TRACE_THREAD_NAME("session worker");
+    std::vector<char> output;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        Session* session = nullptr;
+        work_available_.wait(lock, [&]() {
+            session = pickSession();
+            if (session || !stopping_)
+            {
+                return session != nullptr;
+            }
+            // stopping, leave once nothing is queued anymore
+            return std::none_of(sessions_.begin(), sessions_.end(),
+                                [](std::unique_ptr<Session> const& s) { return !s->queue.empty(); });
+        });
+        if (!session)
+        {
+            break;
+        }
+
+        QueuedFrame frame = std::move(session->queue.front());
+        session->queue.pop_front();
+        session->busy = true;
+        int threads   = session->encoder->GetThreadNum();
+        busy_threads_ += threads;
+        lock.unlock();
+
+        auto start  = Clock::now();
+        auto end    = start;
+        bool failed = false;
+        try
+        {
+            output.clear();
+            session->encoder->Encode(reinterpret_cast<uint8_t const*>(frame.image.data()), output);
+            end = Clock::now();
+            if (!output.empty())
+            {
+                session->on_packet(output);
+            }
+        }
+        catch (std::exception const& e)
+        {
+            // one bad frame or callback must not take the other sessions down
+            std::cerr << "session " << session->name << ": " << e.what() << std::endl;
+            failed = true;
+        }
+        catch (...)
+        {
+            std::cerr << "session " << session->name << ": unknown error" << std::endl;
+            failed = true;
+        }
+
+        lock.lock();
+        busy_threads_ -= threads;
+        session->busy = false;
+        if (failed)
+        {
+            session->encode_errors++;
+            work_available_.notify_all();
+            continue;
+        }
+
+        Clock::duration queue_latency = start - frame.enqueued;
+        if (session->frames_encoded == 0)
+        {
+            session->first_encoded = end;
+        }
+        session->last_encoded = end;
+        session->frames_encoded++;
+        session->total_queue_latency += queue_latency;
+        session->max_queue_latency = std::max(session->max_queue_latency, queue_latency);
+        session->total_encode_time += end - start;
+        if (end > frame.deadline)
+        {
+            session->deadline_misses++;
+        }
+        work_available_.notify_all();
+    }
+}
+
+std::vector<EncoderSessionStats> EncoderSessionManager::Stats()
+{
+    auto to_ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<EncoderSessionStats> stats;
+    for (auto const& session : sessions_)
+    {
+        EncoderSessionStats s;
+        s.name             = session->name;
+        s.thread_num       = session->encoder->GetThreadNum();
+        s.frames_submitted = session->frames_submitted;
+        s.frames_rejected  = session->frames_rejected;
+        s.frames_encoded   = session->frames_encoded;
+        s.deadline_misses  = session->deadline_misses;
+        s.encode_errors    = session->encode_errors;
+        s.queue_depth      = session->queue.size();
+        if (session->frames_encoded > 0)
+        {
+            double elapsed         = std::chrono::duration<double>(session->last_encoded - session->first_encoded).count();
+            s.fps                  = elapsed > 0 ? (session->frames_encoded - 1) / elapsed : 0;
+            s.avg_queue_latency_ms = to_ms(session->total_queue_latency) / session->frames_encoded;
+            s.max_queue_latency_ms = to_ms(session->max_queue_latency);
+            s.avg_encode_ms        = to_ms(session->total_encode_time) / session->frames_encoded;
+        }
+        stats.push_back(s);
+    }
+    return stats;
+}
+
+std::string EncoderSessionManager::Report()
+{
+    std::stringstream ss;
+    ss << "cpu_budget: " << cpu_budget_ << std::endl;
+    ss << std::left << std::setw(16) << "session" << std::right << std::setw(8) << "threads" << std::setw(10)
+       << "encoded" << std::setw(10) << "rejected" << std::setw(8) << "missed" << std::setw(8) << "errors" << std::setw(8) << "queued"
+       << std::setw(10) << "fps" << std::setw(14) << "queue_avg_ms" << std::setw(14) << "queue_max_ms"
+       << std::setw(12) << "encode_ms" << std::endl;
+    ss << std::fixed << std::setprecision(2);
+    for (auto const& s : Stats())
+    {
+        ss << std::left << std::setw(16) << s.name << std::right << std::setw(8) << s.thread_num << std::setw(10)
+           << s.frames_encoded << std::setw(10) << s.frames_rejected << std::setw(8) << s.deadline_misses
+           << std::setw(8) << s.encode_errors << std::setw(8) << s.queue_depth << std::setw(10) << s.fps << std::setw(14) << s.avg_queue_latency_ms
+           << std::setw(14) << s.max_queue_latency_ms << std::setw(12) << s.avg_encode_ms << std::endl;
+    }
+    return ss.str();
+}
@@ -0,0 +1,65 @@
+#include <h26xcodec/encoder_stats.hpp>
+
+#include <iomanip>
+#include <sstream>
+
+double LatencyHistogram::Percentile(double p) const
+{
+    if (count_ == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(count_ * p / 100.0)));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; i++)
+    {
+        seen += buckets_[i];
+        if (seen >= rank)
+        {
+            // the bucket bound can overshoot the largest sample
+            return std::min(bucketUpperUs(i), max_us_);
+        }
+    }
+    return max_us_;
+}
+
+void EncoderStats::Merge(EncoderStats const& other)
+{
+    convert.Merge(other.convert);
+    send.Merge(other.send);
+    queue.Merge(other.queue);
+    total.Merge(other.total);
+    frames_in += other.frames_in;
+    packets_out += other.packets_out;
+    bytes_out += other.bytes_out;
+    key_frames += other.key_frames;
+    send_errors += other.send_errors;
+    untagged += other.untagged;
+    wall_ms = std::max(wall_ms, other.wall_ms);
+}
+
+static void printHistogram(std::stringstream& ss, std::string const& name, LatencyHistogram const& histogram)
+{
+    ss << std::left << std::setw(10) << name << std::right << " p50 " << std::setw(9)
+       << histogram.Percentile(50) / 1000 << " ms  p99 " << std::setw(9) << histogram.Percentile(99) / 1000
+       << " ms  max " << std::setw(9) << histogram.GetMaxUs() / 1000 << " ms  mean " << std::setw(9)
+       << histogram.GetMeanUs() / 1000 << " ms" << std::endl;
+}
+
+std::string EncoderStats::Str() const
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3);
+    ss << "frames_in: " << frames_in << std::endl
+       << "packets_out: " << packets_out << std::endl
+       << "bytes_out: " << bytes_out << std::endl
+       << "key_frames: " << key_frames << std::endl
+       << "send_errors: " << send_errors << std::endl
+       << "untagged_packets: " << untagged << std::endl
+       << "fps: " << GetFps() << std::endl;
+    printHistogram(ss, "convert", convert);
+    printHistogram(ss, "send", send);
+    printHistogram(ss, "queue", queue);
+    printHistogram(ss, "total", total);
+    return ss.str();
+}
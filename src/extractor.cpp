@@ -1,5 +1,8 @@
 #include <h26xcodec/extractor.hpp>
-#include <iostream>
+#include <h26xcodec/frame_ptr.hpp>
+#include <h26xcodec/h26xexceptions.hpp>
+#include <h26xcodec/trace.hpp>
+#include <memory>
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -7,131 +10,178 @@ extern "C" {
 #include <libavcodec/bsf.h>
 }
 
-Extractor::Extractor(std::string source_path):source_file_path(source_path){}
+namespace {
+struct FormatContextDeleter {
+    void operator()(AVFormatContext* ctx) const { InputSource::Close(&ctx); }
+};
 
-void Extractor::extract(std::vector<std::string>& output_frames){
-    AVFormatContext* fmt_ctx = nullptr;
-    if (avformat_open_input(&fmt_ctx, source_file_path.c_str(), nullptr, nullptr) < 0) {
-        std::cerr << "无法打开输入文件" << std::endl;
-        return;
+struct CodecContextDeleter {
+    void operator()(AVCodecContext* ctx) const { avcodec_free_context(&ctx); }
+};
+
+// 错误信息带上 av_strerror 的文字和返回值
+std::string av_error_text(const char* what, int ret) {
+    char errbuf[256];
+    av_strerror(ret, errbuf, sizeof(errbuf));
+    return std::string(what) + ": " + errbuf + " (ret=" + std::to_string(ret) + ")";
+}
+}  // namespace
+
+PacketReader::PacketReader(const InputSource& source, bool annexb) {
+    H26X_TRACE_SCOPE("demux", "open");
+    if (source.OpenProbed(&fmt_ctx) < 0) {
+        throw H26xInitFailure(("cannot open " + source.GetName()).c_str());
     }
-    if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
-        std::cerr << "无法获取流信息" << std::endl;
-        avformat_close_input(&fmt_ctx);
-        return;
+    init(annexb, source.GetName());
+}
+
+PacketReader::PacketReader(VideoReader& probed, bool annexb) {
+    // 接过 VideoReader 已经打开并探测过的上下文，不再打开一次
+    fmt_ctx = probed.Release();
+    if (!fmt_ctx) {
+        throw H26xInitFailure("the video reader has no opened source");
     }
+    init(annexb, fmt_ctx->url ? fmt_ctx->url : "");
+}
+
+void PacketReader::init(bool annexb, const std::string& name) {
+    auto fail = [&](const std::string& msg) {
+        av_bsf_free(&bsf_ctx);
+        InputSource::Close(&fmt_ctx);
+        throw H26xInitFailure((msg + " " + name).c_str());
+    };
 
-    int video_stream_index = -1;
     for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
         AVStream* s = fmt_ctx->streams[i];
-        if (s->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) continue;
-        if (s->codecpar->codec_id == AV_CODEC_ID_H264 || s->codecpar->codec_id == AV_CODEC_ID_HEVC) {
+        if (s->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+            (s->codecpar->codec_id == AV_CODEC_ID_H264 || s->codecpar->codec_id == AV_CODEC_ID_HEVC)) {
             video_stream_index = i;
             break;
         }
     }
-    if (video_stream_index < 0) {
-        std::cerr << "未找到 H.26x 视频流" << std::endl;
-        avformat_close_input(&fmt_ctx);
-        return;
-    }
-
-    // 从MP4文件中提取H.26x裸流（Elementary Stream）有两种标准格式：Annex B（带起始码）和AVCC（长度前缀); Annex B可以被大多数h26x解码器播放
-    // 需要保持MP4内部的原始存储格式（用于分析容器结构或直接写回MP4）使用AVCC
-    // BSF: Bitstream Filter
-    const char* bsf_name = (fmt_ctx->streams[video_stream_index]->codecpar->codec_id == AV_CODEC_ID_HEVC)
-                           ? "hevc_mp4toannexb" : "h264_mp4toannexb";
-    const AVBitStreamFilter* bsf = av_bsf_get_by_name(bsf_name);
-    if (!bsf) {
-        std::cerr << "无法找到 BSF: " << bsf_name << std::endl;
-        avformat_close_input(&fmt_ctx);
-        return;
-    }
-
-    AVBSFContext* bsf_ctx = nullptr;
-    if (av_bsf_alloc(bsf, &bsf_ctx) < 0) {
-        avformat_close_input(&fmt_ctx);
-        return;
-    }
-
-    // int avcodec_parameters_copy(AVCodecParameters *dst, const AVCodecParameters *src);
-    // 把一个流的编解码参数复制到另一个目标结构，通常是在设置解码器/编码器或BSF的输入参数时使用
-    // 把MP4视频流的AVCodecParameters复制进BSF的par_in，让h264_mp4toannexb/hevc_mp4toannexb能：
-    // 1. 识别H.264/H.265
-    // 2. 使用extradata（SPS/PPS）做 AVCC → Annex B 转换
-    // 3. 在首个输出packet前正确插入参数集
-    // 如果不做这步，BSF 无法正确处理 extradata，转换结果可能出错
-    if (avcodec_parameters_copy(bsf_ctx->par_in, fmt_ctx->streams[video_stream_index]->codecpar) < 0) {
-        av_bsf_free(&bsf_ctx);
-        avformat_close_input(&fmt_ctx);
-        return;
+    if (video_stream_index < 0) fail("no H.264/H.265 video stream in");
+    AVStream* stream = fmt_ctx->streams[video_stream_index];
+    time_base = stream->time_base;
+    frame_rate = stream->avg_frame_rate;
+
+    // 其他流的 packet 在 libavformat 里就丢掉，不读它们的数据
+    for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
+        if (int(i) != video_stream_index) fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
     }
 
-    if (av_bsf_init(bsf_ctx) < 0) {
-        av_bsf_free(&bsf_ctx);
-        avformat_close_input(&fmt_ctx);
-        return;
+    if (annexb) {
+        const char* bsf_name = stream->codecpar->codec_id == AV_CODEC_ID_HEVC ? "hevc_mp4toannexb" : "h264_mp4toannexb";
+        const AVBitStreamFilter* bsf = av_bsf_get_by_name(bsf_name);
+        if (!bsf) fail(std::string("cannot find bsf ") + bsf_name + " for");
+        if (av_bsf_alloc(bsf, &bsf_ctx) < 0) fail("cannot allocate bsf for");
+        bsf_ctx->time_base_in = stream->time_base;
+        if (avcodec_parameters_copy(bsf_ctx->par_in, stream->codecpar) < 0 || av_bsf_init(bsf_ctx) < 0)
+            fail(std::string("cannot init bsf ") + bsf_name + " for");
     }
 
-    AVPacket pkt;
-    av_init_packet(&pkt);
-    pkt.data = nullptr;
-    pkt.size = 0;
+    input = av_packet_alloc();
+    if (!input) fail("cannot allocate packet for");
+}
+
+PacketReader::~PacketReader() {
+    av_packet_free(&input);
+    av_bsf_free(&bsf_ctx);
+    InputSource::Close(&fmt_ctx);
+}
+
+std::string PacketReader::get_codec_name() const {
+    return fmt_ctx->streams[video_stream_index]->codecpar->codec_id == AV_CODEC_ID_HEVC ? "h265" : "h264";
+}
 
-    while (av_read_frame(fmt_ctx, &pkt) >= 0) {
-        if (pkt.stream_index != video_stream_index) {
-            av_packet_unref(&pkt);
+const AVCodecParameters* PacketReader::get_codec_parameters() const {
+    return bsf_ctx ? bsf_ctx->par_out : fmt_ctx->streams[video_stream_index]->codecpar;
+}
+
+bool PacketReader::next(PacketPtr& packet) {
+    if (!packet) {
+        packet.reset(av_packet_alloc());
+        if (!packet) throw H26xDecodeFailure("cannot allocate packet");
+    }
+    av_packet_unref(packet.get());
+
+    while (true) {
+        if (bsf_ctx) {
+            // BSF 里还有转换好的 packet 先取出来
+            int ret;
+            {
+                H26X_TRACE_SCOPE("demux", "annexb");
+                ret = av_bsf_receive_packet(bsf_ctx, packet.get());
+            }
+            if (ret == 0) return true;
+            if (ret == AVERROR_EOF) return false;
+            if (ret != AVERROR(EAGAIN)) throw H26xDecodeFailure("bitstream filter failed");
+        }
+        if (draining) return false;
+
+        int ret;
+        {
+            H26X_TRACE_SCOPE("demux", "read_frame");
+            ret = av_read_frame(fmt_ctx, input);
+        }
+        if (ret < 0 && ret != AVERROR_EOF) {
+            // 读错误不能当成文件结束，否则截断的输入会被悄悄当成完整的
+            throw H26xDecodeFailure(av_error_text("error reading packet", ret).c_str());
+        }
+        if (ret < 0) {
+            // 文件结束，冲刷 BSF
+            draining = true;
+            if (bsf_ctx) av_bsf_send_packet(bsf_ctx, nullptr);
             continue;
         }
-        if (av_bsf_send_packet(bsf_ctx, &pkt) < 0) {
-            av_packet_unref(&pkt);
-            break;
+        if (input->stream_index != video_stream_index) {
+            av_packet_unref(input);
+            continue;
+        }
+        if (!bsf_ctx) {
+            av_packet_move_ref(packet.get(), input);
+            return true;
         }
-        av_packet_unref(&pkt);
-
-        AVPacket annexb_pkt;
-        av_init_packet(&annexb_pkt);
-        annexb_pkt.data = nullptr;
-        annexb_pkt.size = 0;
-        // int av_bsf_receive_packet(AVBSFContext *ctx, AVPacket *pkt);
-        // 从BSF取出一条已处理过的packet
-        while (av_bsf_receive_packet(bsf_ctx, &annexb_pkt) == 0) {
-            std::string frame(reinterpret_cast<const char*>(annexb_pkt.data), annexb_pkt.size);
-            output_frames.push_back(std::move(frame));
-            av_packet_unref(&annexb_pkt);
+        // av_bsf_send_packet 接管 input 的引用，不复制数据
+        H26X_TRACE_SCOPE("demux", "annexb");
+        if (av_bsf_send_packet(bsf_ctx, input) < 0) {
+            av_packet_unref(input);
+            throw H26xDecodeFailure("bitstream filter rejected a packet");
         }
     }
+}
 
-    AVPacket eos;
-    av_init_packet(&eos);
-    eos.data = nullptr;
-    eos.size = 0;
-    av_bsf_send_packet(bsf_ctx, &eos);
+Extractor::Extractor(std::string source_path):source(InputSource::FromPath(source_path)){}
 
-    AVPacket annexb_pkt;
-    av_init_packet(&annexb_pkt);
-    annexb_pkt.data = nullptr;
-    annexb_pkt.size = 0;
-    while (av_bsf_receive_packet(bsf_ctx, &annexb_pkt) == 0) {
-        std::string frame(reinterpret_cast<const char*>(annexb_pkt.data), annexb_pkt.size);
-        output_frames.push_back(std::move(frame));
-        av_packet_unref(&annexb_pkt);
-    }
+Extractor::Extractor(InputSource source):source(std::move(source)){}
 
-    av_bsf_free(&bsf_ctx);
-    avformat_close_input(&fmt_ctx);
+void Extractor::extract(std::vector<std::string>& output_frames){
+    extract_packets([&](const AVPacket& pkt) {
+        output_frames.emplace_back(reinterpret_cast<const char*>(pkt.data), pkt.size);
+    });
 }
 
-void Extractor::extract_decoded(std::function<void(const AVFrame&)> on_frame) {
-    AVFormatContext* fmt_ctx = nullptr;
-    if (avformat_open_input(&fmt_ctx, source_file_path.c_str(), nullptr, nullptr) < 0) {
-        std::cerr << "无法打开输入文件" << std::endl;
-        return;
+void Extractor::extract_packets(std::function<void(const AVPacket&)> on_packet){
+    PacketReader reader(source);
+    time_base = reader.get_time_base();
+    frame_rate = reader.get_frame_rate();
+    PacketPtr packet;
+    while (reader.next(packet)) {
+        on_packet(*packet);
     }
-    if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
-        std::cerr << "无法获取流信息" << std::endl;
-        avformat_close_input(&fmt_ctx);
-        return;
+}
+
+void Extractor::extract_decoded(std::function<void(const AVFrame&)> on_frame) {
+    // 全部由 RAII 持有，on_frame 抛异常也不泄漏
+    std::unique_ptr<AVFormatContext, FormatContextDeleter> fmt_ctx;
+    {
+        H26X_TRACE_SCOPE("demux", "open");
+        AVFormatContext* opened = nullptr;
+        // 探测一次, 同一个文件再打开时用缓存的流信息, 见 ProbeOptions
+        if (source.OpenProbed(&opened) < 0) {
+            InputSource::Close(&opened);
+            throw H26xInitFailure(("cannot open " + source.GetName()).c_str());
+        }
+        fmt_ctx.reset(opened);
     }
 
     int video_stream_index = -1;
@@ -144,66 +194,71 @@ void Extractor::extract_decoded(std::function<void(const AVFrame&)> on_frame) {
         }
     }
     if (video_stream_index < 0) {
-        std::cerr << "未找到 H.26x 视频流" << std::endl;
-        avformat_close_input(&fmt_ctx);
-        return;
+        throw H26xInitFailure(("no H.264/H.265 video stream in " + source.GetName()).c_str());
     }
+    AVStream* stream = fmt_ctx->streams[video_stream_index];
+    time_base = stream->time_base;
+    frame_rate = stream->avg_frame_rate;
 
-    const AVCodec* codec = avcodec_find_decoder(fmt_ctx->streams[video_stream_index]->codecpar->codec_id);
+    const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
     if (!codec) {
-        std::cerr << "无法找到解码器" << std::endl;
-        avformat_close_input(&fmt_ctx);
-        return;
+        throw H26xInitFailure(("cannot find a decoder for " + source.GetName()).c_str());
     }
-
-    AVCodecContext* ctx = avcodec_alloc_context3(codec);
+    std::unique_ptr<AVCodecContext, CodecContextDeleter> ctx(avcodec_alloc_context3(codec));
     if (!ctx) {
-        avformat_close_input(&fmt_ctx);
-        return;
-    }
-    if (avcodec_parameters_to_context(ctx, fmt_ctx->streams[video_stream_index]->codecpar) < 0) {
-        avcodec_free_context(&ctx);
-        avformat_close_input(&fmt_ctx);
-        return;
-    }
-    if (avcodec_open2(ctx, codec, nullptr) < 0) {
-        avcodec_free_context(&ctx);
-        avformat_close_input(&fmt_ctx);
-        return;
-    }
-
-    AVFrame* frame = av_frame_alloc();
-    AVPacket pkt;
-    av_init_packet(&pkt);
-    pkt.data = nullptr;
-    pkt.size = 0;
-    if (!frame) {
-        avcodec_free_context(&ctx);
-        avformat_close_input(&fmt_ctx);
-        return;
-    }
-
-    while (av_read_frame(fmt_ctx, &pkt) >= 0) {
-        if (pkt.stream_index != video_stream_index) {
-            av_packet_unref(&pkt);
-            continue;
-        }
-        if (avcodec_send_packet(ctx, &pkt) < 0) {
-            av_packet_unref(&pkt);
-            break;
-        }
-        av_packet_unref(&pkt);
-        while (avcodec_receive_frame(ctx, frame) == 0) {
+        throw H26xInitFailure("cannot allocate decoder context");
+    }
+    int ret = avcodec_parameters_to_context(ctx.get(), stream->codecpar);
+    if (ret < 0) {
+        throw H26xInitFailure(av_error_text("cannot copy codec parameters", ret).c_str());
+    }
+    ret = avcodec_open2(ctx.get(), codec, nullptr);
+    if (ret < 0) {
+        throw H26xInitFailure(av_error_text("cannot open decoder", ret).c_str());
+    }
+
+    FramePtr frame(av_frame_alloc());
+    PacketPtr pkt(av_packet_alloc());
+    if (!frame || !pkt) {
+        throw H26xInitFailure("cannot allocate frame or packet");
+    }
+
+    // 回调不计入解码时间, 它可能在等待下游
+    auto receive_frames = [&]() {
+        while (true) {
+            int ret;
+            {
+                H26X_TRACE_SCOPE("decode", "receive_frame");
+                ret = avcodec_receive_frame(ctx.get(), frame.get());
+            }
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return;
+            if (ret < 0) throw H26xDecodeFailure(av_error_text("error decoding frame", ret).c_str());
+            H26X_TRACE_COUNT(FramesDecoded, 1);
             on_frame(*frame);
         }
-    }
+    };
 
-    avcodec_send_packet(ctx, nullptr);
-    while (avcodec_receive_frame(ctx, frame) == 0) {
-        on_frame(*frame);
+    while (true) {
+        {
+            H26X_TRACE_SCOPE("demux", "read_frame");
+            ret = av_read_frame(fmt_ctx.get(), pkt.get());
+        }
+        // 只有 AVERROR_EOF 是文件结束，截断或读错误不能悄悄当成完整的流
+        if (ret == AVERROR_EOF) break;
+        if (ret < 0) throw H26xDecodeFailure(av_error_text("error reading packet", ret).c_str());
+        if (pkt->stream_index != video_stream_index) {
+            av_packet_unref(pkt.get());
+            continue;
+        }
+        {
+            H26X_TRACE_SCOPE("decode", "send_packet");
+            ret = avcodec_send_packet(ctx.get(), pkt.get());
+        }
+        av_packet_unref(pkt.get());
+        if (ret < 0) throw H26xDecodeFailure(av_error_text("error sending packet", ret).c_str());
+        receive_frames();
     }
 
-    av_frame_free(&frame);
-    avcodec_free_context(&ctx);
-    avformat_close_input(&fmt_ctx);
-}
\ No newline at end of file
+    avcodec_send_packet(ctx.get(), nullptr);
+    receive_frames();
+}
@@ -0,0 +1,270 @@
+extern "C" {
+#include <libavutil/intreadwrite.h>
+}
+
+#include <h26xcodec/frame_archive.hpp>
+#include <h26xcodec/h26xexceptions.hpp>
+#include <h26xcodec/trace.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+constexpr char     kHeaderMagic[8] = {'H', '2', '6', 'X', 'A', 'R', 'C', 'H'};
+constexpr char     kFooterMagic[8] = {'H', '2', '6', 'X', 'I', 'N', 'D', 'X'};
+constexpr uint32_t kVersion        = 1;
+constexpr size_t   kHeaderSize     = 64;
+constexpr size_t   kFormatSize     = 32;
+constexpr size_t   kEntrySize      = 48;
+constexpr size_t   kFooterSize     = 32;
+constexpr size_t   kAlignment      = 64;
+constexpr size_t   kBufferSize     = 1 << 20;
+
+void encodeEntry(FrameArchiveEntry const& entry, uint8_t* out)
+{
+    AV_WL64(out, entry.offset);
+    AV_WL64(out + 8, entry.size);
+    AV_WL64(out + 16, uint64_t(entry.frame_number));
+    AV_WL64(out + 24, uint64_t(entry.pts));
+    AV_WL32(out + 32, entry.width);
+    AV_WL32(out + 36, entry.height);
+    AV_WL32(out + 40, entry.flags);
+    AV_WL32(out + 44, 0);
+}
+
+FrameArchiveEntry decodeEntry(uint8_t const* in)
+{
+    FrameArchiveEntry entry;
+    entry.offset       = AV_RL64(in);
+    entry.size         = AV_RL64(in + 8);
+    entry.frame_number = int64_t(AV_RL64(in + 16));
+    entry.pts          = int64_t(AV_RL64(in + 24));
+    entry.width        = AV_RL32(in + 32);
+    entry.height       = AV_RL32(in + 36);
+    entry.flags        = AV_RL32(in + 40);
+    return entry;
+}
+
+std::string errorMessage(char const* what, std::string const& path)
+{
+    return std::string(what) + " " + path + ": " + std::strerror(errno);
+}
+}  // namespace
+
+FrameArchiveWriter::FrameArchiveWriter(std::string const& path, std::string const& format)
+  : fd_{-1}
+  , path_{path}
+  , offset_{0}
+{
+    if (format.size() >= kFormatSize)
+    {
+        throw H26xInitFailure("frame archive format name too long");
+    }
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0)
+    {
+        throw H26xInitFailure(errorMessage("cannot create", path).c_str());
+    }
+    buffer_.reserve(kBufferSize);
+
+    uint8_t header[kHeaderSize] = {};
+    std::memcpy(header, kHeaderMagic, sizeof(kHeaderMagic));
+    AV_WL32(header + 8, kVersion);
+    AV_WL32(header + 12, uint32_t(kHeaderSize));
+    std::memcpy(header + 16, format.data(), format.size());
+    write(header, sizeof(header));
+}
+
+FrameArchiveWriter::~FrameArchiveWriter()
+{
+    try
+    {
+        Finish();
+    }
+    catch (...)
+    {
+    }
+}
+
+/// Small payloads are gathered into large writes, that is what network file systems want.
+void FrameArchiveWriter::write(void const* data, size_t size)
+{
+    if (buffer_.size() + size > kBufferSize)
+    {
+        flushBuffer();
+    }
+    if (size >= kBufferSize)
+    {
+        buffer_.assign(static_cast<char const*>(data), static_cast<char const*>(data) + size);
+        flushBuffer();
+    }
+    else
+    {
+        buffer_.insert(buffer_.end(), static_cast<char const*>(data), static_cast<char const*>(data) + size);
+    }
+    offset_ += size;
+}
+
+void FrameArchiveWriter::flushBuffer()
+{
+    H26X_TRACE_SCOPE("io", "archive_write");
+    char const* p    = buffer_.data();
+    size_t      left = buffer_.size();
+    while (left > 0)
+    {
+        ssize_t n = ::write(fd_, p, left);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw H26xInitFailure(errorMessage("cannot write", path_).c_str());
+        }
+        p += n;
+        left -= size_t(n);
+    }
+    H26X_TRACE_COUNT(BytesOut, buffer_.size());
+    buffer_.clear();
+}
+
+size_t FrameArchiveWriter::Append(void const* data, size_t size, FrameArchiveEntry entry)
+{
+    if (fd_ < 0)
+    {
+        throw H26xInitFailure("frame archive is finished");
+    }
+    // aligned payloads can be handed to SIMD code or numpy straight from the mapping
+    static const char padding[kAlignment] = {};
+    size_t            pad                 = (kAlignment - offset_ % kAlignment) % kAlignment;
+    write(padding, pad);
+
+    entry.offset = offset_;
+    entry.size   = size;
+    write(data, size);
+    entries_.push_back(entry);
+    return entries_.size() - 1;
+}
+
+void FrameArchiveWriter::Finish()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+
+    try
+    {
+        uint64_t index_offset = offset_;
+        uint8_t  entry[kEntrySize];
+        for (auto const& e : entries_)
+        {
+            encodeEntry(e, entry);
+            write(entry, sizeof(entry));
+        }
+
+        uint8_t footer[kFooterSize];
+        AV_WL64(footer, index_offset);
+        AV_WL64(footer + 8, uint64_t(entries_.size()));
+        AV_WL32(footer + 16, uint32_t(kEntrySize));
+        AV_WL32(footer + 20, kVersion);
+        std::memcpy(footer + 24, kFooterMagic, sizeof(kFooterMagic));
+        write(footer, sizeof(footer));
+        flushBuffer();
+    }
+    catch (...)
+    {
+        // without its footer the file is rejected by readers, don't try again
+        close(fd_);
+        fd_ = -1;
+        throw;
+    }
+
+    int fd = fd_;
+    fd_    = -1;
+    if (close(fd) < 0)
+    {
+        throw H26xInitFailure(errorMessage("cannot close", path_).c_str());
+    }
+}
+
+FrameArchiveReader::FrameArchiveReader(std::string const& path)
+  : map_{nullptr}
+  , map_size_{0}
+  , index_{nullptr}
+  , count_{0}
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw H26xDecodeFailure(errorMessage("cannot open", path).c_str());
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || size_t(st.st_size) < kHeaderSize + kFooterSize)
+    {
+        close(fd);
+        throw H26xDecodeFailure(("not a frame archive: " + path).c_str());
+    }
+    map_size_ = size_t(st.st_size);
+    void* map = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps the file, the descriptor isn't needed any more
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        throw H26xDecodeFailure(errorMessage("cannot map", path).c_str());
+    }
+    map_ = static_cast<uint8_t const*>(map);
+    madvise(map, map_size_, MADV_RANDOM);
+
+    uint8_t const* footer       = map_ + map_size_ - kFooterSize;
+    uint64_t       index_offset = AV_RL64(footer);
+    uint64_t       count        = AV_RL64(footer + 8);
+    if (std::memcmp(map_, kHeaderMagic, sizeof(kHeaderMagic)) != 0 ||
+        std::memcmp(footer + 24, kFooterMagic, sizeof(kFooterMagic)) != 0 || AV_RL32(footer + 16) != kEntrySize ||
+        AV_RL32(footer + 20) != kVersion || index_offset < kHeaderSize || index_offset > map_size_ - kFooterSize ||
+        count > (map_size_ - kFooterSize - index_offset) / kEntrySize ||
+        index_offset + count * kEntrySize != map_size_ - kFooterSize)
+    {
+        munmap(map, map_size_);
+        throw H26xDecodeFailure(("not a complete frame archive: " + path).c_str());
+    }
+    index_ = map_ + index_offset;
+    count_ = size_t(count);
+
+    char const* format = reinterpret_cast<char const*>(map_ + 16);
+    format_.assign(format, strnlen(format, kFormatSize));
+}
+
+FrameArchiveReader::~FrameArchiveReader()
+{
+    munmap(const_cast<uint8_t*>(map_), map_size_);
+}
+
+FrameArchiveEntry FrameArchiveReader::GetEntry(size_t index) const
+{
+    if (index >= count_)
+    {
+        throw std::out_of_range("frame archive index out of range");
+    }
+    return decodeEntry(index_ + index * kEntrySize);
+}
+
+uint8_t const* FrameArchiveReader::GetFrame(size_t index, size_t* size) const
+{
+    FrameArchiveEntry entry        = GetEntry(index);
+    uint64_t          payloads_end = uint64_t(index_ - map_);
+    if (entry.offset < kHeaderSize || entry.offset > payloads_end || entry.size > payloads_end - entry.offset)
+    {
+        throw H26xDecodeFailure("frame archive entry points outside the payloads");
+    }
+    if (size)
+    {
+        *size = size_t(entry.size);
+    }
+    return map_ + entry.offset;
+}
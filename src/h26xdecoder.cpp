@@ -10,6 +10,7 @@ extern "C" {
 
 #include <h26xcodec/h26xdecoder.hpp>
 #include <h26xcodec/converter.hpp>
+#include <h26xcodec/trace.hpp>
 #include <tuple>
 #include <chrono>
 #include <fstream>
@@ -24,7 +25,7 @@ typedef unsigned char ubyte;
 #endif
 
 
-H26xDecoder::H26xDecoder(std::string const& decoder_id):formatContext(nullptr)
+H26xDecoder::H26xDecoder(std::string const& decoder_id, bool export_motion_vectors):formatContext(nullptr)
 {
   AVCodecID codec_id = AV_CODEC_ID_NONE;
   if(decoder_id == "h264")
@@ -50,6 +51,19 @@ H26xDecoder::H26xDecoder(std::string const& decoder_id):formatContext(nullptr)
     context->flags |= AV_CODEC_FLAG2_CHUNKS;
   }  
 
+  // attached to the frames as side data, read them with FrameMotion::Extract
+  if(export_motion_vectors) {
+#ifdef AV_CODEC_FLAG2_EXPORT_MVS
+    context->flags2 |= AV_CODEC_FLAG2_EXPORT_MVS;
+#endif
+#ifdef AV_CODEC_EXPORT_DATA_MVS
+    context->export_side_data |= AV_CODEC_EXPORT_DATA_MVS;
+#endif
+#ifdef AV_CODEC_EXPORT_DATA_VIDEO_ENC_PARAMS
+    context->export_side_data |= AV_CODEC_EXPORT_DATA_VIDEO_ENC_PARAMS;
+#endif
+  }
+
   int err = avcodec_open2(context, codec, nullptr);
   if (err < 0)
     throw H26xInitFailure("cannot open context");
@@ -75,11 +89,13 @@ H26xDecoder::~H26xDecoder()
   av_free(context);
   av_frame_free(&frame);
   delete pkt;
+  InputSource::Close(&formatContext);
 }
 
 
 ptrdiff_t H26xDecoder::parse(const ubyte* in_data, ptrdiff_t in_size)
 {
+  H26X_TRACE_SCOPE("parse", "parse");
   auto nread = av_parser_parse2(parser, context, &pkt->data, &pkt->size, 
                                 in_data, in_size, 
                                 0, 0, AV_NOPTS_VALUE);
@@ -94,6 +110,7 @@ bool H26xDecoder::is_frame_available() const
 
 const AVFrame& H26xDecoder::decode_frame()
 {
+  H26X_TRACE_SCOPE("decode", "decode_frame");
 #if (LIBAVCODEC_VERSION_MAJOR > 56)
   if (!pkt || pkt->size <= 0) {
     throw H26xDecodeFailure("no packet to decode (pkt empty)");
@@ -103,14 +120,16 @@ const AVFrame& H26xDecoder::decode_frame()
   av_packet_unref(pkt);
   if (ret == AVERROR(EAGAIN)) {
     ret = avcodec_receive_frame(context, frame);
-    if (ret == 0) return *frame;
   } else if (ret == 0) {
     ret = avcodec_receive_frame(context, frame);
-    if (ret == 0) return *frame;
     if (ret == AVERROR(EAGAIN)) {
       throw H26xDecodeFailure("decoder needs more packets (EAGAIN)");
     }
   }
+  if (ret == 0) {
+    H26X_TRACE_COUNT(FramesDecoded, 1);
+    return *frame;
+  }
 
   char errbuf[256];
   av_strerror(ret, errbuf, sizeof(errbuf));
@@ -121,23 +140,120 @@ const AVFrame& H26xDecoder::decode_frame()
   int nread = avcodec_decode_video2(context, frame, &got_picture, pkt);
   if (nread < 0 || got_picture == 0)
     throw H26xDecodeFailure("error decoding frame\n");
+  H26X_TRACE_COUNT(FramesDecoded, 1);
   return *frame;
 #endif
 }
 
-void H26xDecoder::decode_video(const std::string& video_path, std::vector<std::shared_ptr<AVFrame>>& decoded_frames){
-  // Open input file
-  int error_code = avformat_open_input(&formatContext, video_path.c_str(), nullptr, nullptr);
-  if(error_code<0){
-    throw H26xDecodeFailure("could't open video");
-  };
-  if(!formatContext){
-    throw H26xDecodeFailure("could't open video");    
+const AVFrame& H26xDecoder::decode_packet(const ubyte* in_data, ptrdiff_t in_size)
+{
+  // not reference counted, avcodec_send_packet copies the data
+  pkt->data = const_cast<ubyte*>(in_data);
+  pkt->size = static_cast<int>(in_size);
+  return decode_frame();
+}
+
+size_t H26xDecoder::receive_frames(const FrameCallback& on_frame)
+{
+  size_t frames = 0;
+  while (true)
+  {
+    int ret;
+    {
+      H26X_TRACE_SCOPE("decode", "receive_frame");
+      ret = avcodec_receive_frame(context, frame);
+    }
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+      return frames;
+    if (ret < 0)
+    {
+      char errbuf[256];
+      av_strerror(ret, errbuf, sizeof(errbuf));
+      std::string msg = std::string("error decoding frame: ") + errbuf;
+      throw H26xDecodeFailure(msg.c_str());
+    }
+    H26X_TRACE_COUNT(FramesDecoded, 1);
+    on_frame(*frame);
+    frames++;
+  }
+}
+
+size_t H26xDecoder::send_and_receive(const FrameCallback& on_frame)
+{
+  // every frame is taken out right after its packet, so the decoder never answers EAGAIN here
+  int ret;
+  {
+    H26X_TRACE_SCOPE("decode", "send_packet");
+    ret = avcodec_send_packet(context, pkt);
+  }
+  av_packet_unref(pkt);
+  if (ret < 0 && ret != AVERROR_INVALIDDATA)
+  {
+    char errbuf[256];
+    av_strerror(ret, errbuf, sizeof(errbuf));
+    std::string msg = std::string("error sending packet: ") + errbuf;
+    throw H26xDecodeFailure(msg.c_str());
   }
+  return receive_frames(on_frame);
+}
+
+size_t H26xDecoder::decode_packet(const AVPacket& packet, const FrameCallback& on_frame)
+{
+  int ret;
+  {
+    H26X_TRACE_SCOPE("decode", "send_packet");
+    ret = avcodec_send_packet(context, &packet);
+  }
+  if (ret < 0 && ret != AVERROR_INVALIDDATA)
+  {
+    char errbuf[256];
+    av_strerror(ret, errbuf, sizeof(errbuf));
+    std::string msg = std::string("error sending packet: ") + errbuf;
+    throw H26xDecodeFailure(msg.c_str());
+  }
+  return receive_frames(on_frame);
+}
+
+size_t H26xDecoder::feed(const ubyte* in_data, ptrdiff_t in_size, const FrameCallback& on_frame)
+{
+  size_t frames = 0;
+  while (in_size > 0)
+  {
+    ptrdiff_t consumed = parse(in_data, in_size);
+    in_data += consumed;
+    in_size -= consumed;
+    if (is_frame_available())
+      frames += send_and_receive(on_frame);
+    else if (consumed == 0)
+      break;
+  }
+  return frames;
+}
 
-  // Find stream information
-  if(avformat_find_stream_info(formatContext, NULL) < 0){
-    throw H26xDecodeFailure("could't find stream information");
+size_t H26xDecoder::flush(const FrameCallback& on_frame)
+{
+  size_t frames = 0;
+  parse(nullptr, 0);
+  if (is_frame_available())
+    frames += send_and_receive(on_frame);
+
+  avcodec_send_packet(context, nullptr);
+  frames += receive_frames(on_frame);
+  avcodec_flush_buffers(context);
+  return frames;
+}
+
+void H26xDecoder::decode_video(const std::string& video_path, std::vector<std::shared_ptr<AVFrame>>& decoded_frames){
+  decode_video(InputSource::FromPath(video_path), decoded_frames);
+}
+
+void H26xDecoder::decode_video(const InputSource& source, std::vector<std::shared_ptr<AVFrame>>& decoded_frames){
+  // Open input file and find stream information (probed as the source's ProbeOptions say), a context
+  // left over from an earlier call is closed first
+  InputSource::Close(&formatContext);
+  int error_code = source.OpenProbed(&formatContext);
+  if(error_code<0 || !formatContext){
+    throw H26xDecodeFailure("could't open video or find stream information");
   }
 
   // Find the first video stream
@@ -174,12 +290,19 @@ void H26xDecoder::decode_video(const std::string& video_path, std::vector<std::s
 
   av_image_fill_arrays(frame->data, frame->linesize, buffer, AV_PIX_FMT_RGB24, context->width, context->height, 1);
 
-  while (av_read_frame(formatContext, pkt) >= 0)
+  while (true)
   {
+    {
+      H26X_TRACE_SCOPE("demux", "read_frame");
+      if (av_read_frame(formatContext, pkt) < 0)
+        break;
+    }
     if(pkt->stream_index == videoStreamIndex){
+      H26X_TRACE_SCOPE("decode", "decode_video");
       int response = avcodec_send_packet(context, pkt);
       if (response >= 0) {
           while (avcodec_receive_frame(context, frame) >= 0) {
+              H26X_TRACE_COUNT(FramesDecoded, 1);
               decoded_frames.push_back(std::make_shared<AVFrame>(*frame));
           }
       }
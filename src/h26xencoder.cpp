@@ -4,16 +4,21 @@ extern "C" {
 #include <libavutil/avutil.h>
 #include <libavutil/frame.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/intreadwrite.h>
 #include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
 #include <libavutil/opt.h>
 #include <libavutil/pixfmt.h>
 #include <libavutil/rational.h>
 #include <libswscale/swscale.h>
 }
 
+#include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <sstream>
 #include <h26xcodec/h26xencoder.hpp>
+#include <h26xcodec/trace.hpp>
 
 void H26xEncoder::Enable()
 {
@@ -70,11 +75,21 @@ void H26xEncoder::createContext()
     /// Frames per second
     context_->time_base.num = 1;
     context_->time_base.den = fps_;
+    if (time_base_.num > 0 && time_base_.den > 0)
+    {
+        /// decoded frames keep the timestamps of their source stream
+        context_->time_base = time_base_;
+    }
     context_->framerate.num = fps_;
     context_->framerate.den = 1;
 
-    /// Only YUV420P for H264|5
+    /// YUV420P for H264|5, NV12 input is handed over as is to encoders which take it (libx264)
+    /// so it needs no conversion at all
     context_->pix_fmt = AV_PIX_FMT_YUV420P;
+    if (input_pixel_format_ == AV_PIX_FMT_NV12 && supportsPixelFormat(AV_PIX_FMT_NV12))
+    {
+        context_->pix_fmt = AV_PIX_FMT_NV12;
+    }
 
     /// Key(intra) frame rate
     /// looks like option not works for H265 :(
@@ -89,11 +104,65 @@ void H26xEncoder::createContext()
     /// [use 3–5 ref per P]
     context_->refs = refs_;
 
+    /// Average bitrate and VBV
+    int64_t bit_rate    = 0;
+    int64_t max_rate    = 0;
+    int     buffer_size = 0;
+    rateControlValues(bit_rate, max_rate, buffer_size);
+    if (bit_rate > 0)
+    {
+        context_->bit_rate = bit_rate;
+    }
+    if (max_rate > 0)
+    {
+        context_->rc_max_rate = max_rate;
+    }
+    if (buffer_size > 0)
+    {
+        context_->rc_buffer_size = buffer_size;
+    }
+    if (rate_control_ == RateControlMode::CBR)
+    {
+        /// HRD conformant CBR, x264 pads with filler data, x265 with strict-cbr
+        context_->rc_min_rate = bit_rate;
+        appendPrivateParam(codec_id_ == AV_CODEC_ID_H265 ? "strict-cbr=1" : "nal-hrd=cbr");
+    }
+    if (intra_refresh_)
+    {
+        appendPrivateParam("intra-refresh=1");
+    }
+
+    /// Segments encoded by different encoders are concatenated, so the first frame of a GOP
+    /// must not reference the previous one.
+    if (closed_gop_)
+    {
+        context_->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+        appendPrivateParam("open-gop=0");
+    }
+
+    if (fixed_gop_ && gop_size_ > 0)
+    {
+        appendPrivateParam("min-keyint=" + std::to_string(gop_size_));
+        appendPrivateParam("scenecut=0");
+    }
+
+    /// crf/qp win over the bitrate in x264/x265, they must not sneak into a bitrate driven mode
+    bool bitrate_mode = rate_control_ != RateControlMode::Options && bit_rate > 0;
     for (auto& option: options_)
     {
+        if (bitrate_mode && (option.first == "crf" || option.first == "qp"))
+        {
+            continue;
+        }
         av_opt_set(context_->priv_data, option.first.c_str(), option.second.c_str(), 0);
     }
 
+    /// Key frames requested by RequestKeyFrame() must be IDR frames, not just I frames
+    av_opt_set_int(context_->priv_data, "forced-idr", 1, 0);
+
+    /// Write the SEI side data added by AddUserDataSei(), nothing is written for frames without
+    av_opt_set_int(context_->priv_data, "udu_sei", 1, 0);
+
     ///// Compression efficiency (slower -> better quality + higher cpu%)
     ///// [ultrafast, superfast, veryfast, faster, fast, medium, slow, slower, veryslow]
     ///// Set this option to "ultrafast" is critical for realtime encoding
@@ -113,6 +182,52 @@ void H26xEncoder::createContext()
     context_->thread_count = thread_num_;
 }
 
+/// Bitrate, maxrate and VBV buffer the rate control mode asks for, 0 leaves a value to the codec.
+void H26xEncoder::rateControlValues(int64_t& bit_rate, int64_t& max_rate, int& buffer_size)
+{
+    bit_rate    = bit_rate_;
+    max_rate    = max_rate_;
+    buffer_size = buffer_size_;
+    switch (rate_control_)
+    {
+        case RateControlMode::CBR:
+            if (bit_rate <= 0)
+            {
+                throw H26xInitFailure("CBR needs a bitrate");
+            }
+            max_rate = bit_rate;
+            break;
+        case RateControlMode::CappedVBR:
+            if (max_rate <= 0)
+            {
+                throw H26xInitFailure("capped VBR needs a maxrate");
+            }
+            break;
+        default:
+            return;
+    }
+    /// one second of maxrate unless told otherwise, smaller buffers mean smaller frame size spikes
+    if (buffer_size <= 0)
+    {
+        buffer_size = int(std::min<int64_t>(max_rate, INT32_MAX));
+    }
+}
+
+/// Append a "key=value" pair to x264-params/x265-params, keeping what the user configured.
+void H26xEncoder::appendPrivateParam(std::string const& param)
+{
+    std::string name = codec_id_ == AV_CODEC_ID_H265 ? "x265-params" : "x264-params";
+    auto        it   = options_.find(name);
+    if (it == options_.end() || it->second.empty())
+    {
+        options_[name] = param;
+    }
+    else if (it->second.find(param) == std::string::npos)
+    {
+        it->second += ":" + param;
+    }
+}
+
 void H26xEncoder::createAVFrameAndAVPacket()
 {
     frame_ = av_frame_alloc();
@@ -132,20 +247,51 @@ void H26xEncoder::createAVFrameAndAVPacket()
         std::abort();
     }
 
+    input_frame_ = av_frame_alloc();
+    if (!input_frame_)
+    {
+        std::cerr << "Could not allocate video frame" << std::endl;
+        std::abort();
+    }
+
     av_init_packet(&packet_);
     packet_.data = nullptr;
     packet_.size = 0;
 }
 
+bool H26xEncoder::supportsPixelFormat(AVPixelFormat format)
+{
+    AVPixelFormat const* formats = nullptr;
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(61, 13, 100)
+    void const* configs     = nullptr;
+    int         num_configs = 0;
+    if (avcodec_get_supported_config(nullptr, codec_, AV_CODEC_CONFIG_PIX_FORMAT, 0, &configs, &num_configs) < 0)
+    {
+        return false;
+    }
+    formats = static_cast<AVPixelFormat const*>(configs);
+#else
+    formats = codec_->pix_fmts;
+#endif
+    for (; formats && *formats != AV_PIX_FMT_NONE; formats++)
+    {
+        if (*formats == format)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 void H26xEncoder::createSwsContext()
 {
-    if (input_pixel_format_ == AV_PIX_FMT_YUV420P)
+    if (input_pixel_format_ == context_->pix_fmt)
     {
         swsContext_ = nullptr;
     }
     else
     {
-        swsContext_ = sws_getContext(width_, height_, input_pixel_format_, width_, height_, AV_PIX_FMT_YUV420P, 0,
+        swsContext_ = sws_getContext(width_, height_, input_pixel_format_, width_, height_, context_->pix_fmt, 0,
                                      nullptr, nullptr, nullptr);
 
         if (!swsContext_)
@@ -156,43 +302,51 @@ void H26xEncoder::createSwsContext()
     }
 }
 
-void H26xEncoder::fillYuv420pFrame(uint8_t const* content)
+void H26xEncoder::fillFrame(uint8_t const* content)
 {
-    int content_size = width_ * height_ * bits_per_pixel_ / 8;
-
-    uint8_t* yData = (uint8_t*)content;
-    uint8_t* uData = (uint8_t*)(content + content_size * 2 / 3);
-    uint8_t* vData = (uint8_t*)(content + content_size * 5 / 6);
-
+    H26X_TRACE_SCOPE("encode", "convert");
+    // ensure avframe buffer is allocated
     int ret = av_frame_make_writable(frame_);
     if (ret < 0)
     {
         throw H26xInitFailure("Allocate new buffer(s) for audio or video data Failed");
     }
 
-    // Copy Y, U, V data to the frame
-    int planeSize = width_ * height_;
-    memcpy(frame_->data[0], yData, planeSize);      // Y plane
-    memcpy(frame_->data[1], uData, planeSize / 4);  // U plane
-    memcpy(frame_->data[2], vData, planeSize / 4);  // V plane
-}
+    // describe the tightly packed input image, no data is touched here
+    uint8_t* inData[4];
+    int      inLineSize[4];
+    av_image_fill_arrays(inData, inLineSize, content, input_pixel_format_, width_, height_, 1);
 
-void H26xEncoder::fillRgb24Frame(uint8_t const* data)
-{
-    // ensure avframe buffer is allocated
-    auto ret = av_frame_make_writable(frame_);
-    if (ret < 0)
+    if (swsContext_)
     {
-        throw H26xInitFailure("Allocate new buffer(s) for audio or video data Failed");
+        // packed RGB/BGR/YUYV or NV12 for a planar-only encoder: one conversion pass into the frame
+        sws_scale(swsContext_, inData, inLineSize, 0, height_, frame_->data, frame_->linesize);
     }
+    else
+    {
+        // same layout as the encoder, copy the planes honouring the frame's line padding
+        av_image_copy(frame_->data, frame_->linesize, const_cast<uint8_t const**>(inData), inLineSize,
+                      input_pixel_format_, width_, height_);
+    }
+}
+
+void H26xEncoder::fillYuv420pFrame(uint8_t const* content)
+{
+    fillFrame(content);
+}
 
-    uint8_t const* inData[1]     = {data};
-    int            inLineSize[1] = {(bits_per_pixel_ * context_->width / 8)};
-    sws_scale(swsContext_, inData, inLineSize, 0, context_->height, frame_->data, frame_->linesize);
+void H26xEncoder::fillRgb24Frame(uint8_t const* data)
+{
+    fillFrame(data);
 }
 
 bool H26xEncoder::sendFrame()
 {
+    /// frame_ is reused, a key frame forced or SEI attached for the previous frame must not stick
+    frame_->flags &= ~AV_FRAME_FLAG_KEY;
+    frame_->pict_type = AVPictureType::AV_PICTURE_TYPE_NONE;
+    av_frame_remove_side_data(frame_, AV_FRAME_DATA_SEI_UNREGISTERED);
+
     if (codec_id_ == AV_CODEC_ID_H265)
     {
         if (gop_size_ >= 0)
@@ -210,8 +364,14 @@ bool H26xEncoder::sendFrame()
         }
     }
 
+    applyKeyFrameRequest(frame_);
+    applyUserData(frame_);
+    applyReconfigure();
+
+    /// the VBV model runs on timestamps, they have to grow steadily
     frame_index_ = (frame_index_ % fps_) + 1;
-    frame_->pts  = frame_index_ % fps_;
+    frame_->pts  = next_pts_++;
+    H26X_TRACE_SCOPE("encode", "send_frame");
     int ret      = avcodec_send_frame(context_, frame_);
     switch (ret)
     {
@@ -232,10 +392,12 @@ bool H26xEncoder::sendFrame()
 
 bool H26xEncoder::recvPacket(std::vector<char>& output)
 {
+    H26X_TRACE_SCOPE("encode", "receive_packet");
     int ret = avcodec_receive_packet(context_, &packet_);
     switch (ret)
     {
         case 0:
+            reportFrameStats(packet_);
             output.assign(reinterpret_cast<char*>(packet_.data), reinterpret_cast<char*>(packet_.data + packet_.size));
             av_packet_unref(&packet_);
             //ret = avcodec_receive_packet(context_, &packet_);
@@ -260,18 +422,372 @@ bool H26xEncoder::recvPacket(std::vector<char>& output)
 
 bool H26xEncoder::Encode(uint8_t const* input, std::vector<char>& output)
 {
+    auto start = statsNow();
     if(input){
-        if (input_pixel_format_ == AV_PIX_FMT_YUV420P)
+        fillFrame(input);
+    }
+    auto converted = statsNow();
+    bool sent      = sendFrame();
+    recordFrame(frame_->pts, start, converted, sent);
+    bool ret = recvPacket(output);
+    takePendingOutput(output);
+    return ret;
+}
+
+bool H26xEncoder::SupportsReconfigure()
+{
+    /// libavcodec's libx264 wrapper compares bitrate, VBV and crf with the running encoder on every frame
+    /// and calls x264_encoder_reconfig(), the other wrappers only read them when opening
+    return codec_ && std::string(codec_->name) == "libx264";
+}
+
+void H26xEncoder::UpdateRateControl(int64_t bit_rate, int64_t max_rate, int buffer_size, double crf)
+{
+    std::lock_guard<std::mutex> lock(reconfigure_mutex_);
+    if (!reconfigure_pending_)
+    {
+        pending_rate_ = RateUpdate{-1, -1, -1, -1};
+    }
+    if (bit_rate >= 0)
+    {
+        pending_rate_.bit_rate = bit_rate;
+    }
+    if (max_rate >= 0)
+    {
+        pending_rate_.max_rate = max_rate;
+    }
+    if (buffer_size >= 0)
+    {
+        pending_rate_.buffer_size = buffer_size;
+    }
+    if (crf >= 0)
+    {
+        pending_rate_.crf = crf;
+    }
+    reconfigure_pending_ = true;
+}
+
+void H26xEncoder::applyKeyFrameRequest(AVFrame* frame)
+{
+    if (force_key_frame_.exchange(false))
+    {
+        frame->flags |= AV_FRAME_FLAG_KEY;
+        frame->pict_type = AVPictureType::AV_PICTURE_TYPE_I;
+    }
+}
+
+void H26xEncoder::applyUserData(AVFrame* frame)
+{
+    for (auto& data : pending_user_data_)
+    {
+        AVFrameSideData* side = av_frame_new_side_data(frame, AV_FRAME_DATA_SEI_UNREGISTERED, data.size());
+        if (!side)
+        {
+            throw H26xInitFailure("Allocate SEI side data Failed");
+        }
+        std::copy(data.begin(), data.end(), side->data);
+    }
+    pending_user_data_.clear();
+}
+
+/// Called in front of every frame, a single atomic load unless a change is pending.
+void H26xEncoder::applyReconfigure()
+{
+    if (!reconfigure_pending_)
+    {
+        return;
+    }
+
+    RateUpdate update;
+    {
+        std::lock_guard<std::mutex> lock(reconfigure_mutex_);
+        update               = pending_rate_;
+        reconfigure_pending_ = false;
+    }
+
+    /// crf wins over the bitrate and is left out of bitrate modes, and x264 can't turn VBV on in a running
+    /// encoder: such updates would change nothing, so they are dropped instead of being counted
+    bool crf_mode = options_.count("crf") && (rate_control_ == RateControlMode::Options || bit_rate_ <= 0);
+    if (crf_mode && update.bit_rate >= 0)
+    {
+        std::cerr << "crf " << options_["crf"] << " drives the rate control, bitrate update ignored" << std::endl;
+        update.bit_rate = -1;
+    }
+    bool bitrate_mode = rate_control_ != RateControlMode::Options && bit_rate_ > 0;
+    if (bitrate_mode && update.crf >= 0)
+    {
+        std::cerr << "the bitrate drives the rate control, crf update ignored" << std::endl;
+        update.crf = -1;
+    }
+    if (crf_mode && SupportsReconfigure() && (update.max_rate >= 0 || update.buffer_size >= 0))
+    {
+        int64_t bit_rate    = 0;
+        int64_t max_rate    = 0;
+        int     buffer_size = 0;
+        rateControlValues(bit_rate, max_rate, buffer_size);
+        if (max_rate <= 0 || buffer_size <= 0)
+        {
+            std::cerr << "VBV is off in crf mode and can't be turned on while encoding, update ignored" << std::endl;
+            update.max_rate    = -1;
+            update.buffer_size = -1;
+        }
+    }
+    if (update.bit_rate < 0 && update.max_rate < 0 && update.buffer_size < 0 && update.crf < 0)
+    {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (update.bit_rate >= 0)
+    {
+        bit_rate_ = update.bit_rate;
+    }
+    if (update.max_rate >= 0)
+    {
+        max_rate_ = update.max_rate;
+    }
+    if (update.buffer_size >= 0)
+    {
+        buffer_size_ = update.buffer_size;
+    }
+    if (update.crf >= 0)
+    {
+        options_["crf"] = std::to_string(update.crf);
+    }
+
+    if (SupportsReconfigure())
+    {
+        /// picked up by the wrapper when this frame is sent, the encoder keeps running
+        int64_t bit_rate    = 0;
+        int64_t max_rate    = 0;
+        int     buffer_size = 0;
+        rateControlValues(bit_rate, max_rate, buffer_size);
+        context_->bit_rate       = bit_rate;
+        context_->rc_max_rate    = max_rate;
+        context_->rc_buffer_size = buffer_size;
+        if (rate_control_ == RateControlMode::CBR)
+        {
+            context_->rc_min_rate = bit_rate;
+        }
+        if (update.crf >= 0 && (rate_control_ == RateControlMode::Options || bit_rate <= 0))
+        {
+            av_opt_set_double(context_->priv_data, "crf", update.crf, 0);
+        }
+    }
+    else
+    {
+        reopen();
+    }
+
+    reconfigure_count_++;
+    last_reconfigure_ms_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// The codec can't change rate control on the fly: drain what it holds and open a new context with the
+/// new settings. The delayed packets are handed out with the next output.
+void H26xEncoder::reopen()
+{
+    H26X_TRACE_SCOPE("encode", "reopen");
+    avcodec_send_frame(context_, nullptr);
+    drainPackets(pending_output_);
+    avcodec_free_context(&context_);
+
+    createContext();
+    if (avcodec_open2(context_, codec_, nullptr) < 0)
+    {
+        throw H26xInitFailure("Could not reopen codec");
+    }
+}
+
+void H26xEncoder::takePendingOutput(std::vector<char>& output)
+{
+    if (!pending_output_.empty())
+    {
+        output.insert(output.begin(), pending_output_.begin(), pending_output_.end());
+        pending_output_.clear();
+    }
+}
+
+/// Append every packet the encoder has ready, returns false once the encoder is fully flushed.
+bool H26xEncoder::drainPackets(std::vector<char>& output)
+{
+    H26X_TRACE_SCOPE("encode", "receive_packet");
+    while (true)
+    {
+        int ret = avcodec_receive_packet(context_, &packet_);
+        if (ret == AVERROR(EAGAIN))
+        {
+            return true;
+        }
+        if (ret < 0)
+        {
+            return false;
+        }
+        reportFrameStats(packet_);
+        output.insert(output.end(), packet_.data, packet_.data + packet_.size);
+        av_packet_unref(&packet_);
+    }
+}
+
+H26xEncoder::StatsClock::time_point H26xEncoder::statsNow()
+{
+    return stats_enabled_ ? StatsClock::now() : StatsClock::time_point{};
+}
+
+static double elapsedUs(H26xEncoder::StatsClock::time_point from, H26xEncoder::StatsClock::time_point to)
+{
+    return std::chrono::duration<double, std::micro>(to - from).count();
+}
+
+/// Tag the frame by pts, its packet carries the same pts whatever the codec's delay and reordering.
+void H26xEncoder::recordFrame(int64_t pts, StatsClock::time_point start, StatsClock::time_point converted,
+                              bool sent)
+{
+    if (!stats_enabled_)
+    {
+        return;
+    }
+
+    auto                        now = StatsClock::now();
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    if (stats_.frames_in == 0)
+    {
+        first_frame_ = start;
+    }
+    stats_.frames_in++;
+    stats_.convert.Record(elapsedUs(start, converted));
+    stats_.send.Record(elapsedUs(converted, now));
+    if (!sent)
+    {
+        stats_.send_errors++;
+        return;
+    }
+    in_flight_[pts] = FrameTiming{start, now};
+    /// frames the codec dropped must not pile up
+    if (in_flight_.size() > 1024)
+    {
+        in_flight_.erase(in_flight_.begin());
+    }
+}
+
+void H26xEncoder::recordPacket(AVPacket const& packet)
+{
+    auto                        now = StatsClock::now();
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.packets_out++;
+    stats_.bytes_out += packet.size;
+    if (packet.flags & AV_PKT_FLAG_KEY)
+    {
+        stats_.key_frames++;
+    }
+
+    auto it = in_flight_.find(packet.pts);
+    if (it == in_flight_.end())
+    {
+        stats_.untagged++;
+    }
+    else
+    {
+        stats_.queue.Record(elapsedUs(it->second.sent, now));
+        stats_.total.Record(elapsedUs(it->second.start, now));
+        in_flight_.erase(it);
+    }
+    stats_.wall_ms = elapsedUs(first_frame_, now) / 1000;
+}
+
+/// The QP comes from the quality stats side data libx264/libx265 attach to every packet.
+void H26xEncoder::reportFrameStats(AVPacket const& packet)
+{
+    H26X_TRACE_COUNT(FramesEncoded, 1);
+    if (stats_enabled_)
+    {
+        recordPacket(packet);
+    }
+    if (!frame_stats_callback_)
+    {
+        return;
+    }
+
+    H26xFrameStats stats;
+    stats.pts       = packet.pts;
+    stats.dts       = packet.dts;
+    stats.size      = packet.size;
+    stats.qp        = -1;
+    stats.pict_type = AV_PICTURE_TYPE_NONE;
+    stats.key       = (packet.flags & AV_PKT_FLAG_KEY) != 0;
+
+    size_t         side_size = 0;
+    uint8_t const* side      = av_packet_get_side_data(&packet, AV_PKT_DATA_QUALITY_STATS, &side_size);
+    if (side && side_size >= 5)
+    {
+        stats.qp        = double(AV_RL32(side)) / FF_QP2LAMBDA;
+        stats.pict_type = static_cast<AVPictureType>(side[4]);
+    }
+    frame_stats_callback_(stats);
+}
+
+bool H26xEncoder::EncodeFrame(AVFrame const& input, std::vector<char>& output)
+{
+    auto     start = statsNow();
+    AVFrame* frame = frame_;
+    if (input.format == context_->pix_fmt && input.width == width_ && input.height == height_)
+    {
+        // same layout as the encoder, reference the decoder's buffers instead of copying them
+        av_frame_unref(input_frame_);
+        if (av_frame_ref(input_frame_, &input) < 0)
         {
-            fillYuv420pFrame(input);
+            throw H26xInitFailure("Reference decoded frame Failed");
         }
-        else if (input_pixel_format_ == AV_PIX_FMT_RGB24)
+        frame = input_frame_;
+    }
+    else
+    {
+        int ret = av_frame_make_writable(frame_);
+        if (ret < 0)
         {
-            fillRgb24Frame(input);
+            throw H26xInitFailure("Allocate new buffer(s) for audio or video data Failed");
         }
+
+        scaleContext_ = sws_getCachedContext(scaleContext_, input.width, input.height, (AVPixelFormat)input.format,
+                                             width_, height_, context_->pix_fmt, SWS_BILINEAR, nullptr, nullptr,
+                                             nullptr);
+        if (!scaleContext_)
+        {
+            throw H26xInitFailure("Could not allocate scale context");
+        }
+        H26X_TRACE_SCOPE("encode", "convert");
+        sws_scale(scaleContext_, input.data, input.linesize, 0, input.height, frame_->data, frame_->linesize);
+    }
+
+    // the picture type and SEI of the source must not leak into the output
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+    frame->flags &= ~AV_FRAME_FLAG_KEY;
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_SEI_UNREGISTERED);
+    frame->pts = input.pts != AV_NOPTS_VALUE ? input.pts : next_pts_;
+    next_pts_  = frame->pts + 1;
+    applyKeyFrameRequest(frame);
+    applyUserData(frame);
+    applyReconfigure();
+
+    auto converted = statsNow();
+    int  ret;
+    {
+        H26X_TRACE_SCOPE("encode", "send_frame");
+        ret = avcodec_send_frame(context_, frame);
+    }
+    recordFrame(frame->pts, start, converted, ret >= 0);
+    if (frame == input_frame_)
+    {
+        av_frame_unref(input_frame_);
+    }
+
+    output.clear();
+    takePendingOutput(output);
+    if (ret < 0 && ret != AVERROR(EAGAIN))
+    {
+        return false;
     }
-    sendFrame();
-    return recvPacket(output);
+    return drainPackets(output);
 }
 
 // void H26xEncoder::flushAll(std::vector<std::string>& tail_frames)
@@ -284,11 +800,16 @@ bool H26xEncoder::Encode(uint8_t const* input, std::vector<char>& output)
 //     }
 // }
 
+/// Drain the encoder, output holds all delayed packets concatenated in Annex B order.
 bool H26xEncoder::Flush(std::vector<char>& output)
 {
+    H26X_TRACE_SCOPE("encode", "flush");
     avcodec_send_frame(context_, nullptr);
-    bool ret = recvPacket(output);
-    return ret;
+    output.clear();
+
+    takePendingOutput(output);
+    drainPackets(output);
+    return !output.empty();
 }
 
 std::string H26xEncoder::Str()
@@ -310,11 +831,19 @@ std::string H26xEncoder::Str()
     ss << "width: " << width_ << std::endl
        << "height: " << height_ << std::endl
        << "input_pixel_format: " << GetInputPixelFormatString() << std::endl
+       << "encoder_pixel_format: " << (context_ ? av_get_pix_fmt_name(context_->pix_fmt) : "none") << std::endl
        << "fps: " << fps_ << std::endl
        << "gop_size: " << gop_size_ << std::endl
        << "max_b_frames: " << max_b_frames_ << std::endl
        << "refs: " << refs_ << std::endl
-       << "thread_num: " << thread_num_ << std::endl;
+       << "thread_num: " << thread_num_ << std::endl
+       << "closed_gop: " << closed_gop_ << std::endl
+       << "fixed_gop: " << fixed_gop_ << std::endl
+       << "rate_control: " << GetRateControlString() << std::endl
+       << "intra_refresh: " << intra_refresh_ << std::endl
+       << "bit_rate: " << bit_rate_ << std::endl
+       << "max_rate: " << max_rate_ << std::endl
+       << "buffer_size: " << buffer_size_ << std::endl;
     for (auto& option : options_)
     {
         ss << "option " << option.first << ": " << option.second << std::endl;
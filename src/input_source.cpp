@@ -0,0 +1,373 @@
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+#include <libavutil/dict.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+#include <h26xcodec/input_source.hpp>
+#include <h26xcodec/trace.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+constexpr int kIoBufferSize = 64 * 1024;
+
+/// The read position of one opened context, a source can be opened several times.
+struct IoState
+{
+    uint8_t const* data;
+    size_t         size;
+    size_t         pos;
+    int            fd;
+};
+
+int readMemory(void* opaque, uint8_t* buf, int buf_size)
+{
+    IoState* state = static_cast<IoState*>(opaque);
+    size_t   n     = std::min(size_t(buf_size), state->size - state->pos);
+    if (n == 0)
+    {
+        return AVERROR_EOF;
+    }
+    std::memcpy(buf, state->data + state->pos, n);
+    state->pos += n;
+    return int(n);
+}
+
+int64_t seekMemory(void* opaque, int64_t offset, int whence)
+{
+    IoState* state = static_cast<IoState*>(opaque);
+    if (whence & AVSEEK_SIZE)
+    {
+        return int64_t(state->size);
+    }
+
+    int64_t pos;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = int64_t(state->pos) + offset;
+            break;
+        case SEEK_END:
+            pos = int64_t(state->size) + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (pos < 0 || pos > int64_t(state->size))
+    {
+        return AVERROR(EINVAL);
+    }
+    state->pos = size_t(pos);
+    return pos;
+}
+
+int readFd(void* opaque, uint8_t* buf, int buf_size)
+{
+    IoState* state = static_cast<IoState*>(opaque);
+    while (true)
+    {
+        ssize_t n = read(state->fd, buf, size_t(buf_size));
+        if (n > 0)
+        {
+            return int(n);
+        }
+        if (n == 0)
+        {
+            return AVERROR_EOF;
+        }
+        if (errno != EINTR)
+        {
+            return AVERROR(errno);
+        }
+    }
+}
+
+void freeIo(AVIOContext* pb)
+{
+    delete static_cast<IoState*>(pb->opaque);
+    // libavformat may have replaced the buffer, free the one the context holds now
+    av_freep(&pb->buffer);
+    avio_context_free(&pb);
+}
+ProbeOptions& defaultProbeOptions()
+{
+    static ProbeOptions probe;
+    return probe;
+}
+
+/// avformat_open_input with the probe limits of the options.
+int openInput(AVFormatContext** ctx, std::string const& name, ProbeOptions const& probe)
+{
+    AVDictionary* options = nullptr;
+    if (probe.probesize > 0)
+    {
+        av_dict_set_int(&options, "probesize", std::max<int64_t>(probe.probesize, 32), 0);
+    }
+    if (probe.analyze_duration_us > 0)
+    {
+        av_dict_set_int(&options, "analyzeduration", probe.analyze_duration_us, 0);
+    }
+    int ret = avformat_open_input(ctx, name.c_str(), nullptr, &options);
+    av_dict_free(&options);
+    return ret;
+}
+
+struct CodecParametersDeleter
+{
+    void operator()(AVCodecParameters* par) const
+    {
+        avcodec_parameters_free(&par);
+    }
+};
+
+/// What avformat_find_stream_info adds to the streams of a file.
+using CodecParametersPtr = std::unique_ptr<AVCodecParameters, CodecParametersDeleter>;
+
+struct CachedStreamInfo
+{
+    std::string                     format;
+    std::vector<CodecParametersPtr> parameters;
+    std::vector<AVRational>         avg_frame_rates;
+    std::vector<AVRational>         r_frame_rates;
+};
+
+constexpr size_t kStreamInfoCacheSize = 64;
+
+std::mutex                              stream_info_mutex;
+std::map<std::string, CachedStreamInfo> stream_info_cache;
+std::deque<std::string>                 stream_info_order;
+
+/// Path, size and modification time, so a rewritten file is probed again. Empty if it can't be stat'ed.
+std::string streamInfoKey(std::string const& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return std::string();
+    }
+    return path + "|" + std::to_string(st.st_size) + "|" + std::to_string(st.st_mtim.tv_sec) + "." +
+           std::to_string(st.st_mtim.tv_nsec);
+}
+
+bool restoreStreamInfo(std::string const& key, AVFormatContext* ctx)
+{
+    std::lock_guard<std::mutex> lock(stream_info_mutex);
+    auto                        it = stream_info_cache.find(key);
+    if (it == stream_info_cache.end() || it->second.format != ctx->iformat->name ||
+        it->second.parameters.size() != ctx->nb_streams)
+    {
+        return false;
+    }
+    for (unsigned i = 0; i < ctx->nb_streams; i++)
+    {
+        if (avcodec_parameters_copy(ctx->streams[i]->codecpar, it->second.parameters[i].get()) < 0)
+        {
+            return false;
+        }
+        ctx->streams[i]->avg_frame_rate = it->second.avg_frame_rates[i];
+        ctx->streams[i]->r_frame_rate   = it->second.r_frame_rates[i];
+    }
+    return true;
+}
+
+void storeStreamInfo(std::string const& key, AVFormatContext const* ctx)
+{
+    CachedStreamInfo info;
+    info.format = ctx->iformat->name;
+    for (unsigned i = 0; i < ctx->nb_streams; i++)
+    {
+        CodecParametersPtr par(avcodec_parameters_alloc());
+        if (!par || avcodec_parameters_copy(par.get(), ctx->streams[i]->codecpar) < 0)
+        {
+            return;
+        }
+        info.parameters.push_back(std::move(par));
+        info.avg_frame_rates.push_back(ctx->streams[i]->avg_frame_rate);
+        info.r_frame_rates.push_back(ctx->streams[i]->r_frame_rate);
+    }
+
+    std::lock_guard<std::mutex> lock(stream_info_mutex);
+    if (stream_info_cache.count(key) == 0)
+    {
+        stream_info_order.push_back(key);
+        if (stream_info_order.size() > kStreamInfoCacheSize)
+        {
+            stream_info_cache.erase(stream_info_order.front());
+            stream_info_order.pop_front();
+        }
+    }
+    stream_info_cache[key] = std::move(info);
+}
+
+/// MP4/MOV and Matroska headers carry size and parameter sets (avcC/hvcC) of every video stream.
+bool headersComplete(AVFormatContext const* ctx)
+{
+    std::string format = ctx->iformat->name;
+    if (format.find("mov") == std::string::npos && format.find("matroska") == std::string::npos)
+    {
+        return false;
+    }
+    bool video = false;
+    for (unsigned i = 0; i < ctx->nb_streams; i++)
+    {
+        AVCodecParameters const* par = ctx->streams[i]->codecpar;
+        if (par->codec_type != AVMEDIA_TYPE_VIDEO)
+        {
+            continue;
+        }
+        if (par->codec_id == AV_CODEC_ID_NONE || par->width <= 0 || par->height <= 0 || par->extradata_size <= 0)
+        {
+            return false;
+        }
+        video = true;
+    }
+    return video;
+}
+}  // namespace
+
+InputSource::InputSource(Kind kind, std::string name)
+  : kind_{kind}
+  , name_{std::move(name)}
+  , data_{nullptr}
+  , size_{0}
+  , fd_{-1}
+  , probe_{defaultProbeOptions()}
+{
+}
+
+void InputSource::SetDefaultProbeOptions(ProbeOptions const& probe)
+{
+    defaultProbeOptions() = probe;
+}
+
+InputSource InputSource::FromPath(std::string const& path)
+{
+    return InputSource(Kind::Path, path);
+}
+
+InputSource InputSource::FromMemory(uint8_t const* data, size_t size)
+{
+    InputSource source(Kind::Memory, "memory");
+    source.data_ = data;
+    source.size_ = size;
+    return source;
+}
+
+InputSource InputSource::FromFd(int fd)
+{
+    InputSource source(Kind::Fd, "fd:" + std::to_string(fd));
+    source.fd_ = fd;
+    return source;
+}
+
+InputSource InputSource::FromArgument(std::string const& argument)
+{
+    return argument == "-" ? FromFd(STDIN_FILENO) : FromPath(argument);
+}
+
+int InputSource::Open(AVFormatContext** fmt_ctx) const
+{
+    if (kind_ == Kind::Path)
+    {
+        return openInput(fmt_ctx, name_, probe_);
+    }
+
+    AVFormatContext* ctx    = avformat_alloc_context();
+    uint8_t*         buffer = static_cast<uint8_t*>(av_malloc(kIoBufferSize));
+    if (!ctx || !buffer)
+    {
+        avformat_free_context(ctx);
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+
+    IoState*     state = new IoState{data_, size_, 0, fd_};
+    AVIOContext* pb    = avio_alloc_context(buffer, kIoBufferSize, 0, state,
+                                            kind_ == Kind::Memory ? readMemory : readFd, nullptr,
+                                            kind_ == Kind::Memory ? seekMemory : nullptr);
+    if (!pb)
+    {
+        delete state;
+        avformat_free_context(ctx);
+        av_free(buffer);
+        return AVERROR(ENOMEM);
+    }
+    pb->seekable = kind_ == Kind::Memory ? AVIO_SEEKABLE_NORMAL : 0;
+
+    ctx->pb = pb;
+    ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    // on failure libavformat frees the format context, never a custom I/O context
+    int ret = openInput(&ctx, name_, probe_);
+    if (ret < 0)
+    {
+        freeIo(pb);
+        return ret;
+    }
+    *fmt_ctx = ctx;
+    return 0;
+}
+
+int InputSource::OpenProbed(AVFormatContext** fmt_ctx) const
+{
+    int ret = Open(fmt_ctx);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    std::string key = kind_ == Kind::Path && probe_.cache ? streamInfoKey(name_) : std::string();
+    if (!key.empty() && restoreStreamInfo(key, *fmt_ctx))
+    {
+        return 0;
+    }
+    if (!probe_.trust_headers || !headersComplete(*fmt_ctx))
+    {
+        H26X_TRACE_SCOPE("demux", "find_stream_info");
+        ret = avformat_find_stream_info(*fmt_ctx, nullptr);
+        if (ret < 0)
+        {
+            Close(fmt_ctx);
+            return ret;
+        }
+    }
+    if (!key.empty())
+    {
+        storeStreamInfo(key, *fmt_ctx);
+    }
+    return 0;
+}
+
+void InputSource::Close(AVFormatContext** fmt_ctx)
+{
+    if (!fmt_ctx || !*fmt_ctx)
+    {
+        return;
+    }
+    if ((*fmt_ctx)->pb)
+    {
+        H26X_TRACE_COUNT(BytesIn, (*fmt_ctx)->pb->bytes_read);
+    }
+    AVIOContext* pb = ((*fmt_ctx)->flags & AVFMT_FLAG_CUSTOM_IO) ? (*fmt_ctx)->pb : nullptr;
+    avformat_close_input(fmt_ctx);
+    if (pb)
+    {
+        freeIo(pb);
+    }
+}
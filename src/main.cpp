@@ -1,281 +1,110 @@
 #include <cxxopts.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
 #include <string>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
-#include <chrono>
 #include <map>
 #include <nlohmann/json.hpp>
+#include <h26xcodec/memory_budget.hpp>
+#include <h26xcodec/pipeline.hpp>
+#include <h26xcodec/run_stats.hpp>
+#include <h26xcodec/trace.hpp>
 #include <h26xcodec/video_reader.hpp>
-#include <h26xcodec/h26xdecoder.hpp>
-#include <h26xcodec/h26xencoder.hpp>
-#include <h26xcodec/converter.hpp>
-#include <h26xcodec/extractor.hpp>
-#include <h26xcodec/h26xexceptions.hpp>
-#include <cstring>
 
 namespace fs = std::filesystem;
 using json = nlohmann::json;
 
-struct EncoderParameters{
-    uint32_t width=0;
-    uint32_t height=0;
-    std::string input_pixel_format;
-    uint32_t gop_size=0;
-    uint32_t fps=25;
-    uint32_t refs=0;
-    uint32_t max_b_frames=0;
-    uint32_t thread_num=4;
-    std::map<std::string, std::string> options{
-        {"preset","veryfast"},
-        {"crf","10"},
-        {"tune","zerolatency"}
-    };
-};
-
-std::string str_tolower(std::string s){
-    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return std::tolower(c); });
-    return s;
-}
-
-bool decode_h26x_to_image(const std::string& source_file_path, const std::string& output_dir_path, const std::string& source_format, const std::string& target_format){
-    fs::path source_path(source_file_path);
-    fs::path output_path(output_dir_path);
-
-    if(!fs::exists(source_path)){
-        throw fs::filesystem_error("source file not exists", std::error_code());
-    }
-
-    H26xDecoder decoder(source_format);
-    size_t len = fs::file_size(source_path);
-    std::ifstream input_stream(source_file_path, std::ios::binary);
-
-    std::string data_in(len, '\0');
-    input_stream.read(&data_in[0], len);
-    ssize_t num_consumed = decoder.parse((unsigned char*)data_in.c_str(), len);
-
-    std::vector<std::shared_ptr<AVFrame>> decoded_frames;
-    decoder.decode_video(source_file_path, decoded_frames);
-
-    if(target_format=="rgb" || target_format=="jpeg" || target_format=="jpg"){
-        ConverterRGB24 converter;
-        int i=0;
-        for(auto frame: decoded_frames){
-            int         w, h;
-            std::tie(w, h)      = width_height(*frame);
-            size_t out_size = converter.predict_size(w, h);
-
-            std::string out_buffer(out_size, '\0');
-            converter.convert(*frame, (unsigned char*)out_buffer.c_str());
-            const std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-
-            std::string output_file_name = std::to_string(now.time_since_epoch().count())+"_"+std::to_string(i)+"."+target_format;
-
-            if(target_format=="jpg" || target_format=="jpeg"){
-                auto converted_jpeg = converter.to_jpeg();
-                out_buffer = *converted_jpeg;
-            }
-            std::ofstream output_stream(output_dir_path+"/"+output_file_name, std::ios::binary);
-            output_stream.write(out_buffer.c_str(), out_size);
-            i++;
-        }
+// every C++ allocation of the tool is counted for --stats, a relaxed load while it's off
+void* operator new(size_t size){
+    RunStats::CountAllocation(size);
+    void* p = std::malloc(size ? size : 1);
+    if(!p){
+        throw std::bad_alloc();
     }
+    return p;
 }
 
-bool decode_mp4_to_image(const std::string& source_file_path, const std::string& output_dir_path, const std::string& source_format, const std::string& target_format){
-    Extractor extractor(source_file_path);
-    std::vector<std::string> frames;
-    extractor.extract(frames);
-
-    std::cout << "read " << frames.size() << " frames" << std::endl;
-
-    H26xDecoder decoder(source_format);
-    ConverterRGB24 converter;
-
-    int output_file_index = 0;
-    for(auto o_frame: frames){
-        size_t num_consumed = 0;
-        if(o_frame.size() > 0){
-            num_consumed = decoder.parse((unsigned char*)o_frame.c_str(), o_frame.size());
-        }
-
-        while (decoder.is_frame_available())
-        {
-            try {
-                const auto& frame = decoder.decode_frame();
-                int         w, h;
-                std::tie(w, h)      = width_height(frame);
-                size_t out_size = converter.predict_size(w, h);
-                std::string out_buffer(out_size, '\0');
-                converter.convert(frame, (unsigned char*)out_buffer.c_str());
-
-                if(target_format=="jpg" || target_format=="jpeg"){
-                    auto converted_jpeg = converter.to_jpeg();
-                    out_buffer = *converted_jpeg;
-                }
-
-                std::string output_file_name = std::to_string(output_file_index) + "." + target_format;
-                std::ofstream output_stream(output_dir_path+"/"+output_file_name, std::ios::binary);
-                output_stream.write(out_buffer.c_str(), out_buffer.size());
-                output_file_index++;
-            } catch (const H26xDecodeFailure& e) {
-                if (std::strstr(e.what(), "EAGAIN"))
-                    break;
-                throw;
-            }
-        }
-    }
-    return true;
+void operator delete(void* p) noexcept{
+    std::free(p);
 }
 
-bool decode_frame_to_image(const std::string& source_file_path, const std::string& output_dir_path, const std::string& source_format, const std::string& target_format){
-    fs::path source_path(source_file_path);
-    fs::path output_dir(output_dir_path);
-
-    if(!fs::exists(source_path)){
-        throw fs::filesystem_error("source file not exists", std::error_code());
-    }
-
-    if(!fs::is_directory(output_dir)){
-        throw fs::filesystem_error("output should be a dir", std::error_code());
-    }
+void operator delete(void* p, size_t) noexcept{
+    std::free(p);
+}
 
-    std::vector<fs::path> frame_files;   
-    if(fs::is_directory(source_path)){
-        for(auto const& dir_entry: fs::directory_iterator(source_path)){
-            if(dir_entry.is_regular_file()){
-                frame_files.emplace_back(dir_entry.path());
-            }
-        }
-    }else{
-        frame_files.emplace_back(source_path);
+void read_encoder_parameters(const json& data, EncoderParameters& encoder_parameters){
+    // keys missing from the file keep their current value
+    encoder_parameters.width = data.value("width", encoder_parameters.width);
+    encoder_parameters.height = data.value("height", encoder_parameters.height);
+    encoder_parameters.input_pixel_format = data.value("input_pixel_format", encoder_parameters.input_pixel_format);
+    encoder_parameters.gop_size = data.value("gop_size", encoder_parameters.gop_size);
+    encoder_parameters.fps = data.value("fps", encoder_parameters.fps);
+    encoder_parameters.refs = data.value("refs", encoder_parameters.refs);
+    encoder_parameters.max_b_frames = data.value("max_b_frames", encoder_parameters.max_b_frames);
+    encoder_parameters.thread_num = data.value("thread_num", encoder_parameters.thread_num);
+    encoder_parameters.rate_control = data.value("rate_control", encoder_parameters.rate_control);
+    encoder_parameters.bitrate = data.value("bitrate", encoder_parameters.bitrate);
+    encoder_parameters.maxrate = data.value("maxrate", encoder_parameters.maxrate);
+    encoder_parameters.bufsize = data.value("bufsize", encoder_parameters.bufsize);
+    encoder_parameters.intra_refresh = data.value("intra_refresh", encoder_parameters.intra_refresh);
+    if(!data.contains("options")){
+        return;
     }
-
-    // sort files in alphabetical order.
-    std::sort(frame_files.begin(), frame_files.end());
-
-    H26xDecoder decoder(source_format);
-    ConverterRGB24 converter;
-
-    uint32_t filename_index = 0;
-    for(uint32_t i=0; i<=frame_files.size(); i++){
-        size_t num_consumed = 0;
-        if(i!=frame_files.size()){
-            fs::path frame_path = frame_files[i];
-            size_t file_size=fs::file_size(frame_path);
-            std::ifstream input_frame(frame_path.string(), std::ios::binary);
-            std::string buffer(file_size,'\0');
-            input_frame.read(&buffer[0], file_size);
-            num_consumed = decoder.parse((unsigned char*)buffer.c_str(), file_size);
+    json options = data["options"];
+    for(auto it=options.begin(); it!=options.end(); ++it){
+        std::string key = it.key();
+        std::string value = it.value();
+        if(encoder_parameters.options.find(key)!=encoder_parameters.options.end()){
+            encoder_parameters.options[key] = value;
         }else{
-            num_consumed = decoder.parse(nullptr, 0);
-        }
-        
-        while (decoder.is_frame_available())
-        {
-            try {
-                const auto& frame = decoder.decode_frame();
-                int         w, h;
-                std::tie(w, h)      = width_height(frame);
-                size_t out_size = converter.predict_size(w, h);
-                std::string out_buffer(out_size, '\0');
-                converter.convert(frame, (unsigned char*)out_buffer.c_str());
-
-                if(target_format=="jpg" || target_format=="jpeg"){
-                    auto converted_jpeg = converter.to_jpeg();
-                    out_buffer = *converted_jpeg;
-                }
-
-                if(filename_index >= frame_files.size()){
-                    break;
-                }
-                size_t last_dot = frame_files[filename_index].string().rfind('.');
-                size_t last_backslash = frame_files[filename_index].string().rfind('/');
-                std::string output_file_name = frame_files[filename_index].string().substr(last_backslash+1, last_dot-last_backslash)+target_format;
-                std::ofstream output_stream(output_dir_path+"/"+output_file_name, std::ios::binary);
-                output_stream.write(out_buffer.c_str(), out_size);
-                filename_index++;
-            } catch (const H26xDecodeFailure& e) {
-                if (std::strstr(e.what(), "EAGAIN"))
-                    break;
-                throw;
-            }
+            encoder_parameters.options.insert({key, value});
         }
     }
 }
 
-bool encode_image_to_frame(const std::string& source_file_path, const std::string& output_file_path, const std::string& source_format, const std::string& target_format, const EncoderParameters& parameters, bool single_file){
-    fs::path source_path(source_file_path);
-    fs::path output_path(output_file_path);
+void read_encoder_config(const std::string& config_path, EncoderParameters& encoder_parameters){
+    std::ifstream config_file(config_path);
+    json data = json::parse(config_file);
+    read_encoder_parameters(data, encoder_parameters);
+}
 
-    if(!fs::exists(source_path)){
-        throw fs::filesystem_error("file not exist", std::error_code());
+// every entry of "renditions" starts from the top level parameters (base) and overrides what it sets
+std::vector<RenditionParameters> read_ladder_config(const std::string& config_path, const EncoderParameters& base){
+    std::ifstream config_file(config_path);
+    json data = json::parse(config_file);
+    if(!data.contains("renditions")){
+        throw cxxopts::exceptions::specification("encoder config has no renditions");
     }
 
-    H26xEncoder encoder(target_format);
-    encoder.SetWidth(parameters.width);
-    encoder.SetHeight(parameters.height);
-    encoder.SetInputPixelFormat(parameters.input_pixel_format);
-    encoder.SetGopSize(parameters.gop_size);
-    encoder.SetFps(parameters.fps);
-    encoder.SetRefs(parameters.refs);
-    encoder.SetMaxBFrames(parameters.max_b_frames);
-    encoder.SetThreadNum(parameters.thread_num);
-    encoder.SetOptions(parameters.options);
-    encoder.Enable();
-
-    std::vector<fs::path> image_files;   
-    for(auto const& dir_entry: fs::directory_iterator(source_path)){
-        if(dir_entry.is_regular_file()){
-            image_files.emplace_back(dir_entry.path());
-        }
+    std::vector<RenditionParameters> renditions;
+    for(auto& item: data["renditions"]){
+        RenditionParameters rendition;
+        rendition.encoder = base;
+        read_encoder_parameters(item, rendition.encoder);
+        rendition.name = item.value("name", std::to_string(rendition.encoder.height)+"p");
+        rendition.output = item.value("output", std::string());
+        renditions.push_back(rendition);
     }
+    return renditions;
+}
 
-    // sort files in alphabetical order.
-    std::sort(image_files.begin(), image_files.end());
-
-    std::ofstream output_file;
-    if(single_file && !fs::is_directory(output_path)){
-        output_file=std::ofstream(output_path.string(), std::ios::binary|std::ios::app);
-    }else if(single_file && fs::is_directory(output_path)){
-        throw fs::filesystem_error("output path can't be a dir when --single setted", std::error_code());
-    }
-
-    ConverterRGB24 converter;
-
-    std::vector<std::vector<char>> output_files;
-    uint32_t i=0;
-    for(fs::path image_path: image_files){
-        size_t file_size=fs::file_size(image_path);
-        std::ifstream input_image(image_path.string(), std::ios::binary);
-        
-        std::string buffer(file_size,'\0');
-        std::vector<char> output;
-        if(source_format=="jpeg" || source_format=="jpg"){
-            std::unique_ptr<std::string> rgbframe = converter.from_jpeg(image_path.string());
-            buffer = *rgbframe;
-        }else{
-            input_image.read(&buffer[0], file_size);
-        }
-
-        encoder.Encode((uint8_t*)buffer.c_str(), output);
-
-        if(single_file){
-            output_file.write(output.data(), output.size());
-        }else{
-            std::ofstream output_stream(output_path.string()+"/"+std::to_string(i)+"."+target_format, std::ios::binary);
-            output_stream.write(output.data(), output.size());
-            i++;
-        }
-    }
+// rate control given on the command line wins over the encoder config
+void read_rate_control_options(const cxxopts::ParseResult& result, EncoderParameters& encoder_parameters){
+    if(result.count("rc")) encoder_parameters.rate_control = result["rc"].as<std::string>();
+    if(result.count("bitrate")) encoder_parameters.bitrate = result["bitrate"].as<int64_t>();
+    if(result.count("maxrate")) encoder_parameters.maxrate = result["maxrate"].as<int64_t>();
+    if(result.count("bufsize")) encoder_parameters.bufsize = result["bufsize"].as<int>();
+    if(result.count("intra_refresh")) encoder_parameters.intra_refresh = result["intra_refresh"].as<bool>();
+}
 
-    std::vector<char> output;
-    encoder.Encode(nullptr, output);
-    if(single_file){
-        output_file.write(output.data(), output.size());
-    }else{
-        std::ofstream output_stream(output_path.string()+"/"+std::to_string(i)+"."+target_format, std::ios::binary);
-        output_stream.write(output.data(), output.size());
-    }
+std::string str_tolower(std::string s){
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return std::tolower(c); });
+    return s;
 }
 
 int main(int argc, char const *argv[])
@@ -287,22 +116,50 @@ int main(int argc, char const *argv[])
         ("d,decode", "docode h26x to image")
         ("v,video", "decode video, only useful with -d")
         ("f,frame", "decode frame, only useful with -d", cxxopts::value<bool>()->default_value("false"))
+        ("archive", "with -d, write every frame into one indexed archive file -o instead of one file per frame", cxxopts::value<bool>()->default_value("false"))
+        ("shm", "with -d, publish every frame in a shared memory ring of this name (/dev/shm) for other processes", cxxopts::value<std::string>()->default_value(""))
+        ("shm_slots", "frames the --shm ring holds, a consumer further behind loses frames", cxxopts::value<int>()->default_value("8"))
+        ("mv", "with -d, write the motion vectors, macroblock QPs and block types of every frame to this file instead of images (H.264 only), - for stdout", cxxopts::value<std::string>()->default_value(""))
+        ("mv_format", "bin or json (one line per frame) for --mv, defaults to json for .json/.jsonl files and bin otherwise", cxxopts::value<std::string>()->default_value(""))
         ("e,encode", "encode image to h26x", cxxopts::value<bool>()->default_value("false"))
+        ("t,transcode", "transcode h264/h265 video to --tf in memory, -o is the output file", cxxopts::value<bool>()->default_value("false"))
+        ("i,info", "print profile, level, resolution, frame rate, frame types and GOP structure of an h264/h265 stream as JSON, parsed from its headers without decoding; to stdout, or to -o", cxxopts::value<bool>()->default_value("false"))
+        ("activity", "find scene changes and motion in an h264/h265 video from frame types, sizes and QPs alone, without decoding; the segments and scene changes as JSON to stdout, or to -o", cxxopts::value<bool>()->default_value("false"))
+        ("activity_threshold", "with --activity, size of a P/B frame over the usual one from which it counts as motion", cxxopts::value<double>()->default_value("2.0"))
+        ("scene_threshold", "with --activity, size of a P/B frame over the usual one from which it counts as a scene change", cxxopts::value<double>()->default_value("4.0"))
+        ("activity_padding", "with --activity, seconds added before and after every segment", cxxopts::value<double>()->default_value("1.0"))
+        ("activity_timeline", "with --activity, add every frame with its size, QP and activity to the JSON", cxxopts::value<bool>()->default_value("false"))
+        ("activity_decode", "with --activity, decode only the segments found to --tf images in this dir", cxxopts::value<std::string>()->default_value(""))
+        ("ladder", "with -t, decode once and encode every rendition of --encoder_config, -o is the output dir", cxxopts::value<bool>()->default_value("false"))
         // ("c,convert", "convert image format", cxxopts::value<bool>()->default_value("false"))
-        ("p,path", "file or dir path", cxxopts::value<std::string>()->default_value("."))
-        ("sf", "the format of source file, for decode is h264/h265, for encode is jpg/png/yuv420p/rgb", cxxopts::value<std::string>()->default_value("h265"))
+        ("p,path", "file or dir path, - reads a stream from stdin (with -d or -t)", cxxopts::value<std::string>()->default_value("."))
+        ("sf", "the format of source file, for decode is h264/h265, for encode is jpg/png/yuv420p/rgb/nv12/bgr/bgra/yuyv", cxxopts::value<std::string>()->default_value("h265"))
         ("tf", "the format of target file, for decode is jpg/png/yuv420p/rgb, for encode is h264/h265", cxxopts::value<std::string>()->default_value("jpeg"))
-        ("o,output", "output path", cxxopts::value<std::string>()->default_value("."))
+        ("o,output", "output path, - streams to stdout: raw rgb/yuv420p frames with -d, the h26x stream with -t", cxxopts::value<std::string>()->default_value("."))
         ("width", "image width, only for encoder", cxxopts::value<int>()->default_value("0"))
         ("height", "image height, only for encoder", cxxopts::value<int>()->default_value("0"))
-        ("input_pixel_format", "input_pixel_format, only for encoder", cxxopts::value<std::string>()->default_value("RGB24"))
+        ("input_pixel_format", "pixel format of raw input frames, rgb24/bgr24/bgra/yuv420p/nv12/yuyv422, defaults to --sf, only for encoder", cxxopts::value<std::string>()->default_value("RGB24"))
         ("gop_size", "gop size, only for encoder", cxxopts::value<int>()->default_value("0"))
         ("fps", "fps, only for encoder", cxxopts::value<int>()->default_value("25"))
         ("refs", "refs, only for encoder", cxxopts::value<int>()->default_value("1"))
         ("max_b_frames", "max_b_frames, only for encoder", cxxopts::value<int>()->default_value("0"))
         ("thread_num", "thread_num, only for encoder", cxxopts::value<int>()->default_value("4"))
+        ("rc", "rate control options/cbr/vbr, options uses the crf of the encoder config, only for encoder", cxxopts::value<std::string>()->default_value("options"))
+        ("bitrate", "target bitrate in bit/s, only for encoder", cxxopts::value<int64_t>()->default_value("0"))
+        ("maxrate", "VBV max rate in bit/s, cbr uses the bitrate, only for encoder", cxxopts::value<int64_t>()->default_value("0"))
+        ("bufsize", "VBV buffer size in bits, defaults to one second of maxrate for cbr/vbr, only for encoder", cxxopts::value<int>()->default_value("0"))
+        ("intra_refresh", "periodic intra refresh instead of key frames, only for encoder", cxxopts::value<bool>()->default_value("false"))
         ("encoder_config", "a json file which include parameters of encoder, only for encoder", cxxopts::value<std::string>()->default_value(" "))
         ("single", "encode to a single file, only for encoder", cxxopts::value<bool>()->default_value("false"))
+        ("stats", "print frames, fps, bytes, peak memory, allocations and time per stage at the end, and the per-frame encode latency (p50/p99/max) when encoding", cxxopts::value<bool>()->default_value("false"))
+        ("stats_json", "with --stats, also write the report as JSON to this file", cxxopts::value<std::string>()->default_value(""))
+        ("trace", "write a Chrome trace (chrome://tracing, Perfetto) of the run to this file", cxxopts::value<std::string>()->default_value(""))
+        ("writer", "how per-frame output files are written: auto (io_uring if available), uring, threads or sync", cxxopts::value<std::string>()->default_value("auto"))
+        ("max_memory", "with -d to image files and -t, bound the frames and files queued between the stages to this many bytes (512M, 2G), the producer waits when it is used up; the peak is printed at the end", cxxopts::value<std::string>()->default_value("0"))
+        ("probesize", "bytes libavformat reads to find the streams of a container, 0 keeps its default (5 MB)", cxxopts::value<int64_t>()->default_value("0"))
+        ("analyzeduration", "microseconds of a container libavformat analyzes to find its streams, 0 keeps its default (5 s)", cxxopts::value<int64_t>()->default_value("0"))
+        ("trust_headers", "take the codec parameters of MP4/MKV from the container header instead of probing the first frames", cxxopts::value<bool>()->default_value("false"))
+        ("segments", "number of GOP aligned segments encoded in parallel, only for encoder", cxxopts::value<int>()->default_value("1"))
         ;
     auto result = options.parse(argc, argv);
 
@@ -310,16 +167,88 @@ int main(int argc, char const *argv[])
         std::cout << options.help() << std::endl;
     }
 
+    // stdout carries the stream, every message goes to stderr then
+    bool stream_output = result["output"].as<std::string>()=="-";
+    if(stream_output || result["mv"].as<std::string>()=="-"){
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+
+    std::string trace_path = result["trace"].as<std::string>();
+    if(!trace_path.empty()){
+        Tracer::Instance().Start();
+        H26X_TRACE_THREAD_NAME("main");
+    }
+
+    bool print_stats = result["stats"].as<bool>();
+    RunStats run_stats;
+    if(print_stats){
+        RunStats::EnableAllocationCounting();
+        run_stats.Start();
+    }
+
+    // every container is opened and probed once with these, reopening a file reuses its stream info
+    ProbeOptions probe;
+    probe.probesize = result["probesize"].as<int64_t>();
+    probe.analyze_duration_us = result["analyzeduration"].as<int64_t>();
+    probe.trust_headers = result["trust_headers"].as<bool>();
+    InputSource::SetDefaultProbeOptions(probe);
+
+    size_t max_memory = 0;
+    try{
+        max_memory = MemoryBudget::ParseSize(result["max_memory"].as<std::string>());
+    }catch(const std::invalid_argument& e){
+        throw cxxopts::exceptions::specification(std::string("--max_memory: ") + e.what());
+    }
+
     bool opt_decode = result["decode"].as<bool>();
     bool opt_encode = result["encode"].as<bool>();
+    bool opt_transcode = result["transcode"].as<bool>();
+    bool opt_info = result["info"].as<bool>();
+    bool opt_activity = result["activity"].as<bool>();
     // bool opt_convert = result["convert"].as<bool>();
-    if(opt_decode && opt_encode){
-        throw cxxopts::exceptions::specification("decode or encode can only be chosen one at a time");
+    if(int(opt_decode) + int(opt_encode) + int(opt_transcode) + int(opt_info) + int(opt_activity) > 1){
+        throw cxxopts::exceptions::specification("decode, encode, transcode, info or activity can only be chosen one at a time");
     }
 
     std::string source_format = str_tolower(result["sf"].as<std::string>());
     std::string target_format = str_tolower(result["tf"].as<std::string>());
-    if(opt_decode){
+    if(opt_info){
+        // --sf defaults to h265, only an explicit one overrides what the stream says
+        std::string source_file_path(result["path"].as<std::string>());
+        H26xStreamInfo info = inspect_stream(source_file_path, result.count("sf") ? source_format : "");
+        if(result.count("output") && !stream_output){
+            std::ofstream(result["output"].as<std::string>()) << info.Json() << std::endl;
+        }else{
+            // std::cout may point at stderr, see above
+            std::printf("%s\n", info.Json().c_str());
+        }
+    }else if(opt_activity){
+        std::string source_file_path(result["path"].as<std::string>());
+        std::string decode_dir = result["activity_decode"].as<std::string>();
+        if(!decode_dir.empty() && target_format!="jpg" && target_format!="jpeg" && target_format!="png" && target_format!="yuv420p" && target_format!="rgb"){
+            throw cxxopts::exceptions::specification("illegal target format");
+        }
+        ActivityOptions activity_options;
+        activity_options.activity_threshold = result["activity_threshold"].as<double>();
+        activity_options.scene_threshold = result["scene_threshold"].as<double>();
+        activity_options.padding_seconds = result["activity_padding"].as<double>();
+        ActivityReport report = analyze_activity(source_file_path, result.count("sf") ? source_format : "", activity_options);
+        bool json_to_file = result.count("output") && !stream_output;
+        if(!json_to_file){
+            // stdout is the JSON's
+            std::cout.rdbuf(std::cerr.rdbuf());
+        }
+        std::cout << report.Str();
+        if(!decode_dir.empty()){
+            fs::create_directories(decode_dir);
+            decode_active_segments(source_file_path, report, decode_dir, target_format, result["writer"].as<std::string>(), max_memory);
+        }
+        if(json_to_file){
+            std::ofstream(result["output"].as<std::string>()) << report.Json(result["activity_timeline"].as<bool>()) << std::endl;
+        }else{
+            std::printf("%s\n", report.Json(result["activity_timeline"].as<bool>()).c_str());
+        }
+    }else if(opt_decode){
         if(target_format!="jpg" && target_format!="jpeg" && target_format!="png" && target_format!="yuv420p" && target_format!="rgb"){
             throw cxxopts::exceptions::specification("illegal target format");
         }
@@ -328,10 +257,38 @@ int main(int argc, char const *argv[])
 
 
         std::cout << "\033[1;32mdecode " + source_file_path + "...\033[0m" <<std::endl;
-        if(result.count("f")){
-            decode_frame_to_image(source_file_path, result["output"].as<std::string>(), source_format, target_format);
+        std::string mv_path = result["mv"].as<std::string>();
+        if(!mv_path.empty()){
+            std::string mv_format = str_tolower(result["mv_format"].as<std::string>());
+            if(mv_format.empty()){
+                std::string extension = str_tolower(fs::path(mv_path).extension().string());
+                mv_format = extension==".json" || extension==".jsonl" ? "json" : "bin";
+            }
+            size_t frames = export_motion_vectors(source_file_path, mv_path, source_format, mv_format);
+            std::cout << "motion vectors of " << frames << " frames written to " << mv_path << std::endl;
+        }else if(!result["shm"].as<std::string>().empty()){
+            if(result["shm_slots"].as<int>() < 2){
+                throw cxxopts::exceptions::specification("--shm_slots needs 2 slots or more");
+            }
+            size_t frames = decode_to_shm(source_file_path, result["shm"].as<std::string>(), source_format, target_format, uint32_t(result["shm_slots"].as<int>()));
+            std::cout << "shared " << frames << " frames through /dev/shm/" << result["shm"].as<std::string>() << std::endl;
+        }else if(result["archive"].as<bool>()){
+            if(stream_output){
+                throw cxxopts::exceptions::specification("--archive needs an output file");
+            }
+            size_t frames = decode_to_archive(source_file_path, result["output"].as<std::string>(), source_format, target_format);
+            std::cout << "archive " << frames << " frames to " << result["output"].as<std::string>() << std::endl;
+        }else if(source_file_path=="-" || stream_output){
+            // a pipe can't be probed twice, --sf h264/h265 is a raw stream and anything else a container
+            if(target_format!="rgb" && target_format!="yuv420p"){
+                throw cxxopts::exceptions::specification("streaming decode writes rgb or yuv420p");
+            }
+            size_t frames = decode_to_stream(source_file_path, result["output"].as<std::string>(), source_format, target_format);
+            std::cout << "decode " << frames << " frames" << std::endl;
+        }else if(result.count("f")){
+            decode_frame_to_image(source_file_path, result["output"].as<std::string>(), source_format, target_format, result["writer"].as<std::string>(), max_memory);
         }else{
-            // check if frame is H264/H265 
+            // check if frame is H264/H265, the probed file is handed on to the MP4 decoder
             VideoReader video_reader(source_file_path);
             video_reader.Open();
             FrameFormat frame_format = video_reader.get_frame_format();
@@ -346,15 +303,15 @@ int main(int argc, char const *argv[])
             }
             if(video_format.find("mp4") != video_format.npos){
                 std::cout << "MP4" << std::endl;
-                decode_mp4_to_image(source_file_path, result["output"].as<std::string>(), source_format, target_format);
+                decode_mp4_to_image(video_reader, result["output"].as<std::string>(), target_format, result["writer"].as<std::string>(), max_memory);
             }else{
                 std::cout << source_format << std::endl;
-                decode_h26x_to_image(source_file_path, result["output"].as<std::string>(), source_format, target_format);
+                decode_h26x_to_image(source_file_path, result["output"].as<std::string>(), source_format, target_format, result["writer"].as<std::string>(), max_memory);
             }
         }
         std::cout << "\033[1;32mdecode " + source_file_path + " complete\033[0m" <<std::endl;
     }else if(opt_encode){
-        if(source_format!="jpg" && source_format!="jpeg" && source_format!="png" && source_format!="yuv420p" && source_format!="rgb"){
+        if(!is_image_format(source_format) && !is_raw_frame_format(source_format)){
             throw cxxopts::exceptions::specification("illegal source format");
         }
         if(target_format!="h264" && target_format!="h265" && target_format!="hevc"){
@@ -363,26 +320,7 @@ int main(int argc, char const *argv[])
         
         EncoderParameters encoder_parameters;
         if(result["encoder_config"].as<std::string>()!=" "){
-            std::ifstream config_file(result["encoder_config"].as<std::string>());
-            json data = json::parse(config_file);
-            encoder_parameters.width = data["width"];
-            encoder_parameters.height = data["height"];
-            encoder_parameters.input_pixel_format = data["input_pixel_format"];
-            encoder_parameters.gop_size = data["gop_size"];
-            encoder_parameters.fps = data["fps"];
-            encoder_parameters.refs = data["refs"];
-            encoder_parameters.max_b_frames = data["max_b_frames"];
-            encoder_parameters.thread_num = data["thread_num"];
-            json options = data["options"];
-            for(auto it=options.begin(); it!=options.end(); ++it){
-                std::string key = it.key();
-                std::string value = it.value();
-                if(encoder_parameters.options.find(key)!=encoder_parameters.options.end()){
-                    encoder_parameters.options[key] = value;
-                }else{
-                    encoder_parameters.options.insert({key, value});
-                }
-            }
+            read_encoder_config(result["encoder_config"].as<std::string>(), encoder_parameters);
         }
 
         if(result["width"].as<int>()){
@@ -396,20 +334,85 @@ int main(int argc, char const *argv[])
             throw cxxopts::exceptions::specification("width and height must be specified");
         }
 
-        encoder_parameters.input_pixel_format=result["input_pixel_format"].as<std::string>();
+        // decoded images are always RGB24, raw frames take the explicit option, then the json config, then --sf
+        if(is_image_format(source_format)){
+            encoder_parameters.input_pixel_format="RGB24";
+        }else if(result.count("input_pixel_format")){
+            encoder_parameters.input_pixel_format=result["input_pixel_format"].as<std::string>();
+        }else if(encoder_parameters.input_pixel_format.empty()){
+            encoder_parameters.input_pixel_format=source_format;
+        }
         encoder_parameters.gop_size=result["gop_size"].as<int>();
         encoder_parameters.fps=result["fps"].as<int>();
         encoder_parameters.refs=result["refs"].as<int>();
         encoder_parameters.max_b_frames=result["max_b_frames"].as<int>();
         encoder_parameters.thread_num=result["thread_num"].as<int>();
+        read_rate_control_options(result, encoder_parameters);
 
         bool output_single_file = result["single"].as<bool>();
+        int segments = result["segments"].as<int>();
 
         std::string source_file_path(result["path"].as<std::string>());
         std::cout << "\033[1;32mencode " + source_file_path + "...\033[0m" <<std::endl;
-        encode_image_to_frame(source_file_path, result["output"].as<std::string>(), source_format, target_format, encoder_parameters, output_single_file);
+        encode_image_to_frame(source_file_path, result["output"].as<std::string>(), source_format, target_format, encoder_parameters, output_single_file, segments, print_stats, result["writer"].as<std::string>());
         std::cout << "\033[1;32mencode " + source_file_path + " complete\033[0m" <<std::endl;
+    }else if(opt_transcode){
+        if(target_format!="h264" && target_format!="h265" && target_format!="hevc"){
+            throw cxxopts::exceptions::specification("illegal target format");
+        }
+
+        // unset values follow the source: its size, its frame rate and the codec's default gop
+        EncoderParameters encoder_parameters;
+        encoder_parameters.fps = 0;
+        encoder_parameters.gop_size = -1;
+        if(result["encoder_config"].as<std::string>()!=" "){
+            read_encoder_config(result["encoder_config"].as<std::string>(), encoder_parameters);
+        }
+        // only the size of the output is scaled, decoded frames are handed over as they are
+        encoder_parameters.input_pixel_format = "YUV420P";
+        if(result.count("width")) encoder_parameters.width = result["width"].as<int>();
+        if(result.count("height")) encoder_parameters.height = result["height"].as<int>();
+        if(result.count("gop_size")) encoder_parameters.gop_size = result["gop_size"].as<int>();
+        if(result.count("fps")) encoder_parameters.fps = result["fps"].as<int>();
+        if(result.count("refs")) encoder_parameters.refs = result["refs"].as<int>();
+        if(result.count("max_b_frames")) encoder_parameters.max_b_frames = result["max_b_frames"].as<int>();
+        if(result.count("thread_num")) encoder_parameters.thread_num = result["thread_num"].as<int>();
+        read_rate_control_options(result, encoder_parameters);
+
+        std::string source_file_path(result["path"].as<std::string>());
+        std::cout << "\033[1;32mtranscode " + source_file_path + "...\033[0m" <<std::endl;
+        if(result["ladder"].as<bool>()){
+            if(source_file_path=="-" || stream_output){
+                throw cxxopts::exceptions::specification("--ladder reads and writes files");
+            }
+            if(result["encoder_config"].as<std::string>()==" "){
+                throw cxxopts::exceptions::specification("--ladder needs the renditions in --encoder_config");
+            }
+            // renditions switch at key frames, so they all share one fixed gop
+            if(encoder_parameters.gop_size <= 0){
+                throw cxxopts::exceptions::specification("--ladder needs a gop_size");
+            }
+            auto renditions = read_ladder_config(result["encoder_config"].as<std::string>(), encoder_parameters);
+            encode_ladder(source_file_path, result["output"].as<std::string>(), target_format, renditions, encoder_parameters.gop_size, print_stats, max_memory);
+        }else{
+            transcode_h26x(source_file_path, result["output"].as<std::string>(), target_format, encoder_parameters, print_stats, max_memory);
+        }
+        std::cout << "\033[1;32mtranscode " + source_file_path + " complete\033[0m" <<std::endl;
+    }
+
+    if(print_stats){
+        RunStatsReport report = run_stats.Stop();
+        std::cout << report.Str();
+        std::string stats_json = result["stats_json"].as<std::string>();
+        if(!stats_json.empty()){
+            std::ofstream(stats_json) << report.Json() << std::endl;
+        }
     }
 
+    if(!trace_path.empty()){
+        Tracer::Instance().Stop();
+        size_t events = Tracer::Instance().WriteChromeTrace(trace_path);
+        std::cout << "trace: " << events << " events written to " << trace_path << std::endl;
+    }
     return 0;
 }
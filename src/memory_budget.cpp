@@ -0,0 +1,133 @@
+#include <h26xcodec/memory_budget.hpp>
+#include <h26xcodec/trace.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+MemoryBudget::MemoryBudget(size_t limit_bytes)
+  : limit_{limit_bytes}
+  , used_{0}
+  , peak_{0}
+  , blocked_seconds_{0}
+{
+}
+
+size_t MemoryBudget::ParseSize(std::string const& text)
+{
+    size_t      end   = 0;
+    double      value = 0;
+    try
+    {
+        value = std::stod(text, &end);
+    }
+    catch (std::exception const&)
+    {
+        throw std::invalid_argument("not a size: " + text);
+    }
+
+    std::string unit = text.substr(end);
+    std::transform(unit.begin(), unit.end(), unit.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (unit.size() > 1 && (unit.back() == 'b' || unit.back() == 'i'))
+    {
+        // 512MB, 512MiB
+        unit.erase(unit.find_first_of("ib", 1));
+    }
+    double scale = 1;
+    if (unit == "k")
+    {
+        scale = 1024.0;
+    }
+    else if (unit == "m")
+    {
+        scale = 1024.0 * 1024;
+    }
+    else if (unit == "g")
+    {
+        scale = 1024.0 * 1024 * 1024;
+    }
+    else if (!unit.empty() && unit != "b")
+    {
+        throw std::invalid_argument("unknown size unit: " + text);
+    }
+    if (value < 0)
+    {
+        throw std::invalid_argument("negative size: " + text);
+    }
+    return size_t(value * scale);
+}
+
+bool MemoryBudget::Acquire(Account& account, size_t bytes, std::atomic<bool> const* cancel)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto cancelled = [&]() { return cancel && cancel->load(std::memory_order_acquire); };
+    auto fits      = [&]() { return limit_ == 0 || account.held == 0 || used_ + bytes <= limit_; };
+    if (!fits() && !cancelled())
+    {
+        H26X_TRACE_SCOPE("queue", "budget_blocked");
+        auto start = Clock::now();
+        released_.wait(lock, [&]() { return fits() || cancelled(); });
+        blocked_seconds_ += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    if (cancelled())
+    {
+        return false;
+    }
+    account.held += bytes;
+    used_ += bytes;
+    peak_ = std::max(peak_, used_);
+    return true;
+}
+
+void MemoryBudget::Release(Account& account, size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bytes = std::min(account.held, bytes);
+        account.held -= bytes;
+        used_ -= bytes;
+    }
+    released_.notify_all();
+}
+
+void MemoryBudget::WakeAll()
+{
+    // taking the lock orders the waiters' check of their cancel flag against the caller's store
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+    released_.notify_all();
+}
+
+size_t MemoryBudget::GetUsed()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return used_;
+}
+
+size_t MemoryBudget::GetPeak()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_;
+}
+
+double MemoryBudget::GetBlockedSeconds()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return blocked_seconds_;
+}
+
+std::string MemoryBudget::Str()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::stringstream           ss;
+    ss << std::fixed << std::setprecision(1) << "peak " << peak_ / (1024.0 * 1024.0) << " MiB";
+    if (limit_ > 0)
+    {
+        ss << " of " << limit_ / (1024.0 * 1024.0) << " MiB";
+    }
+    ss << std::setprecision(2) << ", producers blocked " << blocked_seconds_ << " s";
+    return ss.str();
+}
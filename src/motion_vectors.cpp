@@ -0,0 +1,239 @@
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/motion_vector.h>
+#include <libavutil/video_enc_params.h>
+}
+
+#include <h26xcodec/motion_vectors.hpp>
+
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+int16_t clampToInt16(int32_t value)
+{
+    return int16_t(std::min<int32_t>(std::max<int32_t>(value, INT16_MIN), INT16_MAX));
+}
+}  // namespace
+
+void FrameMotion::Extract(AVFrame const& decoded, uint64_t index)
+{
+    frame   = index;
+    pts     = decoded.best_effort_timestamp != AV_NOPTS_VALUE ? decoded.best_effort_timestamp : decoded.pts;
+    width   = uint16_t(decoded.width);
+    height  = uint16_t(decoded.height);
+    type    = av_get_picture_type_char(decoded.pict_type);
+    flags   = 0;
+    mb_cols = uint16_t((decoded.width + kBlockSize - 1) / kBlockSize);
+    mb_rows = uint16_t((decoded.height + kBlockSize - 1) / kBlockSize);
+    vectors.clear();
+    qp.clear();
+    blocks.clear();
+    size_t cells = size_t(mb_cols) * mb_rows;
+
+    if (AVFrameSideData const* side = av_frame_get_side_data(&decoded, AV_FRAME_DATA_MOTION_VECTORS))
+    {
+        flags |= kHasVectors;
+        blocks.assign(cells, Intra);
+        AVMotionVector const* mvs   = reinterpret_cast<AVMotionVector const*>(side->data);
+        size_t                count = side->size / sizeof(AVMotionVector);
+        vectors.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            AVMotionVector const& mv = mvs[i];
+            MotionVectorRecord    record;
+            record.src_x        = mv.src_x;
+            record.src_y        = mv.src_y;
+            record.dst_x        = mv.dst_x;
+            record.dst_y        = mv.dst_y;
+            record.motion_x     = clampToInt16(mv.motion_x);
+            record.motion_y     = clampToInt16(mv.motion_y);
+            record.w            = mv.w;
+            record.h            = mv.h;
+            record.source       = mv.source < 0 ? -1 : 1;
+            record.motion_scale = uint8_t(std::min<uint16_t>(mv.motion_scale, 255));
+            vectors.push_back(record);
+
+            // every macroblock the block covers, blocks are never larger than one
+            uint8_t kind = mv.source < 0 ? Forward : Backward;
+            int     x    = std::max(0, mv.dst_x - mv.w / 2) / kBlockSize;
+            int     y    = std::max(0, mv.dst_y - mv.h / 2) / kBlockSize;
+            if (x < mb_cols && y < mb_rows)
+            {
+                blocks[size_t(y) * mb_cols + size_t(x)] |= kind;
+            }
+        }
+    }
+
+    if (AVFrameSideData const* side = av_frame_get_side_data(&decoded, AV_FRAME_DATA_VIDEO_ENC_PARAMS))
+    {
+        AVVideoEncParams* params = reinterpret_cast<AVVideoEncParams*>(side->data);
+        if (params->nb_blocks > 0)
+        {
+            flags |= kHasQp;
+            qp.assign(cells, -1);
+            for (unsigned i = 0; i < params->nb_blocks; i++)
+            {
+                AVVideoBlockParams const* block = av_video_enc_params_block(params, i);
+                int                       x     = block->src_x / kBlockSize;
+                int                       y     = block->src_y / kBlockSize;
+                if (x >= 0 && y >= 0 && x < mb_cols && y < mb_rows)
+                {
+                    qp[size_t(y) * mb_cols + size_t(x)] = int8_t(std::min(params->qp + block->delta_qp, 127));
+                }
+            }
+        }
+    }
+}
+
+void FrameMotion::AppendFileHeader(std::string& out)
+{
+    uint8_t header[kFileHeaderSize] = {};
+    AV_WL32(header, kFileMagic);
+    AV_WL16(header + 4, kVersion);
+    out.append(reinterpret_cast<char const*>(header), sizeof(header));
+}
+
+void FrameMotion::AppendBinary(std::string& out) const
+{
+    size_t cells   = size_t(mb_cols) * mb_rows;
+    size_t payload = vectors.size() * kVectorSize + ((flags & kHasQp) ? cells : 0) + ((flags & kHasVectors) ? cells : 0);
+    size_t start   = out.size();
+    out.resize(start + kHeaderSize + payload);
+    uint8_t* p = reinterpret_cast<uint8_t*>(&out[start]);
+
+    AV_WL32(p, kFrameMagic);
+    AV_WL32(p + 4, uint32_t(payload));
+    AV_WL64(p + 8, frame);
+    AV_WL64(p + 16, uint64_t(pts));
+    AV_WL16(p + 24, width);
+    AV_WL16(p + 26, height);
+    AV_WL16(p + 28, mb_cols);
+    AV_WL16(p + 30, mb_rows);
+    AV_WL32(p + 32, uint32_t(vectors.size()));
+    p[36] = uint8_t(type);
+    p[37] = flags;
+    AV_WL16(p + 38, 0);
+    p += kHeaderSize;
+
+    for (MotionVectorRecord const& mv : vectors)
+    {
+        AV_WL16(p, uint16_t(mv.src_x));
+        AV_WL16(p + 2, uint16_t(mv.src_y));
+        AV_WL16(p + 4, uint16_t(mv.dst_x));
+        AV_WL16(p + 6, uint16_t(mv.dst_y));
+        AV_WL16(p + 8, uint16_t(mv.motion_x));
+        AV_WL16(p + 10, uint16_t(mv.motion_y));
+        p[12] = mv.w;
+        p[13] = mv.h;
+        p[14] = uint8_t(mv.source);
+        p[15] = mv.motion_scale;
+        p += kVectorSize;
+    }
+    if (flags & kHasQp)
+    {
+        std::copy(qp.begin(), qp.end(), reinterpret_cast<int8_t*>(p));
+        p += cells;
+    }
+    if (flags & kHasVectors)
+    {
+        std::copy(blocks.begin(), blocks.end(), p);
+    }
+}
+
+size_t FrameMotion::ParseBinary(uint8_t const* data, size_t size)
+{
+    if (size < kHeaderSize)
+    {
+        return 0;
+    }
+    if (AV_RL32(data) != kFrameMagic)
+    {
+        throw std::runtime_error("not a motion vector frame");
+    }
+    size_t payload = AV_RL32(data + 4);
+    if (size < kHeaderSize + payload)
+    {
+        return 0;
+    }
+    frame            = AV_RL64(data + 8);
+    pts              = int64_t(AV_RL64(data + 16));
+    width            = AV_RL16(data + 24);
+    height           = AV_RL16(data + 26);
+    mb_cols          = AV_RL16(data + 28);
+    mb_rows          = AV_RL16(data + 30);
+    size_t count     = AV_RL32(data + 32);
+    type             = char(data[36]);
+    flags            = data[37];
+    size_t cells     = size_t(mb_cols) * mb_rows;
+    size_t needed    = count * kVectorSize + ((flags & kHasQp) ? cells : 0) + ((flags & kHasVectors) ? cells : 0);
+    if (needed != payload)
+    {
+        throw std::runtime_error("corrupt motion vector frame");
+    }
+
+    uint8_t const* p = data + kHeaderSize;
+    vectors.resize(count);
+    for (MotionVectorRecord& mv : vectors)
+    {
+        mv.src_x        = int16_t(AV_RL16(p));
+        mv.src_y        = int16_t(AV_RL16(p + 2));
+        mv.dst_x        = int16_t(AV_RL16(p + 4));
+        mv.dst_y        = int16_t(AV_RL16(p + 6));
+        mv.motion_x     = int16_t(AV_RL16(p + 8));
+        mv.motion_y     = int16_t(AV_RL16(p + 10));
+        mv.w            = p[12];
+        mv.h            = p[13];
+        mv.source       = int8_t(p[14]);
+        mv.motion_scale = p[15];
+        p += kVectorSize;
+    }
+    qp.clear();
+    blocks.clear();
+    if (flags & kHasQp)
+    {
+        qp.assign(reinterpret_cast<int8_t const*>(p), reinterpret_cast<int8_t const*>(p) + cells);
+        p += cells;
+    }
+    if (flags & kHasVectors)
+    {
+        blocks.assign(p, p + cells);
+    }
+    return kHeaderSize + payload;
+}
+
+std::string FrameMotion::Json() const
+{
+    nlohmann::json json;
+    json["frame"] = frame;
+    if (pts != INT64_MIN)
+    {
+        json["pts"] = pts;
+    }
+    json["type"]    = std::string(1, type);
+    json["width"]   = width;
+    json["height"]  = height;
+    json["mb_cols"] = mb_cols;
+    json["mb_rows"] = mb_rows;
+
+    // [src_x, src_y, dst_x, dst_y, w, h, source, motion_x, motion_y, motion_scale] each, objects would triple the size
+    nlohmann::json list = nlohmann::json::array();
+    for (MotionVectorRecord const& mv : vectors)
+    {
+        list.push_back({mv.src_x, mv.src_y, mv.dst_x, mv.dst_y, mv.w, mv.h, mv.source, mv.motion_x, mv.motion_y,
+                        mv.motion_scale});
+    }
+    json["vectors"] = list;
+    if (flags & kHasQp)
+    {
+        json["qp"] = qp;
+    }
+    if (flags & kHasVectors)
+    {
+        json["blocks"] = blocks;
+    }
+    return json.dump();
+}
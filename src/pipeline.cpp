@@ -0,0 +1,926 @@
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/intreadwrite.h>
+#include <libswscale/swscale.h>
+}
+
+#include <h26xcodec/pipeline.hpp>
+#include <h26xcodec/activity_detector.hpp>
+#include <h26xcodec/async_writer.hpp>
+#include <h26xcodec/bitstream_parser.hpp>
+#include <h26xcodec/bounded_queue.hpp>
+#include <h26xcodec/converter.hpp>
+#include <h26xcodec/extractor.hpp>
+#include <h26xcodec/frame_archive.hpp>
+#include <h26xcodec/frame_ptr.hpp>
+#include <h26xcodec/h26xdecoder.hpp>
+#include <h26xcodec/h26xexceptions.hpp>
+#include <h26xcodec/memory_budget.hpp>
+#include <h26xcodec/motion_vectors.hpp>
+#include <h26xcodec/packet_ptr.hpp>
+#include <h26xcodec/rendition_ladder.hpp>
+#include <h26xcodec/segment_encoder.hpp>
+#include <h26xcodec/shm_ring.hpp>
+#include <h26xcodec/trace.hpp>
+#include <h26xcodec/transcoder.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+// "-" is stdin/stdout, read(2)/write(2) go straight to the descriptor so nothing waits in a stdio buffer
+struct StreamFile{
+    int fd;
+
+    StreamFile(const std::string& path, bool output){
+        if(path=="-"){
+            fd = output ? STDOUT_FILENO : STDIN_FILENO;
+            return;
+        }
+        fd = output ? open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644) : open(path.c_str(), O_RDONLY);
+        if(fd<0){
+            throw fs::filesystem_error(output ? "can't open output" : "can't open source", path, std::error_code(errno, std::generic_category()));
+        }
+    }
+
+    ~StreamFile(){
+        if(fd!=STDIN_FILENO && fd!=STDOUT_FILENO){
+            close(fd);
+        }
+    }
+
+    /// 0 at the end of the stream
+    size_t read(void* data, size_t size){
+        H26X_TRACE_SCOPE("io", "read");
+        while(true){
+            ssize_t n = ::read(fd, data, size);
+            if(n>=0){
+                H26X_TRACE_COUNT(BytesIn, n);
+                return size_t(n);
+            }
+            if(errno!=EINTR){
+                throw fs::filesystem_error("read failed", std::error_code(errno, std::generic_category()));
+            }
+        }
+    }
+
+    void write(const void* data, size_t size){
+        H26X_TRACE_SCOPE("io", "write");
+        const char* p = static_cast<const char*>(data);
+        while(size>0){
+            ssize_t n = ::write(fd, p, size);
+            if(n<0){
+                if(errno==EINTR) continue;
+                throw fs::filesystem_error("write failed", std::error_code(errno, std::generic_category()));
+            }
+            p += n;
+            size -= size_t(n);
+            H26X_TRACE_COUNT(BytesOut, n);
+        }
+    }
+};
+}
+
+void RawFrameHeader::write(uint8_t* out) const{
+    AV_WL32(out, magic);
+    AV_WL16(out+4, width);
+    AV_WL16(out+6, height);
+    AV_WL32(out+8, format);
+    AV_WL32(out+12, size);
+    AV_WL64(out+16, uint64_t(pts));
+}
+
+bool RawFrameHeader::read(const uint8_t* in){
+    if(AV_RL32(in)!=kMagic){
+        return false;
+    }
+    magic = kMagic;
+    width = AV_RL16(in+4);
+    height = AV_RL16(in+6);
+    format = AV_RL32(in+8);
+    size = AV_RL32(in+12);
+    pts = int64_t(AV_RL64(in+16));
+    return true;
+}
+
+namespace {
+using SwsContextPtr = std::unique_ptr<SwsContext, decltype(&sws_freeContext)>;
+
+// bytes of the tightly packed rgb24 or yuv420p picture of a frame
+size_t raw_picture_size(const AVFrame& frame, bool yuv){
+    return yuv ? size_t(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, frame.width, frame.height, 1)) : size_t(frame.width)*frame.height*3;
+}
+
+// convert straight into out, raw_picture_size bytes
+void frame_to_raw(const AVFrame& frame, bool yuv, ConverterRGB24& converter, SwsContextPtr& yuv_context, uint8_t* out){
+    int w = frame.width;
+    int h = frame.height;
+    if(!yuv){
+        converter.convert(frame, out);
+        return;
+    }
+    if(frame.format==AV_PIX_FMT_YUV420P){
+        av_image_copy_to_buffer(out, int(raw_picture_size(frame, true)), frame.data, frame.linesize, AV_PIX_FMT_YUV420P, w, h, 1);
+        return;
+    }
+    yuv_context.reset(sws_getCachedContext(yuv_context.release(), w, h, (AVPixelFormat)frame.format, w, h, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr, nullptr, nullptr));
+    if(!yuv_context){
+        throw H26xInitFailure("cannot allocate scale context");
+    }
+    uint8_t* planes[4];
+    int linesizes[4];
+    av_image_fill_arrays(planes, linesizes, out, AV_PIX_FMT_YUV420P, w, h, 1);
+    sws_scale(yuv_context.get(), frame.data, frame.linesize, 0, h, planes, linesizes);
+}
+
+// the picture of a decoded frame as rgb/yuv420p (tightly packed), jpeg or png bytes
+void frame_to_picture(const AVFrame& frame, const std::string& target_format, ConverterRGB24& converter, SwsContextPtr& yuv_context, std::string& picture){
+    bool yuv = target_format=="yuv420p";
+    picture.resize(raw_picture_size(frame, yuv));
+    frame_to_raw(frame, yuv, converter, yuv_context, (uint8_t*)&picture[0]);
+    if(target_format=="jpg" || target_format=="jpeg"){
+        picture = *converter.to_jpeg();
+    }else if(target_format=="png"){
+        picture = *converter.to_png();
+    }
+}
+
+// raw Annex B is fed to the parser as it arrives: the first frame comes out as soon as its bytes are in, no probing
+void decode_annexb(const std::string& source, const std::string& source_format, const H26xDecoder::FrameCallback& on_frame){
+    StreamFile input_stream(source, false);
+    H26xDecoder decoder(source_format=="h264" ? "h264" : "h265");
+    std::vector<unsigned char> chunk(64*1024);
+    size_t n;
+    while((n = input_stream.read(chunk.data(), chunk.size())) > 0){
+        decoder.feed(chunk.data(), ptrdiff_t(n), on_frame);
+    }
+    decoder.flush(on_frame);
+}
+
+// stdin with --sf h264/h265 is fed to the parser as it arrives, anything else goes through libavformat
+void decode_source(const std::string& source, const std::string& source_format, const H26xDecoder::FrameCallback& on_frame){
+    if(source!="-" && !fs::exists(source)){
+        throw fs::filesystem_error("source file not exists", std::error_code());
+    }
+    if(source=="-" && (source_format=="h264" || source_format=="h265" || source_format=="hevc")){
+        decode_annexb(source, source_format, on_frame);
+    }else{
+        Extractor extractor(InputSource::FromArgument(source));
+        extractor.extract_decoded(on_frame);
+    }
+}
+
+// Demux on a thread of its own and decode the Annex B packets as they come, by reference: nothing is copied
+// and nothing goes through the parser again. Packets waiting for the decoder count against budget.
+void decode_packets(PacketReader& reader, MemoryBudget& budget, const H26xDecoder::FrameCallback& on_frame){
+    H26xDecoder decoder(reader.get_codec_name());
+    BoundedQueue<PacketPtr> packets(64, &budget);
+    std::exception_ptr demux_error;
+    std::thread demuxer([&](){
+        H26X_TRACE_THREAD_NAME("demuxer");
+        try{
+            PacketPtr packet;
+            while(reader.next(packet)){
+                size_t bytes = size_t(packet->size);
+                if(!packets.Push(std::move(packet), bytes)){
+                    break;
+                }
+            }
+        }catch(...){
+            demux_error = std::current_exception();
+        }
+        packets.Close();
+    });
+
+    std::exception_ptr decode_error;
+    try{
+        PacketPtr packet;
+        while(packets.Pop(packet)){
+            decoder.decode_packet(*packet, on_frame);
+        }
+        decoder.flush(on_frame);
+    }catch(...){
+        decode_error = std::current_exception();
+        packets.Close();
+    }
+    demuxer.join();
+    if(decode_error){
+        std::rethrow_exception(decode_error);
+    }
+    if(demux_error){
+        std::rethrow_exception(demux_error);
+    }
+}
+
+// Decode on a thread of its own, convert and compress on this one, write in the background. Frames waiting
+// for conversion and images waiting for the disk share one budget (0 only counts), whichever stage falls
+// behind blocks the decoder instead of piling up frames. Returns the number of images.
+size_t decode_to_images(const std::function<void(MemoryBudget&, const H26xDecoder::FrameCallback&)>& decode, const std::string& target_format, const std::string& writer_backend, size_t max_memory, const std::function<std::string(size_t)>& image_path){
+    MemoryBudget budget(max_memory);
+    AsyncFileWriter writer(AsyncFileWriter::ParseBackend(writer_backend), 64 << 20, 4, &budget);
+    BoundedQueue<FramePtr> frames(8, &budget);
+    std::exception_ptr decode_error;
+    std::thread decoder([&](){
+        H26X_TRACE_THREAD_NAME("decoder");
+        try{
+            decode(budget, [&](const AVFrame& frame){
+                // only a reference on the decoder's buffers
+                FramePtr clone(av_frame_clone(&frame));
+                if(clone){
+                    H26X_TRACE_SCOPE("queue", "push");
+                    size_t bytes = FrameBytes(clone.get());
+                    frames.Push(std::move(clone), bytes);
+                }
+            });
+        }catch(...){
+            decode_error = std::current_exception();
+        }
+        frames.Close();
+    });
+
+    std::exception_ptr convert_error;
+    size_t images = 0;
+    try{
+        ConverterRGB24 converter;
+        SwsContextPtr yuv_context(nullptr, &sws_freeContext);
+        FramePtr frame;
+        std::string picture;
+        while(frames.Pop(frame)){
+            frame_to_picture(*frame, target_format, converter, yuv_context, picture);
+            frame.reset();
+            writer.Write(image_path(images), std::move(picture));
+            images++;
+        }
+        writer.Finish();
+    }catch(...){
+        convert_error = std::current_exception();
+        // unblock the decoder, it drops the rest of the stream
+        frames.Close();
+    }
+    decoder.join();
+    if(convert_error){
+        std::rethrow_exception(convert_error);
+    }
+    if(decode_error){
+        std::rethrow_exception(decode_error);
+    }
+    std::cout << writer.GetStats().Str();
+    std::cout << "memory: " << budget.Str() << std::endl;
+    return images;
+}
+}
+
+bool decode_h26x_to_image(const std::string& source_file_path, const std::string& output_dir_path, const std::string& source_format, const std::string& target_format, const std::string& writer_backend, size_t max_memory){
+    if(!fs::exists(source_file_path)){
+        throw fs::filesystem_error("source file not exists", std::error_code());
+    }
+    size_t images = decode_to_images([&](MemoryBudget&, const H26xDecoder::FrameCallback& on_frame){
+        decode_annexb(source_file_path, source_format, on_frame);
+    }, target_format, writer_backend, max_memory, [&](size_t i){
+        const std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
+        return output_dir_path+"/"+std::to_string(now.time_since_epoch().count())+"_"+std::to_string(i)+"."+target_format;
+    });
+    std::cout << "decode " << images << " frames" << std::endl;
+    return true;
+}
+
+bool decode_mp4_to_image(const std::string& source_file_path, const std::string& output_dir_path, const std::string& source_format, const std::string& target_format, const std::string& writer_backend, size_t max_memory){
+    if(!fs::exists(source_file_path)){
+        throw fs::filesystem_error("source file not exists", std::error_code());
+    }
+    VideoReader probed(source_file_path);
+    probed.Open();
+    return decode_mp4_to_image(probed, output_dir_path, target_format, writer_backend, max_memory);
+}
+
+bool decode_mp4_to_image(VideoReader& probed, const std::string& output_dir_path, const std::string& target_format, const std::string& writer_backend, size_t max_memory){
+    PacketReader reader(probed);
+    size_t images = decode_to_images([&](MemoryBudget& budget, const H26xDecoder::FrameCallback& on_frame){
+        decode_packets(reader, budget, on_frame);
+    }, target_format, writer_backend, max_memory, [&](size_t i){
+        return output_dir_path+"/"+std::to_string(i)+"."+target_format;
+    });
+    std::cout << "decode " << images << " frames" << std::endl;
+    return true;
+}
+
+namespace {
+// Run the H26xStreamParser over source: a raw Annex B file (or stdin with an explicit codec) straight from
+// 1 MiB reads, a container packet by packet without probing. on_picture, if set, gets every picture with its
+// time in seconds, NaN for raw streams which have no timestamps.
+H26xStreamInfo parse_stream(const std::string& source, const std::string& source_format, const std::function<void(const H26xPictureInfo&, double)>& on_picture){
+    if(source!="-" && !fs::exists(source)){
+        throw fs::filesystem_error("source file not exists", std::error_code());
+    }
+    bool explicit_codec = source_format=="h264" || source_format=="h265" || source_format=="hevc";
+    std::vector<uint8_t> chunk(1024*1024);
+    size_t n = 0;
+    bool annexb = source=="-" && explicit_codec;
+    std::unique_ptr<StreamFile> input_stream;
+    if(!annexb && source!="-"){
+        // a raw stream starts with a start code, a container never does
+        input_stream = std::make_unique<StreamFile>(source, false);
+        n = input_stream->read(chunk.data(), chunk.size());
+        annexb = n>=4 && chunk[0]==0 && chunk[1]==0 && (chunk[2]==1 || (chunk[2]==0 && chunk[3]==1));
+    }
+
+    if(annexb){
+        if(!input_stream){
+            input_stream = std::make_unique<StreamFile>(source, false);
+            n = input_stream->read(chunk.data(), chunk.size());
+        }
+        std::string codec = explicit_codec ? source_format : H26xStreamParser::DetectCodec(chunk.data(), n);
+        if(codec.empty()){
+            throw H26xInitFailure(("cannot tell h264 from h265 in " + source + ", pass --sf").c_str());
+        }
+        H26xStreamParser parser(codec);
+        if(on_picture){
+            parser.SetPictureCallback([&](const H26xPictureInfo& picture){
+                on_picture(picture, std::nan(""));
+            });
+        }
+        while(n>0){
+            parser.Feed(chunk.data(), n);
+            n = input_stream->read(chunk.data(), chunk.size());
+        }
+        return parser.Finish();
+    }
+
+    // the parameter sets come from the container header, nothing needs probing
+    input_stream.reset();
+    InputSource input = InputSource::FromArgument(source);
+    ProbeOptions probe = input.GetProbeOptions();
+    probe.trust_headers = true;
+    input.SetProbeOptions(probe);
+    PacketReader reader(input);
+    H26xStreamParser parser(reader.get_codec_name());
+    double time_base = av_q2d(reader.get_time_base());
+    if(on_picture){
+        parser.SetPictureCallback([&](const H26xPictureInfo& picture){
+            on_picture(picture, picture.pts==AV_NOPTS_VALUE ? std::nan("") : picture.pts*time_base);
+        });
+    }
+    PacketPtr packet;
+    while(reader.next(packet)){
+        int64_t pts = packet->pts!=AV_NOPTS_VALUE ? packet->pts : packet->dts;
+        parser.FeedAccessUnit(packet->data, size_t(packet->size), pts);
+    }
+    H26xStreamInfo info = parser.Finish();
+    if(info.fps<=0 && reader.get_frame_rate().num>0 && reader.get_frame_rate().den>0){
+        info.fps = av_q2d(reader.get_frame_rate());
+    }
+    return info;
+}
+}
+
+H26xStreamInfo inspect_stream(const std::string& source, const std::string& source_format){
+    return parse_stream(source, source_format, nullptr);
+}
+
+ActivityReport analyze_activity(const std::string& source, const std::string& source_format, const ActivityOptions& options){
+    ActivityDetector detector(options);
+    H26xStreamInfo info = parse_stream(source, source_format, [&](const H26xPictureInfo& picture, double time){
+        detector.Add(picture, time);
+    });
+    return detector.Finish(info.fps);
+}
+
+size_t decode_active_segments(const std::string& source, const ActivityReport& report, const std::string& output_dir_path, const std::string& target_format, const std::string& writer_backend, size_t max_memory){
+    if(source=="-"){
+        throw H26xInitFailure("flagged segments are decoded in a second pass over the file, stdin can't be read twice");
+    }
+    if(!fs::exists(source)){
+        throw fs::filesystem_error("source file not exists", std::error_code());
+    }
+    // every segment decodes from the key frame before it, runs sharing a key frame are decoded in one go
+    struct Run{
+        uint64_t key;
+        uint64_t first;
+        uint64_t last;
+        size_t segment;
+    };
+    std::vector<Run> runs;
+    for(size_t i=0; i<report.segments.size(); i++){
+        const ActivitySegment& segment = report.segments[i];
+        uint64_t key = segment.first_frame;
+        while(key>0 && !report.frames[key].key){
+            key--;
+        }
+        if(!runs.empty() && key<=runs.back().last+1){
+            runs.back().last = std::max(runs.back().last, segment.last_frame);
+            continue;
+        }
+        runs.push_back({key, segment.first_frame, segment.last_frame, i});
+    }
+
+    // image names come from the decoder thread, the images from the converter in the same order
+    std::mutex names_mutex;
+    std::deque<std::string> names;
+    size_t images = decode_to_images([&](MemoryBudget&, const H26xDecoder::FrameCallback& on_frame){
+        PacketReader reader(InputSource::FromPath(source));
+        H26xDecoder decoder(reader.get_codec_name());
+        PacketPtr packet;
+        uint64_t index = 0;
+        size_t run = 0;
+        uint64_t frame = 0;
+        // frames come out in presentation order, the ones before the segment only lead up to it
+        auto keep = [&](const AVFrame& decoded){
+            if(frame >= runs[run].first){
+                std::lock_guard<std::mutex> lock(names_mutex);
+                names.push_back("segment" + std::to_string(runs[run].segment) + "_" + std::to_string(frame));
+                on_frame(decoded);
+            }
+            frame++;
+        };
+        while(run<runs.size() && reader.next(packet)){
+            if(index>=runs[run].key){
+                if(index==runs[run].key){
+                    frame = runs[run].key;
+                }
+                decoder.decode_packet(*packet, keep);
+            }
+            if(index==runs[run].last){
+                decoder.flush(keep);
+                run++;
+            }
+            index++;
+        }
+        if(run<runs.size()){
+            decoder.flush(keep);
+        }
+    }, target_format, writer_backend, max_memory, [&](size_t){
+        std::lock_guard<std::mutex> lock(names_mutex);
+        std::string name = names.front();
+        names.pop_front();
+        return output_dir_path+"/"+name+"."+target_format;
+    });
+    std::cout << "decode " << images << " frames of " << report.segments.size() << " segments" << std::endl;
+    return images;
+}
+
+size_t decode_to_stream(const std::string& source, const std::string& output, const std::string& source_format, const std::string& target_format){
+    bool yuv = target_format=="yuv420p";
+    if(!yuv && target_format!="rgb" && target_format!="rgb24"){
+        throw H26xInitFailure("raw frame streams are rgb or yuv420p");
+    }
+
+    StreamFile output_stream(output, true);
+    ConverterRGB24 converter;
+    SwsContextPtr yuv_context(nullptr, sws_freeContext);
+    std::string picture;
+    uint8_t header_bytes[RawFrameHeader::kSize];
+    size_t frames = 0;
+
+    // one frame in flight: it is converted into a reused buffer and written before the next one is decoded
+    decode_source(source, source_format, [&](const AVFrame& frame){
+        frame_to_picture(frame, target_format, converter, yuv_context, picture);
+        RawFrameHeader header;
+        header.width = uint16_t(frame.width);
+        header.height = uint16_t(frame.height);
+        header.format = yuv ? RawFrameHeader::YUV420P : RawFrameHeader::RGB24;
+        header.size = uint32_t(picture.size());
+        header.pts = frame.pts;
+        header.write(header_bytes);
+        output_stream.write(header_bytes, sizeof(header_bytes));
+        output_stream.write(picture.data(), picture.size());
+        frames++;
+    });
+    return frames;
+}
+
+size_t export_motion_vectors(const std::string& source, const std::string& output, const std::string& source_format, const std::string& format){
+    bool json = format=="json";
+    if(!json && format!="bin"){
+        throw H26xInitFailure("motion vectors are written as bin or json");
+    }
+    if(source!="-" && !fs::exists(source)){
+        throw fs::filesystem_error("source file not exists", std::error_code());
+    }
+
+    StreamFile output_stream(output, true);
+    FrameMotion motion;
+    std::string record;
+    size_t frames = 0;
+    if(!json){
+        FrameMotion::AppendFileHeader(record);
+    }
+    auto on_frame = [&](const AVFrame& frame){
+        motion.Extract(frame, frames++);
+        if(json){
+            record += motion.Json();
+            record += '\n';
+        }else{
+            motion.AppendBinary(record);
+        }
+        output_stream.write(record.data(), record.size());
+        record.clear();
+    };
+
+    std::string codec;
+    auto check_codec = [&](const std::string& name){
+        codec = name;
+        if(codec!="h264"){
+            std::cerr << "the H.265 decoder exports no motion vectors, frames are written without" << std::endl;
+        }
+    };
+    if(source=="-" && (source_format=="h264" || source_format=="h265" || source_format=="hevc")){
+        // raw Annex B from stdin, fed as it arrives
+        check_codec(source_format=="h264" ? "h264" : "h265");
+        StreamFile input_stream(source, false);
+        H26xDecoder decoder(codec, true);
+        std::vector<unsigned char> chunk(64*1024);
+        size_t n;
+        while((n = input_stream.read(chunk.data(), chunk.size())) > 0){
+            decoder.feed(chunk.data(), ptrdiff_t(n), on_frame);
+        }
+        decoder.flush(on_frame);
+    }else{
+        PacketReader reader(InputSource::FromArgument(source));
+        check_codec(reader.get_codec_name());
+        H26xDecoder decoder(codec, true);
+        PacketPtr packet;
+        while(reader.next(packet)){
+            decoder.decode_packet(*packet, on_frame);
+        }
+        decoder.flush(on_frame);
+    }
+    if(!record.empty()){
+        // the file header of a stream without frames
+        output_stream.write(record.data(), record.size());
+    }
+    return frames;
+}
+
+size_t decode_to_archive(const std::string& source, const std::string& archive_path, const std::string& source_format, const std::string& target_format){
+    std::string format = target_format=="jpg" ? "jpeg" : target_format=="rgb24" ? "rgb" : target_format;
+    if(format!="jpeg" && format!="png" && format!="rgb" && format!="yuv420p"){
+        throw H26xInitFailure("frame archives hold jpeg, png, rgb or yuv420p frames");
+    }
+    if(fs::is_directory(archive_path)){
+        throw fs::filesystem_error("the archive is a file, not a dir", std::error_code());
+    }
+
+    FrameArchiveWriter archive(archive_path, format);
+    ConverterRGB24 converter;
+    SwsContextPtr yuv_context(nullptr, sws_freeContext);
+    std::string picture;
+    int64_t frame_number = 0;
+    decode_source(source, source_format, [&](const AVFrame& frame){
+        frame_to_picture(frame, format, converter, yuv_context, picture);
+        FrameArchiveEntry entry;
+        entry.frame_number = frame_number++;
+        entry.pts = frame.pts;
+        entry.width = uint32_t(frame.width);
+        entry.height = uint32_t(frame.height);
+        entry.flags = (frame.flags & AV_FRAME_FLAG_KEY) ? FrameArchiveEntry::kKeyFrame : 0;
+        archive.Append(picture.data(), picture.size(), entry);
+    });
+    archive.Finish();
+    return archive.GetFrameCount();
+}
+
+size_t decode_to_shm(const std::string& source, const std::string& shm_name, const std::string& source_format, const std::string& target_format, uint32_t slots){
+    std::string format = target_format=="jpg" ? "jpeg" : target_format=="rgb24" ? "rgb" : target_format;
+    if(format!="jpeg" && format!="png" && format!="rgb" && format!="yuv420p"){
+        throw H26xInitFailure("shared memory rings hold jpeg, png, rgb or yuv420p frames");
+    }
+    bool raw = format=="rgb" || format=="yuv420p";
+    bool yuv = format=="yuv420p";
+    ShmFrameFormat shm_format = format=="rgb" ? ShmFrameFormat::RGB24 : yuv ? ShmFrameFormat::YUV420P : format=="jpeg" ? ShmFrameFormat::JPEG : ShmFrameFormat::PNG;
+
+    // the slot size comes from the first frame, so the ring is made once it is decoded
+    std::unique_ptr<ShmRingProducer> ring;
+    ConverterRGB24 converter;
+    SwsContextPtr yuv_context(nullptr, sws_freeContext);
+    std::string picture;
+    decode_source(source, source_format, [&](const AVFrame& frame){
+        size_t raw_size = raw_picture_size(frame, yuv);
+        if(!ring){
+            // rgb bytes plus some for a png that doesn't compress
+            size_t slot_size = raw ? raw_size : raw_picture_size(frame, false)*9/8 + 4096;
+            ring = std::make_unique<ShmRingProducer>(shm_name, slots, slot_size);
+        }
+
+        ShmFrameInfo info;
+        info.pts = frame.pts;
+        info.format = shm_format;
+        info.width = uint32_t(frame.width);
+        info.height = uint32_t(frame.height);
+        if(raw){
+            if(raw_size > ring->GetSlotSize()){
+                throw H26xDecodeFailure("frame size changed, larger than the shared memory slots");
+            }
+            // decoded and converted right into the slot, the consumer reads the same pages
+            frame_to_raw(frame, yuv, converter, yuv_context, ring->Begin());
+            info.size = uint32_t(raw_size);
+        }else{
+            frame_to_picture(frame, format, converter, yuv_context, picture);
+            if(picture.size() > ring->GetSlotSize()){
+                throw H26xDecodeFailure("encoded frame larger than the shared memory slots");
+            }
+            std::memcpy(ring->Begin(), picture.data(), picture.size());
+            info.size = uint32_t(picture.size());
+        }
+        ring->Commit(info);
+        H26X_TRACE_COUNT(BytesOut, info.size);
+    });
+    if(!ring){
+        return 0;
+    }
+    ring->Close();
+    return size_t(ring->GetPublished());
+}
+
+bool decode_frame_to_image(const std::string& source_file_path, const std::string& output_dir_path, const std::string& source_format, const std::string& target_format, const std::string& writer_backend, size_t max_memory){
+    fs::path source_path(source_file_path);
+    fs::path output_dir(output_dir_path);
+
+    if(!fs::exists(source_path)){
+        throw fs::filesystem_error("source file not exists", std::error_code());
+    }
+
+    if(!fs::is_directory(output_dir)){
+        throw fs::filesystem_error("output should be a dir", std::error_code());
+    }
+
+    std::vector<fs::path> frame_files;   
+    if(fs::is_directory(source_path)){
+        for(auto const& dir_entry: fs::directory_iterator(source_path)){
+            if(dir_entry.is_regular_file()){
+                frame_files.emplace_back(dir_entry.path());
+            }
+        }
+    }else{
+        frame_files.emplace_back(source_path);
+    }
+
+    // sort files in alphabetical order.
+    std::sort(frame_files.begin(), frame_files.end());
+
+    H26xDecoder decoder(source_format);
+    ConverterRGB24 converter;
+    // decoding is sequential here, only the images waiting for the disk count against the budget
+    MemoryBudget budget(max_memory);
+    AsyncFileWriter writer(AsyncFileWriter::ParseBackend(writer_backend), 64 << 20, 4, &budget);
+
+    uint32_t filename_index = 0;
+    for(uint32_t i=0; i<=frame_files.size(); i++){
+        size_t num_consumed = 0;
+        if(i!=frame_files.size()){
+            fs::path frame_path = frame_files[i];
+            size_t file_size=fs::file_size(frame_path);
+            std::string buffer(file_size,'\0');
+            {
+                H26X_TRACE_SCOPE("io", "read");
+                std::ifstream input_frame(frame_path.string(), std::ios::binary);
+                input_frame.read(&buffer[0], file_size);
+                H26X_TRACE_COUNT(BytesIn, file_size);
+            }
+            num_consumed = decoder.parse((unsigned char*)buffer.c_str(), file_size);
+        }else{
+            num_consumed = decoder.parse(nullptr, 0);
+        }
+        
+        while (decoder.is_frame_available())
+        {
+            try {
+                const auto& frame = decoder.decode_frame();
+                int         w, h;
+                std::tie(w, h)      = width_height(frame);
+                size_t out_size = converter.predict_size(w, h);
+                std::string out_buffer(out_size, '\0');
+                converter.convert(frame, (unsigned char*)out_buffer.c_str());
+
+                if(target_format=="jpg" || target_format=="jpeg"){
+                    auto converted_jpeg = converter.to_jpeg();
+                    out_buffer = *converted_jpeg;
+                }
+
+                if(filename_index >= frame_files.size()){
+                    break;
+                }
+                size_t last_dot = frame_files[filename_index].string().rfind('.');
+                size_t last_backslash = frame_files[filename_index].string().rfind('/');
+                std::string output_file_name = frame_files[filename_index].string().substr(last_backslash+1, last_dot-last_backslash)+target_format;
+                writer.Write(output_dir_path+"/"+output_file_name, std::move(out_buffer));
+                filename_index++;
+            } catch (const H26xDecodeFailure& e) {
+                if (std::strstr(e.what(), "EAGAIN"))
+                    break;
+                throw;
+            }
+        }
+    }
+    writer.Finish();
+    std::cout << writer.GetStats().Str();
+    std::cout << "memory: " << budget.Str() << std::endl;
+    return true;
+}
+
+bool is_image_format(const std::string& format){
+    return format=="jpeg" || format=="jpg" || format=="png";
+}
+
+bool is_raw_frame_format(const std::string& format){
+    return format=="yuv420p" || format=="rgb" || format=="nv12" || format=="bgr" || format=="bgra" || format=="yuyv";
+}
+
+std::unique_ptr<H26xEncoder> create_encoder(const std::string& target_format, const EncoderParameters& parameters){
+    auto encoder = std::make_unique<H26xEncoder>(target_format);
+    encoder->SetWidth(parameters.width);
+    encoder->SetHeight(parameters.height);
+    encoder->SetInputPixelFormat(parameters.input_pixel_format);
+    encoder->SetGopSize(parameters.gop_size);
+    encoder->SetFps(parameters.fps);
+    encoder->SetRefs(parameters.refs);
+    encoder->SetMaxBFrames(parameters.max_b_frames);
+    encoder->SetThreadNum(parameters.thread_num);
+    encoder->SetOptions(parameters.options);
+    encoder->SetRateControl(parameters.rate_control);
+    encoder->SetBitrate(parameters.bitrate);
+    encoder->SetMaxRate(parameters.maxrate);
+    encoder->SetBufferSize(parameters.bufsize);
+    encoder->SetIntraRefresh(parameters.intra_refresh);
+    return encoder;
+}
+
+void load_image(const fs::path& image_path, const std::string& source_format, std::string& buffer){
+    if(is_image_format(source_format)){
+        // from_jpeg keeps no state between calls, one converter per thread is enough
+        thread_local ConverterRGB24 converter;
+        std::unique_ptr<std::string> rgbframe = converter.from_jpeg(image_path.string());
+        buffer = *rgbframe;
+    }else{
+        size_t file_size=fs::file_size(image_path);
+        H26X_TRACE_SCOPE("io", "read");
+        std::ifstream input_image(image_path.string(), std::ios::binary);
+        buffer.assign(file_size, '\0');
+        input_image.read(&buffer[0], file_size);
+        H26X_TRACE_COUNT(BytesIn, file_size);
+    }
+}
+
+bool encode_image_to_frame(const std::string& source_file_path, const std::string& output_file_path, const std::string& source_format, const std::string& target_format, const EncoderParameters& parameters, bool single_file, int segments, bool print_stats, const std::string& writer_backend){
+    fs::path source_path(source_file_path);
+    fs::path output_path(output_file_path);
+
+    if(!fs::exists(source_path)){
+        throw fs::filesystem_error("file not exist", std::error_code());
+    }
+
+    std::vector<fs::path> image_files;   
+    for(auto const& dir_entry: fs::directory_iterator(source_path)){
+        if(dir_entry.is_regular_file()){
+            image_files.emplace_back(dir_entry.path());
+        }
+    }
+
+    // sort files in alphabetical order.
+    std::sort(image_files.begin(), image_files.end());
+
+    std::ofstream output_file;
+    if(single_file && !fs::is_directory(output_path)){
+        output_file=std::ofstream(output_path.string(), std::ios::binary|std::ios::app);
+    }else if(single_file && fs::is_directory(output_path)){
+        throw fs::filesystem_error("output path can't be a dir when --single setted", std::error_code());
+    }
+
+    // one file per frame goes through the background writer, a single file is appended in order here
+    AsyncFileWriter writer(single_file ? AsyncFileWriter::Backend::Sync : AsyncFileWriter::ParseBackend(writer_backend));
+    auto write_packet = [&](uint32_t index, const std::vector<char>& output){
+        if(single_file){
+            H26X_TRACE_SCOPE("io", "write");
+            output_file.write(output.data(), output.size());
+            H26X_TRACE_COUNT(BytesOut, output.size());
+        }else{
+            writer.Write(output_path.string()+"/"+std::to_string(index)+"."+target_format, output);
+        }
+    };
+    auto finish_writes = [&](){
+        writer.Finish();
+        if(!single_file){
+            std::cout << writer.GetStats().Str();
+        }
+    };
+
+    if(segments > 1){
+        if(print_stats){
+            std::cout << "--stats is not supported with --segments" << std::endl;
+        }
+        // every segment is a run of whole GOPs encoded by its own encoder, the outputs are written in order
+        SegmentEncoder segment_encoder([&](){ return create_encoder(target_format, parameters); }, segments, parameters.gop_size);
+        segment_encoder.Encode(image_files.size(),
+            [&](size_t index, std::string& buffer){ load_image(image_files[index], source_format, buffer); },
+            [&](size_t index, const std::vector<char>& packet){ write_packet(index, packet); });
+        finish_writes();
+        return true;
+    }
+
+    std::unique_ptr<H26xEncoder> encoder = create_encoder(target_format, parameters);
+    encoder->EnableStats(print_stats);
+    encoder->Enable();
+
+    std::string buffer;
+    uint32_t i=0;
+    for(fs::path image_path: image_files){
+        std::vector<char> output;
+        load_image(image_path, source_format, buffer);
+        encoder->Encode((uint8_t*)buffer.c_str(), output);
+
+        write_packet(i, output);
+        if(!single_file){
+            i++;
+        }
+    }
+
+    // the packets lookahead and B frames still hold, like every segment ends in SegmentEncoder
+    std::vector<char> output;
+    if(encoder->Flush(output)){
+        write_packet(i, output);
+    }
+    finish_writes();
+    if(print_stats){
+        std::cout << encoder->GetStats().Str();
+    }
+    return true;
+}
+
+bool transcode_h26x(const std::string& source_file_path, const std::string& output_file_path, const std::string& target_format, const EncoderParameters& parameters, bool print_stats, size_t max_memory){
+    fs::path source_path(source_file_path);
+    fs::path output_path(output_file_path);
+
+    if(source_file_path!="-" && !fs::exists(source_path)){
+        throw fs::filesystem_error("source file not exists", std::error_code());
+    }
+    if(output_file_path!="-" && fs::is_directory(output_path)){
+        throw fs::filesystem_error("output path can't be a dir when transcoding", std::error_code());
+    }
+
+    StreamFile output_file(output_file_path, true);
+    Transcoder transcoder(create_encoder(target_format, parameters));
+    MemoryBudget budget(max_memory);
+    transcoder.SetMemoryBudget(&budget);
+    transcoder.GetEncoder().EnableStats(print_stats);
+    size_t frames = transcoder.Run(InputSource::FromArgument(source_file_path), [&](const std::vector<char>& packet){
+        output_file.write(packet.data(), packet.size());
+    });
+    std::cout << "transcode " << frames << " frames" << std::endl;
+    if(max_memory>0){
+        std::cout << "memory: " << budget.Str() << std::endl;
+    }
+    if(print_stats){
+        std::cout << transcoder.GetEncoder().GetStats().Str();
+    }
+    return true;
+}
+
+bool encode_ladder(const std::string& source_file_path, const std::string& output_dir_path, const std::string& target_format, const std::vector<RenditionParameters>& renditions, int gop_size, bool print_stats, size_t max_memory){
+    fs::path source_path(source_file_path);
+    fs::path output_dir(output_dir_path);
+
+    if(!fs::exists(source_path)){
+        throw fs::filesystem_error("source file not exists", std::error_code());
+    }
+    if(!fs::is_directory(output_dir)){
+        throw fs::filesystem_error("output should be a dir", std::error_code());
+    }
+
+    MemoryBudget budget(max_memory);
+    RenditionLadder ladder(gop_size);
+    ladder.SetMemoryBudget(&budget);
+    std::vector<std::ofstream> output_files;
+    for(auto& rendition: renditions){
+        size_t index = ladder.AddRendition(rendition.name, create_encoder(target_format, rendition.encoder));
+        ladder.GetEncoder(index).EnableStats(print_stats);
+        std::string output_file_path = rendition.output.empty() ? output_dir_path+"/"+rendition.name+"."+target_format : rendition.output;
+        output_files.emplace_back(output_file_path, std::ios::binary);
+    }
+
+    size_t frames = ladder.Run(source_file_path, [&](size_t index, const std::vector<char>& packet){
+        H26X_TRACE_SCOPE("io", "write");
+        output_files[index].write(packet.data(), packet.size());
+        H26X_TRACE_COUNT(BytesOut, packet.size());
+    });
+    std::cout << "encode " << frames << " frames to " << renditions.size() << " renditions" << std::endl;
+    if(max_memory>0){
+        std::cout << "memory: " << budget.Str() << std::endl;
+    }
+    if(print_stats){
+        for(size_t i=0; i<renditions.size(); i++){
+            std::cout << "rendition " << ladder.GetName(i) << std::endl << ladder.GetEncoder(i).GetStats().Str();
+        }
+    }
+    return true;
+}
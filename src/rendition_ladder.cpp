@@ -0,0 +1,275 @@
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+#include <h26xcodec/rendition_ladder.hpp>
+#include <h26xcodec/bounded_queue.hpp>
+#include <h26xcodec/extractor.hpp>
+#include <h26xcodec/frame_ptr.hpp>
+#include <h26xcodec/trace.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+struct RenditionLadder::Rendition
+{
+    std::string                  name;
+    std::unique_ptr<H26xEncoder> encoder;
+    int                          width;
+    int                          height;
+    BoundedQueue<FramePtr>       queue;
+    std::vector<size_t>          children;
+    SwsContext*                  scale;
+
+    Rendition(std::string const& name, std::unique_ptr<H26xEncoder> encoder, size_t queue_size, MemoryBudget* budget)
+      : name{name}
+      , encoder{std::move(encoder)}
+      , width{this->encoder->GetWidth()}
+      , height{this->encoder->GetHeight()}
+      , queue{queue_size, budget}
+      , scale{nullptr}
+    {
+    }
+
+    ~Rendition()
+    {
+        sws_freeContext(scale);
+    }
+};
+
+RenditionLadder::RenditionLadder(int gop_size, size_t queue_size)
+  : gop_size_{gop_size}
+  , queue_size_{queue_size}
+  , budget_{nullptr}
+{
+}
+
+RenditionLadder::~RenditionLadder() = default;
+
+size_t RenditionLadder::AddRendition(std::string const& name, std::unique_ptr<H26xEncoder> encoder)
+{
+    if (encoder->GetWidth() <= 0 || encoder->GetHeight() <= 0)
+    {
+        std::string msg = std::string("rendition ") + name + " needs a width and height";
+        throw H26xInitFailure(msg.c_str());
+    }
+
+    // identical GOP structure everywhere keeps the renditions switchable at every key frame
+    encoder->SetGopSize(gop_size_);
+    encoder->SetClosedGop(true);
+    encoder->SetFixedGop(true);
+    renditions_.push_back(std::make_unique<Rendition>(name, std::move(encoder), queue_size_, budget_));
+    return renditions_.size() - 1;
+}
+
+std::string const& RenditionLadder::GetName(size_t rendition)
+{
+    return renditions_[rendition]->name;
+}
+
+H26xEncoder& RenditionLadder::GetEncoder(size_t rendition)
+{
+    return *renditions_[rendition]->encoder;
+}
+
+/// Every rendition is fed by the smallest rendition that is at least as large in both dimensions,
+/// renditions without such a parent are fed by the decoder.
+void RenditionLadder::planCascade()
+{
+    std::vector<size_t> by_area(renditions_.size());
+    for (size_t i = 0; i < by_area.size(); i++)
+    {
+        by_area[i] = i;
+        renditions_[i]->children.clear();
+    }
+    std::stable_sort(by_area.begin(), by_area.end(), [this](size_t a, size_t b) {
+        return renditions_[a]->width * renditions_[a]->height > renditions_[b]->width * renditions_[b]->height;
+    });
+
+    roots_.clear();
+    for (size_t i = 0; i < by_area.size(); i++)
+    {
+        Rendition& rendition = *renditions_[by_area[i]];
+        bool       fed       = false;
+        for (size_t j = i; j-- > 0;)
+        {
+            Rendition& parent = *renditions_[by_area[j]];
+            if (parent.width >= rendition.width && parent.height >= rendition.height)
+            {
+                parent.children.push_back(by_area[i]);
+                fed = true;
+                break;
+            }
+        }
+        if (!fed)
+        {
+            roots_.push_back(by_area[i]);
+        }
+    }
+}
+
+size_t RenditionLadder::Run(std::string const& source_path, PacketWriter const& on_packet)
+{
+    return Run(InputSource::FromPath(source_path), on_packet);
+}
+
+size_t RenditionLadder::Run(InputSource const& source, PacketWriter const& on_packet)
+{
+    planCascade();
+
+    Extractor          extractor(source);
+    std::mutex         error_mutex;
+    std::exception_ptr error;
+
+    auto fail = [&](std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error)
+        {
+            error = e;
+        }
+    };
+
+    auto worker = [&](size_t index) {
+        Rendition&        rendition = *renditions_[index];
+        H26X_TRACE_THREAD_NAME("rendition " + rendition.name);
+        std::vector<char> output;
+        bool              enabled = false;
+        FramePtr          input;
+        try
+        {
+            while (rendition.queue.Pop(input))
+            {
+                FramePtr frame;
+                if (input->width == rendition.width && input->height == rendition.height &&
+                    input->format == AV_PIX_FMT_YUV420P)
+                {
+                    frame = std::move(input);
+                }
+                else
+                {
+                    frame.reset(av_frame_alloc());
+                    if (!frame)
+                    {
+                        throw H26xInitFailure("cannot allocate scaled frame");
+                    }
+                    frame->format = AV_PIX_FMT_YUV420P;
+                    frame->width  = rendition.width;
+                    frame->height = rendition.height;
+                    if (av_frame_get_buffer(frame.get(), 0) < 0)
+                    {
+                        throw H26xInitFailure("cannot allocate scaled frame");
+                    }
+                    rendition.scale = sws_getCachedContext(rendition.scale, input->width, input->height,
+                                                           (AVPixelFormat)input->format, rendition.width,
+                                                           rendition.height, AV_PIX_FMT_YUV420P, SWS_BICUBIC,
+                                                           nullptr, nullptr, nullptr);
+                    if (!rendition.scale)
+                    {
+                        throw H26xInitFailure("cannot allocate scale context");
+                    }
+                    H26X_TRACE_SCOPE("ladder", "scale");
+                    sws_scale(rendition.scale, input->data, input->linesize, 0, input->height, frame->data,
+                              frame->linesize);
+                    av_frame_copy_props(frame.get(), input.get());
+                    input.reset();
+                }
+
+                // smaller renditions scale from this frame, they only take a reference
+                for (size_t child : rendition.children)
+                {
+                    FramePtr clone(av_frame_clone(frame.get()));
+                    if (clone)
+                    {
+                        renditions_[child]->queue.Push(std::move(clone), FrameBytes(frame.get()));
+                    }
+                }
+
+                if (!enabled)
+                {
+                    AVRational frame_rate = extractor.get_frame_rate();
+                    if (rendition.encoder->GetFps() <= 0)
+                    {
+                        rendition.encoder->SetFps(frame_rate.num > 0 && frame_rate.den > 0
+                                                      ? int(std::lround(av_q2d(frame_rate)))
+                                                      : 25);
+                    }
+                    AVRational time_base = extractor.get_time_base();
+                    if (time_base.num > 0 && time_base.den > 0 && frame->pts != AV_NOPTS_VALUE)
+                    {
+                        rendition.encoder->SetTimeBase(time_base);
+                    }
+                    rendition.encoder->SetInputPixelFormat(AV_PIX_FMT_YUV420P);
+                    rendition.encoder->Enable();
+                    enabled = true;
+                }
+
+                rendition.encoder->EncodeFrame(*frame, output);
+                if (!output.empty())
+                {
+                    on_packet(index, output);
+                }
+            }
+
+            if (enabled && rendition.encoder->Flush(output))
+            {
+                on_packet(index, output);
+            }
+        }
+        catch (...)
+        {
+            fail(std::current_exception());
+            // unblock whoever feeds this rendition
+            rendition.queue.Close();
+        }
+        for (size_t child : rendition.children)
+        {
+            renditions_[child]->queue.Close();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < renditions_.size(); i++)
+    {
+        workers.emplace_back(worker, i);
+    }
+
+    // decode once, the largest renditions get a reference to every decoded frame
+    size_t decoded = 0;
+    try
+    {
+        extractor.extract_decoded([&](const AVFrame& frame) {
+            for (size_t root : roots_)
+            {
+                FramePtr clone(av_frame_clone(&frame));
+                if (clone)
+                {
+                    renditions_[root]->queue.Push(std::move(clone), FrameBytes(&frame));
+                }
+            }
+            decoded++;
+        });
+    }
+    catch (...)
+    {
+        fail(std::current_exception());
+    }
+    for (size_t root : roots_)
+    {
+        renditions_[root]->queue.Close();
+    }
+
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    return decoded;
+}
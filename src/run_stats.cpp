@@ -0,0 +1,162 @@
+#include <h26xcodec/run_stats.hpp>
+
+#include <nlohmann/json.hpp>
+#include <sys/resource.h>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+std::atomic<bool>     RunStats::counting_{false};
+std::atomic<uint64_t> RunStats::allocations_{0};
+std::atomic<uint64_t> RunStats::allocated_bytes_{0};
+bool                  RunStats::hooked_ = false;
+
+namespace
+{
+double processCpuSeconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+uint64_t peakRssBytes()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // kilobytes on Linux
+    return uint64_t(usage.ru_maxrss) * 1024;
+}
+
+double mib(uint64_t bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+/// One row per category, the scopes of a category added up.
+std::vector<TraceStageStats> byCategory(std::vector<TraceStageStats> const& stages)
+{
+    std::vector<TraceStageStats> categories;
+    for (auto const& stage : stages)
+    {
+        auto it = std::find_if(categories.begin(), categories.end(),
+                               [&](TraceStageStats const& c) { return c.category == stage.category; });
+        if (it == categories.end())
+        {
+            categories.push_back(TraceStageStats{stage.category, ""});
+            it = categories.end() - 1;
+        }
+        it->calls += stage.calls;
+        it->wall_ns += stage.wall_ns;
+        it->cpu_ns += stage.cpu_ns;
+    }
+    return categories;
+}
+}  // namespace
+
+RunStats::RunStats()
+  : start_{Clock::now()}
+  , cpu_start_{0}
+{
+}
+
+void RunStats::Start()
+{
+    allocations_.store(0, std::memory_order_relaxed);
+    allocated_bytes_.store(0, std::memory_order_relaxed);
+    counting_.store(hooked_, std::memory_order_relaxed);
+    Tracer::Instance().StartStages();
+    cpu_start_ = processCpuSeconds();
+    start_     = Clock::now();
+}
+
+RunStatsReport RunStats::Stop()
+{
+    RunStatsReport report;
+    report.wall_seconds = std::chrono::duration<double>(Clock::now() - start_).count();
+    report.cpu_seconds  = processCpuSeconds() - cpu_start_;
+    counting_.store(false, std::memory_order_relaxed);
+    Tracer& tracer = Tracer::Instance();
+    tracer.StopStages();
+
+    report.frames_decoded      = tracer.GetCounter(TraceCounter::FramesDecoded);
+    report.frames_encoded      = tracer.GetCounter(TraceCounter::FramesEncoded);
+    report.bytes_in            = tracer.GetCounter(TraceCounter::BytesIn);
+    report.bytes_out           = tracer.GetCounter(TraceCounter::BytesOut);
+    report.peak_rss_bytes      = peakRssBytes();
+    report.allocations_counted = hooked_;
+    report.allocations         = allocations_.load(std::memory_order_relaxed);
+    report.allocated_bytes     = allocated_bytes_.load(std::memory_order_relaxed);
+    report.stages              = tracer.GetStageStats();
+    return report;
+}
+
+std::string RunStatsReport::Str() const
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    ss << "frames: " << frames_decoded << " decoded, " << frames_encoded << " encoded, " << GetFps() << " fps"
+       << std::endl
+       << "time: " << wall_seconds << " s wall, " << cpu_seconds << " s cpu" << std::endl
+       << "bytes: " << mib(bytes_in) << " MiB in, " << mib(bytes_out) << " MiB out" << std::endl
+       << "memory: " << mib(peak_rss_bytes) << " MiB peak rss";
+    if (allocations_counted)
+    {
+        ss << ", " << allocations << " allocations, " << mib(allocated_bytes) << " MiB allocated";
+    }
+    ss << std::endl;
+
+    if (stages.empty())
+    {
+        return ss.str();
+    }
+    ss << std::left << std::setw(12) << "stage" << std::right << std::setw(10) << "calls" << std::setw(12)
+       << "wall ms" << std::setw(12) << "cpu ms" << std::setw(9) << "wall %" << std::endl;
+    for (auto const& stage : byCategory(stages))
+    {
+        ss << std::left << std::setw(12) << stage.category << std::right << std::setw(10) << stage.calls
+           << std::setw(12) << stage.wall_ns / 1e6 << std::setw(12) << stage.cpu_ns / 1e6 << std::setw(9)
+           << (wall_seconds > 0 ? stage.wall_ns / 1e7 / wall_seconds : 0) << std::endl;
+    }
+    return ss.str();
+}
+
+std::string RunStatsReport::Json() const
+{
+    nlohmann::json json;
+    json["wall_seconds"]   = wall_seconds;
+    json["cpu_seconds"]    = cpu_seconds;
+    json["fps"]            = GetFps();
+    json["frames_decoded"] = frames_decoded;
+    json["frames_encoded"] = frames_encoded;
+    json["bytes_in"]       = bytes_in;
+    json["bytes_out"]      = bytes_out;
+    json["peak_rss_bytes"] = peak_rss_bytes;
+    if (allocations_counted)
+    {
+        json["allocations"]     = allocations;
+        json["allocated_bytes"] = allocated_bytes;
+    }
+
+    nlohmann::json categories = nlohmann::json::array();
+    for (auto const& stage : byCategory(stages))
+    {
+        categories.push_back({{"stage", stage.category},
+                              {"calls", stage.calls},
+                              {"wall_seconds", stage.wall_ns / 1e9},
+                              {"cpu_seconds", stage.cpu_ns / 1e9}});
+    }
+    json["stages"] = categories;
+
+    nlohmann::json scopes = nlohmann::json::array();
+    for (auto const& stage : stages)
+    {
+        scopes.push_back({{"stage", stage.category},
+                          {"name", stage.name},
+                          {"calls", stage.calls},
+                          {"wall_seconds", stage.wall_ns / 1e9},
+                          {"cpu_seconds", stage.cpu_ns / 1e9}});
+    }
+    json["scopes"] = scopes;
+    return json.dump(2);
+}
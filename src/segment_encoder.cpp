@@ -0,0 +1,153 @@
+#include <h26xcodec/segment_encoder.hpp>
+#include <h26xcodec/trace.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+struct Segment
+{
+    std::vector<std::vector<char>> packets;
+    std::exception_ptr             error;
+    bool                           done = false;
+};
+}  // namespace
+
+SegmentEncoder::SegmentEncoder(EncoderFactory factory, int jobs, int gop_size)
+  : factory_{std::move(factory)}
+  , jobs_{jobs > 0 ? jobs : 1}
+  , gop_size_{gop_size > 0 ? gop_size : 1}
+{
+}
+
+size_t SegmentEncoder::SegmentSize(size_t frame_count) const
+{
+    size_t per_job = (frame_count + jobs_ - 1) / jobs_;
+    // round up to whole GOPs, a GOP must never be split across two encoders
+    size_t gops = (per_job + gop_size_ - 1) / gop_size_;
+    return std::max<size_t>(gops, 1) * gop_size_;
+}
+
+void SegmentEncoder::Encode(size_t frame_count, FrameLoader const& loader, PacketWriter const& writer)
+{
+    if (frame_count == 0)
+    {
+        return;
+    }
+
+    size_t segment_size  = SegmentSize(frame_count);
+    size_t segment_count = (frame_count + segment_size - 1) / segment_size;
+
+    std::vector<Segment>    segments(segment_count);
+    std::atomic<size_t>     next_segment{0};
+    std::mutex              mutex;
+    std::condition_variable segment_done;
+
+    auto worker = [&]() {
+        H26X_TRACE_THREAD_NAME("segment worker");
+        for (size_t s = next_segment++; s < segment_count; s = next_segment++)
+        {
+            Segment& segment = segments[s];
+            try
+            {
+                H26X_TRACE_SCOPE("segment", "encode_segment");
+                encodeSegment(s * segment_size, std::min(frame_count, (s + 1) * segment_size), loader,
+                              segment.packets);
+            }
+            catch (...)
+            {
+                segment.error = std::current_exception();
+                // segments are handed out in order, the ones before this were all started and finish
+                next_segment = segment_count;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                segment.done = true;
+            }
+            segment_done.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min<size_t>(jobs_, segment_count); i++)
+    {
+        workers.emplace_back(worker);
+    }
+
+    // write segments in order as soon as they are complete, later segments keep encoding meanwhile
+    std::exception_ptr error;
+    size_t             packet_index = 0;
+    for (size_t s = 0; s < segment_count; s++)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        segment_done.wait(lock, [&]() { return segments[s].done; });
+        lock.unlock();
+
+        if (segments[s].error)
+        {
+            error        = segments[s].error;
+            next_segment = segment_count;
+            break;
+        }
+        try
+        {
+            for (auto const& packet : segments[s].packets)
+            {
+                writer(packet_index++, packet);
+            }
+        }
+        catch (...)
+        {
+            // e.g. disk full: stop handing out segments, the workers must be joined before it leaves
+            error        = std::current_exception();
+            next_segment = segment_count;
+            break;
+        }
+        std::vector<std::vector<char>>().swap(segments[s].packets);
+    }
+
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void SegmentEncoder::encodeSegment(size_t first, size_t last, FrameLoader const& loader,
+                                   std::vector<std::vector<char>>& packets)
+{
+    std::unique_ptr<H26xEncoder> encoder = factory_();
+    encoder->SetClosedGop(true);
+    encoder->Enable();
+
+    std::string       buffer;
+    std::vector<char> output;
+    for (size_t i = first; i < last; i++)
+    {
+        {
+            H26X_TRACE_SCOPE("io", "load_frame");
+            loader(i, buffer);
+        }
+        output.clear();
+        encoder->Encode(reinterpret_cast<uint8_t const*>(buffer.data()), output);
+        if (!output.empty())
+        {
+            packets.push_back(std::move(output));
+        }
+    }
+
+    output.clear();
+    if (encoder->Flush(output))
+    {
+        packets.push_back(std::move(output));
+    }
+}
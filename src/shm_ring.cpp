@@ -0,0 +1,286 @@
+#include <h26xcodec/shm_ring.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace
+{
+constexpr size_t kAlignment = 64;
+
+std::string shmName(std::string const& name)
+{
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+std::system_error systemError(char const* what, std::string const& name)
+{
+    return std::system_error(errno, std::generic_category(), std::string(what) + " " + name);
+}
+
+/// Shared (not FUTEX_PRIVATE) so producer and consumers in different processes meet on the same word.
+void futexWait(std::atomic<uint32_t> const& word, uint32_t expected, int timeout_ms)
+{
+    timespec  timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    uint32_t* address = const_cast<uint32_t*>(reinterpret_cast<uint32_t const*>(&word));
+    syscall(SYS_futex, address, FUTEX_WAIT, expected, timeout_ms < 0 ? nullptr : &timeout, nullptr, 0);
+}
+
+void futexWakeAll(std::atomic<uint32_t>& word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+int64_t monotonicMilliseconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return int64_t(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+}  // namespace
+
+ShmRingProducer::ShmRingProducer(std::string const& name, uint32_t slot_count, size_t slot_size)
+  : name_{shmName(name)}
+  , map_{nullptr}
+  , map_size_{0}
+  , header_{nullptr}
+  , next_{0}
+  , writing_{false}
+{
+    if (slot_count < 2 || slot_size == 0)
+    {
+        throw std::invalid_argument("a shared memory ring needs two slots or more");
+    }
+    size_t stride = sizeof(ShmSlotHeader) + (slot_size + kAlignment - 1) / kAlignment * kAlignment;
+    map_size_     = sizeof(ShmRingHeader) + size_t(slot_count) * stride;
+
+    // a ring left behind by a crashed run is replaced by a new object under the same name; nobody closes
+    // the old one, consumers still mapping it only notice through the timeout of Next
+    shm_unlink(name_.c_str());
+    int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        throw systemError("cannot create shared memory", name_);
+    }
+    if (ftruncate(fd, off_t(map_size_)) < 0)
+    {
+        auto error = systemError("cannot size shared memory", name_);
+        close(fd);
+        shm_unlink(name_.c_str());
+        throw error;
+    }
+    void* map = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        auto error = systemError("cannot map shared memory", name_);
+        shm_unlink(name_.c_str());
+        throw error;
+    }
+    map_ = static_cast<uint8_t*>(map);
+
+    // ftruncate zero fills, every slot starts at sequence 0 which no frame has
+    header_              = new (map_) ShmRingHeader;
+    header_->slot_count  = slot_count;
+    header_->slot_size   = slot_size;
+    header_->slot_stride = stride;
+    header_->published.store(0, std::memory_order_relaxed);
+    header_->closed.store(0, std::memory_order_relaxed);
+    header_->futex.store(0, std::memory_order_relaxed);
+    header_->version = ShmRingHeader::kVersion;
+    // consumers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = ShmRingHeader::kMagic;
+}
+
+ShmRingProducer::~ShmRingProducer()
+{
+    Close();
+    munmap(map_, map_size_);
+    shm_unlink(name_.c_str());
+}
+
+ShmSlotHeader* ShmRingProducer::slot(uint64_t sequence) const
+{
+    return reinterpret_cast<ShmSlotHeader*>(map_ + sizeof(ShmRingHeader) +
+                                            size_t(sequence % header_->slot_count) * header_->slot_stride);
+}
+
+uint8_t* ShmRingProducer::Begin()
+{
+    ShmSlotHeader* s = slot(next_);
+    if (!writing_)
+    {
+        // odd: readers of the frame that was here notice it is gone, before any byte of it changes
+        s->sequence.store(2 * next_ + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        writing_ = true;
+    }
+    return reinterpret_cast<uint8_t*>(s + 1);
+}
+
+void ShmRingProducer::Commit(ShmFrameInfo info)
+{
+    if (!writing_)
+    {
+        throw std::logic_error("ShmRingProducer::Commit without Begin");
+    }
+    if (info.size > header_->slot_size)
+    {
+        throw std::length_error("frame larger than the shared memory slots");
+    }
+    ShmSlotHeader* s = slot(next_);
+    s->pts           = info.pts;
+    s->size          = info.size;
+    s->format        = uint32_t(info.format);
+    s->width         = info.width;
+    s->height        = info.height;
+    s->sequence.store(2 * next_ + 2, std::memory_order_release);
+    writing_ = false;
+
+    header_->published.store(++next_, std::memory_order_release);
+    header_->futex.fetch_add(1, std::memory_order_release);
+    futexWakeAll(header_->futex);
+}
+
+void ShmRingProducer::Close()
+{
+    if (header_->closed.exchange(1, std::memory_order_release) == 0)
+    {
+        header_->futex.fetch_add(1, std::memory_order_release);
+        futexWakeAll(header_->futex);
+    }
+}
+
+ShmRingConsumer::ShmRingConsumer(std::string const& name)
+  : map_{nullptr}
+  , map_size_{0}
+  , header_{nullptr}
+  , next_{0}
+  , dropped_{0}
+{
+    std::string path = shmName(name);
+    int         fd   = shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        throw systemError("cannot open shared memory", path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(ShmRingHeader))
+    {
+        close(fd);
+        throw std::system_error(EINVAL, std::generic_category(), "not a frame ring " + path);
+    }
+    map_size_ = size_t(st.st_size);
+    void* map = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        throw systemError("cannot map shared memory", path);
+    }
+    map_    = static_cast<uint8_t const*>(map);
+    header_ = reinterpret_cast<ShmRingHeader const*>(map_);
+
+    bool valid = header_->magic == ShmRingHeader::kMagic;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    valid = valid && header_->version == ShmRingHeader::kVersion && header_->slot_count >= 2 &&
+            header_->slot_stride >= sizeof(ShmSlotHeader) + header_->slot_size &&
+            header_->slot_stride <= (map_size_ - sizeof(ShmRingHeader)) / header_->slot_count;
+    if (!valid)
+    {
+        munmap(map, map_size_);
+        throw std::system_error(EINVAL, std::generic_category(), "not a frame ring " + path);
+    }
+
+    // start with the oldest frame that can't be overwritten right now
+    uint64_t published = header_->published.load(std::memory_order_acquire);
+    next_              = published > header_->slot_count - 1 ? published - (header_->slot_count - 1) : 0;
+}
+
+ShmRingConsumer::~ShmRingConsumer()
+{
+    munmap(const_cast<uint8_t*>(map_), map_size_);
+}
+
+ShmSlotHeader const* ShmRingConsumer::slot(uint64_t sequence) const
+{
+    return reinterpret_cast<ShmSlotHeader const*>(map_ + sizeof(ShmRingHeader) +
+                                                  size_t(sequence % header_->slot_count) * header_->slot_stride);
+}
+
+bool ShmRingConsumer::Next(ShmFrame& frame, int timeout_ms)
+{
+    int64_t deadline = timeout_ms < 0 ? 0 : monotonicMilliseconds() + timeout_ms;
+    while (true)
+    {
+        // read the futex word before looking, a frame published in between changes it and the wait returns
+        uint32_t wake      = header_->futex.load(std::memory_order_acquire);
+        uint64_t published = header_->published.load(std::memory_order_acquire);
+        if (next_ < published)
+        {
+            // the slot of frame `published` may be half written already
+            uint64_t oldest = published - std::min<uint64_t>(published, header_->slot_count - 1);
+            if (next_ < oldest)
+            {
+                dropped_ += oldest - next_;
+                next_ = oldest;
+            }
+
+            ShmSlotHeader const* s        = slot(next_);
+            uint64_t             sequence = s->sequence.load(std::memory_order_acquire);
+            if (sequence != 2 * next_ + 2)
+            {
+                // lapped since published was read
+                dropped_++;
+                next_++;
+                continue;
+            }
+            frame.info.sequence = next_;
+            frame.info.pts      = s->pts;
+            frame.info.size     = std::min<uint32_t>(s->size, uint32_t(header_->slot_size));
+            frame.info.format   = ShmFrameFormat(s->format);
+            frame.info.width    = s->width;
+            frame.info.height   = s->height;
+            frame.data          = reinterpret_cast<uint8_t const*>(s + 1);
+            next_++;
+            if (!Valid(frame))
+            {
+                dropped_++;
+                continue;
+            }
+            return true;
+        }
+        if (header_->closed.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        int wait_ms = -1;
+        if (timeout_ms >= 0)
+        {
+            wait_ms = int(deadline - monotonicMilliseconds());
+            if (wait_ms <= 0)
+            {
+                return false;
+            }
+        }
+        futexWait(header_->futex, wake, wait_ms);
+    }
+}
+
+bool ShmRingConsumer::Valid(ShmFrame const& frame) const
+{
+    // everything read from the slot so far happens before this load
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot(frame.info.sequence)->sequence.load(std::memory_order_relaxed) == 2 * frame.info.sequence + 2;
+}
@@ -0,0 +1,291 @@
+#include <h26xcodec/trace.hpp>
+
+#include <nlohmann/json.hpp>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+std::atomic<uint32_t> Tracer::mode_{0};
+std::atomic<uint64_t> Tracer::counters_[int(TraceCounter::Count)];
+
+namespace
+{
+/// innermost open scope of the thread while stages are counted
+thread_local TraceScope* current_scope = nullptr;
+
+int64_t threadCpuNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+}  // namespace
+
+Tracer& Tracer::Instance()
+{
+    // never destroyed, threads may still record while the process exits
+    static Tracer* tracer = new Tracer();
+    return *tracer;
+}
+
+Tracer::Tracer()
+  : generation_{0}
+  , epoch_{Clock::now().time_since_epoch().count()}
+{
+}
+
+Tracer::~Tracer()
+{
+    for (auto& buffer : buffers_)
+    {
+        freeChunks(buffer->head);
+    }
+}
+
+void Tracer::freeChunks(Chunk* chunk)
+{
+    while (chunk)
+    {
+        Chunk* next = chunk->next.load(std::memory_order_acquire);
+        delete chunk;
+        chunk = next;
+    }
+}
+
+void Tracer::Start()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation_++;
+        epoch_ = Clock::now().time_since_epoch().count();
+    }
+    mode_.fetch_or(kTimeline, std::memory_order_release);
+}
+
+void Tracer::Stop()
+{
+    mode_.fetch_and(~kTimeline, std::memory_order_release);
+}
+
+void Tracer::StartStages()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& buffer : buffers_)
+        {
+            size_t count = buffer->stage_count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++)
+            {
+                buffer->stages[i].calls.store(0, std::memory_order_relaxed);
+                buffer->stages[i].wall_ns.store(0, std::memory_order_relaxed);
+                buffer->stages[i].cpu_ns.store(0, std::memory_order_relaxed);
+            }
+        }
+        for (auto& counter : counters_)
+        {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+    mode_.fetch_or(kStages, std::memory_order_release);
+}
+
+void Tracer::StopStages()
+{
+    mode_.fetch_and(~kStages, std::memory_order_release);
+}
+
+std::vector<TraceStageStats> Tracer::GetStageStats()
+{
+    std::vector<TraceStageStats> stages;
+    std::lock_guard<std::mutex>  lock(mutex_);
+    for (auto& buffer : buffers_)
+    {
+        size_t count = buffer->stage_count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; i++)
+        {
+            StageSlot const& slot = buffer->stages[i];
+            auto             it   = std::find_if(stages.begin(), stages.end(), [&](TraceStageStats const& stage) {
+                return stage.category == slot.category && stage.name == slot.name;
+            });
+            if (it == stages.end())
+            {
+                stages.push_back(TraceStageStats{slot.category, slot.name});
+                it = stages.end() - 1;
+            }
+            it->calls += slot.calls.load(std::memory_order_relaxed);
+            it->wall_ns += slot.wall_ns.load(std::memory_order_relaxed);
+            it->cpu_ns += slot.cpu_ns.load(std::memory_order_relaxed);
+        }
+    }
+    stages.erase(std::remove_if(stages.begin(), stages.end(), [](TraceStageStats const& stage) { return stage.calls == 0; }),
+                 stages.end());
+    return stages;
+}
+
+void Tracer::enter(TraceScope& scope)
+{
+    scope.parent_        = current_scope;
+    scope.child_wall_ns_ = 0;
+    scope.child_cpu_ns_  = 0;
+    scope.cpu_start_ns_  = threadCpuNs();
+    current_scope        = &scope;
+}
+
+void Tracer::leave(TraceScope& scope, Clock::time_point end)
+{
+    if (scope.mode_ & kTimeline)
+    {
+        Record(scope.category_, scope.name_, scope.start_, end);
+    }
+    if (!(scope.mode_ & kStages))
+    {
+        return;
+    }
+
+    int64_t wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - scope.start_).count();
+    int64_t cpu_ns  = threadCpuNs() - scope.cpu_start_ns_;
+    addStage(threadBuffer(), scope.category_, scope.name_, wall_ns - scope.child_wall_ns_,
+             cpu_ns - scope.child_cpu_ns_);
+    if (scope.parent_)
+    {
+        scope.parent_->child_wall_ns_ += wall_ns;
+        scope.parent_->child_cpu_ns_ += cpu_ns;
+    }
+    current_scope = scope.parent_;
+}
+
+void Tracer::addStage(ThreadBuffer& buffer, char const* category, char const* name, int64_t wall_ns, int64_t cpu_ns)
+{
+    size_t     count = buffer.stage_count.load(std::memory_order_relaxed);
+    StageSlot* slot  = nullptr;
+    for (size_t i = 0; i < count && !slot; i++)
+    {
+        StageSlot& s = buffer.stages[i];
+        // the same literal may have different addresses in different translation units
+        if ((s.category == category || std::strcmp(s.category, category) == 0) &&
+            (s.name == name || std::strcmp(s.name, name) == 0))
+        {
+            slot = &s;
+        }
+    }
+    if (!slot)
+    {
+        if (count == kMaxStages)
+        {
+            return;
+        }
+        slot           = &buffer.stages[count];
+        slot->category = category;
+        slot->name     = name;
+        buffer.stage_count.store(count + 1, std::memory_order_release);
+    }
+    // single writer, plain stores are enough for the reader
+    slot->calls.store(slot->calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    slot->wall_ns.store(slot->wall_ns.load(std::memory_order_relaxed) + wall_ns, std::memory_order_relaxed);
+    slot->cpu_ns.store(slot->cpu_ns.load(std::memory_order_relaxed) + cpu_ns, std::memory_order_relaxed);
+}
+
+/// The calling thread's buffer, registered on first use. Only the owner thread appends to it.
+Tracer::ThreadBuffer& Tracer::threadBuffer()
+{
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers_.push_back(std::make_unique<ThreadBuffer>());
+        buffer             = buffers_.back().get();
+        buffer->tid        = int(buffers_.size());
+        buffer->name       = "thread " + std::to_string(buffer->tid);
+        buffer->head       = new Chunk();
+        buffer->tail       = buffer->head;
+        buffer->generation = generation_;
+    }
+    else if (buffer->generation != generation_.load(std::memory_order_relaxed))
+    {
+        // events of an earlier recording, the writer may be reading them so swap under the lock
+        std::lock_guard<std::mutex> lock(mutex_);
+        freeChunks(buffer->head);
+        buffer->head       = new Chunk();
+        buffer->tail       = buffer->head;
+        buffer->generation = generation_;
+    }
+    return *buffer;
+}
+
+void Tracer::SetThreadName(std::string const& name)
+{
+    ThreadBuffer&               buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffer.name = name;
+}
+
+void Tracer::Record(char const* category, char const* name, Clock::time_point start, Clock::time_point end)
+{
+    ThreadBuffer& buffer = threadBuffer();
+    Chunk*        tail   = buffer.tail;
+    size_t        size   = tail->size.load(std::memory_order_relaxed);
+    if (size == Chunk::kCapacity)
+    {
+        Chunk* chunk = new Chunk();
+        tail->next.store(chunk, std::memory_order_release);
+        buffer.tail = chunk;
+        tail        = chunk;
+        size        = 0;
+    }
+
+    Clock::time_point epoch{Clock::duration(epoch_.load(std::memory_order_relaxed))};
+    TraceEvent&       event = tail->events[size];
+    event.category    = category;
+    event.name        = name;
+    event.start_ns    = std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch).count();
+    event.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    // publish the event to the writer
+    tail->size.store(size + 1, std::memory_order_release);
+}
+
+size_t Tracer::WriteChromeTrace(std::string const& path)
+{
+    nlohmann::json events = nlohmann::json::array();
+    int            pid    = int(getpid());
+    size_t         count  = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& buffer : buffers_)
+        {
+            if (buffer->generation != generation_)
+            {
+                continue;
+            }
+            events.push_back({{"ph", "M"},
+                              {"name", "thread_name"},
+                              {"pid", pid},
+                              {"tid", buffer->tid},
+                              {"args", {{"name", buffer->name}}}});
+            for (Chunk* chunk = buffer->head; chunk; chunk = chunk->next.load(std::memory_order_acquire))
+            {
+                size_t size = chunk->size.load(std::memory_order_acquire);
+                for (size_t i = 0; i < size; i++)
+                {
+                    TraceEvent const& event = chunk->events[i];
+                    events.push_back({{"ph", "X"},
+                                      {"cat", event.category},
+                                      {"name", event.name},
+                                      {"ts", event.start_ns / 1000.0},
+                                      {"dur", event.duration_ns / 1000.0},
+                                      {"pid", pid},
+                                      {"tid", buffer->tid}});
+                    count++;
+                }
+            }
+        }
+    }
+
+    nlohmann::json trace;
+    trace["traceEvents"]     = events;
+    trace["displayTimeUnit"] = "ms";
+    std::ofstream file(path);
+    file << trace.dump();
+    return count;
+}
@@ -0,0 +1,116 @@
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+}
+
+#include <h26xcodec/transcoder.hpp>
+#include <h26xcodec/bounded_queue.hpp>
+#include <h26xcodec/extractor.hpp>
+#include <h26xcodec/frame_ptr.hpp>
+#include <h26xcodec/trace.hpp>
+
+#include <cmath>
+#include <exception>
+#include <thread>
+
+Transcoder::Transcoder(std::unique_ptr<H26xEncoder> encoder, size_t queue_size)
+  : encoder_{std::move(encoder)}
+  , queue_size_{queue_size}
+  , budget_{nullptr}
+{
+}
+
+size_t Transcoder::Run(std::string const& source_path, PacketWriter const& on_packet)
+{
+    return Run(InputSource::FromPath(source_path), on_packet);
+}
+
+size_t Transcoder::Run(InputSource const& source, PacketWriter const& on_packet)
+{
+    Extractor               extractor(source);
+    BoundedQueue<FramePtr>  frames(queue_size_, budget_);
+    std::exception_ptr      decode_error;
+
+    // decode thread: av_frame_clone only takes a reference on the decoder's buffers
+    std::thread decoder([&]() {
+        H26X_TRACE_THREAD_NAME("transcode decoder");
+        try
+        {
+            extractor.extract_decoded([&](const AVFrame& frame) {
+                FramePtr clone(av_frame_clone(&frame));
+                if (clone)
+                {
+                    H26X_TRACE_SCOPE("queue", "push");
+                    size_t bytes = FrameBytes(clone.get());
+                    frames.Push(std::move(clone), bytes);
+                }
+            });
+        }
+        catch (...)
+        {
+            decode_error = std::current_exception();
+        }
+        frames.Close();
+    });
+
+    std::exception_ptr encode_error;
+    std::vector<char>  output;
+    size_t             encoded = 0;
+    FramePtr           frame;
+    try
+    {
+        while (frames.Pop(frame))
+        {
+            if (encoded == 0)
+            {
+                // the encoder is opened lazily, size and timing come from the source stream
+                if (encoder_->GetWidth() <= 0 || encoder_->GetHeight() <= 0)
+                {
+                    encoder_->SetWidth(frame->width);
+                    encoder_->SetHeight(frame->height);
+                }
+                AVRational frame_rate = extractor.get_frame_rate();
+                if (encoder_->GetFps() <= 0)
+                {
+                    encoder_->SetFps(frame_rate.num > 0 && frame_rate.den > 0 ? int(std::lround(av_q2d(frame_rate))) : 25);
+                }
+                AVRational time_base = extractor.get_time_base();
+                if (time_base.num > 0 && time_base.den > 0 && frame->pts != AV_NOPTS_VALUE)
+                {
+                    encoder_->SetTimeBase(time_base);
+                }
+                encoder_->SetInputPixelFormat(frame->format == AV_PIX_FMT_NV12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P);
+                encoder_->Enable();
+            }
+
+            encoder_->EncodeFrame(*frame, output);
+            if (!output.empty())
+            {
+                on_packet(output);
+            }
+            encoded++;
+        }
+
+        if (encoded > 0 && encoder_->Flush(output))
+        {
+            on_packet(output);
+        }
+    }
+    catch (...)
+    {
+        encode_error = std::current_exception();
+        // unblock the decoder, it drops the rest of the stream
+        frames.Close();
+    }
+
+    decoder.join();
+    if (encode_error)
+    {
+        std::rethrow_exception(encode_error);
+    }
+    if (decode_error)
+    {
+        std::rethrow_exception(decode_error);
+    }
+    return encoded;
+}
@@ -3,17 +3,16 @@
 #include <libavformat/avformat.h>
 
 VideoReader::~VideoReader(){
-    if(fmt_ctx){
-        avformat_close_input(&fmt_ctx);
-    }
+    InputSource::Close(&fmt_ctx);
 }
 
 void VideoReader::Open(){
-    fmt_ctx = nullptr;
+    InputSource::Close(&fmt_ctx);
 
-    int ret = avformat_open_input(&fmt_ctx, source_file_path.c_str(), NULL, NULL);
+    // the only probe of the file: the context is handed on with Release, see ProbeOptions for its cost
+    int ret = source.OpenProbed(&fmt_ctx);
     if(ret < 0){
-        std::cout << "Can't Open source file:" << source_file_path << std::endl;
+        std::cout << "Can't Open source file:" << source.GetName() << std::endl;
         char errbuf[AV_ERROR_MAX_STRING_SIZE] = {0};
         av_strerror(ret, errbuf, sizeof(errbuf));
         std::cerr << "avformat_open_input failed: " << errbuf << std::endl;
@@ -22,26 +21,30 @@ void VideoReader::Open(){
 
     file_format = fmt_ctx->iformat->name;
 
-    ret = avformat_find_stream_info(fmt_ctx, NULL);
-    if(ret < 0){
-        std::cout << "Can't read stream" << std::endl;
+    if(!fmt_ctx->nb_streams){
+        std::cout << "Can't found streams" << std::endl;
         return;
     }
-
-    // int video_stream_index = -1;
-    if(fmt_ctx->nb_streams){
-        AVStream* stream = fmt_ctx->streams[0];
+    for(unsigned i = 0; i < fmt_ctx->nb_streams; i++){
+        AVStream* stream = fmt_ctx->streams[i];
+        if(stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO){
+            continue;
+        }
         if(stream->codecpar->codec_id == AV_CODEC_ID_HEVC){
             frame_format = FrameFormat::H265;
         }else if(stream->codecpar->codec_id == AV_CODEC_ID_H264){
             frame_format = FrameFormat::H264;
         }
-    }else{
-        std::cout << "Can't found streams" << std::endl;
-        return;
+        break;
     }
 }
 
+AVFormatContext* VideoReader::Release(){
+    AVFormatContext* ctx = fmt_ctx;
+    fmt_ctx = nullptr;
+    return ctx;
+}
+
 FrameFormat VideoReader::get_frame_format(){
     return frame_format;
 }